@@ -0,0 +1,452 @@
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "util.h"
+#include "log.h"
+#include "metrics.h"
+#include "affinity.h"
+
+Affinity *AffinityCreate(int numCpus, int numDomains)
+{
+    Affinity *affinity = calloc(1, sizeof(Affinity));
+    checkMemAlloc(affinity);
+    affinity->numCpus = numCpus;
+    affinity->numDomains = numDomains;
+    affinity->numLocalities = 1;
+    affinity->localities[0] = (unsigned char) ((1U << numCpus) - 1);
+
+    return affinity;
+error:
+    return NULL;
+}
+
+void AffinityFree(Affinity *affinity)
+{
+    if (affinity) {
+        for (int g = 0; g < affinity->numGroups; g++) {
+            free(affinity->groups[g].members);
+        }
+        free(affinity);
+    }
+}
+
+/**
+ * copies the value of the attribute `attr` of the XML element starting at `element` into `value`
+ * @return length of the value, -1 if the element has no such attribute
+ */
+int AffinityGetAttribute(const char *element, const char *attr, char *value, size_t size)
+{
+    const char *end = strchr(element, '>');
+    const char *start = element;
+    const char *close = NULL;
+    size_t length = strlen(attr);
+
+    while ((start = strstr(start, attr)) && (!end || start < end)) {
+        if (start[-1] == ' ' && start[length] == '=' && (start[length + 1] == '"' || start[length + 1] == '\'')) {
+            close = strchr(start + length + 2, start[length + 1]);
+            if (!close || close - start - length - 2 >= (long) size) {
+                return -1;
+            }
+            memset(value, 0, size);
+            strncpy(value, start + length + 2, close - start - length - 2);
+            return (int) (close - start - length - 2);
+        }
+        start += length;
+    }
+    return -1;
+}
+
+/**
+ * reads the cpus of each NUMA cell from the host topology in the hypervisor's capabilities
+ * (`<topology><cells><cell><cpus><cpu id="..."/>`), the cpus of a cell need not be numbered contiguously
+ * @return number of localities read, 0 if the topology can't be read
+ */
+int AffinityReadCells(Affinity *affinity, virConnectPtr conn)
+{
+    char *capabilities = NULL;
+    const char *cell = NULL;
+    const char *cellEnd = NULL;
+    const char *cpu = NULL;
+    char id[16];
+    int c = 0;
+    int numCells = 0;
+
+    capabilities = virConnectGetCapabilities(conn);
+    MetricsCountRpc(METRICS_RPC_LIST, capabilities == NULL);
+    if (!capabilities) {
+        return 0;
+    }
+    cell = strstr(capabilities, "<cells");
+    for (cell = cell ? strstr(cell, "<cell ") : NULL; cell; cell = strstr(cellEnd, "<cell ")) {
+        cellEnd = strstr(cell, "</cell>");
+        if (!cellEnd || numCells == AFFINITY_MAX_LOCALITIES) {
+            break;
+        }
+        for (cpu = strstr(cell, "<cpu "); cpu && cpu < cellEnd; cpu = strstr(cpu + 1, "<cpu ")) {
+            c = AffinityGetAttribute(cpu, "id", id, sizeof(id)) > 0 ? atoi(id) : -1;
+            if (c >= 0 && c < affinity->numCpus) {
+                affinity->localities[numCells] |= getCpuMask(c);
+            }
+        }
+        // cells without any of the scheduled cpus, e.g. memory only nodes, are not localities
+        numCells += affinity->localities[numCells] != 0;
+    }
+    free(capabilities);
+
+    return numCells;
+}
+
+int AffinitySetLocalities(Affinity *affinity, virConnectPtr conn, const char *masks)
+{
+    const char *next = masks;
+    char *end = NULL;
+    unsigned long mask = 0;
+
+    checkNull(affinity);
+    // the node masks are ORed in, the all-cpu locality set at creation must not remain
+    memset(affinity->localities, 0, sizeof(affinity->localities));
+    affinity->numLocalities = 0;
+
+    if (masks) {
+        while (*next != '\0') {
+            check(affinity->numLocalities < AFFINITY_MAX_LOCALITIES, "too many cpu localities");
+            mask = strtoul(next, &end, 0);
+            check(end != next && (*end == ',' || *end == '\0'), "cpu localities should be a comma separated list of cpu masks");
+            affinity->localities[affinity->numLocalities++] = (unsigned char) mask;
+            next = *end == ',' ? end + 1 : end;
+        }
+        return 0;
+    }
+
+    affinity->numLocalities = AffinityReadCells(affinity, conn);
+    if (affinity->numLocalities == 0) {
+        logInfo("host NUMA topology not available, all cpus are in a single locality");
+        affinity->numLocalities = 1;
+        affinity->localities[0] = (unsigned char) ((1U << affinity->numCpus) - 1);
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * @return group with the given name, created with the given kind and strength if it does not exist, NULL if full
+ */
+AffinityGroup *AffinityGetGroup(Affinity *affinity, const char *name, AffinityKind kind, int hard)
+{
+    AffinityGroup *group = NULL;
+
+    for (int g = 0; g < affinity->numGroups; g++) {
+        group = affinity->groups + g;
+        if (strcmp(group->name, name) == 0) {
+            if (group->kind != kind || group->hard != hard) {
+                logWarn("affinity group %s declared with different constraints, keeping the first one", name);
+            }
+            return group;
+        }
+    }
+    check(affinity->numGroups < AFFINITY_MAX_GROUPS, "too many affinity groups");
+
+    group = affinity->groups + affinity->numGroups;
+    group->members = calloc(affinity->numDomains, sizeof(int));
+    checkMemAlloc(group->members);
+    strncpy(group->name, name, AFFINITY_MAX_NAME - 1);
+    group->kind = kind;
+    group->hard = hard;
+    group->enabled = 1;
+    affinity->numGroups += 1;
+
+    return group;
+error:
+    return NULL;
+}
+
+void AffinityAddMember(AffinityGroup *group, int d)
+{
+    for (int i = 0; i < group->numMembers; i++) {
+        if (group->members[i] == d) {
+            return;
+        }
+    }
+    group->members[group->numMembers++] = d;
+}
+
+/**
+ * parses a constraint kind and strength
+ * @return 0 on success, -1 if either is unknown
+ */
+int AffinityParseConstraint(const char *kind, size_t kindLength, const char *strength, size_t strengthLength,
+    AffinityKind *kindPtr, int *hardPtr)
+{
+    if (kindLength == strlen("together") && strncmp(kind, "together", kindLength) == 0) {
+        *kindPtr = AFFINITY_TOGETHER;
+    }
+    else if (kindLength == strlen("apart") && strncmp(kind, "apart", kindLength) == 0) {
+        *kindPtr = AFFINITY_APART;
+    }
+    else {
+        return -1;
+    }
+    if (strengthLength == strlen("hard") && strncmp(strength, "hard", strengthLength) == 0) {
+        *hardPtr = 1;
+    }
+    else if (strengthLength == strlen("soft") && strncmp(strength, "soft", strengthLength) == 0) {
+        *hardPtr = 0;
+    }
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @return index of the domain with the given name, -1 if it is not active
+ */
+int AffinityFindDomain(GuestList *guests, const char *name, size_t length)
+{
+    const char *domainName = NULL;
+
+    for (int d = 0; d < guests->count; d++) {
+        domainName = virDomainGetName(GuestListDomainAt(guests, d));
+        if (domainName && strlen(domainName) == length && strncmp(domainName, name, length) == 0) {
+            return d;
+        }
+    }
+    return -1;
+}
+
+int AffinityAddSpec(Affinity *affinity, GuestList *guests, const char *spec)
+{
+    const char *strength = NULL;
+    const char *name = NULL;
+    const char *domains = NULL;
+    const char *next = NULL;
+    char groupName[AFFINITY_MAX_NAME];
+    AffinityKind kind = AFFINITY_TOGETHER;
+    int hard = 0;
+    int d = 0;
+    AffinityGroup *group = NULL;
+
+    checkNull(affinity);
+    checkNull(guests);
+    checkNull(spec);
+
+    strength = strchr(spec, ':');
+    name = strength ? strchr(strength + 1, ':') : NULL;
+    domains = name ? strchr(name + 1, '=') : NULL;
+    check(domains && domains - name - 1 < AFFINITY_MAX_NAME,
+        "affinity group should have the format <together|apart>:<hard|soft>:<group>=<domain>[,<domain>...]");
+    check(AffinityParseConstraint(spec, strength - spec, strength + 1, name - strength - 1, &kind, &hard) == 0,
+        "affinity group should have the format <together|apart>:<hard|soft>:<group>=<domain>[,<domain>...]");
+
+    memset(groupName, 0, AFFINITY_MAX_NAME);
+    strncpy(groupName, name + 1, domains - name - 1);
+    group = AffinityGetGroup(affinity, groupName, kind, hard);
+    check(group, "failed to add affinity group");
+
+    for (name = domains + 1; *name != '\0'; name = *next == ',' ? next + 1 : next) {
+        next = strchr(name, ',');
+        next = next ? next : name + strlen(name);
+        d = AffinityFindDomain(guests, name, next - name);
+        if (d < 0) {
+            logInfo("no active domain %.*s for affinity group %s", (int) (next - name), name, groupName);
+            continue;
+        }
+        AffinityAddMember(group, d);
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+int AffinityReadMetadata(Affinity *affinity, GuestList *guests)
+{
+    char *metadata = NULL;
+    const char *element = NULL;
+    char name[AFFINITY_MAX_NAME];
+    char kind[AFFINITY_MAX_NAME];
+    char strength[AFFINITY_MAX_NAME];
+    AffinityKind kindValue = AFFINITY_TOGETHER;
+    int hard = 0;
+    AffinityGroup *group = NULL;
+
+    checkNull(affinity);
+    checkNull(guests);
+
+    for (int d = 0; d < guests->count; d++) {
+        metadata = virDomainGetMetadata(GuestListDomainAt(guests, d), VIR_DOMAIN_METADATA_ELEMENT,
+            AFFINITY_METADATA_URI, 0);
+        // most domains do not declare any group, a missing element is not a failed call
+        MetricsCountRpc(METRICS_RPC_LIST, !metadata && virGetLastErrorCode() != VIR_ERR_NO_DOMAIN_METADATA);
+        if (!metadata) {
+            if (virGetLastErrorCode() != VIR_ERR_NO_DOMAIN_METADATA) {
+                logWarn("failed to read the affinity metadata of domain %d", d);
+            }
+            virResetLastError();
+            continue;
+        }
+        for (element = strstr(metadata, "<group"); element; element = strstr(element + 1, "<group")) {
+            if (AffinityGetAttribute(element, "name", name, AFFINITY_MAX_NAME) <= 0 ||
+                AffinityGetAttribute(element, "kind", kind, AFFINITY_MAX_NAME) < 0 ||
+                AffinityGetAttribute(element, "strength", strength, AFFINITY_MAX_NAME) < 0 ||
+                AffinityParseConstraint(kind, strlen(kind), strength, strlen(strength), &kindValue, &hard) != 0) {
+                logWarn("ignoring invalid affinity group in the metadata of domain %d", d);
+                continue;
+            }
+            group = AffinityGetGroup(affinity, name, kindValue, hard);
+            if (group) {
+                AffinityAddMember(group, d);
+            }
+        }
+        free(metadata);
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * @return bit mask of the localities the cpus of `cpuMap` belong to
+ */
+unsigned int AffinityLocalitiesOf(Affinity *affinity, unsigned char cpuMap)
+{
+    unsigned int localities = 0;
+
+    for (int l = 0; l < affinity->numLocalities; l++) {
+        if ((affinity->localities[l] & cpuMap) != 0) {
+            localities |= 1U << l;
+        }
+    }
+    return localities;
+}
+
+/**
+ * @return whether placing domain `d` on the cpus of `cpumask` breaks the group, given the members already placed
+ */
+int AffinityBreaks(Affinity *affinity, AffinityGroup *group, unsigned char *cpuMaps, int d, unsigned char cpumask)
+{
+    int m = 0;
+    int member = 0;
+
+    for (int i = 0; i < group->numMembers; i++) {
+        member |= group->members[i] == d;
+    }
+    if (!group->enabled || !member || cpumask == 0) {
+        return 0;
+    }
+    for (int i = 0; i < group->numMembers; i++) {
+        m = group->members[i];
+        if (m == d || cpuMaps[m] == 0) {
+            continue;
+        }
+        if (group->kind == AFFINITY_APART && (cpuMaps[m] & cpumask) != 0) {
+            return 1;
+        }
+        if (group->kind == AFFINITY_TOGETHER &&
+            (AffinityLocalitiesOf(affinity, cpuMaps[m]) & AffinityLocalitiesOf(affinity, cpumask)) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int AffinityAllows(Affinity *affinity, unsigned char *cpuMaps, int d, unsigned char cpumask)
+{
+    if (!affinity) {
+        return 1;
+    }
+    for (int g = 0; g < affinity->numGroups; g++) {
+        if (affinity->groups[g].hard && AffinityBreaks(affinity, affinity->groups + g, cpuMaps, d, cpumask)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int AffinityPenalty(Affinity *affinity, unsigned char *cpuMaps, int d, unsigned char cpumask)
+{
+    int penalty = 0;
+
+    if (!affinity) {
+        return 0;
+    }
+    for (int g = 0; g < affinity->numGroups; g++) {
+        penalty += !affinity->groups[g].hard && AffinityBreaks(affinity, affinity->groups + g, cpuMaps, d, cpumask);
+    }
+    return penalty;
+}
+
+int AffinityIsViolated(Affinity *affinity, unsigned char *cpuMaps, int d)
+{
+    if (!affinity) {
+        return 0;
+    }
+    for (int g = 0; g < affinity->numGroups; g++) {
+        if (AffinityBreaks(affinity, affinity->groups + g, cpuMaps, d, cpuMaps[d])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int AffinityCountViolations(Affinity *affinity, unsigned char *cpuMaps)
+{
+    int total = 0;
+    AffinityGroup *group = NULL;
+
+    if (!affinity) {
+        return 0;
+    }
+    for (int g = 0; g < affinity->numGroups; g++) {
+        group = affinity->groups + g;
+        group->numViolations = 0;
+        for (int i = 0; i < group->numMembers; i++) {
+            group->numViolations += AffinityBreaks(affinity, group, cpuMaps, group->members[i],
+                cpuMaps[group->members[i]]);
+        }
+        total += group->numViolations;
+    }
+    return total;
+}
+
+int AffinityRender(Affinity *affinity, Introspect *introspect)
+{
+    int rt = 0;
+    AffinityGroup *group = NULL;
+    checkNull(affinity);
+    checkNull(introspect);
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "[");
+    for (int g = 0; g < affinity->numGroups; g++) {
+        group = affinity->groups + g;
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN,
+            "%s{\"name\":\"%s\",\"kind\":\"%s\",\"hard\":%d,\"violations\":%d,\"cost\":%.4Lf,\"members\":[",
+            g > 0 ? "," : "", group->name, group->kind == AFFINITY_TOGETHER ? "together" : "apart", group->hard,
+            group->numViolations, group->cost);
+        for (int i = 0; i < group->numMembers; i++) {
+            rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "%s%d", i > 0 ? "," : "", group->members[i]);
+        }
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "]}");
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "]");
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_constraint_cost gauge\n", introspect->name);
+    for (int g = 0; g < affinity->numGroups; g++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "%s_constraint_cost{group=\"%s\"} %.4Lf\n",
+            introspect->name, affinity->groups[g].name, affinity->groups[g].cost);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_constraint_violations gauge\n",
+        introspect->name);
+    for (int g = 0; g < affinity->numGroups; g++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "%s_constraint_violations{group=\"%s\"} %d\n",
+            introspect->name, affinity->groups[g].name, affinity->groups[g].numViolations);
+    }
+    check(rt == 0, "failed to render affinity groups");
+
+    return 0;
+error:
+    return -1;
+}
@@ -0,0 +1,106 @@
+#ifndef affinity_h
+#define affinity_h
+
+#include <libvirt/libvirt.h>
+#include "cpustats.h"
+#include "guestlist.h"
+#include "introspect.h"
+
+#define AFFINITY_MAX_GROUPS 16
+#define AFFINITY_MAX_NAME 32
+// cpu maps are a single byte, there cannot be more localities than cpus
+#define AFFINITY_MAX_LOCALITIES 8
+// namespace of the domain metadata element declaring the groups of a domain
+#define AFFINITY_METADATA_URI "urn:vcpu-scheduler:affinity"
+// weight a violated soft constraint takes off the room of a cpu when placing a domain
+#define AFFINITY_SOFT_PENALTY 0.25
+
+typedef enum AffinityKind {
+    // the members share a locality (last level cache or NUMA node)
+    AFFINITY_TOGETHER,
+    // no two members share a cpu
+    AFFINITY_APART
+} AffinityKind;
+
+typedef struct AffinityGroup {
+    char name[AFFINITY_MAX_NAME];
+    AffinityKind kind;
+    /**
+     * hard constraints are only broken when the domain fits nowhere else,
+     * soft constraints are traded against the balance of the cpus
+     */
+    int hard;
+    int numMembers;
+    int *members;
+    /**
+     * whether the constraint is taken into account, cleared while its cost is measured
+     */
+    int enabled;
+    // number of members placed against the constraint in the last plan
+    int numViolations;
+    /**
+     * imbalance the constraint added to the last plan: the usage that would have to move
+     * to reach the cpu targets, minus the same without the constraint
+     */
+    CpuStatsUsage_t cost;
+} AffinityGroup;
+
+/**
+ * affinity and anti-affinity groups of the domains, declared on the command line or in the
+ * domains' metadata
+ */
+typedef struct Affinity {
+    int numCpus;
+    int numDomains;
+    int numGroups;
+    AffinityGroup groups[AFFINITY_MAX_GROUPS];
+    /**
+     * cpus sharing a last level cache or NUMA node
+     */
+    int numLocalities;
+    unsigned char localities[AFFINITY_MAX_LOCALITIES];
+} Affinity;
+
+/**
+ * @return empty set of groups with every cpu in a single locality, should be freed with AffinityFree()
+ */
+Affinity *AffinityCreate(int numCpus, int numDomains);
+void AffinityFree(Affinity *affinity);
+/**
+ * sets the cpus sharing a last level cache or NUMA node from a comma separated list of cpu masks.
+ * Without a list, each NUMA cell of the host topology in the hypervisor's capabilities is a locality
+ */
+int AffinitySetLocalities(Affinity *affinity, virConnectPtr conn, const char *masks);
+/**
+ * adds the domains of a group declared as `<together|apart>:<hard|soft>:<group>=<domain>[,<domain>...]`
+ */
+int AffinityAddSpec(Affinity *affinity, GuestList *guests, const char *spec);
+/**
+ * adds the domains to the groups declared in their metadata, as
+ * `<affinity xmlns="urn:vcpu-scheduler:affinity"><group name=".." kind="together|apart" strength="hard|soft"/></affinity>`
+ */
+int AffinityReadMetadata(Affinity *affinity, GuestList *guests);
+/**
+ * @return whether placing domain `d` on the cpus of `cpumask` keeps the hard constraints,
+ * given the domains already placed in `cpuMaps`
+ */
+int AffinityAllows(Affinity *affinity, unsigned char *cpuMaps, int d, unsigned char cpumask);
+/**
+ * @return number of soft constraints broken by placing domain `d` on the cpus of `cpumask`
+ */
+int AffinityPenalty(Affinity *affinity, unsigned char *cpuMaps, int d, unsigned char cpumask);
+/**
+ * @return whether domain `d` breaks any of its constraints where `cpuMaps` places it
+ */
+int AffinityIsViolated(Affinity *affinity, unsigned char *cpuMaps, int d);
+/**
+ * counts the members of each group placed against it in `cpuMaps`
+ * @return total number of violations
+ */
+int AffinityCountViolations(Affinity *affinity, unsigned char *cpuMaps);
+/**
+ * renders the groups as a JSON array in the plan section, and their cost as prometheus gauges
+ */
+int AffinityRender(Affinity *affinity, Introspect *introspect);
+
+#endif
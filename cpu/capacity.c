@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "capacity.h"
+#include "cpuplan.h"
+#include "util.h"
+#include "metrics.h"
+
+static const char *sloNames[] = {"none", "queuing", "balance"};
+
+void CapacityInit(Capacity *capacity)
+{
+    memset(capacity, 0, sizeof(Capacity));
+}
+
+int CapacityAddProfile(Capacity *capacity, const char *spec)
+{
+    CapacityProfile *profile = NULL;
+    const char *separator = NULL;
+    char *end = NULL;
+
+    checkNull(capacity);
+    checkNull(spec);
+    check(capacity->numProfiles < CAPACITY_MAX_PROFILES, "too many guest profiles");
+    separator = strchr(spec, '=');
+    check(separator && separator > spec && separator - spec < CAPACITY_MAX_NAME,
+        "guest profile should be <name>=<usage>");
+
+    profile = capacity->profiles + capacity->numProfiles;
+    memset(profile, 0, sizeof(CapacityProfile));
+    memcpy(profile->name, spec, separator - spec);
+    profile->usage = strtod(separator + 1, &end);
+    // a guest has a single vcpu, it cannot demand more than one cpu
+    check(end != separator + 1 && *end == '\0' && profile->usage > 0 && profile->usage <= 1,
+        "guest profile usage should be a share of one cpu");
+    capacity->numProfiles += 1;
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * places the domains of the snapshot and `numGuests` additional guests, the profiles taking turns,
+ * with the scheduler's full plan and checks the SLOs
+ * @param loads set to the predicted load of each cpu
+ * @param broken set for each SLO the placement breaks
+ */
+int CapacityPlaceGuests(Capacity *capacity, CpuStats *base, SchedulerConfig *config, int numGuests,
+    double *loads, int *broken)
+{
+    int rt = 0;
+    int d = 0;
+    double minLoad = -1;
+    double maxLoad = 0;
+    double largest = 0;
+    CpuStats *stats = NULL;
+    CpuPlan *plan = NULL;
+
+    stats = CpuStatsCreate(base->numCpus, base->numDomains + numGuests, 0);
+    checkMemAlloc(stats);
+    plan = CpuPlanCreate(stats->numCpus, stats->numDomains);
+    checkMemAlloc(plan);
+    // the guests have no co-location history, and without one the placement does not need to look it up
+    InterferenceFree(plan->interference);
+    plan->interference = NULL;
+
+    // the current maps only break ties, so that the snapshot's domains stay where they are when they can
+    memcpy(stats->domainUsages, base->domainUsages, base->numDomains * sizeof(CpuStatsUsage_t));
+    memcpy(stats->cpuMaps, base->cpuMaps, base->numDomains * sizeof(unsigned char));
+    memcpy(stats->numVcpus, base->numVcpus, base->numDomains * sizeof(int));
+    for (int g = 0; g < numGuests; g++) {
+        d = base->numDomains + g;
+        stats->domainUsages[d] = capacity->profiles[g % capacity->numProfiles].usage;
+        stats->numVcpus[d] = 1;
+    }
+
+    rt = planCpus(stats, config, plan);
+    check(rt == 0, "failed to plan the cpus");
+    capacity->numPlans += 1;
+
+    // the vcpu of a domain pinned to several cpus runs on one of them at a time, its demand is split across them
+    memset(loads, 0, stats->numCpus * sizeof(double));
+    for (d = 0; d < stats->numDomains; d++) {
+        for (int c = 0; c < stats->numCpus; c++) {
+            if (isPinnedToCpu(plan->cpuMaps[d], getCpuMask(c))) {
+                loads[c] += (double) stats->domainUsages[d] / countOnBits(plan->cpuMaps[d], stats->numCpus);
+            }
+        }
+    }
+    memset(broken, 0, sizeof(capacity->baselineBroken));
+    for (int c = 0; c < stats->numCpus; c++) {
+        // the demand a cpu cannot serve is time its vcpus spend waiting
+        broken[CAPACITY_SLO_QUEUING] |= loads[c] > 1 + QUEUING_WAIT;
+        if (isPinnedToCpu(plan->activeCpus, getCpuMask(c))) {
+            minLoad = minLoad < 0 ? loads[c] : min(minLoad, loads[c]);
+            maxLoad = max(maxLoad, loads[c]);
+        }
+    }
+    // whole domains cannot be split evenly across the cpus, the active cpus are balanced as long as
+    // moving the largest domain could not bring them closer
+    for (d = 0; d < stats->numDomains; d++) {
+        largest = max(largest, (double) stats->domainUsages[d]);
+    }
+    broken[CAPACITY_SLO_BALANCE] = certainlyGreaterThan(maxLoad - max(minLoad, 0), largest);
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    CpuPlanFree(plan);
+    CpuStatsFree(stats);
+    return rt;
+}
+
+int CapacityPlan(Capacity *capacity, CpuStats *stats, SchedulerConfig *config)
+{
+    int rt = 0;
+    int broken[CAPACITY_SLO_BALANCE + 1];
+    double loads[8 * sizeof(unsigned char)];
+    MetricsTime start = MetricsNow();
+    MetricsTime end;
+
+    checkNull(capacity);
+    checkNull(stats);
+    checkNull(config);
+    check(capacity->numProfiles > 0, "no guest profile to plan for");
+
+    capacity->numCpus = stats->numCpus;
+    capacity->numDomains = stats->numDomains;
+    capacity->maxGuests = 0;
+    capacity->brokenSlo = CAPACITY_SLO_NONE;
+    capacity->numPlans = 0;
+
+    rt = CapacityPlaceGuests(capacity, stats, config, 0, capacity->loads, capacity->baselineBroken);
+    check(rt == 0, "failed to place the current domains");
+    // a host whose vcpus already queue has no room left, while a placement that cannot be balanced
+    // may balance again with more guests to spread
+    if (capacity->baselineBroken[CAPACITY_SLO_QUEUING]) {
+        capacity->brokenSlo = CAPACITY_SLO_QUEUING;
+        memcpy(capacity->brokenLoads, capacity->loads, stats->numCpus * sizeof(double));
+    }
+
+    // the search stops at the first guest breaking an SLO the host meets now
+    for (int n = 1; n <= CAPACITY_MAX_GUESTS && capacity->brokenSlo == CAPACITY_SLO_NONE; n++) {
+        rt = CapacityPlaceGuests(capacity, stats, config, n, loads, broken);
+        check(rt == 0, "failed to place the additional guests");
+        for (int slo = CAPACITY_SLO_QUEUING; slo <= CAPACITY_SLO_BALANCE; slo++) {
+            if (broken[slo] && !capacity->baselineBroken[slo] && capacity->brokenSlo == CAPACITY_SLO_NONE) {
+                capacity->brokenSlo = slo;
+            }
+        }
+        if (capacity->brokenSlo != CAPACITY_SLO_NONE) {
+            memcpy(capacity->brokenLoads, loads, stats->numCpus * sizeof(double));
+        }
+        else {
+            capacity->maxGuests = n;
+            memcpy(capacity->loads, loads, stats->numCpus * sizeof(double));
+        }
+    }
+
+    for (int p = 0; p < capacity->numProfiles; p++) {
+        capacity->profiles[p].numAdded = capacity->maxGuests / capacity->numProfiles +
+            (p < capacity->maxGuests % capacity->numProfiles);
+    }
+    end = MetricsNow();
+    capacity->elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return 0;
+error:
+    return -1;
+}
+
+void CapacityPrintLoads(double *loads, int numCpus, FILE *file)
+{
+    fprintf(file, "[");
+    for (int c = 0; c < numCpus; c++) {
+        fprintf(file, "%s%.4f", c > 0 ? "," : "", loads[c]);
+    }
+    fprintf(file, "]");
+}
+
+void CapacityPrint(Capacity *capacity, FILE *file)
+{
+    int first = 1;
+
+    fprintf(file, "{\"cpus\":%d,\"domains\":%d,\"profiles\":[", capacity->numCpus, capacity->numDomains);
+    for (int p = 0; p < capacity->numProfiles; p++) {
+        fprintf(file, "%s{\"name\":\"%s\",\"usage\":%.4f,\"added\":%d}", p > 0 ? "," : "",
+            capacity->profiles[p].name, capacity->profiles[p].usage, capacity->profiles[p].numAdded);
+    }
+    fprintf(file, "],\"baseline_broken\":[");
+    for (int slo = CAPACITY_SLO_QUEUING; slo <= CAPACITY_SLO_BALANCE; slo++) {
+        if (capacity->baselineBroken[slo]) {
+            fprintf(file, "%s\"%s\"", first ? "" : ",", sloNames[slo]);
+            first = 0;
+        }
+    }
+    fprintf(file, "],\"max_additional_guests\":%d,", capacity->maxGuests);
+    if (capacity->brokenSlo != CAPACITY_SLO_NONE) {
+        fprintf(file, "\"first_slo_broken\":\"%s\",", sloNames[capacity->brokenSlo]);
+    }
+    else {
+        fprintf(file, "\"first_slo_broken\":null,");
+    }
+    fprintf(file, "\"predicted_load\":");
+    CapacityPrintLoads(capacity->loads, capacity->numCpus, file);
+    fprintf(file, ",\"breaking_load\":");
+    if (capacity->brokenSlo != CAPACITY_SLO_NONE) {
+        CapacityPrintLoads(capacity->brokenLoads, capacity->numCpus, file);
+    }
+    else {
+        fprintf(file, "null");
+    }
+    fprintf(file, ",\"plans\":%d,\"elapsed_ms\":%.3f}\n", capacity->numPlans, capacity->elapsed * 1000);
+}
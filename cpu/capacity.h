@@ -0,0 +1,83 @@
+#ifndef capacity_h
+#define capacity_h
+
+#include <stdio.h>
+#include "cpustats.h"
+#include "scheduler.h"
+
+#define CAPACITY_MAX_PROFILES 8
+#define CAPACITY_MAX_NAME 32
+// the search stops after this many additional guests, which keeps it well under a second
+#define CAPACITY_MAX_GUESTS 128
+
+/**
+ * service level objectives a placement is checked against
+ */
+typedef enum CapacitySlo {
+    CAPACITY_SLO_NONE = 0,
+    // a pCPU is given more demand than it can serve, its vCPUs would queue for more than the queuing threshold
+    CAPACITY_SLO_QUEUING,
+    // the loads of the active pCPUs are further apart than the largest domain's usage, more than whole domains explain
+    CAPACITY_SLO_BALANCE
+} CapacitySlo;
+
+/**
+ * hypothetical guest, a single vCPU with a steady demand
+ */
+typedef struct CapacityProfile {
+    char name[CAPACITY_MAX_NAME];
+    // demand of the guest's vCPU (share of one pCPU)
+    double usage;
+    // number of guests of the profile added in the largest placement meeting the SLOs
+    int numAdded;
+} CapacityProfile;
+
+/**
+ * what-if capacity plan: guests of the profiles are added in turn to a snapshot of the host
+ * and placed with the scheduler's full plan until an SLO breaks
+ */
+typedef struct Capacity {
+    int numProfiles;
+    CapacityProfile profiles[CAPACITY_MAX_PROFILES];
+    int numCpus;
+    // number of domains in the snapshot
+    int numDomains;
+    /**
+     * SLOs already broken by the snapshot's own domains. Queuing leaves no room for any guest,
+     * an unbalanced placement is not held against the additional guests
+     */
+    int baselineBroken[CAPACITY_SLO_BALANCE + 1];
+    // largest number of additional guests placed without breaking an SLO
+    int maxGuests;
+    // first SLO broken by adding one more guest, none if the search stopped at the maximum
+    CapacitySlo brokenSlo;
+    /**
+     * predicted load of each pCPU with the largest number of guests meeting the SLOs,
+     * and with the guest that breaks the first SLO
+     */
+    double loads[8 * sizeof(unsigned char)];
+    double brokenLoads[8 * sizeof(unsigned char)];
+    // number of placements computed and time taken by the search (in seconds)
+    int numPlans;
+    double elapsed;
+} Capacity;
+
+/**
+ * initialises a capacity plan without any profile
+ */
+void CapacityInit(Capacity *capacity);
+/**
+ * adds a guest profile given as `<name>=<usage>`, the usage being the demand of its vCPU as a share of one pCPU
+ */
+int CapacityAddProfile(Capacity *capacity, const char *spec);
+/**
+ * adds guests of the profiles in turn to the domains of `stats` and places them with the scheduler's policy,
+ * until one more guest would break an SLO. The snapshot's stats are not modified
+ */
+int CapacityPlan(Capacity *capacity, CpuStats *stats, SchedulerConfig *config);
+/**
+ * writes the result of the plan as a JSON object
+ */
+void CapacityPrint(Capacity *capacity, FILE *file);
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "cpuplan.h"
+
+CpuPlan *CpuPlanCreate(int numCpus, int numDomains)
+{
+    CpuPlan *plan = calloc(1, sizeof(CpuPlan));
+    checkMemAlloc(plan);
+    plan->numCpus = numCpus;
+    plan->numDomains = numDomains;
+    plan->targetWeights = calloc(numCpus, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(plan->targetWeights);
+    plan->cpuMaps = calloc(numDomains, sizeof(unsigned char));
+    checkMemAlloc(plan->cpuMaps);
+    plan->plannedUsages = calloc(numDomains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(plan->plannedUsages);
+    plan->candidates = calloc(numDomains, sizeof(int));
+    checkMemAlloc(plan->candidates);
+    plan->replanned = calloc(numDomains, sizeof(int));
+    checkMemAlloc(plan->replanned);
+    plan->cyclesSinceFullPlan = -1;
+    plan->interference = InterferenceCreate(numDomains);
+    checkNull(plan->interference);
+
+    return plan;
+error:
+    CpuPlanFree(plan);
+    return NULL;
+}
+
+void CpuPlanFree(CpuPlan *plan)
+{
+    if (plan) {
+        if (plan->targetWeights) {
+            free(plan->targetWeights);
+        }
+        if (plan->cpuMaps) {
+            free(plan->cpuMaps);
+        }
+        if (plan->plannedUsages) {
+            free(plan->plannedUsages);
+        }
+        if (plan->candidates) {
+            free(plan->candidates);
+        }
+        if (plan->replanned) {
+            free(plan->replanned);
+        }
+        InterferenceFree(plan->interference);
+        free(plan);
+    }
+}
+
+int CpuPlanReset(CpuPlan *plan)
+{
+    checkNull(plan);
+    memset(plan->targetWeights, 0, plan->numCpus * sizeof(CpuStatsUsage_t));
+    memset(plan->cpuMaps, 0, plan->numDomains * sizeof(unsigned char));
+    plan->balanced = 0;
+    plan->numRepins = 0;
+    plan->numThreadRepins = 0;
+    plan->numActiveCpus = 0;
+    plan->activeCpus = 0;
+    plan->numCandidates = 0;
+    plan->incremental = 0;
+    plan->numDirtyCpus = 0;
+    plan->numNoisyColocated = 0;
+    plan->numViolations = 0;
+
+    return 0;
+error:
+    return -1;
+}
+
+int CpuPlanRender(CpuPlan *plan, Introspect *introspect)
+{
+    int rt = 0;
+    checkNull(plan);
+    checkNull(introspect);
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN,
+        "{\"balanced\":%d,\"repins\":%d,\"thread_repins\":%d,\"consolidated\":%d,\"active_cpus\":%d,"
+        "\"incremental\":%d,\"replanned\":%d,\"target_weights\":[",
+        plan->balanced, plan->numRepins, plan->numThreadRepins, plan->consolidated, plan->numActiveCpus,
+        plan->incremental, plan->numCandidates);
+    for (int c = 0; c < plan->numCpus; c++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "%s%.4Lf", c > 0 ? "," : "", plan->targetWeights[c]);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "],\"cpu_maps\":[");
+    for (int d = 0; d < plan->numDomains; d++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "%s%u", d > 0 ? "," : "", plan->cpuMaps[d]);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "],\"noisy_colocated\":%d,\"noisy_neighbours\":",
+        plan->numNoisyColocated);
+    rt |= InterferenceRender(plan->interference, plan->cpuMaps, introspect);
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, ",\"violations\":%d,\"constraints\":", plan->numViolations);
+    if (plan->affinity) {
+        rt |= AffinityRender(plan->affinity, introspect);
+    }
+    else {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "[]");
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "}\n");
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_active_cpus gauge\n%s_active_cpus %d\n",
+        introspect->name, introspect->name, plan->numActiveCpus);
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS,
+        "# TYPE %s_noisy_colocated gauge\n%s_noisy_colocated %d\n",
+        introspect->name, introspect->name, plan->numNoisyColocated);
+    check(rt == 0, "failed to render cpu plan");
+
+    return 0;
+error:
+    return -1;
+}
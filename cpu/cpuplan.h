@@ -0,0 +1,74 @@
+#ifndef cpuplan_h
+#define cpuplan_h
+
+#include "cpustats.h"
+#include "introspect.h"
+#include "interference.h"
+#include "affinity.h"
+
+/**
+ * placement decided by the scheduler in its last cycle
+ */
+typedef struct CpuPlan {
+    int numCpus;
+    int numDomains;
+    CpuStatsUsage_t *targetWeights;
+    unsigned char *cpuMaps;
+    // whether the cpus were already balanced, in which case no domain is repinned
+    int balanced;
+    int numRepins;
+    // number of domains whose emulator and iothreads were repinned
+    int numThreadRepins;
+    /**
+     * whether the load is packed onto as few cpus as possible, kept across cycles
+     * for the hysteresis between consolidating and spreading
+     */
+    int consolidated;
+    /**
+     * number of cpus the domains are pinned to, the other cpus are left idle
+     */
+    int numActiveCpus;
+    // bit mask of the active cpus
+    unsigned char activeCpus;
+    /**
+     * usage of each domain when it was last placed, kept across cycles to find the dirty domains
+     */
+    CpuStatsUsage_t *plannedUsages;
+    /**
+     * domains placed in this cycle, every domain for a full plan
+     */
+    int *candidates;
+    int numCandidates;
+    // whether each domain is placed in this cycle
+    int *replanned;
+    // whether only the dirty domains were re-planned in this cycle
+    int incremental;
+    // number of evictions from cpus whose clean domains exceeded their target
+    int numDirtyCpus;
+    // number of plans since the last full plan, -1 before the first one
+    int cyclesSinceFullPlan;
+    /**
+     * co-location history of the domains, kept across cycles. Noisy neighbours are kept apart
+     * when the placement allows it
+     */
+    Interference *interference;
+    // number of pairs of noisy neighbours sharing a cpu before this plan
+    int numNoisyColocated;
+    /**
+     * affinity and anti-affinity groups honoured by the placement, set and owned by the worker, NULL if none
+     */
+    Affinity *affinity;
+    // number of domains placed against their groups in this plan
+    int numViolations;
+} CpuPlan;
+
+CpuPlan *CpuPlanCreate(int numCpus, int numDomains);
+void CpuPlanFree(CpuPlan *plan);
+int CpuPlanReset(CpuPlan *plan);
+/**
+ * renders the plan as JSON, and the number of active cpus and of co-located noisy neighbours
+ * as prometheus gauges in the introspection snapshot
+ */
+int CpuPlanRender(CpuPlan *plan, Introspect *introspect);
+
+#endif
@@ -1,10 +1,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <math.h>
 #include "cpustats.h"
 #include "util.h"
+#include "log.h"
+#include "metrics.h"
 
-CpuStats *CpuStatsCreate(int cpus, int domains)
+CpuStats *CpuStatsCreate(int cpus, int domains, int sampleBudget)
 {
     CpuStats *stats = calloc(1, sizeof(CpuStats));
     checkMemAlloc(stats);
@@ -20,6 +23,45 @@ CpuStats *CpuStatsCreate(int cpus, int domains)
     checkMemAlloc(stats->domainUsages);
     stats->cpuMaps = calloc(domains, sizeof(unsigned char));
     checkMemAlloc(stats->cpuMaps);
+    stats->lastTimeDiffs = calloc(domains * cpus, sizeof(CpuStatsTime_t));
+    checkMemAlloc(stats->lastTimeDiffs);
+    stats->prevDomainUsages = calloc(domains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(stats->prevDomainUsages);
+    stats->hot = calloc(domains, sizeof(int));
+    checkMemAlloc(stats->hot);
+    stats->sampled = calloc(domains, sizeof(int));
+    checkMemAlloc(stats->sampled);
+    stats->sampleAges = calloc(domains, sizeof(int));
+    checkMemAlloc(stats->sampleAges);
+    stats->burstUsages = calloc(domains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(stats->burstUsages);
+    stats->bursting = calloc(domains, sizeof(int));
+    checkMemAlloc(stats->bursting);
+    stats->overheadTimes = calloc(domains, sizeof(CpuStatsTime_t));
+    checkMemAlloc(stats->overheadTimes);
+    stats->lastOverheadDiffs = calloc(domains, sizeof(CpuStatsTime_t));
+    checkMemAlloc(stats->lastOverheadDiffs);
+    stats->overheadUsages = calloc(domains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(stats->overheadUsages);
+    stats->threadMaps = calloc(domains, sizeof(unsigned char));
+    checkMemAlloc(stats->threadMaps);
+    stats->waitTimes = calloc(domains, sizeof(CpuStatsTime_t));
+    checkMemAlloc(stats->waitTimes);
+    stats->lastWaitDiffs = calloc(domains, sizeof(CpuStatsTime_t));
+    checkMemAlloc(stats->lastWaitDiffs);
+    stats->waitUsages = calloc(domains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(stats->waitUsages);
+    stats->numVcpus = calloc(domains, sizeof(int));
+    checkMemAlloc(stats->numVcpus);
+    stats->cpuWaits = calloc(cpus, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(stats->cpuWaits);
+    stats->waitRetryIn = 0;
+    stats->sampleBudget = sampleBudget;
+    // every domain is hot until its usage is known
+    for (int d = 0; d < domains; d++) {
+        stats->hot[d] = 1;
+        stats->sampled[d] = 1;
+    }
 
     return stats;
 
@@ -46,6 +88,54 @@ void CpuStatsFree(CpuStats *stats)
         if (stats->cpuMaps) {
             free(stats->cpuMaps);
         }
+        if (stats->lastTimeDiffs) {
+            free(stats->lastTimeDiffs);
+        }
+        if (stats->prevDomainUsages) {
+            free(stats->prevDomainUsages);
+        }
+        if (stats->hot) {
+            free(stats->hot);
+        }
+        if (stats->sampled) {
+            free(stats->sampled);
+        }
+        if (stats->sampleAges) {
+            free(stats->sampleAges);
+        }
+        if (stats->burstUsages) {
+            free(stats->burstUsages);
+        }
+        if (stats->bursting) {
+            free(stats->bursting);
+        }
+        if (stats->overheadTimes) {
+            free(stats->overheadTimes);
+        }
+        if (stats->lastOverheadDiffs) {
+            free(stats->lastOverheadDiffs);
+        }
+        if (stats->overheadUsages) {
+            free(stats->overheadUsages);
+        }
+        if (stats->threadMaps) {
+            free(stats->threadMaps);
+        }
+        if (stats->waitTimes) {
+            free(stats->waitTimes);
+        }
+        if (stats->lastWaitDiffs) {
+            free(stats->lastWaitDiffs);
+        }
+        if (stats->waitUsages) {
+            free(stats->waitUsages);
+        }
+        if (stats->numVcpus) {
+            free(stats->numVcpus);
+        }
+        if (stats->cpuWaits) {
+            free(stats->cpuWaits);
+        }
         free(stats);
     }
 }
@@ -102,6 +192,24 @@ error:
     return -1;
 }
 
+/**
+ * spreads the wait of each domain over the cpus it is pinned to
+ */
+void CpuStatsUpdateCpuWaits(CpuStats *stats)
+{
+    int numPinned = 0;
+
+    memset(stats->cpuWaits, 0, stats->numCpus * sizeof(CpuStatsUsage_t));
+    for (int d = 0; d < stats->numDomains; d++) {
+        numPinned = countOnBits(stats->cpuMaps[d], stats->numCpus);
+        for (int c = 0; c < stats->numCpus && numPinned > 0; c++) {
+            if (isPinnedToCpu(stats->cpuMaps[d], getCpuMask(c))) {
+                stats->cpuWaits[c] += stats->waitUsages[d] / numPinned;
+            }
+        }
+    }
+}
+
 int CpuStatsUsagesToPct(CpuStats *stats, double timeInterval)
 {
     int i = 0;
@@ -123,11 +231,27 @@ int CpuStatsUsagesToPct(CpuStats *stats, double timeInterval)
 
     for (i = 0; i < stats->numDomains; i++) {
         stats->domainUsages[i] = stats->domainUsages[i] / 1e9;
+        stats->overheadUsages[i] = (CpuStatsUsage_t) stats->lastOverheadDiffs[i] / 1e9;
         if (timeInterval > 0) {
             stats->domainUsages[i] = stats->domainUsages[i] / timeInterval;
+            stats->overheadUsages[i] = stats->overheadUsages[i] / timeInterval;
+        }
+        if (stats->includeOverhead) {
+            stats->domainUsages[i] += stats->overheadUsages[i];
+        }
+        // a domain's demand is the time it used plus the time it waited for a cpu
+        stats->waitUsages[i] = (CpuStatsUsage_t) stats->lastWaitDiffs[i] / 1e9;
+        if (timeInterval > 0) {
+            stats->waitUsages[i] = stats->waitUsages[i] / timeInterval;
+        }
+        stats->domainUsages[i] += stats->waitUsages[i];
+        if (stats->numVcpus[i] > 0) {
+            stats->domainUsages[i] = fminl(stats->domainUsages[i], (CpuStatsUsage_t) stats->numVcpus[i]);
         }
     }
 
+    CpuStatsUpdateCpuWaits(stats);
+
     return 0;
 
 error:
@@ -137,21 +261,19 @@ error:
 
 int CpuStatsPrint(CpuStats *stats)
 {
-    // CpuStatsTime_t cpuTime = 0;
     check(stats, "Stats cannot be null");
+    if (!LogIsEnabled(LOG_DEBUG)) {
+        return 0;
+    }
 
     for (int c = 0; c < stats->numCpus; c++) {
-        printf("cpu %d usage: %.2Lf\n", c, 100 * stats->usages[c]);
-        printf("- cpu weight %.2Lf\n", stats->cpuWeights[c]);
+        logDebug("cpu %d usage: %.2Lf, weight %.2Lf", c, 100 * stats->usages[c], stats->cpuWeights[c]);
     }
 
     for (int i = 0; i < stats->numDomains; i++) {
-        printf("domain %d\n", i);
-        printf("domain usage: %.2Lf\n", 100 * stats->domainUsages[i]);
-        // for (int c = 0; c < stats->numCpus; c++) {
-        //     cpuTime = *(stats->times + stats->numCpus * i + c);
-        //     printf("-- cpuTime %d: %llu\n", c, cpuTime);
-        // }
+        logDebug("domain %d usage: %.2Lf, emulator and iothreads %.2Lf, sampled %d cycles ago%s", i,
+            100 * stats->domainUsages[i], 100 * stats->overheadUsages[i], stats->sampleAges[i],
+            stats->hot[i] ? " (hot)" : "");
     }
 
     return 0;
@@ -159,6 +281,52 @@ error:
     return -1;
 }
 
+int CpuStatsRender(CpuStats *stats, Introspect *introspect)
+{
+    const char *name = NULL;
+    int rt = 0;
+    checkNull(stats);
+    checkNull(introspect);
+    name = introspect->name;
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_STATS, "{\"cpus\":[");
+    for (int c = 0; c < stats->numCpus; c++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_STATS, "%s{\"usage\":%.4Lf,\"weight\":%.4Lf,\"wait\":%.4Lf}",
+            c > 0 ? "," : "", stats->usages[c], stats->cpuWeights[c], stats->cpuWaits[c]);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_STATS, "],\"domains\":[");
+    for (int d = 0; d < stats->numDomains; d++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_STATS,
+            "%s{\"usage\":%.4Lf,\"cpu_map\":%u,\"hot\":%d,\"sample_age\":%d,\"burst_usage\":%.4Lf,\"bursting\":%d,"
+            "\"overhead_usage\":%.4Lf,\"thread_map\":%u,\"wait_usage\":%.4Lf}",
+            d > 0 ? "," : "", stats->domainUsages[d], stats->cpuMaps[d], stats->hot[d], stats->sampleAges[d],
+            stats->burstUsages[d], stats->bursting[d], stats->overheadUsages[d], stats->threadMaps[d],
+            stats->waitUsages[d]);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_STATS, "]}\n");
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_cpu_usage gauge\n", name);
+    for (int c = 0; c < stats->numCpus; c++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "%s_cpu_usage{cpu=\"%d\"} %.4Lf\n",
+            name, c, stats->usages[c]);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_cpu_wait gauge\n", name);
+    for (int c = 0; c < stats->numCpus; c++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "%s_cpu_wait{cpu=\"%d\"} %.4Lf\n",
+            name, c, stats->cpuWaits[c]);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_domain_usage gauge\n", name);
+    for (int d = 0; d < stats->numDomains; d++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "%s_domain_usage{domain=\"%d\"} %.4Lf\n",
+            name, d, stats->domainUsages[d]);
+    }
+    check(rt == 0, "failed to render cpu stats");
+
+    return 0;
+error:
+    return -1;
+}
+
 int CpuStatsCountDomainsOnCpu(CpuStats *stats, int cpu)
 {
     CpuStatsCheckStatsArg(stats);
@@ -187,7 +355,7 @@ CpuStatsWeight_t CpuStatsCountDomainWeightOnCpu(CpuStats *stats, int cpu)
 
     for (d = 0; d < stats->numDomains; d++) {
         if (isPinnedToCpu(stats->cpuMaps[d], getCpuMask(cpu))) {
-            weight += (CpuStatsWeight_t) stats->domainUsages[d];
+            weight += (CpuStatsWeight_t) CpuStatsGetDemand(stats, d);
         }
     }
     return weight;
@@ -196,6 +364,35 @@ error:
     return -1;
 }
 
+int CpuStatsQueuesLessOn(CpuStats *stats, int domain, unsigned char cpumask)
+{
+    int numPinned = 0;
+    int numCandidates = 0;
+    CpuStatsUsage_t pinnedWait = 0;
+    CpuStatsUsage_t candidateWait = 0;
+
+    if (!CpuStatsIsQueuing(stats, domain) || isPinnedToCpu(stats->cpuMaps[domain], cpumask)) {
+        return 0;
+    }
+    for (int c = 0; c < stats->numCpus; c++) {
+        if (isPinnedToCpu(stats->cpuMaps[domain], getCpuMask(c))) {
+            pinnedWait += stats->cpuWaits[c];
+            numPinned += 1;
+        }
+        if (isPinnedToCpu(cpumask, getCpuMask(c))) {
+            candidateWait += stats->cpuWaits[c];
+            numCandidates += 1;
+        }
+    }
+    if (numPinned == 0 || numCandidates == 0) {
+        return numCandidates > 0;
+    }
+    // the domain's own wait is left out, it takes it along wherever it goes
+    pinnedWait = (pinnedWait - stats->waitUsages[domain]) / numPinned;
+    candidateWait = candidateWait / numCandidates;
+    return candidateWait + QUEUING_WAIT < pinnedWait;
+}
+
 int CpuStatsUpdateCpuMaps(CpuStats *stats, GuestList *guests)
 {
     virDomainPtr domain = NULL;
@@ -205,8 +402,14 @@ int CpuStatsUpdateCpuMaps(CpuStats *stats, GuestList *guests)
     checkNull(guests);
 
     for (int i = 0; i < guests->count; i++) {
+        // pin changes are only made by the scheduler, maps of domains
+        // that are not sampled are kept up to date when they're repinned
+        if (!stats->sampled[i]) {
+            continue;
+        }
         domain = GuestListDomainAt(guests, i);
         rt = virDomainGetVcpuPinInfo(domain, 1, &cpumap, 1, 0);
+        MetricsCountRpc(METRICS_RPC_COLLECT, rt == -1);
         check(rt != -1, "failed to get vcpu pin info");
         stats->cpuMaps[i] = cpumap;
     }
@@ -217,7 +420,185 @@ error:
     return -1;
 }
 
-int updateStats(CpuStats *stats, GuestList *guests, int timeInterval)
+/**
+ * selects the domains to sample in this cycle: all hot domains, and the
+ * stable domains that fit in the sample budget, in round-robin order
+ */
+void CpuStatsSelectSamples(CpuStats *stats)
+{
+    int budget = stats->numDomains;
+    int selected = 0;
+    int d = 0;
+
+    if (stats->sampleBudget > 0) {
+        // always sample at least one stable domain so none of them is left behind
+        budget = stats->sampleBudget / RPCS_PER_SAMPLE;
+        budget = budget > 0 ? budget : 1;
+    }
+
+    for (d = 0; d < stats->numDomains; d++) {
+        stats->sampled[d] = stats->hot[d];
+    }
+
+    for (int k = 0; k < stats->numDomains && selected < budget; k++) {
+        d = (stats->nextStable + k) % stats->numDomains;
+        if (!stats->hot[d]) {
+            stats->sampled[d] = 1;
+            selected += 1;
+            stats->nextStable = (d + 1) % stats->numDomains;
+        }
+    }
+}
+
+/**
+ * reads the wait time of a domain's vcpus from its bulk stats record
+ */
+void CpuStatsReadWaitTime(CpuStats *stats, int d, virDomainStatsRecordPtr record)
+{
+    CpuStatsTime_t waitTime = 0;
+    CpuStatsTime_t timeDiff = 0;
+    unsigned int numVcpus = 0;
+    size_t length = 0;
+
+    for (int p = 0; p < record->nparams; p++) {
+        length = strnlen(record->params[p].field, VIR_TYPED_PARAM_FIELD_LENGTH);
+        if (strncmp(record->params[p].field, "vcpu.", 5) == 0 && length > 5 &&
+            strcmp(record->params[p].field + length - 5, ".wait") == 0) {
+            waitTime += record->params[p].value.ul;
+        }
+    }
+    if (virTypedParamsGetUInt(record->params, record->nparams, "vcpu.current", &numVcpus) == 1) {
+        stats->numVcpus[d] = (int) numVcpus;
+    }
+
+    timeDiff = stats->waitTimes[d] > 0 && waitTime >= stats->waitTimes[d] ? waitTime - stats->waitTimes[d] : 0;
+    // spread the time waited since the last sample over the cycles it covers
+    stats->lastWaitDiffs[d] = timeDiff / (stats->sampleAges[d] + 1);
+    stats->waitTimes[d] = waitTime;
+}
+
+/**
+ * samples the wait time of the vcpus of the domains sampled in this cycle, with a single
+ * bulk stats call. Hypervisors that do not report it leave the domains' wait at 0
+ */
+int CpuStatsUpdateWaitTimes(CpuStats *stats, GuestList *guests)
+{
+    int numSampled = 0;
+    int numRecords = 0;
+    int id = 0;
+    int d = 0;
+    virDomainPtr *domains = NULL;
+    int *indexes = NULL;
+    virDomainStatsRecordPtr *records = NULL;
+
+    if (stats->waitRetryIn > 0) {
+        stats->waitRetryIn -= 1;
+        return 0;
+    }
+
+    domains = calloc(guests->count + 1, sizeof(virDomainPtr));
+    checkMemAlloc(domains);
+    indexes = calloc(guests->count, sizeof(int));
+    checkMemAlloc(indexes);
+    for (d = 0; d < guests->count; d++) {
+        if (stats->sampled[d]) {
+            indexes[numSampled] = d;
+            domains[numSampled++] = GuestListDomainAt(guests, d);
+        }
+    }
+    if (numSampled == 0) {
+        goto final;
+    }
+
+    numRecords = virDomainListGetStats(domains, VIR_DOMAIN_STATS_VCPU, &records, 0);
+    MetricsCountRpc(METRICS_RPC_COLLECT, numRecords < 0);
+    if (numRecords < 0) {
+        logWarn("vcpu wait times are not available, scheduling on consumed time only for %d cycles",
+            WAIT_RETRY_CYCLES);
+        stats->waitRetryIn = WAIT_RETRY_CYCLES;
+        // the waits are not carried over the cycles without them, the next sample starts afresh
+        for (d = 0; d < stats->numDomains; d++) {
+            stats->lastWaitDiffs[d] = 0;
+            stats->waitTimes[d] = 0;
+        }
+        goto final;
+    }
+
+    for (int r = 0; r < numRecords; r++) {
+        // records are expected in the order of the domains, fall back to a lookup by id otherwise
+        id = virDomainGetID(records[r]->dom);
+        d = r < numSampled && GuestListIdAt(guests, indexes[r]) == id ? indexes[r] : -1;
+        for (int i = 0; i < numSampled && d < 0; i++) {
+            if (GuestListIdAt(guests, indexes[i]) == id) {
+                d = indexes[i];
+            }
+        }
+        if (d >= 0) {
+            CpuStatsReadWaitTime(stats, d, records[r]);
+        }
+    }
+
+final:
+    if (records) {
+        virDomainStatsRecordListFree(records);
+    }
+    free(domains);
+    free(indexes);
+    return 0;
+error:
+    free(domains);
+    free(indexes);
+    return -1;
+}
+
+/**
+ * adds the cpu time used by a domain that was not sampled in this cycle,
+ * assuming it used as much as in its last sampled cycle. The time is charged to the cpus
+ * the domain is pinned to now, which are not those of its last sample if it was repinned since
+ */
+int CpuStatsAddLastUsage(CpuStats *stats, int domain)
+{
+    int rt = 0;
+    int numPinned = countOnBits(stats->cpuMaps[domain], stats->numCpus);
+    CpuStatsTime_t timeDiff = 0;
+    CpuStatsTime_t total = 0;
+
+    for (int c = 0; c < stats->numCpus; c++) {
+        total += stats->lastTimeDiffs[stats->numCpus * domain + c];
+    }
+    rt = CpuStatsAddDomainUsage(stats, domain, (CpuStatsUsage_t) total);
+    check(rt == 0, "failed to add domain usage");
+    for (int c = 0; c < stats->numCpus; c++) {
+        // without pins, the domain is assumed to run where it ran last
+        if (numPinned == 0) {
+            timeDiff = stats->lastTimeDiffs[stats->numCpus * domain + c];
+        }
+        else {
+            timeDiff = isPinnedToCpu(stats->cpuMaps[domain], getCpuMask(c)) ? total / numPinned : 0;
+        }
+        rt = CpuStatsAddUsage(stats, c, (CpuStatsUsage_t) timeDiff);
+        check(rt == 0, "failed to add cpu usage");
+    }
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * marks the sampled domains whose usage changed significantly as hot
+ */
+void CpuStatsUpdateHotDomains(CpuStats *stats)
+{
+    for (int d = 0; d < stats->numDomains; d++) {
+        if (!stats->sampled[d]) {
+            continue;
+        }
+        stats->hot[d] = fabsl(stats->domainUsages[d] - stats->prevDomainUsages[d]) > HOT_USAGE_CHANGE;
+        stats->prevDomainUsages[d] = stats->domainUsages[d];
+    }
+}
+
+int updateStats(CpuStats *stats, GuestList *guests, double timeInterval)
 {
     int nparams = 0;
     int d = 0; // domain iterator
@@ -227,6 +608,9 @@ int updateStats(CpuStats *stats, GuestList *guests, int timeInterval)
     unsigned long long prevTime = 0L;
     unsigned long long currTime = 0L;
     unsigned long long timeDiff = 0L;
+    unsigned long long cpuTime = 0L;
+    unsigned long long vcpuTime = 0L;
+    unsigned long long overheadTime = 0L;
     int rt = 0;
     virDomainPtr domain = NULL;
     virTypedParameterPtr params = NULL;
@@ -235,6 +619,7 @@ int updateStats(CpuStats *stats, GuestList *guests, int timeInterval)
     check(guests, "guests is null");
  
     nparams = virDomainGetCPUStats(GuestListDomainAt(guests, 0), NULL, 0, 0, 1, 0);
+    MetricsCountRpc(METRICS_RPC_COLLECT, nparams < 0);
     check(nparams >= 0, "failed to get domain cpu params");
     params = calloc(stats->numCpus * nparams, sizeof(virTypedParameter));
     check(params, "failed to allocated params");
@@ -242,22 +627,46 @@ int updateStats(CpuStats *stats, GuestList *guests, int timeInterval)
     rt = CpuStatsResetUsages(stats);
     check(rt == 0, "failed to reset usages");
 
+    if (timeInterval > 0) {
+        CpuStatsSelectSamples(stats);
+    }
+
     rt = CpuStatsUpdateCpuMaps(stats, guests);
     check(rt == 0, "failed to update cpu maps");
 
+    rt = CpuStatsUpdateWaitTimes(stats, guests);
+    check(rt == 0, "failed to update wait times");
+
     for (d = 0; d < guests->count; d++) {
+        if (!stats->sampled[d]) {
+            stats->sampleAges[d] += 1;
+            rt = CpuStatsAddLastUsage(stats, d);
+            check(rt == 0, "failed to add last usage");
+            continue;
+        }
         domain = GuestListDomainAt(guests, d);
-        virDomainGetCPUStats(domain, params, nparams, 0, stats->numCpus, 0);
+        rt = virDomainGetCPUStats(domain, params, nparams, 0, stats->numCpus, 0);
+        MetricsCountRpc(METRICS_RPC_COLLECT, rt < 0);
+        cpuTime = 0;
+        vcpuTime = 0;
 
         for (c = 0; c < stats->numCpus; c++) {
             for (p = 0; p < nparams; p++) {
                 paramPos = nparams * c + p;
 
+                if (strncmp(params[paramPos].field, "cpu_time", VIR_TYPED_PARAM_FIELD_LENGTH) == 0) {
+                    cpuTime += params[paramPos].value.ul;
+                }
+
                 if (strncmp(params[paramPos].field, "vcpu_time", VIR_TYPED_PARAM_FIELD_LENGTH) == 0) {
                     rt = CpuStatsGetTime(stats, c, d, &prevTime);
                     check(rt == 0, "failed to get cpu time from stats");
                     currTime = params[paramPos].value.ul;
+                    vcpuTime += currTime;
                     timeDiff = prevTime > 0 ? currTime - prevTime : 0;
+                    // spread the time used since the last sample over the cycles it covers
+                    timeDiff = timeDiff / (stats->sampleAges[d] + 1);
+                    stats->lastTimeDiffs[stats->numCpus * d + c] = timeDiff;
                     rt = CpuStatsAddUsage(stats, c, (CpuStatsUsage_t) timeDiff);
                     check(rt == 0, "failed to add cpu usage");
                     rt = CpuStatsAddDomainUsage(stats, d, (CpuStatsUsage_t) timeDiff);
@@ -267,11 +676,22 @@ int updateStats(CpuStats *stats, GuestList *guests, int timeInterval)
                 }
             }
         }
+        // the emulator and iothreads used the domain's cpu time that its vcpus did not
+        overheadTime = cpuTime > vcpuTime ? cpuTime - vcpuTime : 0;
+        timeDiff = stats->overheadTimes[d] > 0 && overheadTime >= stats->overheadTimes[d] ?
+            overheadTime - stats->overheadTimes[d] : 0;
+        stats->lastOverheadDiffs[d] = timeDiff / (stats->sampleAges[d] + 1);
+        stats->overheadTimes[d] = overheadTime;
+        stats->sampleAges[d] = 0;
     }
 
     rt = CpuStatsUsagesToPct(stats, timeInterval);
     check(rt == 0, "failed to update usages");
 
+    if (timeInterval > 0) {
+        CpuStatsUpdateHotDomains(stats);
+    }
+
     rt = 0;
     goto final;
 
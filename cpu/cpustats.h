@@ -3,11 +3,21 @@
 
 #include "check.h"
 #include "guestlist.h"
+#include "introspect.h"
 
 typedef long double CpuStatsUsage_t;
 typedef unsigned long long CpuStatsTime_t;
 typedef long double CpuStatsWeight_t;
 
+// number of libvirt calls needed to sample a domain
+#define RPCS_PER_SAMPLE 2
+// change in domain usage between two samples above which a domain is hot
+#define HOT_USAGE_CHANGE 0.1
+// share of the time a domain's vcpus wait for a cpu above which the domain is queuing
+#define QUEUING_WAIT 0.05
+// cycles after which the wait times are requested again when the hypervisor failed to report them
+#define WAIT_RETRY_CYCLES 30
+
 typedef struct CpuStats {
     int numCpus;
     int numDomains;
@@ -16,6 +26,70 @@ typedef struct CpuStats {
     CpuStatsWeight_t *cpuWeights;
     CpuStatsTime_t *times;
     unsigned char *cpuMaps;
+    /**
+     * cpu time each domain used on each cpu in its last sampled cycle,
+     * reused for the cycles in which the domain is not sampled
+     */
+    CpuStatsTime_t *lastTimeDiffs;
+    CpuStatsUsage_t *prevDomainUsages;
+    /**
+     * hot domains are sampled every cycle, the others share the sample budget
+     */
+    int *hot;
+    int *sampled;
+    /**
+     * number of cycles since each domain was last sampled
+     */
+    int *sampleAges;
+    /**
+     * maximum number of libvirt calls used to sample stable domains each cycle, 0 for no limit
+     */
+    int sampleBudget;
+    int nextStable;
+    /**
+     * usage of each domain at its highest short-window sample since the last cycle, i.e. its cycle usage
+     * plus how far the fast sampler saw it go above, 0 for domains the fast sampler does not watch.
+     * Kept apart from the cycle usage, which hot detection and the state file read
+     */
+    CpuStatsUsage_t *burstUsages;
+    /**
+     * whether the short-window usage of each domain went well above its cycle usage
+     */
+    int *bursting;
+    /**
+     * cpu time used by each domain's emulator and iothreads, i.e. its cpu time minus its vcpu time:
+     * cumulative counter, time used in the domain's last sampled cycle and usage in the last cycle
+     */
+    CpuStatsTime_t *overheadTimes;
+    CpuStatsTime_t *lastOverheadDiffs;
+    CpuStatsUsage_t *overheadUsages;
+    /**
+     * whether the usage of the emulator and iothreads is added to each domain's usage,
+     * when they run on the same cpus as the domain's vcpus
+     */
+    int includeOverhead;
+    /**
+     * cpus each domain's emulator and iothreads are pinned to, 0 while they are not managed
+     */
+    unsigned char *threadMaps;
+    /**
+     * time each domain's vcpus spent runnable but waiting for a cpu (vcpu.N.wait in the bulk stats):
+     * cumulative counter, time waited in the domain's last sampled cycle and share of the last cycle
+     * spent waiting. The usage of a domain is its demand, the time it used plus the time it waited
+     */
+    CpuStatsTime_t *waitTimes;
+    CpuStatsTime_t *lastWaitDiffs;
+    CpuStatsUsage_t *waitUsages;
+    /**
+     * number of vcpus of each domain, 0 if unknown, a domain's demand cannot exceed it
+     */
+    int *numVcpus;
+    /**
+     * wait of the domains pinned to each cpu, a cpu is queuing when its domains wait for it
+     */
+    CpuStatsUsage_t *cpuWaits;
+    // cycles left before the vcpu wait times are requested again, 0 while the hypervisor reports them
+    int waitRetryIn;
 } CpuStats;
 
 #define CpuStatsCheckStatsArg(stats) check(stats, "stats is null")
@@ -28,14 +102,22 @@ typedef struct CpuStats {
 
 #define CpuStatsGetUsage(stats, cpu) ((stats)->usages[(cpu)])
 #define CpuStatsGetCpuWeight(stats, cpu) ((stats)->cpuWeights[(cpu)])
+#define CpuStatsGetSampleAge(stats, domain) ((stats)->sampleAges[(domain)])
+// usage the placement makes room for: the burst usage of a bursting domain, its cycle usage otherwise
+#define CpuStatsGetDemand(stats, domain) ((stats)->bursting[(domain)] && \
+    (stats)->burstUsages[(domain)] > (stats)->domainUsages[(domain)] ? \
+    (stats)->burstUsages[(domain)] : (stats)->domainUsages[(domain)])
+#define CpuStatsIsQueuing(stats, domain) ((stats)->waitUsages[(domain)] > QUEUING_WAIT)
+#define CpuStatsIsCpuQueuing(stats, cpu) ((stats)->cpuWaits[(cpu)] > QUEUING_WAIT)
 
 /**
  * creates cpu stats object
  * @param cpus number of cpus
  * @param domains number of domains
+ * @param sampleBudget maximum number of libvirt calls used to sample stable domains each cycle, 0 for no limit
  * @return pointer to stats object. Created object should be freed using CpuStatsFree()
  */
-CpuStats *CpuStatsCreate(int cpus, int domains);
+CpuStats *CpuStatsCreate(int cpus, int domains, int sampleBudget);
 void CpuStatsFree(CpuStats *);
 int CpuStatsSetTime(CpuStats *stats, int cpu, int domain, CpuStatsTime_t time);
 int CpuStatsGetTime(CpuStats *stats, int cpu, int domain, CpuStatsTime_t *timePtr);
@@ -44,9 +126,23 @@ int CpuStatsAddUsage(CpuStats *stats, int cpu, CpuStatsUsage_t usage);
 int CpuStatsAddDomainUsage(CpuStats *stats, int domain, CpuStatsUsage_t usage);
 int CpuStatsCountDomainsOnCpu(CpuStats *stats, int cpu);
 CpuStatsWeight_t CpuStatsCountDomainWeightOnCpu(CpuStats *stats, int cpu);
+/**
+ * @return whether a queuing domain would wait less on the cpus of `cpumask` than on the cpus it is pinned to:
+ * the other domains there must queue less by more than QUEUING_WAIT, so that a domain queuing on its own vcpus
+ * or on an evenly oversubscribed host is not moved every cycle
+ */
+int CpuStatsQueuesLessOn(CpuStats *stats, int domain, unsigned char cpumask);
 int CpuStatsUsagesToPct(CpuStats *stats, double timeInterval);
 int CpuStatsPrint(CpuStats *stats);
+/**
+ * renders the stats as JSON and as prometheus gauges in the introspection snapshot
+ */
+int CpuStatsRender(CpuStats *stats, Introspect *introspect);
 int CpuStatsUpdateCpuMaps(CpuStats *stats, GuestList *guests);
-int updateStats(CpuStats *stats, GuestList *guests, int timeInterval);
+/**
+ * samples the domains' cpu time and computes usages over the last `timeInterval` seconds,
+ * a non-positive interval only records the cpu time counters of the domains
+ */
+int updateStats(CpuStats *stats, GuestList *guests, double timeInterval);
 
 #endif
@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libvirt/libvirt.h>
+#include "check.h"
+#include "util.h"
+#include "log.h"
+#include "metrics.h"
+#include "fastpath.h"
+
+CpuStatsTime_t FastPathNanoseconds(MetricsTime time)
+{
+    return (CpuStatsTime_t) time.tv_sec * 1000000000ULL + (CpuStatsTime_t) time.tv_nsec;
+}
+
+int FastPathIsRunning(FastPath *fastPath)
+{
+    int running = 0;
+    pthread_mutex_lock(&fastPath->lock);
+    running = fastPath->running;
+    pthread_mutex_unlock(&fastPath->lock);
+    return running;
+}
+
+/**
+ * samples the cpu time of a watched domain
+ * @return usage of the domain since its last sample (in cpus), -1 if it is not known yet
+ */
+CpuStatsUsage_t FastPathSampleDomain(FastPath *fastPath, int d)
+{
+    int rt = 0;
+    virDomainInfo info;
+    CpuStatsTime_t now = 0;
+    CpuStatsUsage_t usage = -1;
+
+    rt = virDomainGetInfo(GuestListDomainAt(fastPath->guests, d), &info);
+    MetricsCountRpc(METRICS_RPC_COLLECT, rt < 0);
+    if (rt < 0) {
+        return -1;
+    }
+    now = FastPathNanoseconds(MetricsNow());
+    if (fastPath->lastSampleTimes[d] > 0 && now > fastPath->lastSampleTimes[d] &&
+        info.cpuTime >= fastPath->lastTimes[d]) {
+        usage = (CpuStatsUsage_t) (info.cpuTime - fastPath->lastTimes[d]) / (now - fastPath->lastSampleTimes[d]);
+    }
+    fastPath->lastTimes[d] = info.cpuTime;
+    fastPath->lastSampleTimes[d] = now;
+
+    return usage;
+}
+
+/**
+ * @return the most loaded cpu if it is saturated and the others have room to take some of its load, -1 otherwise
+ */
+int FastPathFindSaturatedCpu(FastPath *fastPath, CpuStatsUsage_t *current)
+{
+    CpuStatsUsage_t loads[8 * sizeof(unsigned char)];
+    CpuStatsUsage_t total = 0;
+    int numPinned = 0;
+    int cpu = 0;
+
+    memset(loads, 0, sizeof(loads));
+    for (int d = 0; d < fastPath->numDomains; d++) {
+        numPinned = countOnBits(fastPath->cpuMaps[d], fastPath->numCpus);
+        for (int c = 0; c < fastPath->numCpus && numPinned > 0; c++) {
+            if (isPinnedToCpu(fastPath->cpuMaps[d], getCpuMask(c))) {
+                loads[c] += current[d] / numPinned;
+            }
+        }
+    }
+    for (int c = 0; c < fastPath->numCpus; c++) {
+        total += loads[c];
+        if (loads[c] > loads[cpu]) {
+            cpu = c;
+        }
+    }
+    if (loads[cpu] > FASTPATH_SATURATION && total < FASTPATH_SATURATION * fastPath->numCpus) {
+        return cpu;
+    }
+    return -1;
+}
+
+/**
+ * samples the watched domains and checks whether their bursts saturate a cpu
+ */
+void FastPathSample(FastPath *fastPath, CpuStatsUsage_t *current)
+{
+    CpuStatsUsage_t usage = 0;
+    int cpu = -1;
+    MetricsTime now;
+
+    // the domains are sampled without holding the lock, the scheduler only waits on it for copies
+    for (int d = 0; d < fastPath->numDomains; d++) {
+        current[d] = -1;
+        pthread_mutex_lock(&fastPath->lock);
+        if (!fastPath->watched[d]) {
+            current[d] = fastPath->usages[d];
+            fastPath->lastSampleTimes[d] = 0;
+        }
+        pthread_mutex_unlock(&fastPath->lock);
+        if (current[d] < 0) {
+            usage = FastPathSampleDomain(fastPath, d);
+            current[d] = usage;
+        }
+    }
+
+    pthread_mutex_lock(&fastPath->lock);
+    for (int d = 0; d < fastPath->numDomains; d++) {
+        if (current[d] < 0) {
+            // watched domain without a usage yet
+            current[d] = fastPath->usages[d];
+        }
+        else if (fastPath->watched[d]) {
+            fastPath->peaks[d] = max(fastPath->peaks[d], current[d]);
+        }
+    }
+    now = MetricsNow();
+    if (fastPath->saturatedCpu < 0 &&
+        FastPathNanoseconds(now) - FastPathNanoseconds(fastPath->watchTime) >= FASTPATH_COOLDOWN_MS * 1000000ULL) {
+        cpu = FastPathFindSaturatedCpu(fastPath, current);
+        if (cpu >= 0) {
+            fastPath->saturatedCpu = cpu;
+            fastPath->numRebalances += 1;
+        }
+    }
+    pthread_mutex_unlock(&fastPath->lock);
+}
+
+void *FastPathRun(void *arg)
+{
+    FastPath *fastPath = (FastPath *) arg;
+    CpuStatsUsage_t *current = NULL;
+    struct timespec interval;
+
+    MetricsSetSource(fastPath->metricsSource, NULL);
+    interval.tv_sec = fastPath->intervalMs / 1000;
+    interval.tv_nsec = (fastPath->intervalMs % 1000) * 1000000L;
+    current = calloc(fastPath->numDomains, sizeof(CpuStatsUsage_t));
+    check(current, "failed to allocate fast path usages");
+
+    while (FastPathIsRunning(fastPath)) {
+        nanosleep(&interval, NULL);
+        FastPathSample(fastPath, current);
+    }
+
+error:
+    free(current);
+    return NULL;
+}
+
+FastPath *FastPathCreate(GuestList *guests, int numCpus, int intervalMs, int topK)
+{
+    FastPath *fastPath = NULL;
+    int numDomains = 0;
+    checkNull(guests);
+    check(numCpus <= 8 * (int) sizeof(unsigned char), "too many cpus for the fast path");
+    check(intervalMs > 0, "fast path interval should be positive");
+
+    numDomains = guests->count;
+    fastPath = calloc(1, sizeof(FastPath));
+    checkMemAlloc(fastPath);
+    fastPath->guests = guests;
+    fastPath->numCpus = numCpus;
+    fastPath->numDomains = numDomains;
+    fastPath->intervalMs = intervalMs;
+    fastPath->topK = topK;
+    fastPath->saturatedCpu = -1;
+    fastPath->watched = calloc(numDomains, sizeof(int));
+    checkMemAlloc(fastPath->watched);
+    fastPath->cpuMaps = calloc(numDomains, sizeof(unsigned char));
+    checkMemAlloc(fastPath->cpuMaps);
+    fastPath->usages = calloc(numDomains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(fastPath->usages);
+    fastPath->peaks = calloc(numDomains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(fastPath->peaks);
+    fastPath->lastTimes = calloc(numDomains, sizeof(CpuStatsTime_t));
+    checkMemAlloc(fastPath->lastTimes);
+    fastPath->lastSampleTimes = calloc(numDomains, sizeof(CpuStatsTime_t));
+    checkMemAlloc(fastPath->lastSampleTimes);
+    check(pthread_mutex_init(&fastPath->lock, NULL) == 0, "failed to init fast path lock");
+
+    return fastPath;
+error:
+    if (fastPath) {
+        free(fastPath->watched);
+        free(fastPath->cpuMaps);
+        free(fastPath->usages);
+        free(fastPath->peaks);
+        free(fastPath->lastTimes);
+        free(fastPath->lastSampleTimes);
+        free(fastPath);
+    }
+    return NULL;
+}
+
+int FastPathStart(FastPath *fastPath)
+{
+    checkNull(fastPath);
+    fastPath->running = 1;
+    check(pthread_create(&fastPath->thread, NULL, FastPathRun, fastPath) == 0, "failed to start fast path thread");
+
+    return 0;
+error:
+    if (fastPath) {
+        fastPath->running = 0;
+    }
+    return -1;
+}
+
+void FastPathStop(FastPath *fastPath)
+{
+    if (!fastPath || !FastPathIsRunning(fastPath)) {
+        return;
+    }
+    pthread_mutex_lock(&fastPath->lock);
+    fastPath->running = 0;
+    pthread_mutex_unlock(&fastPath->lock);
+    pthread_join(fastPath->thread, NULL);
+}
+
+void FastPathFree(FastPath *fastPath)
+{
+    if (fastPath) {
+        FastPathStop(fastPath);
+        pthread_mutex_destroy(&fastPath->lock);
+        free(fastPath->watched);
+        free(fastPath->cpuMaps);
+        free(fastPath->usages);
+        free(fastPath->peaks);
+        free(fastPath->lastTimes);
+        free(fastPath->lastSampleTimes);
+        free(fastPath);
+    }
+}
+
+int FastPathWatch(FastPath *fastPath, CpuStats *stats)
+{
+    int best = 0;
+    CpuStatsUsage_t score = 0;
+    CpuStatsUsage_t bestScore = 0;
+    checkNull(fastPath);
+    checkNull(stats);
+
+    pthread_mutex_lock(&fastPath->lock);
+    memset(fastPath->watched, 0, fastPath->numDomains * sizeof(int));
+    // volatile (hot) domains first, then the busiest ones
+    for (int k = 0; k < fastPath->topK && k < fastPath->numDomains; k++) {
+        best = -1;
+        for (int d = 0; d < fastPath->numDomains; d++) {
+            score = stats->domainUsages[d] + (stats->hot[d] ? 1 : 0);
+            if (!fastPath->watched[d] && (best < 0 || score > bestScore)) {
+                best = d;
+                bestScore = score;
+            }
+        }
+        fastPath->watched[best] = 1;
+    }
+    memcpy(fastPath->cpuMaps, stats->cpuMaps, fastPath->numDomains * sizeof(unsigned char));
+    for (int d = 0; d < fastPath->numDomains; d++) {
+        // the sampler reads the cpu time of the whole domain, which never includes the wait
+        // and always the emulator and iothreads
+        fastPath->usages[d] = max(stats->domainUsages[d] - stats->waitUsages[d] +
+            (stats->includeOverhead ? 0 : stats->overheadUsages[d]), 0);
+    }
+    memset(fastPath->peaks, 0, fastPath->numDomains * sizeof(CpuStatsUsage_t));
+    fastPath->saturatedCpu = -1;
+    fastPath->watchTime = MetricsNow();
+    pthread_mutex_unlock(&fastPath->lock);
+
+    return 0;
+error:
+    return -1;
+}
+
+int FastPathRebalanceRequested(FastPath *fastPath)
+{
+    int cpu = -1;
+    pthread_mutex_lock(&fastPath->lock);
+    cpu = fastPath->saturatedCpu;
+    pthread_mutex_unlock(&fastPath->lock);
+    return cpu;
+}
+
+int FastPathDrain(FastPath *fastPath, CpuStats *stats)
+{
+    int numBursting = 0;
+    checkNull(fastPath);
+    checkNull(stats);
+
+    pthread_mutex_lock(&fastPath->lock);
+    for (int d = 0; d < fastPath->numDomains; d++) {
+        // the peaks and the cycle usages the sampler was given are measured alike, only their difference
+        // is carried over to the domain's usage
+        stats->burstUsages[d] = fastPath->watched[d] && fastPath->peaks[d] > 0 ?
+            max(stats->domainUsages[d] + fastPath->peaks[d] - fastPath->usages[d], 0) : 0;
+        stats->bursting[d] = fastPath->watched[d] &&
+            fastPath->peaks[d] > fastPath->usages[d] + FASTPATH_BURST_DELTA;
+        if (stats->bursting[d]) {
+            logInfo("domain %d bursts to %.2Lf%%, cycle usage %.2Lf%%",
+                d, 100 * stats->burstUsages[d], 100 * stats->domainUsages[d]);
+            numBursting += 1;
+        }
+    }
+    pthread_mutex_unlock(&fastPath->lock);
+
+    return numBursting;
+error:
+    return -1;
+}
@@ -0,0 +1,83 @@
+#ifndef fastpath_h
+#define fastpath_h
+
+#include <pthread.h>
+#include "cpustats.h"
+#include "guestlist.h"
+#include "metrics.h"
+
+// default period of the fast sampler and number of domains it watches
+#define FASTPATH_DEFAULT_INTERVAL_MS 200
+#define FASTPATH_DEFAULT_TOP_K 4
+// a watched domain bursts when its short-window usage exceeds its cycle usage by this much
+#define FASTPATH_BURST_DELTA 0.25
+// a cpu is saturated when the usage of the domains pinned to it exceeds this
+#define FASTPATH_SATURATION 0.95
+// minimum time between the last placement and an out-of-band rebalance
+#define FASTPATH_COOLDOWN_MS 1000
+
+/**
+ * background thread sampling the cpu time of the hottest domains every few hundred milliseconds,
+ * to detect bursts that the scheduler's cycle would average away. When a burst saturates a cpu,
+ * it asks the scheduler for an out-of-band rebalance
+ */
+typedef struct FastPath {
+    GuestList *guests;
+    int numCpus;
+    int numDomains;
+    int intervalMs;
+    int topK;
+    /**
+     * metrics source of the sampler's connection
+     */
+    int metricsSource;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int running;
+    /**
+     * placement and cycle usages of the last cycle, set by the scheduler with FastPathWatch(). The usages
+     * are the cpu time the domains consumed, overhead included and wait left out, as the sampler measures it
+     */
+    int *watched;
+    unsigned char *cpuMaps;
+    CpuStatsUsage_t *usages;
+    MetricsTime watchTime;
+    /**
+     * highest short-window usage of each watched domain since the last cycle
+     */
+    CpuStatsUsage_t *peaks;
+    /**
+     * cpu time and time of the last sample of each watched domain (in ns), only used by the sampler
+     */
+    CpuStatsTime_t *lastTimes;
+    CpuStatsTime_t *lastSampleTimes;
+    // cpu whose saturation requested a rebalance, -1 if none was requested
+    int saturatedCpu;
+    int numRebalances;
+} FastPath;
+
+/**
+ * @return fast path sampler, should be freed using FastPathFree()
+ */
+FastPath *FastPathCreate(GuestList *guests, int numCpus, int intervalMs, int topK);
+int FastPathStart(FastPath *fastPath);
+void FastPathStop(FastPath *fastPath);
+void FastPathFree(FastPath *fastPath);
+/**
+ * selects the `topK` hottest or most volatile domains to watch until the next cycle, and
+ * gives the sampler the current placement. Clears any pending rebalance request
+ */
+int FastPathWatch(FastPath *fastPath, CpuStats *stats);
+/**
+ * @return the saturated cpu if the sampler asked for an out-of-band rebalance, -1 otherwise
+ */
+int FastPathRebalanceRequested(FastPath *fastPath);
+/**
+ * records the bursts seen since the last cycle in `stats`. The burst usage of a bursting domain is its
+ * cycle usage raised by how far its peak short-window usage went above the cycle, the placement makes
+ * room for it while the cycle usage is left as measured
+ * @return number of bursting domains, -1 on error
+ */
+int FastPathDrain(FastPath *fastPath, CpuStats *stats);
+
+#endif
@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "check.h"
+#include "log.h"
+#include "housekeeping.h"
+
+int HousekeepingPinSelf(unsigned long cpus)
+{
+    cpu_set_t set;
+
+    if (cpus == 0) {
+        return 0;
+    }
+    CPU_ZERO(&set);
+    for (int c = 0; c < (int) (8 * sizeof(unsigned long)); c++) {
+        if ((cpus >> c) & 1UL) {
+            CPU_SET(c, &set);
+        }
+    }
+    check(sched_setaffinity(0, sizeof(cpu_set_t), &set) == 0, "failed to pin to the housekeeping cpus");
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * @return cpu time used by the calling thread (in seconds), the other threads of the process are not counted
+ */
+double HousekeepingCpuTime(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+void HousekeepingInit(Housekeeping *housekeeping, double budget)
+{
+    housekeeping->budget = budget;
+    housekeeping->usage = 0;
+    housekeeping->throttled = 0;
+    housekeeping->lastCpuTime = HousekeepingCpuTime();
+    clock_gettime(CLOCK_MONOTONIC, &housekeeping->lastTime);
+}
+
+double HousekeepingMeasure(Housekeeping *housekeeping)
+{
+    double cpuTime = 0;
+    double elapsed = 0;
+    struct timespec now;
+
+    checkNull(housekeeping);
+    cpuTime = HousekeepingCpuTime();
+    check(cpuTime >= 0, "failed to get the worker's cpu time");
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - housekeeping->lastTime.tv_sec) + (now.tv_nsec - housekeeping->lastTime.tv_nsec) / 1e9;
+    if (elapsed > 0) {
+        housekeeping->usage = (cpuTime - housekeeping->lastCpuTime) / elapsed;
+    }
+    housekeeping->lastCpuTime = cpuTime;
+    housekeeping->lastTime = now;
+
+    return housekeeping->usage;
+error:
+    return -1;
+}
+
+int HousekeepingThrottle(Housekeeping *housekeeping, int sampleBudget, int minBudget, int maxBudget)
+{
+    if (housekeeping->budget <= 0) {
+        return sampleBudget;
+    }
+    if (housekeeping->usage > housekeeping->budget && sampleBudget > minBudget) {
+        sampleBudget = sampleBudget / 2 > minBudget ? sampleBudget / 2 : minBudget;
+        housekeeping->throttled = 1;
+        logWarn("using %.1f%% cpu, above the %.1f%% budget, sampling budget reduced to %d calls",
+            100 * housekeeping->usage, 100 * housekeeping->budget, sampleBudget);
+    }
+    else if (housekeeping->throttled && housekeeping->usage < housekeeping->budget / 2) {
+        sampleBudget = 2 * sampleBudget < maxBudget ? 2 * sampleBudget : maxBudget;
+        housekeeping->throttled = sampleBudget < maxBudget;
+        logInfo("using %.1f%% cpu, sampling budget raised to %d calls", 100 * housekeeping->usage, sampleBudget);
+    }
+    return sampleBudget;
+}
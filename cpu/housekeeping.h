@@ -0,0 +1,46 @@
+#ifndef housekeeping_h
+#define housekeeping_h
+
+#include <time.h>
+
+/**
+ * cpu time used by a worker thread, measured with getrusage, and the budget it should stay within
+ */
+typedef struct Housekeeping {
+    /**
+     * share of one cpu the worker may use, 0 for no budget
+     */
+    double budget;
+    /**
+     * usage of the worker thread (in cpus) between the last two measures
+     */
+    double usage;
+    // whether sampling is currently reduced to stay within the budget
+    int throttled;
+    double lastCpuTime;
+    struct timespec lastTime;
+} Housekeeping;
+
+/**
+ * pins the calling thread to the housekeeping cpus, threads created afterwards inherit
+ * the affinity, so it should be called before any other thread is started
+ * @param cpus bit mask of the housekeeping cpus, 0 to leave the affinity unchanged
+ */
+int HousekeepingPinSelf(unsigned long cpus);
+/**
+ * should be called from the worker thread, whose cpu time is measured
+ */
+void HousekeepingInit(Housekeeping *housekeeping, double budget);
+/**
+ * measures the cpu usage of the calling worker thread since the last measure
+ * @return usage in cpus, -1 on error
+ */
+double HousekeepingMeasure(Housekeeping *housekeeping);
+/**
+ * halves the sample budget while the worker uses more than its cpu budget, and doubles it
+ * back, up to `maxBudget`, once it uses less than half of it
+ * @return sample budget to use in the next cycle, between `minBudget` and `maxBudget`
+ */
+int HousekeepingThrottle(Housekeeping *housekeeping, int sampleBudget, int minBudget, int maxBudget);
+
+#endif
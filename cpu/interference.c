@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <math.h>
+#include "check.h"
+#include "util.h"
+#include "log.h"
+#include "interference.h"
+
+Interference *InterferenceCreate(int numDomains)
+{
+    Interference *inter = calloc(1, sizeof(Interference));
+    checkMemAlloc(inter);
+    inter->numDomains = numDomains;
+    inter->achieved = calloc(numDomains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(inter->achieved);
+    inter->slowdowns = calloc(numDomains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(inter->slowdowns);
+    inter->together = calloc(numDomains * numDomains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(inter->together);
+    inter->apart = calloc(numDomains * numDomains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(inter->apart);
+    inter->coCycles = calloc(numDomains * numDomains, sizeof(int));
+    checkMemAlloc(inter->coCycles);
+    inter->apartCycles = calloc(numDomains * numDomains, sizeof(int));
+    checkMemAlloc(inter->apartCycles);
+    inter->scores = calloc(numDomains * numDomains, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(inter->scores);
+
+    return inter;
+error:
+    InterferenceFree(inter);
+    return NULL;
+}
+
+void InterferenceFree(Interference *inter)
+{
+    if (inter) {
+        if (inter->achieved) {
+            free(inter->achieved);
+        }
+        if (inter->slowdowns) {
+            free(inter->slowdowns);
+        }
+        if (inter->together) {
+            free(inter->together);
+        }
+        if (inter->apart) {
+            free(inter->apart);
+        }
+        if (inter->coCycles) {
+            free(inter->coCycles);
+        }
+        if (inter->apartCycles) {
+            free(inter->apartCycles);
+        }
+        if (inter->scores) {
+            free(inter->scores);
+        }
+        free(inter);
+    }
+}
+
+/**
+ * updates the slowdown of the domain from the cpu time it achieved in this cycle. A drop only counts as
+ * far as the domain waited for a cpu, a domain that went idle did not wait and is not slowed down
+ * @return whether the domain was busy enough, and its wait known, for its slowdown to be recorded
+ */
+int InterferenceUpdateSlowdown(Interference *inter, CpuStats *stats, int d)
+{
+    CpuStatsUsage_t achieved = stats->domainUsages[d] - stats->waitUsages[d];
+    CpuStatsUsage_t average = inter->achieved[d];
+    CpuStatsUsage_t waitShare = 0;
+
+    if (average <= 0) {
+        inter->achieved[d] = achieved;
+        return 0;
+    }
+    inter->achieved[d] = (1 - INTERFERENCE_SMOOTHING) * average + INTERFERENCE_SMOOTHING * achieved;
+    if (average < INTERFERENCE_MIN_USAGE || stats->waitRetryIn > 0) {
+        return 0;
+    }
+    waitShare = stats->domainUsages[d] > 0 ? stats->waitUsages[d] / stats->domainUsages[d] : 0;
+    inter->slowdowns[d] = fminl(waitShare, fmaxl(0, (average - achieved) / average));
+    return 1;
+}
+
+/**
+ * adds the slowdown of domain `a` in this cycle to its average with or without domain `b`
+ */
+void InterferenceRecordPair(Interference *inter, int a, int b, int colocated)
+{
+    int pair = InterferencePair(inter, a, b);
+    CpuStatsUsage_t *average = colocated ? inter->together + pair : inter->apart + pair;
+    int *cycles = colocated ? inter->coCycles + pair : inter->apartCycles + pair;
+
+    *average = *cycles == 0 ? inter->slowdowns[a] :
+        (1 - INTERFERENCE_SMOOTHING) * *average + INTERFERENCE_SMOOTHING * inter->slowdowns[a];
+    *cycles += 1;
+}
+
+/**
+ * @return extra slowdown of domain `a` when it shares a cpu with domain `b`
+ */
+CpuStatsUsage_t InterferenceExcess(Interference *inter, int a, int b)
+{
+    int pair = InterferencePair(inter, a, b);
+    CpuStatsUsage_t apart = inter->apartCycles[pair] >= INTERFERENCE_MIN_CYCLES ? inter->apart[pair] : 0;
+    return inter->together[pair] - apart;
+}
+
+int InterferenceUpdate(Interference *inter, CpuStats *stats)
+{
+    int *recorded = NULL;
+    int n = 0;
+    int colocated = 0;
+
+    checkNull(inter);
+    checkNull(stats);
+    n = min(inter->numDomains, stats->numDomains);
+    recorded = calloc(n, sizeof(int));
+    checkMemAlloc(recorded);
+
+    for (int d = 0; d < n; d++) {
+        // domains not sampled in this cycle only have the usage of their last sample
+        recorded[d] = stats->sampled[d] && InterferenceUpdateSlowdown(inter, stats, d);
+    }
+
+    for (int a = 0; a < n; a++) {
+        for (int b = a + 1; b < n && recorded[a]; b++) {
+            if (!recorded[b]) {
+                continue;
+            }
+            colocated = (stats->cpuMaps[a] & stats->cpuMaps[b]) != 0;
+            InterferenceRecordPair(inter, a, b, colocated);
+            InterferenceRecordPair(inter, b, a, colocated);
+            if (InterferenceCoCycles(inter, a, b) > 0) {
+                InterferenceRawScore(inter, a, b) = (InterferenceExcess(inter, a, b) + InterferenceExcess(inter, b, a)) / 2;
+                InterferenceRawScore(inter, b, a) = InterferenceRawScore(inter, a, b);
+            }
+        }
+    }
+
+    free(recorded);
+    return 0;
+error:
+    return -1;
+}
+
+CpuStatsUsage_t InterferenceScore(Interference *inter, int a, int b)
+{
+    if (!inter || a == b || a >= inter->numDomains || b >= inter->numDomains ||
+        InterferenceCoCycles(inter, a, b) < INTERFERENCE_MIN_CYCLES) {
+        return 0;
+    }
+    return InterferenceRawScore(inter, a, b) > INTERFERENCE_THRESHOLD ? InterferenceRawScore(inter, a, b) : 0;
+}
+
+CpuStatsUsage_t InterferenceOnCpus(Interference *inter, unsigned char *cpuMaps, int d, unsigned char cpumask)
+{
+    CpuStatsUsage_t total = 0;
+
+    if (!inter) {
+        return 0;
+    }
+    for (int o = 0; o < inter->numDomains; o++) {
+        if (o != d && (cpuMaps[o] & cpumask) != 0) {
+            total += InterferenceScore(inter, d, o);
+        }
+    }
+    return total;
+}
+
+int InterferenceCountColocated(Interference *inter, unsigned char *cpuMaps)
+{
+    int count = 0;
+
+    if (!inter) {
+        return 0;
+    }
+    for (int a = 0; a < inter->numDomains; a++) {
+        for (int b = a + 1; b < inter->numDomains; b++) {
+            count += (cpuMaps[a] & cpuMaps[b]) != 0 && InterferenceScore(inter, a, b) > 0;
+        }
+    }
+    return count;
+}
+
+int InterferenceRender(Interference *inter, unsigned char *cpuMaps, Introspect *introspect)
+{
+    int rt = 0;
+    int first = 1;
+    checkNull(inter);
+    checkNull(introspect);
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "[");
+    for (int a = 0; a < inter->numDomains; a++) {
+        for (int b = a + 1; b < inter->numDomains; b++) {
+            if (InterferenceScore(inter, a, b) <= 0) {
+                continue;
+            }
+            rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN,
+                "%s{\"domains\":[%d,%d],\"score\":%.4Lf,\"cycles\":%d,\"colocated\":%d}",
+                first ? "" : ",", a, b, InterferenceRawScore(inter, a, b), InterferenceCoCycles(inter, a, b),
+                (cpuMaps[a] & cpuMaps[b]) != 0);
+            first = 0;
+        }
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "]");
+    check(rt == 0, "failed to render noisy neighbours");
+
+    return 0;
+error:
+    return -1;
+}
@@ -0,0 +1,78 @@
+#ifndef interference_h
+#define interference_h
+
+#include "cpustats.h"
+#include "introspect.h"
+
+// weight of the last cycle in the moving averages of the domains' usage and slowdown
+#define INTERFERENCE_SMOOTHING 0.2
+// domains using less than this are too idle for their slowdown to mean anything
+#define INTERFERENCE_MIN_USAGE 0.05
+// number of cycles two domains have to share a cpu before their score is trusted
+#define INTERFERENCE_MIN_CYCLES 5
+// excess slowdown of two co-located domains above which they are noisy neighbours
+#define INTERFERENCE_THRESHOLD 0.1
+// weight a noisy neighbour takes off the room of a cpu when placing a domain, per unit of score
+#define INTERFERENCE_PENALTY 1.0
+
+/**
+ * co-location history of the domains. Each cycle, the slowdown of a domain is how far its achieved
+ * cpu time fell below its moving average, up to the share of its demand it spent waiting for a cpu.
+ * For each pair of domains, the slowdown of each one is averaged separately over the cycles they
+ * shared a cpu and the cycles they did not: the score of the pair is the
+ * extra slowdown they show together, or their slowdown together until they were seen apart. Pairs whose
+ * score stays above the threshold are noisy neighbours, kept apart by the scheduler when it can
+ */
+typedef struct Interference {
+    int numDomains;
+    /**
+     * moving average of the cpu time each domain achieved, its usage without the time it waited
+     */
+    CpuStatsUsage_t *achieved;
+    // slowdown of each domain in the last cycle
+    CpuStatsUsage_t *slowdowns;
+    /**
+     * per ordered pair of domains (a, b), moving average of the slowdown of a in the cycles it shared
+     * a cpu with b and in the cycles it did not, and the number of cycles of each
+     */
+    CpuStatsUsage_t *together;
+    CpuStatsUsage_t *apart;
+    int *coCycles;
+    int *apartCycles;
+    // interference score of each pair of domains
+    CpuStatsUsage_t *scores;
+} Interference;
+
+#define InterferencePair(inter, a, b) ((a) * (inter)->numDomains + (b))
+#define InterferenceCoCycles(inter, a, b) ((inter)->coCycles[InterferencePair(inter, a, b)])
+#define InterferenceRawScore(inter, a, b) ((inter)->scores[InterferencePair(inter, a, b)])
+
+/**
+ * @return co-location history, should be freed with InterferenceFree()
+ */
+Interference *InterferenceCreate(int numDomains);
+void InterferenceFree(Interference *inter);
+/**
+ * records the slowdown of the domains sampled in this cycle against the domains they shared a cpu with,
+ * to be called once per cycle after the stats are updated, while they still hold the maps of the cycle
+ */
+int InterferenceUpdate(Interference *inter, CpuStats *stats);
+/**
+ * @return interference score of the two domains, 0 until they shared a cpu for enough cycles
+ */
+CpuStatsUsage_t InterferenceScore(Interference *inter, int a, int b);
+/**
+ * @return sum of the scores of domain `d` with the noisy neighbours placed on the cpus of `cpumask`
+ * according to `cpuMaps`
+ */
+CpuStatsUsage_t InterferenceOnCpus(Interference *inter, unsigned char *cpuMaps, int d, unsigned char cpumask);
+/**
+ * @return number of pairs of noisy neighbours sharing a cpu in `cpuMaps`
+ */
+int InterferenceCountColocated(Interference *inter, unsigned char *cpuMaps);
+/**
+ * renders the noisy neighbours as a JSON array in the plan section of the introspection snapshot
+ */
+int InterferenceRender(Interference *inter, unsigned char *cpuMaps, Introspect *introspect);
+
+#endif
@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "check.h"
+#include "log.h"
+
+#define LOG_QUEUE_MASK (LOG_QUEUE_SIZE - 1)
+
+typedef struct LogRecord {
+    struct timespec time;
+    LogLevel level;
+    char message[LOG_MESSAGE_LENGTH];
+} LogRecord;
+
+typedef struct LogQueue {
+    LogRecord records[LOG_QUEUE_SIZE];
+    // next slot written by the producer
+    atomic_uint head;
+    // next slot read by the writer thread
+    atomic_uint tail;
+    // name of the producer, added to its records
+    const char *name;
+} LogQueue;
+
+// each producer thread has its own queue, so that no lock is shared between producers
+static LogQueue *_Atomic queues[LOG_MAX_QUEUES];
+static atomic_int numQueues;
+static _Thread_local LogQueue *queue = NULL;
+static atomic_ulong dropped;
+static atomic_ulong totalDropped;
+static atomic_int running;
+static atomic_int level = LOG_INFO;
+static LogFormat format = LOG_FORMAT_TEXT;
+static FILE *output = NULL;
+static pthread_t writer;
+
+static const char *levelNames[] = {"error", "warn", "info", "debug"};
+
+void LogWriteJsonString(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (; *str; str++) {
+        switch (*str) {
+            case '"':
+                fputs("\\\"", file);
+                break;
+            case '\\':
+                fputs("\\\\", file);
+                break;
+            case '\n':
+                fputs("\\n", file);
+                break;
+            case '\t':
+                fputs("\\t", file);
+                break;
+            default:
+                if ((unsigned char) *str < 0x20) {
+                    fprintf(file, "\\u%04x", *str);
+                }
+                else {
+                    fputc(*str, file);
+                }
+        }
+    }
+    fputc('"', file);
+}
+
+void LogWriteRecord(FILE *file, LogRecord *record, const char *name)
+{
+    double time = record->time.tv_sec + record->time.tv_nsec / 1e9;
+    if (format == LOG_FORMAT_JSON) {
+        fprintf(file, "{\"ts\":%.3f,\"level\":\"%s\",", time, levelNames[record->level]);
+        if (name) {
+            fputs("\"src\":", file);
+            LogWriteJsonString(file, name);
+            fputc(',', file);
+        }
+        fputs("\"msg\":", file);
+        LogWriteJsonString(file, record->message);
+        fputs("}\n", file);
+    }
+    else if (name) {
+        fprintf(file, "%.3f %s [%s] %s\n", time, levelNames[record->level], name, record->message);
+    }
+    else {
+        fprintf(file, "%.3f %s %s\n", time, levelNames[record->level], record->message);
+    }
+}
+
+/**
+ * writes all the records queued so far
+ * @return number of records written
+ */
+int LogFlush(void)
+{
+    LogQueue *q = NULL;
+    unsigned int t = 0;
+    unsigned int h = 0;
+    unsigned long numDropped = 0;
+    LogRecord record;
+    int written = 0;
+    int n = atomic_load(&numQueues);
+
+    flockfile(output);
+    for (int i = 0; i < n && i < LOG_MAX_QUEUES; i++) {
+        // the slot may be reserved but not filled yet
+        q = atomic_load(queues + i);
+        if (!q) {
+            continue;
+        }
+        t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        h = atomic_load_explicit(&q->head, memory_order_acquire);
+        for (; t != h; t++) {
+            LogWriteRecord(output, q->records + (t & LOG_QUEUE_MASK), q->name);
+            written += 1;
+        }
+        atomic_store_explicit(&q->tail, t, memory_order_release);
+    }
+
+    numDropped = atomic_exchange(&dropped, 0);
+    if (numDropped > 0) {
+        clock_gettime(CLOCK_REALTIME, &record.time);
+        record.level = LOG_WARN;
+        snprintf(record.message, LOG_MESSAGE_LENGTH, "log queue full, dropped %lu records", numDropped);
+        LogWriteRecord(output, &record, NULL);
+        written += 1;
+    }
+
+    if (written > 0) {
+        fflush(output);
+    }
+    funlockfile(output);
+    return written;
+}
+
+void *LogRun(void *arg __attribute__((unused)))
+{
+    struct timespec interval;
+    interval.tv_sec = 0;
+    interval.tv_nsec = LOG_WRITER_SLEEP_MS * 1000000L;
+
+    while (atomic_load(&running)) {
+        if (LogFlush() == 0) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    LogFlush();
+
+    return NULL;
+}
+
+int LogStart(FILE *file, LogLevel logLevel, LogFormat logFormat)
+{
+    checkNull(file);
+    check(!atomic_load(&running), "logging already started");
+    output = file;
+    format = logFormat;
+    atomic_store(&level, logLevel);
+    check(LogAttachThread(NULL) == 0, "failed to create log queue");
+    atomic_store(&running, 1);
+    check(pthread_create(&writer, NULL, LogRun, NULL) == 0, "failed to start log writer thread");
+
+    return 0;
+error:
+    atomic_store(&running, 0);
+    return -1;
+}
+
+int LogAttachThread(const char *name)
+{
+    int slot = 0;
+
+    if (queue) {
+        return 0;
+    }
+    slot = atomic_fetch_add(&numQueues, 1);
+    check(slot < LOG_MAX_QUEUES, "too many log producer threads");
+    queue = calloc(1, sizeof(LogQueue));
+    checkMemAlloc(queue);
+    queue->name = name;
+    atomic_store(queues + slot, queue);
+
+    return 0;
+error:
+    return -1;
+}
+
+void LogStop(void)
+{
+    LogQueue *q = NULL;
+
+    if (!atomic_exchange(&running, 0)) {
+        return;
+    }
+    pthread_join(writer, NULL);
+    // producers are expected to have stopped
+    for (int i = 0; i < LOG_MAX_QUEUES; i++) {
+        q = atomic_exchange(queues + i, NULL);
+        if (q) {
+            free(q);
+        }
+    }
+    atomic_store(&numQueues, 0);
+    queue = NULL;
+}
+
+void LogSetLevel(LogLevel logLevel)
+{
+    atomic_store(&level, logLevel);
+}
+
+int LogIsEnabled(LogLevel logLevel)
+{
+    return (int) logLevel <= atomic_load_explicit(&level, memory_order_relaxed);
+}
+
+int LogParseLevel(const char *name)
+{
+    for (int i = LOG_ERROR; i <= LOG_DEBUG; i++) {
+        if (strcmp(name, levelNames[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+unsigned long LogDropped(void)
+{
+    return atomic_load(&totalDropped);
+}
+
+void LogWrite(LogLevel logLevel, const char *fmt, ...)
+{
+    va_list args;
+    LogRecord *record = NULL;
+    unsigned int h = 0;
+
+    if (!LogIsEnabled(logLevel)) {
+        return;
+    }
+
+    va_start(args, fmt);
+    if (!atomic_load_explicit(&running, memory_order_relaxed) || !queue) {
+        // threads without a queue write synchronously
+        flockfile(stdout);
+        vprintf(fmt, args);
+        putchar('\n');
+        funlockfile(stdout);
+        va_end(args);
+        return;
+    }
+
+    h = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (h - atomic_load_explicit(&queue->tail, memory_order_acquire) >= LOG_QUEUE_SIZE) {
+        atomic_fetch_add(&dropped, 1);
+        atomic_fetch_add(&totalDropped, 1);
+        va_end(args);
+        return;
+    }
+
+    record = queue->records + (h & LOG_QUEUE_MASK);
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->level = logLevel;
+    vsnprintf(record->message, LOG_MESSAGE_LENGTH, fmt, args);
+    va_end(args);
+    atomic_store_explicit(&queue->head, h + 1, memory_order_release);
+}
@@ -0,0 +1,62 @@
+#ifndef log_h
+#define log_h
+
+#include <stdio.h>
+
+// number of records the queue can hold, must be a power of 2
+#define LOG_QUEUE_SIZE 4096
+#define LOG_MESSAGE_LENGTH 256
+// maximum number of threads with their own log queue
+#define LOG_MAX_QUEUES 64
+// how long the writer thread sleeps when the queue is empty
+#define LOG_WRITER_SLEEP_MS 10
+
+typedef enum LogLevel {
+    LOG_ERROR = 0,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG
+} LogLevel;
+
+typedef enum LogFormat {
+    LOG_FORMAT_TEXT = 0,
+    LOG_FORMAT_JSON
+} LogFormat;
+
+/**
+ * starts the background thread that writes log records to `output`.
+ * Records are queued in lock-free single-producer single-consumer queues, one for each thread
+ * attached with LogAttachThread() (the calling thread is attached by LogStart()). Records are
+ * dropped (and counted) when a queue is full so that logging never blocks a control loop.
+ * Before LogStart() is called, or from threads that are not attached, records at or below
+ * `level` are written synchronously to stdout
+ */
+int LogStart(FILE *output, LogLevel level, LogFormat format);
+/**
+ * gives the calling thread its own log queue
+ * @param name added to the thread's records, NULL for none
+ */
+int LogAttachThread(const char *name);
+/**
+ * writes the queued records and stops the writer thread
+ */
+void LogStop(void);
+void LogSetLevel(LogLevel level);
+int LogIsEnabled(LogLevel level);
+/**
+ * parses a level name (error, warn, info or debug)
+ * @return the level, -1 if the name is unknown
+ */
+int LogParseLevel(const char *name);
+/**
+ * @return number of records dropped because the queue was full
+ */
+unsigned long LogDropped(void);
+void LogWrite(LogLevel level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#define logError(...) LogWrite(LOG_ERROR, __VA_ARGS__)
+#define logWarn(...) LogWrite(LOG_WARN, __VA_ARGS__)
+#define logInfo(...) LogWrite(LOG_INFO, __VA_ARGS__)
+#define logDebug(...) LogWrite(LOG_DEBUG, __VA_ARGS__)
+
+#endif
@@ -4,79 +4,218 @@
 #include <signal.h>
 #include <libvirt/libvirt.h>
 #include "check.h"
-#include "guestlist.h"
-#include "cpustats.h"
-#include "scheduler.h"
-#include "util.h"
+#include "log.h"
+#include "metrics.h"
+#include "worker.h"
+#include "capacity.h"
+#include "params.h"
 
-virConnectPtr conn = NULL;
-GuestList *guests = NULL;
-CpuStats *stats = NULL;
+#define USAGE "usage: ./cpu_scheduler [-c uri]... [-b rpc_budget] [-k consolidate_below] [-t thread_policy] [-H housekeeping_cpu_mask] [-f fast_interval_ms] [-K fast_top_k] [-u cpu_budget] [-A affinity_group]... [-L cpu_localities] [-W guest_profile]... [-P params_profile] [-l log_level] [-j] [-s socket_path] [-S state_path] <interval>"
+// default number of libvirt calls used to sample stable domains each cycle
+#define DEFAULT_SAMPLE_BUDGET 64
+#define DEFAULT_URI "qemu:///system"
+#define DEFAULT_SOCKET_PATH "/tmp/vcpu_scheduler.sock"
+#define DEFAULT_STATE_PATH "/var/tmp/vcpu_scheduler.state"
+#define MAX_CONNECTIONS METRICS_MAX_SOURCES
+
+Worker *workers[MAX_CONNECTIONS];
+int numWorkers = 0;
 
 void cleanUp()
 {
-    if (conn) {
-        virConnectClose(conn);
-    }
-    if (guests) {
-        GuestListFree(guests);
-    }
-    if (stats) {
-        CpuStatsFree(stats);
+    for (int i = 0; i < numWorkers; i++) {
+        WorkerJoin(workers[i]);
+        WorkerFree(workers[i]);
     }
+    numWorkers = 0;
+    // write out the queued log records
+    LogStop();
 }
 
 void sigintHandler(int sigNum)
 {
-    printf("Terminating due to keyboard interrupt...");
-    cleanUp();
-    exit(0);
+    WorkerStopAll();
 }
 
-int main(int argc, char *argv[])
+/**
+ * reports libvirt errors in the log instead of on stderr. A domain without
+ * affinity metadata is not an error, see AffinityReadMetadata()
+ */
+void libvirtErrorHandler(void *userData, virErrorPtr error)
 {
-    int interval = 0;
-    char * uri = "qemu:///system";
-    virConnectPtr conn = NULL;
-    GuestList *guests = NULL;
+    if (error->code != VIR_ERR_NO_DOMAIN_METADATA) {
+        logWarn("libvirt: %s", error->message);
+    }
+}
+
+/**
+ * what-if mode: plans how many guests of the profiles the host can take, from the stats of the last cycle
+ * saved in the state file, without connecting to the hypervisor
+ */
+int planCapacity(Capacity *capacity, WorkerConfig *config)
+{
+    int rt = 0;
+    double age = 0;
     CpuStats *stats = NULL;
+
+    check(config->statePath[0] != '\0', "what-if mode reads the stats from the state file (-S)");
+    stats = StateFileLoadStats(config->statePath, &age);
+    check(stats, "failed to load the stats from the state file");
+    logInfo("planning with the stats of %d domains saved %.0fs ago", stats->numDomains, age);
+
+    rt = CapacityPlan(capacity, stats, &config->scheduler);
+    check(rt == 0, "failed to plan capacity");
+    CapacityPrint(capacity, stdout);
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    CpuStatsFree(stats);
+    return rt;
+}
+
+int main(int argc, char *argv[])
+{
+    char *uris[MAX_CONNECTIONS];
+    int numUris = 0;
+    char *affinityGroups[AFFINITY_MAX_GROUPS];
     int rt = 0;
+    int opt = 0;
+    int logLevel = LOG_INFO;
+    LogFormat logFormat = LOG_FORMAT_TEXT;
+    WorkerConfig config;
+    Capacity capacity;
+
+    config.interval = 0;
+    config.sampleBudget = DEFAULT_SAMPLE_BUDGET;
+    config.scheduler.consolidateBelow = 0;
+    config.scheduler.threadPolicy = THREADS_FLOAT;
+    config.scheduler.housekeepingCpus = 0;
+    config.fastIntervalMs = FASTPATH_DEFAULT_INTERVAL_MS;
+    config.fastTopK = FASTPATH_DEFAULT_TOP_K;
+    config.cpuBudget = 0;
+    config.affinityGroups = affinityGroups;
+    config.numAffinityGroups = 0;
+    config.localities = NULL;
+    config.socketPath = DEFAULT_SOCKET_PATH;
+    config.statePath = DEFAULT_STATE_PATH;
+    CapacityInit(&capacity);
 
     signal(SIGINT, sigintHandler);
 
-    check(argc > 1, "interval arg required, usage: ./cpu_scheduler <interval>");
-    interval = atoi(argv[1]);
+    while ((opt = getopt(argc, argv, "c:b:k:t:H:f:K:u:A:L:W:P:l:js:S:")) != -1) {
+        switch (opt) {
+            case 'c':
+                check(numUris < MAX_CONNECTIONS, "too many connections");
+                uris[numUris++] = optarg;
+                break;
+            case 'b':
+                config.sampleBudget = atoi(optarg);
+                break;
+            case 'k':
+                config.scheduler.consolidateBelow = atof(optarg);
+                break;
+            case 't':
+                rt = SchedulerParseThreadPolicy(optarg);
+                check(rt >= 0, "unknown thread policy, " USAGE);
+                config.scheduler.threadPolicy = rt;
+                break;
+            case 'H':
+                config.scheduler.housekeepingCpus = (unsigned char) strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                config.fastIntervalMs = atoi(optarg);
+                break;
+            case 'K':
+                config.fastTopK = atoi(optarg);
+                break;
+            case 'u':
+                config.cpuBudget = atof(optarg);
+                break;
+            case 'A':
+                check(config.numAffinityGroups < AFFINITY_MAX_GROUPS, "too many affinity groups");
+                affinityGroups[config.numAffinityGroups++] = optarg;
+                break;
+            case 'L':
+                config.localities = optarg;
+                break;
+            case 'W':
+                rt = CapacityAddProfile(&capacity, optarg);
+                check(rt == 0, "invalid guest profile, " USAGE);
+                break;
+            case 'P':
+                rt = ParamsLoad(ParamsGlobal(), optarg);
+                check(rt == 0, "invalid parameter profile");
+                break;
+            case 'l':
+                logLevel = LogParseLevel(optarg);
+                check(logLevel >= 0, "unknown log level, " USAGE);
+                break;
+            case 'j':
+                logFormat = LOG_FORMAT_JSON;
+                break;
+            case 's':
+                config.socketPath = optarg;
+                break;
+            case 'S':
+                config.statePath = optarg;
+                break;
+            default:
+                check(0, USAGE);
+        }
+    }
 
-    conn = virConnectOpen(uri);
-    check(conn, "Failed to connect to host");
+    if (capacity.numProfiles > 0) {
+        // the plan is the only output on stdout
+        rt = LogStart(stderr, logLevel, logFormat);
+        check(rt == 0, "failed to start logging");
+        rt = planCapacity(&capacity, &config) == 0 ? 0 : 1;
+        LogStop();
+        return rt;
+    }
 
-    guests = GuestListGet(conn);
-    check(guests, "Failed to create guest list");
+    check(optind < argc, "interval arg required, " USAGE);
+    check(config.scheduler.threadPolicy != THREADS_HOUSEKEEPING || config.scheduler.housekeepingCpus != 0,
+        "housekeeping thread policy requires housekeeping cpus (-H)");
+    config.interval = atoi(argv[optind]);
+    if (numUris == 0) {
+        uris[numUris++] = DEFAULT_URI;
+    }
 
-    stats = CpuStatsCreate(4, guests->count);
-    check(stats, "Failed to create stats");
+    // pinned before any thread is started so that all of them inherit the affinity
+    rt = HousekeepingPinSelf(config.scheduler.housekeepingCpus);
+    check(rt == 0, "failed to pin the scheduler to the housekeeping cpus");
 
-    rt = updateStats(stats, guests, -1);
-    check(rt == 0, "error updating stats");
-    CpuStatsPrint(stats);
+    rt = LogStart(stdout, logLevel, logFormat);
+    check(rt == 0, "failed to start logging");
+    virSetErrorFunc(NULL, libvirtErrorHandler);
 
-    while (1) {
-        puts("sleeping...");
-        sleep(interval);
-        puts("scheduling...");
-        rt = updateStats(stats, guests, interval);
-        check(rt == 0, "error updating stats");
-        rt = allocateCpus(stats, guests);
-        check(rt == 0, "error allocating cpus");
-        puts("scheduling cycle done\n");
+    // each connection is scheduled independently on its own thread
+    for (int i = 0; i < numUris; i++) {
+        workers[i] = WorkerCreate(i, uris[i], &config, numUris);
+        check(workers[i], "failed to create worker");
+        numWorkers += 1;
+        rt = WorkerStart(workers[i]);
+        check(rt == 0, "failed to start worker");
     }
 
     rt = 0;
+    for (int i = 0; i < numWorkers; i++) {
+        WorkerJoin(workers[i]);
+        if (workers[i]->failed) {
+            rt = 1;
+        }
+    }
+    logInfo("Terminating...");
     goto final;
 
 error:
+    WorkerStopAll();
     rt = 1;
 final:
     cleanUp();
     return rt;
-}
\ No newline at end of file
+}
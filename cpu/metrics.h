@@ -0,0 +1,58 @@
+#ifndef metrics_h
+#define metrics_h
+
+#include <time.h>
+#include "introspect.h"
+
+// number of cycle latency histogram buckets, the last one has no upper bound
+#define METRICS_NUM_BUCKETS 16
+// maximum number of hypervisor connections with their own metrics
+#define METRICS_MAX_SOURCES 64
+
+typedef enum MetricsPhase {
+    METRICS_COLLECT = 0,
+    METRICS_PLAN,
+    METRICS_ACTUATE,
+    METRICS_NUM_PHASES
+} MetricsPhase;
+
+/**
+ * kinds of libvirt calls: listing domains, collecting stats, and changing domains
+ */
+typedef enum MetricsRpc {
+    METRICS_RPC_LIST = 0,
+    METRICS_RPC_COLLECT,
+    METRICS_RPC_ACTUATE,
+    METRICS_NUM_RPCS
+} MetricsRpc;
+
+typedef struct timespec MetricsTime;
+
+/**
+ * makes the calling thread record its metrics in the given source, one for each hypervisor
+ * connection. Threads record in source 0 until they set their source
+ * @param name name of the source, NULL to keep the current name
+ */
+int MetricsSetSource(int index, const char *name);
+/**
+ * counts a libvirt call
+ * @param failed whether the call returned an error
+ */
+void MetricsCountRpc(MetricsRpc kind, int failed);
+/**
+ * counts a completed control cycle
+ */
+void MetricsCountCycle(void);
+MetricsTime MetricsNow(void);
+/**
+ * records the time spent in a phase of the current cycle since `start`.
+ * Should only be called from the control loop of the source
+ */
+void MetricsRecordPhase(MetricsPhase phase, MetricsTime start);
+/**
+ * renders the cycle latency histograms and counters of every source, and their totals,
+ * as JSON and in the prometheus text format
+ */
+int MetricsRender(Introspect *introspect);
+
+#endif
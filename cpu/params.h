@@ -0,0 +1,64 @@
+#ifndef params_h
+#define params_h
+
+#include <stdio.h>
+
+// prefix of the scheduler's parameters in a profile, the parameters of the other daemon are skipped
+#define PARAMS_PREFIX "cpu."
+#define PARAMS_MAX_LINE 256
+
+/**
+ * tunable thresholds of the scheduling policy. A profile sets them at startup, the defaults are the values the
+ * policy was designed with
+ */
+typedef struct Params {
+    // weights and usages closer than this are considered equal
+    double equalityPrecision;
+} Params;
+
+/**
+ * describes a parameter: its name in profiles, where it is in Params and its default
+ */
+typedef struct ParamsField {
+    const char *name;
+    size_t offset;
+    double defaultValue;
+} ParamsField;
+
+#define ParamsValue(params, field) ((double *) ((char *) (params) + (field)->offset))
+
+/**
+ * @return the parameters in use on the calling thread, the process-wide ones unless ParamsUse() was called
+ */
+const Params *ParamsCurrent(void);
+/**
+ * @return the process-wide parameters, used by every thread that does not use its own
+ */
+Params *ParamsGlobal(void);
+/**
+ * makes the calling thread use `params`, or the process-wide parameters when NULL
+ */
+void ParamsUse(const Params *params);
+/**
+ * sets all the parameters to their defaults
+ */
+void ParamsInit(Params *params);
+/**
+ * @return the description of each parameter, and their number in `numFields`
+ */
+const ParamsField *ParamsFields(int *numFields);
+/**
+ * sets the parameter named `name`, without the prefix
+ */
+int ParamsSet(Params *params, const char *name, double value);
+/**
+ * loads a profile, one `<prefix><name> <value>` per line, `#` starts a comment.
+ * The parameters a profile does not set keep their value
+ */
+int ParamsLoad(Params *params, const char *path);
+/**
+ * writes the parameters as a profile
+ */
+void ParamsPrint(const Params *params, FILE *file);
+
+#endif
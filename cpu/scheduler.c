@@ -5,26 +5,104 @@
 #include <libvirt/libvirt.h>
 #include "scheduler.h"
 #include "util.h"
+#include "log.h"
+#include "metrics.h"
+
+/**
+ * decides whether the load is consolidated this cycle, switching modes only once the
+ * utilisation is past the threshold by the hysteresis margin
+ */
+int shouldConsolidate(SchedulerConfig *config, CpuPlan *plan, CpuStatsUsage_t utilisation)
+{
+    if (config->consolidateBelow <= 0) {
+        return 0;
+    }
+    if (plan->consolidated) {
+        return utilisation < config->consolidateBelow + CONSOLIDATION_HYSTERESIS;
+    }
+    return utilisation < config->consolidateBelow - CONSOLIDATION_HYSTERESIS;
+}
+
+/**
+ * selects the `numActive` usable cpus currently carrying the most weight,
+ * so that consolidating moves as few domains as possible
+ * @return bit mask of the active cpus
+ */
+unsigned char selectActiveCpus(CpuStats *stats, int numActive, unsigned char usableCpus)
+{
+    int best = 0;
+    unsigned char active = 0;
+    CpuStatsWeight_t bestWeight = 0;
+    CpuStatsWeight_t weight = 0;
+
+    for (int n = 0; n < numActive; n++) {
+        best = -1;
+        for (int c = 0; c < stats->numCpus; c++) {
+            if (!isPinnedToCpu(usableCpus, getCpuMask(c)) || isPinnedToCpu(active, getCpuMask(c))) {
+                continue;
+            }
+            weight = CpuStatsCountDomainWeightOnCpu(stats, c);
+            if (best < 0 || weight > bestWeight) {
+                best = c;
+                bestWeight = weight;
+            }
+        }
+        active |= getCpuMask(best);
+    }
+    return active;
+}
+
+/**
+ * @return bit mask of the cpus the vcpus can be placed on, every cpu but the housekeeping ones
+ */
+unsigned char getUsableCpus(CpuStats *stats, SchedulerConfig *config)
+{
+    unsigned char allCpus = (unsigned char) ((1U << stats->numCpus) - 1);
+    unsigned char usable = allCpus & ~config->housekeepingCpus;
+    return usable != 0 ? usable : allCpus;
+}
 
-int computeTargetCpuWeights(CpuStats *stats, CpuStatsUsage_t *targetWeights)
+int computeTargetCpuWeights(CpuStats *stats, SchedulerConfig *config, CpuPlan *plan)
 {
     CpuStatsUsage_t totalWeight = 0;
+    CpuStatsUsage_t maxWeight = 0;
     CpuStatsUsage_t targetWeight = 0;
+    unsigned char usableCpus = 0;
+    int numUsable = 0;
+    int numActive = 0;
 
     checkNull(stats);
-    checkNull(targetWeights);
+    checkNull(config);
+    checkNull(plan);
 
     for (int i = 0; i < stats->numDomains; i++) {
-        totalWeight += stats->domainUsages[i];
+        totalWeight += CpuStatsGetDemand(stats, i);
+        maxWeight = max(maxWeight, CpuStatsGetDemand(stats, i));
+    }
+
+    // the housekeeping cpus are left to the daemons and never receive vcpus
+    usableCpus = getUsableCpus(stats, config);
+    numUsable = countOnBits(usableCpus, stats->numCpus);
+    plan->consolidated = shouldConsolidate(config, plan, totalWeight / numUsable);
+    numActive = numUsable;
+    if (plan->consolidated) {
+        // fewest cpus that can hold the load while keeping the headroom free on each of them
+        numActive = (int) ceill(totalWeight / (1 - CONSOLIDATION_HEADROOM));
+        numActive = max(1, min(numActive, numUsable));
+    }
+    targetWeight = totalWeight / numActive;
+    if (plan->consolidated) {
+        // a domain cannot be split, each active cpu must be able to take the largest one
+        targetWeight = max(targetWeight, maxWeight);
     }
-    targetWeight = totalWeight / stats->numCpus;
 
+    plan->activeCpus = selectActiveCpus(stats, numActive, usableCpus);
     for (int i = 0; i < stats->numCpus; i++) {
-        targetWeights[i] = targetWeight;
+        plan->targetWeights[i] = isPinnedToCpu(plan->activeCpus, getCpuMask(i)) ? targetWeight : 0;
     }
+    plan->numActiveCpus = numActive;
 
     return 0;
-
 error:
     return -1;
 }
@@ -41,9 +119,14 @@ int checkIfCpusAreBalanced(CpuStats *stats, CpuStatsUsage_t *targetWeights)
     return 1;
 }
 
-int getDomainToPinToCpu(unsigned char cpumask, unsigned char *newCpuMaps, CpuStatsUsage_t targetWeight, CpuStats *stats)
+int getDomainToPinToCpu(unsigned char cpumask, unsigned char *newCpuMaps, CpuStatsUsage_t targetWeight, CpuStats *stats,
+    Interference *interference, Affinity *affinity, int *domains, int numDomains)
 {
     int d = 0;
+    int avoided = 0;
+    int curAvoided = 0;
+    int relieved = 0;
+    int curRelieved = 0;
     int curDomain = -1;
     CpuStatsUsage_t curWeight = -1;
     CpuStatsUsage_t weight = 0;
@@ -51,17 +134,41 @@ int getDomainToPinToCpu(unsigned char cpumask, unsigned char *newCpuMaps, CpuSta
     
     checkNull(newCpuMaps);
     checkNull(stats);
+    checkNull(domains);
 
-    for (d = 0; d < stats->numDomains; d++) {
-        weight = stats->domainUsages[d];
-        curWeight = curDomain > -1 ? stats->domainUsages[curDomain] : -1;
+    for (int i = 0; i < numDomains; i++) {
+        d = domains[i];
+        weight = CpuStatsGetDemand(stats, d);
+        curWeight = curDomain > -1 ? CpuStatsGetDemand(stats, curDomain) : -1;
         curPins = curDomain > -1 ? countOnBits(newCpuMaps[curDomain], stats->numCpus) : INT_MAX;
         
         // skip domains with large weight than cpu target weight
         if (certainlyGreaterThan((double) weight, (double) targetWeight)) {
             continue;
         }
-        if (isPinnedToCpu(newCpuMaps[d], cpumask)) {
+        if (isPinnedToCpu(newCpuMaps[d], cpumask) || !AffinityAllows(affinity, newCpuMaps, d, cpumask)) {
+            continue;
+        }
+        // soft constraints: a domain that interferes with the domains already on the cpu, or that
+        // breaks one of its soft groups there, is only taken when no other domain fits
+        avoided = InterferenceOnCpus(interference, newCpuMaps, d, cpumask) > 0 ||
+            AffinityPenalty(affinity, newCpuMaps, d, cpumask) > 0;
+        if (curDomain > -1 && avoided != curAvoided) {
+            if (!avoided) {
+                curDomain = d;
+                curAvoided = avoided;
+                curRelieved = CpuStatsQueuesLessOn(stats, d, cpumask);
+            }
+            continue;
+        }
+        // a queuing domain that would wait less on the cpu is relieved before the larger domains
+        relieved = CpuStatsQueuesLessOn(stats, d, cpumask);
+        if (curDomain > -1 && relieved != curRelieved) {
+            if (relieved) {
+                curDomain = d;
+                curAvoided = avoided;
+                curRelieved = relieved;
+            }
             continue;
         }
         // take the domain with the higher weight
@@ -69,6 +176,8 @@ int getDomainToPinToCpu(unsigned char cpumask, unsigned char *newCpuMaps, CpuSta
             (countOnBits(newCpuMaps[d], stats->numCpus) <= curPins)
         ) {
             curDomain = d;
+            curAvoided = avoided;
+            curRelieved = relieved;
             continue;
         }
         // if domains have same weight, prefer domain which is already pinned to the cpu
@@ -79,11 +188,15 @@ int getDomainToPinToCpu(unsigned char cpumask, unsigned char *newCpuMaps, CpuSta
             (countOnBits(newCpuMaps[d], stats->numCpus) < countOnBits(newCpuMaps[curDomain], stats->numCpus))
         )) {
             curDomain = d;
+            curAvoided = avoided;
+            curRelieved = relieved;
             continue;
         }
 
         if (curDomain < 0) {
             curDomain = d;
+            curAvoided = avoided;
+            curRelieved = relieved;
             continue;
         }
     }
@@ -93,7 +206,8 @@ error:
     return -1;
 }
 
-int updateNewDomainMapsForCpu(int cpu, unsigned char *newCpuMaps, CpuStatsUsage_t *targetWeights, CpuStats *stats)
+int updateNewDomainMapsForCpu(int cpu, unsigned char *newCpuMaps, CpuStatsUsage_t *targetWeights, CpuStats *stats,
+    Interference *interference, Affinity *affinity, int *domains, int numDomains)
 {
     int domain = -1;
     unsigned char cpumask = getCpuMask(cpu);
@@ -102,22 +216,75 @@ int updateNewDomainMapsForCpu(int cpu, unsigned char *newCpuMaps, CpuStatsUsage_
     checkNull(targetWeights);
     checkNull(stats);
 
-    domain = getDomainToPinToCpu(cpumask, newCpuMaps, targetWeights[cpu], stats);
+    domain = getDomainToPinToCpu(cpumask, newCpuMaps, targetWeights[cpu], stats, interference, affinity,
+        domains, numDomains);
     if (domain < 0) {
         return -1;
     }
 
     newCpuMaps[domain] = newCpuMaps[domain] | cpumask;
-    targetWeights[cpu] -= stats->domainUsages[domain];
-     printf("cpu %d receives domain %d, new weight %.2Lf, domain weight %.2Lf, new map 0x%X\n",
-        cpu, domain, targetWeights[cpu], stats->domainUsages[domain], newCpuMaps[domain]);
+    targetWeights[cpu] -= CpuStatsGetDemand(stats, domain);
+    logDebug("cpu %d receives domain %d, new weight %.2Lf, domain weight %.2Lf, new map 0x%X",
+        cpu, domain, targetWeights[cpu], CpuStatsGetDemand(stats, domain), newCpuMaps[domain]);
 
     return 0;
 error:
     return -1;
 }
 
-int updateCpuMaps(unsigned char *newCpuMaps, CpuStatsUsage_t *targetWeights, CpuStats *stats)
+/**
+ * @return active cpu with the most weight left to fill among those the hard constraints allow for the domain,
+ * or among all the active cpus if they allow none
+ */
+int getRoomiestCpu(CpuStatsUsage_t *targetWeights, CpuStats *stats, Affinity *affinity, unsigned char *newCpuMaps,
+    unsigned char activeCpus, int d)
+{
+    int cpu = -1;
+
+    for (int c = 0; c < stats->numCpus; c++) {
+        if (isPinnedToCpu(activeCpus, getCpuMask(c)) && AffinityAllows(affinity, newCpuMaps, d, getCpuMask(c)) &&
+            (cpu < 0 || targetWeights[c] > targetWeights[cpu])) {
+            cpu = c;
+        }
+    }
+    if (cpu < 0) {
+        logWarn("domain %d cannot be placed without breaking a hard constraint", d);
+        return getRoomiestCpu(targetWeights, stats, NULL, newCpuMaps, activeCpus, d);
+    }
+    return cpu;
+}
+
+/**
+ * pins the domains that did not fit on any cpu to the cpu with the most weight left to fill
+ */
+void placeRemainingDomains(unsigned char *newCpuMaps, CpuStatsUsage_t *targetWeights, CpuStats *stats,
+    Affinity *affinity, unsigned char activeCpus, int *domains, int numDomains)
+{
+    int cpu = 0;
+    int d = 0;
+
+    for (int i = 0; i < numDomains; i++) {
+        d = domains[i];
+        if (newCpuMaps[d] != 0) {
+            continue;
+        }
+        cpu = getRoomiestCpu(targetWeights, stats, affinity, newCpuMaps, activeCpus, d);
+        newCpuMaps[d] = getCpuMask(cpu);
+        targetWeights[cpu] -= CpuStatsGetDemand(stats, d);
+        logDebug("cpu %d receives remaining domain %d, new weight %.2Lf", cpu, d, targetWeights[cpu]);
+    }
+}
+
+/**
+ * places `domains` on the cpus, filling each cpu up to its target weight
+ * @param newCpuMaps maps of the domains, the maps of the placed domains should be empty
+ * @param targetWeights weight left to fill on each cpu
+ * @param activeCpus cpus the domains can be placed on
+ * @param interference co-location history keeping noisy neighbours apart, NULL to place on weight alone
+ * @param affinity groups of domains to keep together or apart, NULL if none
+ */
+int updateCpuMaps(unsigned char *newCpuMaps, CpuStatsUsage_t *targetWeights, CpuStats *stats,
+    Interference *interference, Affinity *affinity, unsigned char activeCpus, int *domains, int numDomains)
 {
     int cpu = 0;
     int res = 0;
@@ -126,23 +293,35 @@ int updateCpuMaps(unsigned char *newCpuMaps, CpuStatsUsage_t *targetWeights, Cpu
     checkNull(targetWeights);
     checkNull(stats);
 
-    while (numFailed < stats->numCpus) {
+    // only the active cpus count as failing, so that the inactive ones do not cut short the passes
+    // keeping the domains' pins before the remaining domains are placed
+    while (numFailed < stats->numCpus && activeCpus != 0) {
         for (cpu = 0; cpu < stats->numCpus; cpu++) {
-            res = updateNewDomainMapsForCpu(cpu, newCpuMaps, targetWeights, stats);
-            printf("target weight to fill %d:%.2Lf, res %d\n", cpu, targetWeights[cpu], res);
+            // inactive cpus do not receive any domain
+            if (!isPinnedToCpu(activeCpus, getCpuMask(cpu))) {
+                continue;
+            }
+            if (targetWeights[cpu] <= 0) {
+                numFailed++;
+                continue;
+            }
+            res = updateNewDomainMapsForCpu(cpu, newCpuMaps, targetWeights, stats, interference, affinity,
+                domains, numDomains);
+            logDebug("target weight to fill %d:%.2Lf, res %d", cpu, targetWeights[cpu], res);
             // res = -1;
             if (res < 0) {
                 numFailed++;
             }
         }
     }
+    placeRemainingDomains(newCpuMaps, targetWeights, stats, affinity, activeCpus, domains, numDomains);
 
     return 0;
 error:
     return -1;
 }
 
-int pinNewCpuMaps(unsigned char *newCpuMaps, CpuStats *stats, GuestList *guests)
+int pinNewCpuMaps(unsigned char *newCpuMaps, CpuStats *stats, GuestList *guests, CpuPlan *plan)
 {
     int rt = 0;
     virDomainPtr domain = NULL;
@@ -150,10 +329,13 @@ int pinNewCpuMaps(unsigned char *newCpuMaps, CpuStats *stats, GuestList *guests)
     for (int d = 0; d < guests->count; d++) {
         domain = GuestListDomainAt(guests, d);
         if (newCpuMaps[d] != stats->cpuMaps[d]) {
-            printf("domain %d new pin 0x%X - old 0x%X\n", d, newCpuMaps[d], stats->cpuMaps[d]);
+            logInfo("domain %d new pin 0x%X - old 0x%X", d, newCpuMaps[d], stats->cpuMaps[d]);
             check(newCpuMaps[d] != 0, "did not assign any cpu to domain");
             rt = virDomainPinVcpu(domain, 0, newCpuMaps + d, 1);
+            MetricsCountRpc(METRICS_RPC_ACTUATE, rt == -1);
             check(rt != -1, "failed to repin vcpu");
+            stats->cpuMaps[d] = newCpuMaps[d];
+            plan->numRepins += 1;
         }
     }
 
@@ -162,66 +344,533 @@ error:
     return -1;
 }
 
-int repinCpus(CpuStats *stats, GuestList *guests, CpuStatsUsage_t *targetWeights)
+int repinCpus(CpuStats *stats, GuestList *guests, CpuPlan *plan)
+{
+    checkNull(stats);
+    checkNull(guests);
+    checkNull(plan);
+
+    pinNewCpuMaps(plan->cpuMaps, stats, guests, plan);
+
+    return 0;
+error:
+    return -1;
+}
+
+int SchedulerParseThreadPolicy(const char *name)
+{
+    if (strcmp(name, "float") == 0) {
+        return THREADS_FLOAT;
+    }
+    if (strcmp(name, "housekeeping") == 0) {
+        return THREADS_HOUSEKEEPING;
+    }
+    if (strcmp(name, "vcpu") == 0) {
+        return THREADS_WITH_VCPU;
+    }
+    return -1;
+}
+
+/**
+ * pins the emulator thread and every iothread of the domain to `cpuMap`
+ */
+int pinThreadsOfDomain(virDomainPtr domain, unsigned char cpuMap)
 {
     int rt = 0;
-    unsigned char *newCpuMaps = NULL;
+    int numIOThreads = 0;
+    virDomainIOThreadInfoPtr *info = NULL;
+
+    rt = virDomainPinEmulator(domain, &cpuMap, 1, VIR_DOMAIN_AFFECT_LIVE);
+    MetricsCountRpc(METRICS_RPC_ACTUATE, rt < 0);
+    check(rt == 0, "failed to pin emulator thread");
+
+    numIOThreads = virDomainGetIOThreadInfo(domain, &info, VIR_DOMAIN_AFFECT_LIVE);
+    MetricsCountRpc(METRICS_RPC_ACTUATE, numIOThreads < 0);
+    check(numIOThreads >= 0, "failed to get iothreads");
+    for (int i = 0; i < numIOThreads; i++) {
+        if (rt == 0) {
+            rt = virDomainPinIOThread(domain, info[i]->iothread_id, &cpuMap, 1, VIR_DOMAIN_AFFECT_LIVE);
+            MetricsCountRpc(METRICS_RPC_ACTUATE, rt < 0);
+        }
+        virDomainIOThreadInfoFree(info[i]);
+    }
+    free(info);
+    check(rt == 0, "failed to pin iothread");
+
+    return 0;
+error:
+    return -1;
+}
+
+int pinDomainThreads(CpuStats *stats, GuestList *guests, SchedulerConfig *config, CpuPlan *plan)
+{
+    unsigned char cpuMap = 0;
 
     checkNull(stats);
     checkNull(guests);
-    checkNull(targetWeights);
+    checkNull(config);
+    checkNull(plan);
 
-    newCpuMaps = calloc(guests->count, sizeof(unsigned char));
-    checkMemAlloc(newCpuMaps);
+    if (config->threadPolicy == THREADS_FLOAT) {
+        return 0;
+    }
+
+    for (int d = 0; d < guests->count; d++) {
+        cpuMap = config->threadPolicy == THREADS_HOUSEKEEPING ? config->housekeepingCpus : stats->cpuMaps[d];
+        if (cpuMap == 0 || cpuMap == stats->threadMaps[d]) {
+            continue;
+        }
+        // the vcpus are still scheduled if the threads of a domain cannot be pinned, they are retried next cycle
+        if (pinThreadsOfDomain(GuestListDomainAt(guests, d), cpuMap) != 0) {
+            logWarn("failed to pin emulator and iothreads of domain %d", d);
+            continue;
+        }
+        logInfo("domain %d emulator and iothreads new pin 0x%X - old 0x%X", d, cpuMap, stats->threadMaps[d]);
+        stats->threadMaps[d] = cpuMap;
+        plan->numThreadRepins += 1;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * @return whether one of the cpus of `cpumask` would relieve the domain's queuing
+ */
+int canRelieveQueuing(CpuStats *stats, unsigned char cpumask, int d)
+{
+    for (int c = 0; c < stats->numCpus; c++) {
+        if (isPinnedToCpu(cpumask, getCpuMask(c)) && CpuStatsQueuesLessOn(stats, d, getCpuMask(c))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return whether the domain's usage moved beyond the tolerance since it was last placed,
+ * its vcpus queue for the cpus it is pinned to while an active cpu would relieve them,
+ * it shares them with a noisy neighbour or it breaks one of its groups
+ */
+int isDomainDirty(CpuStats *stats, CpuPlan *plan, int d)
+{
+    return stats->cpuMaps[d] == 0 || stats->bursting[d] || canRelieveQueuing(stats, plan->activeCpus, d) ||
+        InterferenceOnCpus(plan->interference, stats->cpuMaps, d, stats->cpuMaps[d]) > 0 ||
+        AffinityIsViolated(plan->affinity, stats->cpuMaps, d) ||
+        fabsl(CpuStatsGetDemand(stats, d) - plan->plannedUsages[d]) > PLAN_DIRTY_TOLERANCE;
+}
+
+/**
+ * removes a clean domain from the cpus it is pinned to and makes it a candidate for placement
+ */
+void evictDomain(CpuStats *stats, CpuPlan *plan, int d)
+{
+    for (int c = 0; c < stats->numCpus; c++) {
+        if (isPinnedToCpu(plan->cpuMaps[d], getCpuMask(c))) {
+            plan->targetWeights[c] += CpuStatsGetDemand(stats, d);
+        }
+    }
+    plan->cpuMaps[d] = 0;
+    plan->replanned[d] = 1;
+    plan->candidates[plan->numCandidates++] = d;
+}
+
+/**
+ * finds the clean domain to evict from a cpu to free `deficit`: the smallest domain
+ * that frees enough, or the largest one if none does
+ * @return domain to evict, -1 if no clean domain is pinned to the cpu
+ */
+int getDomainToEvict(CpuStats *stats, CpuPlan *plan, unsigned char cpumask, CpuStatsUsage_t deficit)
+{
+    int best = -1;
+    int largest = -1;
+    CpuStatsUsage_t usage = 0;
+
+    for (int d = 0; d < stats->numDomains; d++) {
+        if (plan->replanned[d] || !isPinnedToCpu(plan->cpuMaps[d], cpumask)) {
+            continue;
+        }
+        usage = CpuStatsGetDemand(stats, d);
+        if (largest < 0 || usage > CpuStatsGetDemand(stats, largest)) {
+            largest = d;
+        }
+        if (usage >= deficit && (best < 0 || usage < CpuStatsGetDemand(stats, best))) {
+            best = d;
+        }
+    }
+    return best >= 0 ? best : largest;
+}
+
+/**
+ * keeps the clean domains on their cpus and makes the dirty ones candidates for placement.
+ * Cpus whose clean domains exceed their target, e.g. inactive cpus or cpus whose target dropped,
+ * give up some of their domains
+ * @return number of dirty domains, or -1 if more than the share allowed for an incremental plan are dirty
+ */
+int selectDirtyDomains(CpuStats *stats, CpuPlan *plan)
+{
+    int numDirty = 0;
+    int evicted = -1;
+
+    for (int d = 0; d < stats->numDomains; d++) {
+        numDirty += isDomainDirty(stats, plan, d);
+    }
+    if (numDirty > PLAN_MAX_DIRTY_SHARE * stats->numDomains) {
+        return -1;
+    }
+
+    plan->numCandidates = 0;
+    for (int d = 0; d < stats->numDomains; d++) {
+        plan->replanned[d] = isDomainDirty(stats, plan, d);
+        if (plan->replanned[d]) {
+            plan->cpuMaps[d] = 0;
+            plan->candidates[plan->numCandidates++] = d;
+            continue;
+        }
+        plan->cpuMaps[d] = stats->cpuMaps[d];
+        for (int c = 0; c < stats->numCpus; c++) {
+            if (isPinnedToCpu(plan->cpuMaps[d], getCpuMask(c))) {
+                plan->targetWeights[c] -= CpuStatsGetDemand(stats, d);
+            }
+        }
+    }
+
+    // plan->targetWeights now holds the weight left on each cpu by its clean domains
+    for (int c = 0; c < stats->numCpus; c++) {
+        if (plan->targetWeights[c] < -EQUALITY_PRECISION) {
+            plan->numDirtyCpus += 1;
+        }
+        while (plan->targetWeights[c] < -EQUALITY_PRECISION) {
+            evicted = getDomainToEvict(stats, plan, getCpuMask(c), -plan->targetWeights[c]);
+            if (evicted < 0) {
+                break;
+            }
+            logDebug("cpu %d over target, evicting domain %d", c, evicted);
+            evictDomain(stats, plan, evicted);
+        }
+    }
+
+    return numDirty;
+}
+
+/**
+ * @return whether domain `a` is placed before domain `b`: domains queuing for a cpu are relieved first,
+ * then the domains with the highest demand
+ */
+int isPlacedBefore(CpuStats *stats, int a, int b)
+{
+    if (CpuStatsIsQueuing(stats, a) != CpuStatsIsQueuing(stats, b)) {
+        return CpuStatsIsQueuing(stats, a);
+    }
+    return CpuStatsGetDemand(stats, a) > CpuStatsGetDemand(stats, b);
+}
+
+/**
+ * places each dirty domain, queuing domains then largest first, on the single cpu with the most weight
+ * left to fill, less a penalty for the noisy neighbours already placed there and the soft constraints broken
+ * there. Cpus breaking a hard constraint are left out unless every cpu does. Among cpus with as much room as the
+ * best one, a queuing domain goes to one where it waits less, any other domain stays on its current cpu. When a domain does not fit, clean domains are evicted from that cpu
+ * and placed after the dirty ones
+ */
+void placeDirtyDomains(CpuStats *stats, CpuPlan *plan)
+{
+    int stays = 0;
+    int queuing = 0;
+    int relieves = 0;
+    int allowed = 0;
+    CpuStatsUsage_t room = 0;
+    CpuStatsUsage_t bestRoom = 0;
+    int d = 0;
+    int cpu = 0;
+    int j = 0;
+    int evicted = -1;
+
+    // insertion sort, queuing domains then largest domains first, the dirty set is expected to be small
+    for (int i = 1; i < plan->numCandidates; i++) {
+        d = plan->candidates[i];
+        for (j = i; j > 0 && isPlacedBefore(stats, d, plan->candidates[j - 1]); j--) {
+            plan->candidates[j] = plan->candidates[j - 1];
+        }
+        plan->candidates[j] = d;
+    }
+
+    for (int i = 0; i < plan->numCandidates; i++) {
+        d = plan->candidates[i];
+        cpu = -1;
+        allowed = 0;
+        queuing = canRelieveQueuing(stats, plan->activeCpus, d);
+        for (int c = 0; c < stats->numCpus; c++) {
+            allowed |= isPinnedToCpu(plan->activeCpus, getCpuMask(c)) &&
+                AffinityAllows(plan->affinity, plan->cpuMaps, d, getCpuMask(c));
+        }
+        if (!allowed) {
+            logWarn("domain %d cannot be placed without breaking a hard constraint", d);
+        }
+        for (int c = 0; c < stats->numCpus; c++) {
+            if (!isPinnedToCpu(plan->activeCpus, getCpuMask(c)) ||
+                (allowed && !AffinityAllows(plan->affinity, plan->cpuMaps, d, getCpuMask(c)))) {
+                continue;
+            }
+            room = plan->targetWeights[c] -
+                INTERFERENCE_PENALTY * InterferenceOnCpus(plan->interference, plan->cpuMaps, d, getCpuMask(c)) -
+                AFFINITY_SOFT_PENALTY * AffinityPenalty(plan->affinity, plan->cpuMaps, d, getCpuMask(c));
+            relieves = CpuStatsQueuesLessOn(stats, d, getCpuMask(c));
+            stays = !queuing && isPinnedToCpu(stats->cpuMaps[d], getCpuMask(c)) &&
+                !isPinnedToCpu(stats->cpuMaps[d], getCpuMask(cpu));
+            if (cpu < 0 || certainlyGreaterThan(room, bestRoom) ||
+                (almostEquals(room, bestRoom) && (relieves || stays))) {
+                cpu = c;
+                bestRoom = room;
+            }
+        }
+        while (certainlyGreaterThan(CpuStatsGetDemand(stats, d), plan->targetWeights[cpu])) {
+            evicted = getDomainToEvict(stats, plan, getCpuMask(cpu),
+                CpuStatsGetDemand(stats, d) - plan->targetWeights[cpu]);
+            if (evicted < 0) {
+                break;
+            }
+            logDebug("cpu %d makes room for domain %d, evicting domain %d", cpu, d, evicted);
+            evictDomain(stats, plan, evicted);
+        }
+        plan->cpuMaps[d] = getCpuMask(cpu);
+        plan->targetWeights[cpu] -= CpuStatsGetDemand(stats, d);
+        logDebug("cpu %d receives dirty domain %d, new weight %.2Lf", cpu, d, plan->targetWeights[cpu]);
+    }
+}
+
+/**
+ * @return whether no cpu was filled beyond its target
+ */
+int isPlanWithinTargets(CpuStats *stats, CpuPlan *plan)
+{
+    for (int c = 0; c < stats->numCpus; c++) {
+        if (plan->targetWeights[c] < -EQUALITY_PRECISION) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * makes every domain a candidate for placement, starting from empty cpus
+ */
+void selectAllDomains(CpuStats *stats, CpuPlan *plan)
+{
+    plan->numCandidates = 0;
+    for (int d = 0; d < stats->numDomains; d++) {
+        plan->cpuMaps[d] = 0;
+        plan->replanned[d] = 1;
+        plan->candidates[plan->numCandidates++] = d;
+    }
+}
+
+/**
+ * @return usage that would have to move for every active cpu to reach its target,
+ * given the weight left to fill on each cpu
+ */
+CpuStatsUsage_t getImbalance(CpuStatsUsage_t *weightsLeft, int numCpus, unsigned char activeCpus)
+{
+    CpuStatsUsage_t imbalance = 0;
+
+    for (int c = 0; c < numCpus; c++) {
+        if (isPinnedToCpu(activeCpus, getCpuMask(c))) {
+            imbalance += fabsl(weightsLeft[c]);
+        }
+    }
+    return imbalance / 2;
+}
+
+/**
+ * measures what each group costs in balance: a full plan is computed with every group,
+ * then without each group in turn, and the cost of a group is the imbalance it adds
+ * @param targets target weight of each cpu in this cycle
+ */
+int computeConstraintCosts(CpuStats *stats, CpuPlan *plan, CpuStatsUsage_t *targets)
+{
+    int rt = 0;
+    unsigned char *maps = NULL;
+    CpuStatsUsage_t *weights = NULL;
+    int *domains = NULL;
+    CpuStatsUsage_t constrained = 0;
+    AffinityGroup *group = NULL;
+
+    maps = calloc(stats->numDomains, sizeof(unsigned char));
+    checkMemAlloc(maps);
+    weights = calloc(stats->numCpus, sizeof(CpuStatsUsage_t));
+    checkMemAlloc(weights);
+    domains = calloc(stats->numDomains, sizeof(int));
+    checkMemAlloc(domains);
+    for (int d = 0; d < stats->numDomains; d++) {
+        domains[d] = d;
+    }
+
+    for (int g = -1; g < plan->affinity->numGroups; g++) {
+        group = g >= 0 ? plan->affinity->groups + g : NULL;
+        if (group) {
+            group->enabled = 0;
+        }
+        memset(maps, 0, stats->numDomains * sizeof(unsigned char));
+        memcpy(weights, targets, stats->numCpus * sizeof(CpuStatsUsage_t));
+        rt = updateCpuMaps(maps, weights, stats, plan->interference, plan->affinity, plan->activeCpus,
+            domains, stats->numDomains);
+        if (group) {
+            group->enabled = 1;
+        }
+        check(rt == 0, "failed to compute cpu maps");
+        if (group) {
+            group->cost = fmaxl(0, constrained - getImbalance(weights, stats->numCpus, plan->activeCpus));
+            logDebug("affinity group %s costs %.2Lf of imbalance", group->name, group->cost);
+        }
+        else {
+            constrained = getImbalance(weights, stats->numCpus, plan->activeCpus);
+        }
+    }
 
-    updateCpuMaps(newCpuMaps, targetWeights, stats);
-    pinNewCpuMaps(newCpuMaps, stats, guests);
-    
     rt = 0;
     goto final;
 
 error:
     rt = -1;
 final:
-    if (newCpuMaps) {
-        free(newCpuMaps);
-    }
+    free(maps);
+    free(weights);
+    free(domains);
     return rt;
 }
 
-int allocateCpus(CpuStats *stats, GuestList *guests)
+int planCpus(CpuStats *stats, SchedulerConfig *config, CpuPlan *plan)
 {
     int rt = 0;
-    CpuStatsUsage_t *targetWeights = NULL;
+
+    checkNull(stats);
+    checkNull(config);
+    checkNull(plan);
+
+    rt = computeTargetCpuWeights(stats, config, plan);
+    check(rt == 0, "could not compute target diffs");
+    selectAllDomains(stats, plan);
+    rt = updateCpuMaps(plan->cpuMaps, plan->targetWeights, stats, plan->interference, plan->affinity,
+        plan->activeCpus, plan->candidates, plan->numCandidates);
+    check(rt == 0, "failed to compute cpu maps");
+
+    return 0;
+error:
+    return -1;
+}
+
+int allocateCpus(CpuStats *stats, GuestList *guests, SchedulerConfig *config, CpuPlan *plan)
+{
+    int rt = 0;
+    int numQueuing = 0;
+    // cpu maps are a single byte, there are at most 8 cpus
+    CpuStatsUsage_t targets[8 * sizeof(unsigned char)];
+    MetricsTime start = MetricsNow();
 
     checkNull(stats);
     checkNull(guests);
+    checkNull(config);
+    checkNull(plan);
 
-    targetWeights = calloc(stats->numCpus, sizeof(CpuStatsUsage_t));
-    checkMemAlloc(targetWeights);
+    rt = CpuPlanReset(plan);
+    check(rt == 0, "failed to reset cpu plan");
 
-    rt = computeTargetCpuWeights(stats, targetWeights);
+    rt = computeTargetCpuWeights(stats, config, plan);
     check(rt == 0, "could not compute target diffs");
+    memcpy(targets, plan->targetWeights, stats->numCpus * sizeof(CpuStatsUsage_t));
 
     for (int i = 0; i < stats->numCpus; i++) {
-        printf("cpu %d target weight %.2Lf\n", i, targetWeights[i]);
+        logDebug("cpu %d target weight %.2Lf", i, plan->targetWeights[i]);
+    }
+    logInfo("%s load on %d active cpus", plan->consolidated ? "consolidating" : "spreading", plan->numActiveCpus);
+    for (int i = 0; i < stats->numCpus; i++) {
+        if (CpuStatsIsCpuQueuing(stats, i)) {
+            logInfo("domains on cpu %d queue for %.1Lf%% of the time", i, stats->cpuWaits[i] * 100);
+        }
+    }
+    // queuing alone does not unbalance the cpus, only when another active cpu would relieve it
+    for (int d = 0; d < stats->numDomains; d++) {
+        numQueuing += canRelieveQueuing(stats, plan->activeCpus, d);
+    }
+
+    plan->numNoisyColocated = InterferenceCountColocated(plan->interference, stats->cpuMaps);
+    if (plan->numNoisyColocated > 0) {
+        logInfo("%d pairs of noisy neighbours share a cpu", plan->numNoisyColocated);
     }
 
-    if (checkIfCpusAreBalanced(stats, targetWeights)) {
-        printf("cpus already balanced, nothing to do...\n");
+    plan->numViolations = AffinityCountViolations(plan->affinity, stats->cpuMaps);
+    if (plan->numViolations > 0) {
+        logInfo("%d domains are placed against their affinity groups", plan->numViolations);
+    }
+
+    // cpus whose domains queue, host noisy neighbours or break their groups are relieved
+    // even when their usage is on target
+    if (numQueuing == 0 && plan->numNoisyColocated == 0 && plan->numViolations == 0 &&
+        checkIfCpusAreBalanced(stats, plan->targetWeights)) {
+        logInfo("cpus already balanced, nothing to do...");
+        plan->balanced = 1;
+        memcpy(plan->cpuMaps, stats->cpuMaps, plan->numDomains * sizeof(unsigned char));
+        for (int d = 0; d < plan->numDomains; d++) {
+            plan->plannedUsages[d] = CpuStatsGetDemand(stats, d);
+        }
+        MetricsRecordPhase(METRICS_PLAN, start);
+        start = MetricsNow();
+        rt = pinDomainThreads(stats, guests, config, plan);
+        check(rt == 0, "failed to pin domain threads");
+        MetricsRecordPhase(METRICS_ACTUATE, start);
+        return 0;
+    }
+
+    // only the domains whose demand changed are re-planned, with a full plan every few cycles as a safety net
+    plan->incremental = plan->cyclesSinceFullPlan >= 0 && plan->cyclesSinceFullPlan + 1 < PLAN_FULL_INTERVAL &&
+        selectDirtyDomains(stats, plan) >= 0;
+    if (plan->incremental) {
+        plan->cyclesSinceFullPlan += 1;
+        logInfo("re-planning %d of %d domains, %d cpus over target",
+            plan->numCandidates, plan->numDomains, plan->numDirtyCpus);
     }
     else {
-        repinCpus(stats, guests, targetWeights);
+        plan->cyclesSinceFullPlan = 0;
+        selectAllDomains(stats, plan);
+        logInfo("re-planning all %d domains", plan->numDomains);
     }
 
-    rt = 0;
-    goto final;
+    if (plan->incremental) {
+        placeDirtyDomains(stats, plan);
+    }
+    else {
+        rt = updateCpuMaps(plan->cpuMaps, plan->targetWeights, stats, plan->interference, plan->affinity,
+            plan->activeCpus, plan->candidates, plan->numCandidates);
+        check(rt == 0, "failed to compute cpu maps");
+    }
+    if (plan->incremental && !isPlanWithinTargets(stats, plan)) {
+        // the dirty domains did not fit in the room left by the clean ones
+        logInfo("incremental plan exceeds the cpu targets, re-planning all %d domains", plan->numDomains);
+        plan->incremental = 0;
+        plan->cyclesSinceFullPlan = 0;
+        rt = planCpus(stats, config, plan);
+        check(rt == 0, "failed to compute cpu maps");
+    }
+    for (int i = 0; i < plan->numCandidates; i++) {
+        plan->plannedUsages[plan->candidates[i]] = CpuStatsGetDemand(stats, plan->candidates[i]);
+    }
+    plan->numViolations = AffinityCountViolations(plan->affinity, plan->cpuMaps);
+    // measuring the costs takes a full plan per group, they are only refreshed with the full plans
+    // so that incremental cycles stay proportional to what changed
+    if (!plan->incremental && plan->affinity && plan->affinity->numGroups > 0) {
+        rt = computeConstraintCosts(stats, plan, targets);
+        check(rt == 0, "failed to compute the cost of the affinity groups");
+    }
+    MetricsRecordPhase(METRICS_PLAN, start);
 
+    start = MetricsNow();
+    rt = repinCpus(stats, guests, plan);
+    check(rt == 0, "failed to repin cpus");
+    rt = pinDomainThreads(stats, guests, config, plan);
+    check(rt == 0, "failed to pin domain threads");
+    MetricsRecordPhase(METRICS_ACTUATE, start);
+
+    return 0;
 error:
-   rt = -1;
-final:
-    if (targetWeights) {
-        free(targetWeights);
-    }
-    return rt;
+    return -1;
 }
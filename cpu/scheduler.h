@@ -2,9 +2,71 @@
 #define scheduler_h
 
 #include "cpustats.h"
+#include "cpuplan.h"
 #include "guestlist.h"
 
-int repinCpus(CpuStats *stats, GuestList *guests, CpuStatsUsage_t *targetWeights);
-int allocateCpus(CpuStats *stats, GuestList *guests);
+// share of each active cpu kept free when the load is consolidated
+#define CONSOLIDATION_HEADROOM 0.25
+// the utilisation has to move this far past the threshold to switch between consolidating and spreading
+#define CONSOLIDATION_HYSTERESIS 0.05
+// a domain is re-planned when its usage moved by more than this since it was last placed
+#define PLAN_DIRTY_TOLERANCE 0.1
+// the whole placement is recomputed every this many plans
+#define PLAN_FULL_INTERVAL 10
+// share of dirty domains above which a full plan is cheaper than an incremental one
+#define PLAN_MAX_DIRTY_SHARE 0.5
 
-#endif
\ No newline at end of file
+/**
+ * where the emulator and iothreads of the domains run
+ */
+typedef enum ThreadPolicy {
+    // left unpinned, free to run on any cpu
+    THREADS_FLOAT,
+    // pinned to the housekeeping cpus, away from the vcpus
+    THREADS_HOUSEKEEPING,
+    // pinned next to their domain's vcpu, their usage counts towards the domain's usage
+    THREADS_WITH_VCPU
+} ThreadPolicy;
+
+typedef struct SchedulerConfig {
+    /**
+     * host utilisation (total domain usage / number of cpus) below which the load is packed
+     * onto as few cpus as possible instead of spread across every cpu, 0 to always spread
+     */
+    double consolidateBelow;
+    ThreadPolicy threadPolicy;
+    /**
+     * cpus reserved for the daemon and, with the housekeeping policy, the emulator and iothreads.
+     * No vcpu is placed on them
+     */
+    unsigned char housekeepingCpus;
+} SchedulerConfig;
+
+/**
+ * pins the domains whose cpu maps differ in the plan
+ */
+int repinCpus(CpuStats *stats, GuestList *guests, CpuPlan *plan);
+/**
+ * pins the emulator and iothreads of the domains according to the thread policy,
+ * only the domains whose thread placement changed are repinned
+ */
+int pinDomainThreads(CpuStats *stats, GuestList *guests, SchedulerConfig *config, CpuPlan *plan);
+/**
+ * @return thread policy with the given name (float, housekeeping or vcpu), -1 if unknown
+ */
+int SchedulerParseThreadPolicy(const char *name);
+/**
+ * computes a full placement of every domain from empty cpus, without pinning anything
+ * @param plan filled with the target weights and cpu maps of the placement, the weight
+ * left to fill on each cpu is left in its target weights
+ */
+int planCpus(CpuStats *stats, SchedulerConfig *config, CpuPlan *plan);
+/**
+ * balances the domains across the active cpus and pins them according to the new placement.
+ * Only the domains whose demand changed since their last placement, and the domains of cpus
+ * above their target, are re-planned against the existing cpu maps, except for a periodic full plan
+ * @param plan filled with the placement of this cycle
+ */
+int allocateCpus(CpuStats *stats, GuestList *guests, SchedulerConfig *config, CpuPlan *plan);
+
+#endif
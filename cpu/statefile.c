@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "check.h"
+#include "log.h"
+#include "statefile.h"
+
+#define StateFileRecordAt(data, recordSize, i) \
+    ((StateFileRecord *) ((char *) (data) + sizeof(StateFileHeader) + (recordSize) * (i)))
+
+double StateFileNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * copies the snapshot currently in the file, if any
+ */
+int StateFileReadPrevious(StateFile *file)
+{
+    struct stat st;
+    void *data = NULL;
+
+    check(fstat(file->fd, &st) == 0, "failed to stat state file");
+    if ((size_t) st.st_size < sizeof(StateFileHeader)) {
+        return 0;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
+    check(data != MAP_FAILED, "failed to map state file");
+    file->previous = malloc(st.st_size);
+    if (file->previous) {
+        memcpy(file->previous, data, st.st_size);
+        file->previousSize = st.st_size;
+    }
+    munmap(data, st.st_size);
+    checkMemAlloc(file->previous);
+
+    return 0;
+error:
+    return -1;
+}
+
+StateFile *StateFileOpen(const char *path, int numCpus, int numDomains)
+{
+    StateFile *file = NULL;
+    void *data = NULL;
+
+    checkNull(path);
+    file = calloc(1, sizeof(StateFile));
+    checkMemAlloc(file);
+    file->fd = -1;
+    file->numCpus = numCpus;
+    file->numDomains = numDomains;
+    file->recordSize = sizeof(StateFileRecord) + 2 * numCpus * sizeof(CpuStatsTime_t);
+    file->size = sizeof(StateFileHeader) + numDomains * file->recordSize;
+
+    file->fd = open(path, O_RDWR | O_CREAT, 0600);
+    check(file->fd >= 0, "failed to open state file");
+    check(StateFileReadPrevious(file) == 0, "failed to read state file");
+    check(ftruncate(file->fd, file->size) == 0, "failed to resize state file");
+
+    data = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    check(data != MAP_FAILED, "failed to map state file");
+    file->header = data;
+
+    return file;
+error:
+    StateFileClose(file);
+    return NULL;
+}
+
+void StateFileClose(StateFile *file)
+{
+    if (file) {
+        if (file->header) {
+            msync(file->header, file->size, MS_SYNC);
+            munmap(file->header, file->size);
+        }
+        if (file->fd >= 0) {
+            close(file->fd);
+        }
+        if (file->previous) {
+            free(file->previous);
+        }
+        free(file);
+    }
+}
+
+int StateFileSave(StateFile *file, CpuStats *stats, CpuPlan *plan, GuestList *guests)
+{
+    StateFileHeader *header = NULL;
+    StateFileRecord *record = NULL;
+    virDomainPtr domain = NULL;
+
+    checkNull(file);
+    checkNull(stats);
+    checkNull(plan);
+    checkNull(guests);
+    header = file->header;
+
+    header->complete = 0;
+    memcpy(header->magic, STATE_FILE_MAGIC, sizeof(header->magic));
+    header->version = STATE_FILE_VERSION;
+    header->recordSize = file->recordSize;
+    header->numCpus = file->numCpus;
+    header->numDomains = file->numDomains;
+
+    for (int d = 0; d < file->numDomains; d++) {
+        record = StateFileRecordAt(header, file->recordSize, d);
+        domain = GuestListDomainAt(guests, d);
+        // the uuid and id of a running domain do not change, only look them up once per process
+        if (!file->saved || record->id != virDomainGetID(domain)) {
+            check(virDomainGetUUIDString(domain, record->uuid) == 0, "failed to get domain uuid");
+            record->id = virDomainGetID(domain);
+        }
+        record->sampleAge = stats->sampleAges[d];
+        record->cpuMap = stats->cpuMaps[d];
+        record->plannedCpuMap = plan->cpuMaps[d];
+        record->domainUsage = (double) stats->domainUsages[d];
+        record->prevDomainUsage = (double) stats->prevDomainUsages[d];
+        memcpy(record->times, stats->times + stats->numCpus * d, stats->numCpus * sizeof(CpuStatsTime_t));
+        memcpy(record->times + stats->numCpus, stats->lastTimeDiffs + stats->numCpus * d,
+            stats->numCpus * sizeof(CpuStatsTime_t));
+    }
+
+    header->time = StateFileNow();
+    header->complete = 1;
+    msync(header, file->size, MS_ASYNC);
+    file->saved = 1;
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * @return index of the record of a domain in the previous snapshot, -1 if it is not there
+ */
+int StateFileFindRecord(StateFile *file, const char *uuid, int id)
+{
+    StateFileHeader *header = file->previous;
+    StateFileRecord *record = NULL;
+
+    for (uint32_t i = 0; i < header->numDomains; i++) {
+        record = StateFileRecordAt(header, header->recordSize, i);
+        if (record->id == id && strncmp(record->uuid, uuid, VIR_UUID_STRING_BUFLEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int StateFileRestore(StateFile *file, CpuStats *stats, CpuPlan *plan, GuestList *guests, double *elapsed)
+{
+    StateFileHeader *header = NULL;
+    StateFileRecord *record = NULL;
+    virDomainPtr domain = NULL;
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    int *records = NULL;
+    int rt = 0;
+
+    checkNull(file);
+    checkNull(stats);
+    checkNull(plan);
+    checkNull(guests);
+    checkNull(elapsed);
+
+    header = file->previous;
+    if (!header || memcmp(header->magic, STATE_FILE_MAGIC, sizeof(header->magic)) != 0) {
+        return 0;
+    }
+    if (stats->numDomains == 0) {
+        return 0;
+    }
+    if (header->version != STATE_FILE_VERSION || !header->complete || header->numCpus != (uint32_t) stats->numCpus ||
+        file->previousSize < sizeof(StateFileHeader) + (size_t) header->numDomains * header->recordSize ||
+        header->recordSize != file->recordSize) {
+        logWarn("state file does not match this version or host, starting cold");
+        return 0;
+    }
+    *elapsed = StateFileNow() - header->time;
+    if (*elapsed <= 0 || *elapsed > STATE_FILE_MAX_AGE) {
+        logWarn("state file is %.0fs old, starting cold", *elapsed);
+        return 0;
+    }
+
+    // usages cannot be computed for domains missing from the snapshot, so it is only
+    // used if every domain is still running
+    records = calloc(stats->numDomains, sizeof(int));
+    checkMemAlloc(records);
+    for (int d = 0; d < stats->numDomains; d++) {
+        domain = GuestListDomainAt(guests, d);
+        check(virDomainGetUUIDString(domain, uuid) == 0, "failed to get domain uuid");
+        records[d] = StateFileFindRecord(file, uuid, virDomainGetID(domain));
+        if (records[d] < 0) {
+            logInfo("domain %d is not in the state file, starting cold", d);
+            rt = 0;
+            goto final;
+        }
+    }
+
+    for (int d = 0; d < stats->numDomains; d++) {
+        record = StateFileRecordAt(header, header->recordSize, records[d]);
+        // the cpu times of a domain that was not sampled lately span more than one cycle
+        stats->sampleAges[d] = record->sampleAge;
+        stats->cpuMaps[d] = record->cpuMap;
+        plan->cpuMaps[d] = record->plannedCpuMap;
+        stats->domainUsages[d] = record->domainUsage;
+        stats->prevDomainUsages[d] = record->prevDomainUsage;
+        memcpy(stats->times + stats->numCpus * d, record->times, stats->numCpus * sizeof(CpuStatsTime_t));
+        memcpy(stats->lastTimeDiffs + stats->numCpus * d, record->times + stats->numCpus,
+            stats->numCpus * sizeof(CpuStatsTime_t));
+    }
+    rt = stats->numDomains;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    if (records) {
+        free(records);
+    }
+    return rt;
+}
+
+CpuStats *StateFileLoadStats(const char *path, double *age)
+{
+    int fd = -1;
+    struct stat st;
+    void *data = NULL;
+    StateFileHeader *header = NULL;
+    StateFileRecord *record = NULL;
+    CpuStats *stats = NULL;
+
+    checkNull(path);
+    checkNull(age);
+
+    fd = open(path, O_RDONLY);
+    check(fd >= 0, "failed to open state file");
+    check(fstat(fd, &st) == 0, "failed to stat state file");
+    check((size_t) st.st_size >= sizeof(StateFileHeader), "state file holds no snapshot");
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    check(data != MAP_FAILED, "failed to map state file");
+    header = data;
+
+    check(memcmp(header->magic, STATE_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == STATE_FILE_VERSION && header->complete,
+        "state file does not hold a complete snapshot of this version");
+    // cpu maps are a single byte, there are at most 8 cpus
+    check(header->numCpus > 0 && header->numCpus <= 8 * sizeof(unsigned char) &&
+        header->recordSize == sizeof(StateFileRecord) + 2 * header->numCpus * sizeof(CpuStatsTime_t) &&
+        (size_t) st.st_size >= sizeof(StateFileHeader) + (size_t) header->numDomains * header->recordSize,
+        "state file is truncated or corrupted");
+
+    stats = CpuStatsCreate(header->numCpus, header->numDomains, 0);
+    check(stats, "failed to create stats");
+    for (uint32_t d = 0; d < header->numDomains; d++) {
+        record = StateFileRecordAt(header, header->recordSize, d);
+        stats->cpuMaps[d] = record->cpuMap;
+        stats->domainUsages[d] = record->domainUsage;
+        stats->prevDomainUsages[d] = record->prevDomainUsage;
+        stats->sampled[d] = 1;
+        stats->sampleAges[d] = record->sampleAge;
+        stats->hot[d] = 0;
+    }
+    *age = StateFileNow() - header->time;
+
+    munmap(data, st.st_size);
+    close(fd);
+    return stats;
+error:
+    if (data && data != MAP_FAILED) {
+        munmap(data, st.st_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    CpuStatsFree(stats);
+    return NULL;
+}
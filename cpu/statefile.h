@@ -0,0 +1,105 @@
+#ifndef statefile_h
+#define statefile_h
+
+#include <stdint.h>
+#include <libvirt/libvirt.h>
+#include "cpustats.h"
+#include "cpuplan.h"
+#include "guestlist.h"
+
+#define STATE_FILE_MAGIC "VCPUSTAT"
+// must be incremented whenever the layout of the header or records changes
+#define STATE_FILE_VERSION 2
+// older snapshots do not describe the current load of the domains
+#define STATE_FILE_MAX_AGE 300
+
+typedef struct StateFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t numCpus;
+    uint32_t numDomains;
+    /**
+     * cleared while the records are written, so that a snapshot
+     * interrupted by a crash is not used
+     */
+    uint32_t complete;
+    uint32_t reserved;
+    /**
+     * wall clock time at which the snapshot was saved (in seconds)
+     */
+    double time;
+} StateFileHeader;
+
+typedef struct StateFileRecord {
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    /**
+     * id of the running domain, a domain that was restarted
+     * has a new id and its cpu time counters were reset
+     */
+    int id;
+    /**
+     * cycles since the domain was last sampled, its cpu times are that old
+     */
+    int sampleAge;
+    unsigned char cpuMap;
+    unsigned char plannedCpuMap;
+    double domainUsage;
+    double prevDomainUsage;
+    /**
+     * cumulative cpu time and time used in the last sampled cycle on each cpu,
+     * followed by numCpus entries of each
+     */
+    CpuStatsTime_t times[];
+} StateFileRecord;
+
+/**
+ * scheduler state persisted in a memory mapped file, so that the scheduler
+ * can make a decision as soon as it restarts
+ */
+typedef struct StateFile {
+    int fd;
+    size_t size;
+    int numCpus;
+    int numDomains;
+    size_t recordSize;
+    /**
+     * whether this process saved the records yet, the uuids left by a previous one
+     * may belong to other domains that got the same ids, e.g. after the host rebooted
+     */
+    int saved;
+    StateFileHeader *header;
+    /**
+     * copy of the snapshot found when the file was opened
+     */
+    void *previous;
+    size_t previousSize;
+} StateFile;
+
+/**
+ * opens (or creates) the state file and keeps a copy of the snapshot it holds
+ * @return state file, should be closed with StateFileClose()
+ */
+StateFile *StateFileOpen(const char *path, int numCpus, int numDomains);
+void StateFileClose(StateFile *file);
+/**
+ * saves the stats and plan of the last cycle
+ */
+int StateFileSave(StateFile *file, CpuStats *stats, CpuPlan *plan, GuestList *guests);
+/**
+ * restores the cpu time counters and estimates of the domains, if all of them
+ * have kept running since the snapshot was saved
+ * @param elapsed set to the time since the snapshot was saved (in seconds)
+ * @return number of domains restored (0 or all of them), -1 on error
+ */
+int StateFileRestore(StateFile *file, CpuStats *stats, CpuPlan *plan, GuestList *guests, double *elapsed);
+/**
+ * reads the snapshot of a state file without connecting to the hypervisor, e.g. the last cycle
+ * of a running scheduler or a snapshot recorded on another host. The file is not modified
+ * @param age set to the time since the snapshot was saved (in seconds)
+ * @return stats holding the usages and cpu maps of the snapshot's domains, should be freed with CpuStatsFree(),
+ * NULL if the file does not hold a complete snapshot of this version
+ */
+CpuStats *StateFileLoadStats(const char *path, double *age);
+
+#endif
@@ -1,10 +1,15 @@
 #ifndef util_h
 #define util_h
 
+#include "params.h"
+
 #define isPinnedToCpu(cpuMap, targetCpuMask) (((cpuMap) & (targetCpuMask)) == (targetCpuMask))
 #define getCpuMask(cpu) ((unsigned char) 1 << cpu)
+#define min(a, b) ((a) <= (b) ? (a) : (b))
+#define max(a, b) ((a) >= (b) ? (a) : (b))
 
-#define EQUALITY_PRECISION 0.1
+// values closer than this are considered equal, set by the parameter profile
+#define EQUALITY_PRECISION (ParamsCurrent()->equalityPrecision)
 
 /**
  * count the number of bits in `byte` that are set
@@ -0,0 +1,335 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include "check.h"
+#include "scheduler.h"
+#include "log.h"
+#include "metrics.h"
+#include "worker.h"
+
+static volatile sig_atomic_t stopping = 0;
+
+void WorkerStopAll(void)
+{
+    stopping = 1;
+}
+
+/**
+ * sleeps until `deadline`, waking up early if the workers are stopped
+ * or if the fast sampler asks for an out-of-band rebalance
+ * @return the saturated cpu if a rebalance was requested, -1 otherwise
+ */
+int WorkerSleepUntil(Worker *worker, MetricsTime deadline)
+{
+    struct timespec step;
+    MetricsTime now;
+    int cpu = -1;
+
+    step.tv_sec = 0;
+    step.tv_nsec = WORKER_SLEEP_STEP_MS * 1000000L;
+    while (!stopping) {
+        if (worker->fastPath && (cpu = FastPathRebalanceRequested(worker->fastPath)) >= 0) {
+            return cpu;
+        }
+        now = MetricsNow();
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+            break;
+        }
+        nanosleep(&step, NULL);
+    }
+    return -1;
+}
+
+int WorkerSetPath(char *dst, const char *path, int index, int numWorkers)
+{
+    int length = 0;
+    if (numWorkers > 1 && path[0] != '\0') {
+        length = snprintf(dst, WORKER_MAX_PATH, "%s.%d", path, index);
+    }
+    else {
+        length = snprintf(dst, WORKER_MAX_PATH, "%s", path);
+    }
+    return length < WORKER_MAX_PATH ? 0 : -1;
+}
+
+Worker *WorkerCreate(int index, const char *uri, WorkerConfig *config, int numWorkers)
+{
+    Worker *worker = NULL;
+
+    checkNull(uri);
+    checkNull(config);
+    worker = calloc(1, sizeof(Worker));
+    checkMemAlloc(worker);
+    worker->index = index;
+    worker->uri = uri;
+    worker->config = *config;
+    check(WorkerSetPath(worker->socketPath, config->socketPath, index, numWorkers) == 0, "socket path too long");
+    check(WorkerSetPath(worker->statePath, config->statePath, index, numWorkers) == 0, "state path too long");
+
+    return worker;
+error:
+    WorkerFree(worker);
+    return NULL;
+}
+
+void WorkerFree(Worker *worker)
+{
+    if (worker) {
+        // the fast sampler uses the connection until it is stopped
+        if (worker->fastPath) {
+            FastPathFree(worker->fastPath);
+        }
+        if (worker->conn) {
+            virConnectClose(worker->conn);
+        }
+        if (worker->guests) {
+            GuestListFree(worker->guests);
+        }
+        if (worker->stats) {
+            CpuStatsFree(worker->stats);
+        }
+        if (worker->plan) {
+            CpuPlanFree(worker->plan);
+        }
+        AffinityFree(worker->affinity);
+        if (worker->introspect) {
+            IntrospectFree(worker->introspect);
+        }
+        if (worker->stateFile) {
+            StateFileClose(worker->stateFile);
+        }
+        free(worker);
+    }
+}
+
+/**
+ * publishes the state of the scheduler to the introspection server,
+ * the cycle is skipped if the previous snapshot is still being read
+ */
+void WorkerPublishSnapshot(Worker *worker, unsigned long cycle)
+{
+    if (!worker->introspect || IntrospectBegin(worker->introspect, cycle) < 0) {
+        return;
+    }
+    CpuStatsRender(worker->stats, worker->introspect);
+    CpuPlanRender(worker->plan, worker->introspect);
+    MetricsRender(worker->introspect);
+    IntrospectPublish(worker->introspect);
+}
+
+/**
+ * measures the daemon's own cpu usage over the last cycle and adapts the sample budget to its cpu budget
+ */
+void WorkerThrottle(Worker *worker)
+{
+    // without a sample budget every domain is sampled, which is the most the budget can be raised to
+    int maxBudget = worker->config.sampleBudget > 0 ?
+        worker->config.sampleBudget : RPCS_PER_SAMPLE * worker->stats->numDomains;
+    int sampleBudget = worker->stats->sampleBudget > 0 ? worker->stats->sampleBudget : maxBudget;
+
+    HousekeepingMeasure(&worker->housekeeping);
+    sampleBudget = HousekeepingThrottle(&worker->housekeeping, sampleBudget, RPCS_PER_SAMPLE, maxBudget);
+    worker->stats->sampleBudget = worker->housekeeping.throttled ? sampleBudget : worker->config.sampleBudget;
+}
+
+/**
+ * reads the affinity groups from the command line and the domains' metadata
+ */
+int WorkerSetAffinity(Worker *worker)
+{
+    int rt = 0;
+
+    worker->affinity = AffinityCreate(worker->stats->numCpus, worker->guests->count);
+    check(worker->affinity, "failed to create affinity groups");
+    rt = AffinitySetLocalities(worker->affinity, worker->conn, worker->config.localities);
+    check(rt == 0, "failed to set cpu localities");
+    for (int i = 0; i < worker->config.numAffinityGroups; i++) {
+        rt = AffinityAddSpec(worker->affinity, worker->guests, worker->config.affinityGroups[i]);
+        check(rt == 0, "failed to add affinity group");
+    }
+    rt = AffinityReadMetadata(worker->affinity, worker->guests);
+    check(rt == 0, "failed to read affinity groups from domain metadata");
+
+    if (worker->affinity->numGroups > 0) {
+        logInfo("%d affinity groups over %d cpu localities", worker->affinity->numGroups,
+            worker->affinity->numLocalities);
+        worker->plan->affinity = worker->affinity;
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * connects to the hypervisor and prepares the worker's stats, plan,
+ * introspection server and state file
+ */
+int WorkerInit(Worker *worker)
+{
+    worker->conn = virConnectOpen(worker->uri);
+    check(worker->conn, "Failed to connect to host");
+
+    worker->guests = GuestListGet(worker->conn);
+    check(worker->guests, "Failed to create guest list");
+
+    worker->stats = CpuStatsCreate(4, worker->guests->count, worker->config.sampleBudget);
+    check(worker->stats, "Failed to create stats");
+
+    // emulator and iothreads running next to the vcpus take their share of the domain's cpus
+    worker->stats->includeOverhead = worker->config.scheduler.threadPolicy == THREADS_WITH_VCPU;
+
+    worker->plan = CpuPlanCreate(worker->stats->numCpus, worker->guests->count);
+    check(worker->plan, "Failed to create cpu plan");
+
+    check(WorkerSetAffinity(worker) == 0, "Failed to set affinity groups");
+
+    // the scheduler keeps running without introspection if the socket cannot be created
+    if (worker->socketPath[0] != '\0') {
+        worker->introspect = IntrospectCreate("vcpu_scheduler", worker->socketPath);
+        if (!worker->introspect || IntrospectStart(worker->introspect) < 0) {
+            logWarn("introspection disabled, could not serve %s", worker->socketPath);
+            IntrospectFree(worker->introspect);
+            worker->introspect = NULL;
+        }
+    }
+
+    if (worker->config.fastIntervalMs > 0 && worker->config.fastTopK > 0) {
+        worker->fastPath = FastPathCreate(worker->guests, worker->stats->numCpus,
+            worker->config.fastIntervalMs, worker->config.fastTopK);
+        check(worker->fastPath, "Failed to create fast path sampler");
+        worker->fastPath->metricsSource = worker->index;
+    }
+
+    if (worker->statePath[0] != '\0') {
+        worker->stateFile = StateFileOpen(worker->statePath, worker->stats->numCpus, worker->guests->count);
+        if (!worker->stateFile) {
+            logWarn("state will not be saved, could not open %s", worker->statePath);
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+void *WorkerRun(void *arg)
+{
+    Worker *worker = arg;
+    CpuStats *stats = NULL;
+    GuestList *guests = NULL;
+    CpuPlan *plan = NULL;
+    unsigned long cycle = 0;
+    int restored = 0;
+    double elapsed = 0;
+    int saturatedCpu = -1;
+    int rt = 0;
+    MetricsTime start;
+    MetricsTime deadline;
+
+    MetricsSetSource(worker->index, worker->uri);
+    LogAttachThread(worker->uri);
+
+    rt = WorkerInit(worker);
+    check(rt == 0, "failed to initialize worker");
+    HousekeepingInit(&worker->housekeeping, worker->config.cpuBudget);
+    stats = worker->stats;
+    guests = worker->guests;
+    plan = worker->plan;
+
+    if (worker->stateFile) {
+        restored = StateFileRestore(worker->stateFile, stats, plan, guests, &elapsed);
+    }
+
+    if (restored > 0) {
+        // the restored cpu times give the usage since the snapshot, no need to wait for a full interval
+        logInfo("restored the state of %d domains saved %.1fs ago", restored, elapsed);
+        rt = updateStats(stats, guests, elapsed);
+        check(rt == 0, "error updating stats");
+        CpuStatsPrint(stats);
+        rt = allocateCpus(stats, guests, &worker->config.scheduler, plan);
+        check(rt == 0, "error allocating cpus");
+        StateFileSave(worker->stateFile, stats, plan, guests);
+    }
+    else {
+        rt = updateStats(stats, guests, -1);
+        check(rt == 0, "error updating stats");
+        CpuStatsPrint(stats);
+    }
+
+    if (worker->fastPath) {
+        FastPathWatch(worker->fastPath, stats);
+        rt = FastPathStart(worker->fastPath);
+        check(rt == 0, "failed to start fast path sampler");
+    }
+
+    deadline = MetricsNow();
+    while (!stopping) {
+        logDebug("sleeping...");
+        deadline.tv_sec += worker->config.interval;
+        while ((saturatedCpu = WorkerSleepUntil(worker, deadline)) >= 0) {
+            // out-of-band rebalance with the stats of the last cycle and the bursts seen since,
+            // the next cycle still happens on schedule
+            logInfo("cpu %d saturated, rebalancing out of band", saturatedCpu);
+            rt = FastPathDrain(worker->fastPath, stats);
+            check(rt >= 0, "error draining fast path");
+            rt = allocateCpus(stats, guests, &worker->config.scheduler, plan);
+            check(rt == 0, "error allocating cpus");
+            FastPathWatch(worker->fastPath, stats);
+        }
+        if (stopping) {
+            break;
+        }
+        logDebug("scheduling...");
+        start = MetricsNow();
+        rt = updateStats(stats, guests, worker->config.interval);
+        check(rt == 0, "error updating stats");
+        rt = InterferenceUpdate(plan->interference, stats);
+        check(rt == 0, "error updating co-location history");
+        if (worker->fastPath) {
+            rt = FastPathDrain(worker->fastPath, stats);
+            check(rt >= 0, "error draining fast path");
+        }
+        MetricsRecordPhase(METRICS_COLLECT, start);
+        rt = allocateCpus(stats, guests, &worker->config.scheduler, plan);
+        check(rt == 0, "error allocating cpus");
+        if (worker->fastPath) {
+            FastPathWatch(worker->fastPath, stats);
+        }
+        MetricsCountCycle();
+        if (worker->stateFile) {
+            StateFileSave(worker->stateFile, stats, plan, guests);
+        }
+        WorkerPublishSnapshot(worker, ++cycle);
+        WorkerThrottle(worker);
+        logInfo("scheduling cycle done, daemon cpu usage %.1f%%", 100 * worker->housekeeping.usage);
+    }
+
+    return NULL;
+error:
+    logError("scheduling of %s stopped", worker->uri);
+    worker->failed = 1;
+    return NULL;
+}
+
+int WorkerStart(Worker *worker)
+{
+    checkNull(worker);
+    check(pthread_create(&worker->thread, NULL, WorkerRun, worker) == 0, "failed to start worker thread");
+    worker->started = 1;
+
+    return 0;
+error:
+    return -1;
+}
+
+void WorkerJoin(Worker *worker)
+{
+    if (worker && worker->started) {
+        pthread_join(worker->thread, NULL);
+        worker->started = 0;
+    }
+}
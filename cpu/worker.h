@@ -0,0 +1,91 @@
+#ifndef worker_h
+#define worker_h
+
+#include <pthread.h>
+#include <libvirt/libvirt.h>
+#include "guestlist.h"
+#include "cpustats.h"
+#include "cpuplan.h"
+#include "scheduler.h"
+#include "fastpath.h"
+#include "housekeeping.h"
+#include "introspect.h"
+#include "statefile.h"
+
+#define WORKER_MAX_PATH 256
+// granularity at which a sleeping worker checks for stop and rebalance requests
+#define WORKER_SLEEP_STEP_MS 100
+
+typedef struct WorkerConfig {
+    int interval;
+    int sampleBudget;
+    SchedulerConfig scheduler;
+    /**
+     * period of the fast sampler (in ms) and number of domains it watches, 0 to disable it
+     */
+    int fastIntervalMs;
+    int fastTopK;
+    /**
+     * share of one cpu the daemon may use before it reduces its sampling, 0 for no budget
+     */
+    double cpuBudget;
+    /**
+     * affinity groups declared on the command line, as <together|apart>:<hard|soft>:<group>=<domain>[,<domain>...],
+     * on top of the groups declared in the domains' metadata
+     */
+    char **affinityGroups;
+    int numAffinityGroups;
+    /**
+     * comma separated cpu masks of the cpus sharing a last level cache or NUMA node, NULL to use the NUMA nodes
+     */
+    const char *localities;
+    /**
+     * introspection socket and state file paths, empty to disable them. With several
+     * connections, the index of the connection is appended to each path
+     */
+    const char *socketPath;
+    const char *statePath;
+} WorkerConfig;
+
+/**
+ * schedules the domains of one hypervisor connection on its own thread.
+ * Workers do not share any state, each one has its own connection, guest list, stats and plan
+ */
+typedef struct Worker {
+    int index;
+    const char *uri;
+    WorkerConfig config;
+    char socketPath[WORKER_MAX_PATH];
+    char statePath[WORKER_MAX_PATH];
+    virConnectPtr conn;
+    GuestList *guests;
+    CpuStats *stats;
+    CpuPlan *plan;
+    Affinity *affinity;
+    Introspect *introspect;
+    StateFile *stateFile;
+    FastPath *fastPath;
+    Housekeeping housekeeping;
+    pthread_t thread;
+    int started;
+    // set when the worker stopped because of an error
+    int failed;
+} Worker;
+
+/**
+ * @param numWorkers total number of workers, paths are only suffixed with the index if there are several
+ * @return worker, should be freed with WorkerFree()
+ */
+Worker *WorkerCreate(int index, const char *uri, WorkerConfig *config, int numWorkers);
+int WorkerStart(Worker *worker);
+/**
+ * waits for the worker's thread to finish
+ */
+void WorkerJoin(Worker *worker);
+void WorkerFree(Worker *worker);
+/**
+ * asks every worker to stop after its current cycle, safe to call from a signal handler
+ */
+void WorkerStopAll(void);
+
+#endif
@@ -66,6 +66,19 @@ error:
     return -1;
 }
 
+MemStatUnit AllocPlanCellGrowth(AllocPlan *plan, MemStats *stats, int cell)
+{
+    MemStatUnit growth = 0;
+    MemStatUnit domainGrowth = 0;
+    for (int i = 0; i < plan->numDomains; i++) {
+        domainGrowth = (MemStatUnit) plan->newSizes[i] - stats->domainStats[i].actual;
+        if (domainGrowth > 0 && MemStatsIsDomainOnCell(stats, i, cell)) {
+            growth += domainGrowth / MemStatsDomainNumCells(stats, i);
+        }
+    }
+    return growth;
+}
+
 int AllocPlanReset(AllocPlan *plan)
 {
     checkNull(plan);
@@ -111,3 +124,22 @@ void AllocPlanFree(AllocPlan *plan)
         free(plan);
     }
 }
+
+int AllocPlanRender(AllocPlan *plan, Introspect *introspect)
+{
+    int rt = 0;
+    checkNull(plan);
+    checkNull(introspect);
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "{\"domains\":[");
+    for (int i = 0; i < plan->numDomains; i++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "%s{\"alloc\":%.0f,\"dealloc\":%.0f,\"new_size\":%lu}",
+            i > 0 ? "," : "", plan->toAlloc[i], plan->toDealloc[i], plan->newSizes[i]);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PLAN, "]}\n");
+    check(rt == 0, "failed to render allocation plan");
+
+    return 0;
+error:
+    return -1;
+}
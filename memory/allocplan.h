@@ -19,5 +19,16 @@ MemStatUnit AllocPlanDiff(AllocPlan *plan);
 int AllocPlanAddAlloc(AllocPlan *plan, int domain, MemStatUnit size);
 int AllocPlanAddDealloc(AllocPlan *plan, int domain, MemStatUnit size);
 int AllocPlanComputeNewSizes(AllocPlan *plan, MemStats *stats);
+/**
+ * computes how much domains would grow on the given NUMA cell if the plan's
+ * new sizes were set. The growth of domains bound to several cells is split evenly
+ * across them. Only domains that grow are counted.
+ * @return growth in kB
+ */
+MemStatUnit AllocPlanCellGrowth(AllocPlan *plan, MemStats *stats, int cell);
+/**
+ * renders the plan as JSON in the introspection snapshot
+ */
+int AllocPlanRender(AllocPlan *plan, Introspect *introspect);
 
 #endif
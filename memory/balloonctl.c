@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "check.h"
+#include "util.h"
+#include "log.h"
+#include "balloonctl.h"
+
+#define isInBand(measurement) ((measurement) >= BALLOON_CTL_BAND_LOW && (measurement) <= BALLOON_CTL_BAND_HIGH)
+
+BalloonCtl *BalloonCtlCreate(int numDomains)
+{
+    BalloonCtl *ctl = NULL;
+    ctl = calloc(1, sizeof(BalloonCtl));
+    checkMemAlloc(ctl);
+    ctl->numDomains = numDomains;
+    ctl->states = calloc(numDomains, sizeof(BalloonCtlState));
+    checkMemAlloc(ctl->states);
+
+    return ctl;
+error:
+    BalloonCtlFree(ctl);
+    return NULL;
+}
+
+void BalloonCtlFree(BalloonCtl *ctl)
+{
+    if (ctl) {
+        if (ctl->states) {
+            free(ctl->states);
+        }
+        free(ctl);
+    }
+}
+
+MemStatUnit BalloonCtlUpdate(BalloonCtl *ctl, int dom, MemStatUnit measurement)
+{
+    BalloonCtlState *state = ctl->states + dom;
+    double error = 0;
+    double derivative = 0;
+    MemStatUnit output = 0;
+
+    if (isInBand(measurement)) {
+        // deadband: leave the domain alone and let the accumulated error fade out
+        if (state->cyclesOutOfBand > 0) {
+            ctl->metrics.numConvergences += 1;
+            ctl->metrics.convergenceCycles += state->cyclesOutOfBand;
+            state->cyclesOutOfBand = 0;
+        }
+        state->integral = state->integral / 2;
+    }
+    else {
+        state->cyclesOutOfBand += 1;
+        error = BALLOON_CTL_TARGET - measurement;
+        state->integral = max(min(state->integral + error, BALLOON_CTL_MAX_INTEGRAL), -BALLOON_CTL_MAX_INTEGRAL);
+        // derivative on measurement: how much free memory the domain consumed since the last cycle
+        derivative = state->hasMeasurement ? state->prevMeasurement - measurement : 0;
+        output = BALLOON_CTL_KP * error + BALLOON_CTL_KI * state->integral + BALLOON_CTL_KD * derivative;
+        // never shrink a domain below the band or grow a domain above it
+        output = measurement < BALLOON_CTL_BAND_LOW ? max(output, 0) : min(output, 0);
+        output = max(min(output, BALLOON_CTL_MAX_GROW), -BALLOON_CTL_MAX_SHRINK);
+    }
+
+    state->prevMeasurement = measurement;
+    state->hasMeasurement = 1;
+    state->output = output;
+    return output;
+}
+
+void BalloonCtlRecordAdjustment(BalloonCtl *ctl, int dom, MemStatUnit adjustment)
+{
+    BalloonCtlState *state = ctl->states + dom;
+    if (adjustment == 0) {
+        return;
+    }
+    if (adjustment > 0) {
+        ctl->metrics.deflated += adjustment;
+    }
+    else {
+        ctl->metrics.inflated += -adjustment;
+    }
+    if (adjustment * state->lastAdjustment < 0) {
+        ctl->metrics.numReversals += 1;
+    }
+    ctl->metrics.numAdjustments += 1;
+    state->lastAdjustment = adjustment;
+}
+
+void BalloonCtlPrintMetrics(BalloonCtl *ctl)
+{
+    BalloonCtlMetrics *metrics = &ctl->metrics;
+    logInfo("Balloon traffic: inflated %.1fkb, deflated %.1fkb in %d adjustments (%d reversals)",
+        metrics->inflated, metrics->deflated, metrics->numAdjustments, metrics->numReversals);
+    logInfo("Convergence: %d domains back in band, %.2f cycles on average",
+        metrics->numConvergences,
+        metrics->numConvergences > 0 ? (double) metrics->convergenceCycles / metrics->numConvergences : 0);
+}
@@ -0,0 +1,92 @@
+#ifndef balloonctl_h
+#define balloonctl_h
+
+#include "memstats.h"
+
+// band of free memory (unused + reclaimable caches) each domain is driven to,
+// matches the coordinator's starving and wasteful thresholds
+#define BALLOON_CTL_BAND_LOW (100 * 1024)
+#define BALLOON_CTL_BAND_HIGH (300 * 1024)
+#define BALLOON_CTL_TARGET (200 * 1024)
+// controller gains
+#define BALLOON_CTL_KP 0.5
+#define BALLOON_CTL_KI 0.1
+#define BALLOON_CTL_KD 1.0
+// limit on the accumulated error to prevent integral windup
+#define BALLOON_CTL_MAX_INTEGRAL (1024 * 1024)
+// maximum balloon deflate (memory given to the domain) in one cycle
+#define BALLOON_CTL_MAX_GROW (512 * 1024)
+// maximum balloon inflate (memory taken from the domain) in one cycle
+#define BALLOON_CTL_MAX_SHRINK (100 * 1024)
+
+typedef struct BalloonCtlState {
+    double integral;
+    MemStatUnit prevMeasurement;
+    int hasMeasurement;
+    /**
+     * Output of the last update, positive to grow the domain, negative to shrink it (in kB)
+     */
+    MemStatUnit output;
+    /**
+     * Last balloon change applied to the domain (in kB)
+     */
+    MemStatUnit lastAdjustment;
+    /**
+     * Number of cycles since the domain left the band, 0 when in band
+     */
+    int cyclesOutOfBand;
+} BalloonCtlState;
+
+typedef struct BalloonCtlMetrics {
+    /**
+     * Total memory taken from domains by inflating their balloons (in kB)
+     */
+    MemStatUnit inflated;
+    /**
+     * Total memory given to domains by deflating their balloons (in kB)
+     */
+    MemStatUnit deflated;
+    /**
+     * Number of balloon size changes
+     */
+    int numAdjustments;
+    /**
+     * Number of balloon size changes in the opposite direction of the domain's previous change
+     */
+    int numReversals;
+    /**
+     * Number of times a domain got back into the band and the total cycles it took
+     */
+    int numConvergences;
+    int convergenceCycles;
+} BalloonCtlMetrics;
+
+typedef struct BalloonCtl {
+    int numDomains;
+    BalloonCtlState *states;
+    BalloonCtlMetrics metrics;
+} BalloonCtl;
+
+#define BalloonCtlOutput(ctl, dom) ((ctl)->states[(dom)].output)
+
+/**
+ * creates per-domain feedback controllers that drive each domain's
+ * free memory towards the target band
+ * @return pointer to controller object. Created object should be freed using BalloonCtlFree()
+ */
+BalloonCtl *BalloonCtlCreate(int numDomains);
+void BalloonCtlFree(BalloonCtl *ctl);
+/**
+ * updates the domain's controller with its current free memory, should
+ * be called exactly once per domain per cycle
+ * @return the balloon change to apply (in kB), positive to grow, negative to shrink,
+ * 0 when the domain is inside the band
+ */
+MemStatUnit BalloonCtlUpdate(BalloonCtl *ctl, int dom, MemStatUnit measurement);
+/**
+ * records a balloon change actually applied to the domain
+ */
+void BalloonCtlRecordAdjustment(BalloonCtl *ctl, int dom, MemStatUnit adjustment);
+void BalloonCtlPrintMetrics(BalloonCtl *ctl);
+
+#endif
@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "check.h"
+#include "capacity.h"
+#include "coordinator.h"
+#include "allocplan.h"
+#include "balloonctl.h"
+#include "util.h"
+#include "metrics.h"
+
+static const char *sloNames[] = {"none", "host_floor", "starvation"};
+
+/**
+ * memory of a simulated domain: what its processes use, which it never gives back, and its
+ * reclaimable caches, which it drops when its balloon takes more than its unused memory (in kB)
+ */
+typedef struct CapacityGuest {
+    MemStatUnit used;
+    MemStatUnit cache;
+} CapacityGuest;
+
+void CapacityInit(Capacity *capacity, MemStatUnit hostAvailable)
+{
+    memset(capacity, 0, sizeof(Capacity));
+    capacity->hostAvailable = hostAvailable;
+}
+
+int CapacityAddProfile(Capacity *capacity, const char *spec)
+{
+    CapacityProfile *profile = NULL;
+    const char *separator = NULL;
+    double memory = 0;
+    double used = 0;
+    int length = 0;
+
+    checkNull(capacity);
+    checkNull(spec);
+    check(capacity->numProfiles < CAPACITY_MAX_PROFILES, "too many guest profiles");
+    separator = strchr(spec, '=');
+    check(separator && separator > spec && separator - spec < CAPACITY_MAX_NAME,
+        "guest profile should be <name>=<memory_mb>:<used_mb>");
+    check(sscanf(separator + 1, "%lf:%lf%n", &memory, &used, &length) == 2 && separator[1 + length] == '\0',
+        "guest profile should be <name>=<memory_mb>:<used_mb>");
+    check(memory > 0 && used >= 0, "guest profile memory should be positive");
+
+    profile = capacity->profiles + capacity->numProfiles;
+    memset(profile, 0, sizeof(CapacityProfile));
+    memcpy(profile->name, spec, separator - spec);
+    profile->memory = memory * 1024;
+    profile->used = used * 1024;
+    capacity->numProfiles += 1;
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * updates the stats of a domain from what it uses and its current balloon size, as its balloon driver would
+ * report them. A domain whose balloon holds less than it uses pages the difference in every cycle
+ * @return whether the domain is starving
+ */
+int CapacityUpdateGuest(MemStats *stats, int d, CapacityGuest *guest, int firstCycle)
+{
+    DomainMemStats *domainStats = stats->domainStats + d;
+    DomainMemStats *deltas = stats->domainDeltas + d;
+    MemStatUnit unused = domainStats->actual - guest->used - guest->cache;
+    MemStatUnit paged = max(guest->used - domainStats->actual, 0);
+
+    if (unused < 0) {
+        guest->cache = max(guest->cache + unused, 0);
+        unused = max(domainStats->actual - guest->used - guest->cache, 0);
+    }
+    deltas->unused = firstCycle ? 0 : unused - domainStats->unused;
+    deltas->swapIn = paged;
+    deltas->majorFault = 0;
+    domainStats->unused = unused;
+    domainStats->usable = unused + guest->cache;
+    domainStats->diskCaches = guest->cache;
+    domainStats->swapIn += paged;
+    stats->sampling[d].sampled = 1;
+    stats->sampling[d].stale = 0;
+
+    return paged > 0 || unused + guest->cache < BALLOON_CTL_BAND_LOW;
+}
+
+/**
+ * runs the coordination policy on the domains of the snapshot and `numGuests` additional guests,
+ * the profiles taking turns. The plan of each cycle is applied right away
+ */
+int CapacitySimulate(Capacity *capacity, MemStats *base, int numGuests, CapacityRun *run)
+{
+    int rt = 0;
+    int numDomains = base->numDomains + numGuests;
+    MemStats *stats = NULL;
+    AllocPlan *plan = NULL;
+    BalloonCtl *ctl = NULL;
+    CapacityGuest *guests = NULL;
+    CapacityProfile *profile = NULL;
+    DomainMemStats *domainStats = NULL;
+    MemStatUnit available = capacity->hostAvailable;
+    MemStatUnit newSize = 0;
+    MemStatUnit change = 0;
+
+    stats = MemStatsCreateEmpty(numDomains, 0);
+    checkMemAlloc(stats);
+    plan = AllocPlanCreate(numDomains);
+    checkMemAlloc(plan);
+    ctl = BalloonCtlCreate(numDomains);
+    checkMemAlloc(ctl);
+    guests = calloc(numDomains, sizeof(CapacityGuest));
+    checkMemAlloc(guests);
+
+    // the snapshot's domains keep what they use, their caches are what they could give back without swapping
+    for (int d = 0; d < base->numDomains; d++) {
+        stats->domainStats[d] = base->domainStats[d];
+        stats->reclaimHistory[d] = base->reclaimHistory[d];
+        domainStats = stats->domainStats + d;
+        guests[d].cache = MemStatsReclaimable(base, d);
+        guests[d].used = max(domainStats->actual - domainStats->unused - guests[d].cache, 0);
+        domainStats->max = domainStats->max > 0 ? domainStats->max : domainStats->actual;
+    }
+    // the additional guests boot with their whole memory taken from the host
+    for (int g = 0; g < numGuests; g++) {
+        profile = capacity->profiles + g % capacity->numProfiles;
+        domainStats = stats->domainStats + base->numDomains + g;
+        domainStats->actual = profile->memory;
+        domainStats->max = profile->memory;
+        guests[base->numDomains + g].used = profile->used;
+        available -= profile->memory;
+    }
+
+    memset(run, 0, sizeof(CapacityRun));
+    run->minAvailable = available;
+    for (int cycle = 0; cycle < CAPACITY_CYCLES; cycle++) {
+        for (int d = 0; d < numDomains; d++) {
+            CapacityUpdateGuest(stats, d, guests + d, cycle == 0);
+        }
+        stats->hostStats.available = available;
+        stats->hostStats.free = available;
+        run->minAvailable = min(run->minAvailable, available);
+        run->broken[CAPACITY_SLO_HOST_FLOOR] |= available < hostReserve(stats);
+
+        rt = planMemory(stats, plan, ctl);
+        check(rt == 0, "failed to plan memory allocations");
+        capacity->numCycles += 1;
+
+        // balloons are resized at once and domains cannot grow beyond their max memory
+        for (int d = 0; d < numDomains; d++) {
+            domainStats = stats->domainStats + d;
+            newSize = min((MemStatUnit) AllocPlanGetNewSize(plan, d), domainStats->max);
+            change = newSize - domainStats->actual;
+            if (almostEquals(newSize, domainStats->actual)) {
+                continue;
+            }
+            BalloonCtlRecordAdjustment(ctl, d, change);
+            if (change < 0) {
+                MemStatsReclaimHistory(stats, d)->last = -change;
+                run->reclaimed += -change;
+            }
+            available -= change;
+            domainStats->actual = newSize;
+        }
+    }
+
+    for (int d = 0; d < numDomains; d++) {
+        run->numStarving += CapacityUpdateGuest(stats, d, guests + d, 0);
+    }
+    run->available = available;
+    run->minAvailable = min(run->minAvailable, available);
+    run->broken[CAPACITY_SLO_HOST_FLOOR] |= available < hostReserve(stats);
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    MemStatsFree(stats);
+    AllocPlanFree(plan);
+    BalloonCtlFree(ctl);
+    free(guests);
+    return rt;
+}
+
+int CapacityPlan(Capacity *capacity, MemStats *stats)
+{
+    int rt = 0;
+    CapacityRun run;
+    MetricsTime start = MetricsNow();
+    MetricsTime end;
+
+    checkNull(capacity);
+    checkNull(stats);
+    check(capacity->numProfiles > 0, "no guest profile to plan for");
+
+    capacity->numDomains = stats->numDomains;
+    capacity->maxGuests = 0;
+    capacity->brokenSlo = CAPACITY_SLO_NONE;
+    capacity->numCycles = 0;
+
+    rt = CapacitySimulate(capacity, stats, 0, &capacity->baseline);
+    check(rt == 0, "failed to simulate the current domains");
+    capacity->best = capacity->baseline;
+    // a host already below its floor has no room left
+    if (capacity->baseline.broken[CAPACITY_SLO_HOST_FLOOR]) {
+        capacity->brokenSlo = CAPACITY_SLO_HOST_FLOOR;
+        capacity->breaking = capacity->baseline;
+    }
+
+    for (int n = 1; n <= CAPACITY_MAX_GUESTS && capacity->brokenSlo == CAPACITY_SLO_NONE; n++) {
+        rt = CapacitySimulate(capacity, stats, n, &run);
+        check(rt == 0, "failed to simulate the additional guests");
+        // starvation is only held against the guests when more of them starve than without them
+        run.broken[CAPACITY_SLO_STARVATION] = run.numStarving > capacity->baseline.numStarving;
+        if (run.broken[CAPACITY_SLO_HOST_FLOOR]) {
+            capacity->brokenSlo = CAPACITY_SLO_HOST_FLOOR;
+        }
+        else if (run.broken[CAPACITY_SLO_STARVATION]) {
+            capacity->brokenSlo = CAPACITY_SLO_STARVATION;
+        }
+        if (capacity->brokenSlo != CAPACITY_SLO_NONE) {
+            capacity->breaking = run;
+        }
+        else {
+            capacity->maxGuests = n;
+            capacity->best = run;
+        }
+    }
+
+    for (int p = 0; p < capacity->numProfiles; p++) {
+        capacity->profiles[p].numAdded = capacity->maxGuests / capacity->numProfiles +
+            (p < capacity->maxGuests % capacity->numProfiles);
+    }
+    end = MetricsNow();
+    capacity->elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return 0;
+error:
+    return -1;
+}
+
+void CapacityPrintRun(CapacityRun *run, FILE *file)
+{
+    fprintf(file, "{\"host_available_mb\":{\"min\":%.1f,\"last\":%.1f},\"reclaimed_mb\":%.1f,\"starving\":%d}",
+        run->minAvailable / 1024, run->available / 1024, run->reclaimed / 1024, run->numStarving);
+}
+
+void CapacityPrint(Capacity *capacity, FILE *file)
+{
+    fprintf(file, "{\"domains\":%d,\"host_available_mb\":%.1f,\"profiles\":[",
+        capacity->numDomains, capacity->hostAvailable / 1024);
+    for (int p = 0; p < capacity->numProfiles; p++) {
+        fprintf(file, "%s{\"name\":\"%s\",\"memory_mb\":%.1f,\"used_mb\":%.1f,\"added\":%d}", p > 0 ? "," : "",
+            capacity->profiles[p].name, capacity->profiles[p].memory / 1024, capacity->profiles[p].used / 1024,
+            capacity->profiles[p].numAdded);
+    }
+    fprintf(file, "],\"baseline\":");
+    CapacityPrintRun(&capacity->baseline, file);
+    fprintf(file, ",\"max_additional_guests\":%d,", capacity->maxGuests);
+    if (capacity->brokenSlo != CAPACITY_SLO_NONE) {
+        fprintf(file, "\"first_slo_broken\":\"%s\",", sloNames[capacity->brokenSlo]);
+    }
+    else {
+        fprintf(file, "\"first_slo_broken\":null,");
+    }
+    fprintf(file, "\"predicted\":");
+    CapacityPrintRun(&capacity->best, file);
+    fprintf(file, ",\"breaking\":");
+    if (capacity->brokenSlo != CAPACITY_SLO_NONE) {
+        CapacityPrintRun(&capacity->breaking, file);
+    }
+    else {
+        fprintf(file, "null");
+    }
+    fprintf(file, ",\"cycles\":%d,\"elapsed_ms\":%.3f}\n", capacity->numCycles, capacity->elapsed * 1000);
+}
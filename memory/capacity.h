@@ -0,0 +1,94 @@
+#ifndef capacity_h
+#define capacity_h
+
+#include <stdio.h>
+#include "memstats.h"
+
+#define CAPACITY_MAX_PROFILES 8
+#define CAPACITY_MAX_NAME 32
+// the search stops after this many additional guests, which keeps it well under a second
+#define CAPACITY_MAX_GUESTS 128
+// coordination cycles simulated for each number of guests, enough for the balloons of new guests to settle
+#define CAPACITY_CYCLES 60
+
+/**
+ * service level objectives the simulated cycles are checked against
+ */
+typedef enum CapacitySlo {
+    CAPACITY_SLO_NONE = 0,
+    // the memory available on the host drops below the coordinator's host reserve
+    CAPACITY_SLO_HOST_FLOOR,
+    // a guest is left with less free memory (unused and reclaimable caches) than the low edge of the balloon band
+    CAPACITY_SLO_STARVATION
+} CapacitySlo;
+
+/**
+ * hypothetical guest, booted with `memory` and using `used` of it, both in kB
+ */
+typedef struct CapacityProfile {
+    char name[CAPACITY_MAX_NAME];
+    MemStatUnit memory;
+    MemStatUnit used;
+    // number of guests of the profile added in the largest simulation meeting the SLOs
+    int numAdded;
+} CapacityProfile;
+
+/**
+ * outcome of the simulated cycles for one number of additional guests
+ */
+typedef struct CapacityRun {
+    int broken[CAPACITY_SLO_STARVATION + 1];
+    int numStarving;
+    // lowest and last memory available on the host over the cycles (in kB)
+    MemStatUnit minAvailable;
+    MemStatUnit available;
+    // memory the coordinator took back from the guests' balloons (in kB)
+    MemStatUnit reclaimed;
+} CapacityRun;
+
+/**
+ * what-if capacity plan: guests of the profiles are added in turn to a snapshot of the host
+ * and the coordination policy is run forward until an SLO breaks
+ */
+typedef struct Capacity {
+    int numProfiles;
+    CapacityProfile profiles[CAPACITY_MAX_PROFILES];
+    // number of domains in the snapshot and memory available on the host (in kB)
+    int numDomains;
+    MemStatUnit hostAvailable;
+    /**
+     * simulation of the snapshot's own domains. A host below its floor has no room for any guest,
+     * the guests starving there are not held against the additional guests
+     */
+    CapacityRun baseline;
+    // largest number of additional guests simulated without breaking an SLO, and its simulation
+    int maxGuests;
+    CapacityRun best;
+    // first SLO broken by adding one more guest, none if the search stopped at the maximum
+    CapacitySlo brokenSlo;
+    CapacityRun breaking;
+    // number of cycles simulated and time taken by the search (in seconds)
+    int numCycles;
+    double elapsed;
+} Capacity;
+
+/**
+ * initialises a capacity plan without any profile
+ * @param hostAvailable memory available on the host with the snapshot's domains running (in kB)
+ */
+void CapacityInit(Capacity *capacity, MemStatUnit hostAvailable);
+/**
+ * adds a guest profile given as `<name>=<memory_mb>:<used_mb>`
+ */
+int CapacityAddProfile(Capacity *capacity, const char *spec);
+/**
+ * adds guests of the profiles in turn to the domains of `stats` and runs the coordination policy forward,
+ * until one more guest would break an SLO. The snapshot's stats are not modified
+ */
+int CapacityPlan(Capacity *capacity, MemStats *stats);
+/**
+ * writes the result of the plan as a JSON object
+ */
+void CapacityPrint(Capacity *capacity, FILE *file);
+
+#endif
@@ -3,19 +3,32 @@
 #include "check.h"
 #include "coordinator.h"
 #include "allocplan.h"
+#include "balloonctl.h"
+#include "growth.h"
 #include "util.h"
+#include "log.h"
+#include "metrics.h"
+#include "params.h"
 
-#define LOW_UNUSED_THRESHOLD 0.2
-#define SAFE_UNUSED_THRESHOLD 0.3
-// minimum memory change in allocation plan to warrant de-allocation
-#define MIN_CHANGE_FOR_DEALLOC 1024
-#define MIN_GUEST_MEMORY 100 * 1024
-#define MIN_HOST_MEMORY 200 * 1024
-#define MAX_FREE_MEMORY 300 * 1024
-// minimum amount that can be deallocated
-#define MIN_DEALLOC_AMOUNT 1024
-// maximum amount to dealloc from wasteful guest
-#define MAX_WASTEFUL_DEALLOC_AMOUNT 100 * 1024
+// guest page size used to convert major faults to kb
+#define GUEST_PAGE_SIZE 4
+// cycles of paging a domain that is consuming memory or paging above the threshold is given memory for
+#define PAGING_ABSORBED_CYCLES 3
+// tunable thresholds of the policy, set at startup from a profile (see params.h)
+#define MIN_CHANGE_FOR_DEALLOC (ParamsCurrent()->minChangeForDealloc)
+#define MIN_GUEST_MEMORY (ParamsCurrent()->minGuestMemory)
+#define MIN_HOST_MEMORY (ParamsCurrent()->minHostMemory)
+#define MAX_FREE_MEMORY (ParamsCurrent()->maxFreeMemory)
+#define MIN_DEALLOC_AMOUNT (ParamsCurrent()->minDeallocAmount)
+#define MAX_WASTEFUL_DEALLOC_AMOUNT (ParamsCurrent()->maxWastefulDeallocAmount)
+#define PAGING_SWAP_IN_THRESHOLD (ParamsCurrent()->pagingSwapInThreshold)
+#define PAGING_MAJOR_FAULT_THRESHOLD (ParamsCurrent()->pagingMajorFaultThreshold)
+#define CACHE_RECLAIM_RATIO (ParamsCurrent()->cacheReclaimRatio)
+#define SOME_PRESSURE_SCALE (ParamsCurrent()->somePressureScale)
+#define FULL_PRESSURE_LIMIT (ParamsCurrent()->fullPressureLimit)
+#define FAST_SAMPLING_CHANGE (ParamsCurrent()->fastSamplingChange)
+#define FAST_SAMPLING_MARGIN (ParamsCurrent()->fastSamplingMargin)
+#define STABLE_CYCLES_TO_SLOW_DOWN ((int) ParamsCurrent()->stableCyclesToSlowDown)
 
 #define unusedPct(stats, dom) ((stats)->domainStats[(dom)].unused / (stats)->domainStats[(dom)].actual)
 
@@ -25,47 +38,169 @@
 
 #define isUsingMemory(stats, dom) certainlyGreaterThan(-(MIN_CHANGE_FOR_DEALLOC), MemStatsUnusedDelta(stats, dom))
 
-#define canDeallocate(stats, dom) (!isUnusedBelowThreshold(stats, dom))
+#define isPaging(stats, dom) (MemStatsSwapInRate(stats, dom) >= PAGING_SWAP_IN_THRESHOLD ||\
+    MemStatsMajorFaultRate(stats, dom) >= PAGING_MAJOR_FAULT_THRESHOLD)
+
+#define cacheReclaimable(stats, dom) (CACHE_RECLAIM_RATIO * MemStatsReclaimable(stats, dom))
+
+// the policy never acts on stats that are stale or were not sampled in this cycle
+#define isOutdated(stats, dom) (MemStatsIsStale(stats, dom) || !MemStatsWasSampled(stats, dom))
+
+// starving domains and the domains the plan gives memory to are never reclaimed from, not even their caches
+#define canDeallocate(plan, stats, dom) (!isPaging(stats, dom) && !isOutdated(stats, dom) &&\
+    !isUnusedBelowThreshold(stats, dom) && (plan)->toAlloc[(dom)] <= 0)
+
+typedef struct ReclaimCandidate {
+    int domain;
+    MemStatUnit cache;
+} ReclaimCandidate;
+
+/**
+ * estimates how much memory (in kb) the domain had to page in from disk
+ * during the last cycle. Only swap-ins and major faults are considered:
+ * pages swapped out and never read back (cold swap) are not a sign that the
+ * domain needs more memory.
+ */
+MemStatUnit pagingPressure(MemStats *stats, int dom)
+{
+    return max(MemStatsSwapInDelta(stats, dom), MemStatsMajorFaultDelta(stats, dom) * GUEST_PAGE_SIZE);
+}
 
 int isWasteful(MemStats *stats, int dom)
 {
-    return stats->domainStats[dom].unused >= MAX_FREE_MEMORY &&
-        stats->domainDeltas[dom].unused >= 0;
+    return stats->domainStats[dom].unused + cacheReclaimable(stats, dom) >= MAX_FREE_MEMORY &&
+        stats->domainDeltas[dom].unused >= 0 &&
+        !isPaging(stats, dom) &&
+        !isOutdated(stats, dom);
+}
+
+/**
+ * limits the amount to reclaim from a domain based on how
+ * much reclaim it tolerated in the past. Domains which started
+ * paging after a reclaim will not lose more than the largest
+ * amount they previously tolerated.
+ */
+MemStatUnit limitReclaim(MemStats *stats, int dom, MemStatUnit amount)
+{
+    DomainReclaimHistory *history = MemStatsReclaimHistory(stats, dom);
+    if (history->rejected > 0) {
+        amount = min(amount, max(history->maxTolerated, MIN_DEALLOC_AMOUNT));
+    }
+    return amount;
+}
+
+/**
+ * checks how domains reacted to the memory reclaimed from them
+ * in the previous cycle, a reclaim is tolerated if the domain
+ * did not start paging afterwards
+ */
+void updateReclaimHistory(MemStats *stats)
+{
+    DomainReclaimHistory *history = NULL;
+    for (int d = 0; d < stats->numDomains; d++) {
+        history = MemStatsReclaimHistory(stats, d);
+        // wait for fresh stats to see how the domain reacted
+        if (history->last <= 0 || isOutdated(stats, d)) {
+            continue;
+        }
+        if (isPaging(stats, d)) {
+            history->rejected += 1;
+            logInfo("Domain %d started paging after reclaiming %.2fkb", d, history->last);
+        }
+        else {
+            history->tolerated += history->last;
+            history->maxTolerated = max(history->maxTolerated, history->last);
+        }
+        history->last = 0;
+    }
+}
+
+int compareReclaimCandidates(const void *a, const void *b)
+{
+    MemStatUnit cacheA = ((const ReclaimCandidate *) a)->cache;
+    MemStatUnit cacheB = ((const ReclaimCandidate *) b)->cache;
+    // largest caches first
+    return (cacheA < cacheB) - (cacheA > cacheB);
 }
 
-int allocateStarvingGuests(AllocPlan *plan, MemStats *stats)
+/**
+ * runs each domain's balloon controller on its free memory (unused and
+ * reclaimable caches), the outputs are used to size allocations and deallocations
+ */
+void updateBalloonControllers(BalloonCtl *ctl, MemStats *stats)
+{
+    MemStatUnit output = 0;
+    for (int d = 0; d < stats->numDomains; d++) {
+        if (isOutdated(stats, d)) {
+            continue;
+        }
+        output = BalloonCtlUpdate(ctl, d, MemStatsUnused(stats, d) + cacheReclaimable(stats, d));
+        if (output != 0) {
+            logDebug("Domain %d controller output %.1fkb", d, output);
+        }
+    }
+}
+
+int allocateStarvingGuests(AllocPlan *plan, MemStats *stats, BalloonCtl *ctl)
 {
     int rt = 0;
     double threshold = 0;
     double distToThresh = 0;
     double toAlloc = 0;
+    double pressure = 0;
     DomainMemStats *deltas = NULL;
 
     for (int d = 0; d < plan->numDomains; d++) {
+        if (isOutdated(stats, d)) {
+            logDebug("Domain %d stats are outdated (%.0fs old, sampled %d cycles ago), skipping",
+                d, MemStatsSampling(stats, d)->age, MemStatsSampling(stats, d)->cyclesSinceSample);
+            continue;
+        }
         deltas = stats->domainDeltas + d;
         threshold = unusedPct(stats, d) * MemStatsActual(stats, d);
         threshold = threshold > MIN_GUEST_MEMORY ? threshold : MIN_GUEST_MEMORY;
         distToThresh = threshold - MemStatsUnused(stats, d);
+        pressure = isPaging(stats, d) ? pagingPressure(stats, d) : 0;
 
         if (certainlyGreaterThan(0, deltas->unused) && isUnusedBelowThreshold(stats, d)) {
-            // domain has used up more memory and is below threshold
-            // allocate more than the amount needed to reach threshold since domain
-            // is still eating up memory
-            toAlloc = 3 * distToThresh;
-            toAlloc = max(toAlloc, 3 * (-deltas->unused));
+            // domain has used up more memory and is below threshold, the controller
+            // accounts for the memory it's still eating up
+            toAlloc = max(BalloonCtlOutput(ctl, d), PAGING_ABSORBED_CYCLES * pressure);
             toAlloc = ceil(toAlloc);
-            printf("Domain %d has used %'.2fkb and is below threshold (%.1fkb), to allocate %'.1fkb\n",
+            logInfo("Domain %d has used %.2fkb and is below threshold (%.1fkb), to allocate %.1fkb",
                 d, -deltas->unused, threshold, toAlloc);
-            rt = AllocPlanAddAlloc(plan, d, toAlloc);
-            check(rt == 0, "failed to add allocation to plan");
+            if (toAlloc > 0) {
+                rt = AllocPlanAddAlloc(plan, d, toAlloc);
+                check(rt == 0, "failed to add allocation to plan");
+            }
+        }
+        else if (isUnusedBelowThreshold(stats, d) && !isPaging(stats, d) &&
+            cacheReclaimable(stats, d) >= distToThresh) {
+            // domain is not using memory and its disk caches can cover the difference,
+            // the guest will drop caches before it runs out of memory
+            logInfo("Domain %d is inactive and below threshold (%.1fkb), but has %.2fkb reclaimable caches",
+                d, threshold, MemStatsReclaimable(stats, d));
         }
         else if (isUnusedBelowThreshold(stats, d)) {
             // domain is not using memory, but still starving
-            // allocate only what's needed to reach threshold
-            toAlloc = ceil(distToThresh);
-            printf("Domain %d is inactive but below threshold (%.1fkb), to allocate %'.1fkb\n",
+            // allocate at least what's needed to reach threshold, plus one cycle of paging: once back
+            // at the threshold the unused memory absorbs the paging, and as the domain does not consume
+            // more, giving it several cycles ahead only takes it from the host
+            toAlloc = ceil(max(BalloonCtlOutput(ctl, d), distToThresh) + pressure);
+            logInfo("Domain %d is inactive but below threshold (%.1fkb), to allocate %.1fkb",
                 d, threshold, toAlloc);
             rt = AllocPlanAddAlloc(plan, d, toAlloc);
+            check(rt == 0, "failed to add allocation to plan");
+        }
+        else if (isPaging(stats, d)) {
+            // domain still has unused memory but is already paging from disk,
+            // so its working set does not fit. Give it enough memory to
+            // absorb the paging rate before its unused memory drops below threshold
+            toAlloc = ceil(PAGING_ABSORBED_CYCLES * pressure);
+            logInfo("Domain %d is paging %.2fkb/s above threshold, to allocate %.1fkb",
+                d, MemStatsPerSecond(stats, pressure), toAlloc);
+            rt = AllocPlanAddAlloc(plan, d, toAlloc);
+            check(rt == 0, "failed to add allocation to plan");
         }
     }
 
@@ -75,7 +210,7 @@ error:
     return -1;
 }
 
-int deallocateWastefulGuests(AllocPlan *plan, MemStats *stats)
+int deallocateWastefulGuests(AllocPlan *plan, MemStats *stats, BalloonCtl *ctl)
 {
     int rt = 0;
     // DomainMemStats *deltas = NULL;
@@ -83,11 +218,14 @@ int deallocateWastefulGuests(AllocPlan *plan, MemStats *stats)
     MemStatUnit toDealloc = 0;
     for (int d = 0; d < plan->numDomains; d++) {
         if (isWasteful(stats, d)) {
-            aboveThresh = stats->domainStats[d].unused - MAX_FREE_MEMORY;
-            toDealloc = max(aboveThresh / 2, MIN_DEALLOC_AMOUNT);
-            // ensure deallocation happens gradually even if there's a lot of wasted memory
+            // clean disk caches count as wasted memory as well
+            aboveThresh = stats->domainStats[d].unused + cacheReclaimable(stats, d) - MAX_FREE_MEMORY;
+            // the controller output is rate limited to ensure deallocation happens
+            // gradually even if there's a lot of wasted memory
+            toDealloc = max(-BalloonCtlOutput(ctl, d), MIN_DEALLOC_AMOUNT);
             toDealloc = min(toDealloc, MAX_WASTEFUL_DEALLOC_AMOUNT);
-            printf("Domain %d is wasteful with %'.2fkb unused above threshold, to dealloc %'.2fkb\n",
+            toDealloc = limitReclaim(stats, d, toDealloc);
+            logInfo("Domain %d is wasteful with %.2fkb unused and reclaimable above threshold, to dealloc %.2fkb",
                 d, aboveThresh, toDealloc);
             rt = AllocPlanAddDealloc(plan, d, toDealloc);
             check(rt == 0, "failed to add wasteful dealloc to plan");
@@ -104,78 +242,203 @@ int deallocateSafeGuests(AllocPlan *plan, MemStats *stats)
     MemStatUnit deallocMem = 0;
     MemStatUnit deallocQuota = 0;
     MemStatUnit maxQuota = 0;
+    MemStatUnit burst = 0;
+    ReclaimCandidate *candidates = NULL;
+    int numCandidates = 0;
+    int d = 0;
     deallocMem = AllocPlanDiff(plan);
-    int candidates = 0;
 
     if (certainlyGreaterThan(deallocMem, MIN_CHANGE_FOR_DEALLOC)) {
-        printf("Additional %'.2fkb needs to be freed, looking for candidates...\n", deallocMem);
-        for (int d = 0; d < plan->numDomains; d++) {
-            if (canDeallocate(stats, d)) {
-               candidates += 1;
+        logDebug("Additional %.2fkb needs to be freed, looking for candidates...", deallocMem);
+        candidates = calloc(plan->numDomains, sizeof(ReclaimCandidate));
+        checkMemAlloc(candidates);
+        for (d = 0; d < plan->numDomains; d++) {
+            if (canDeallocate(plan, stats, d)) {
+                candidates[numCandidates].domain = d;
+                // caches already claimed by the wasteful pass are not available anymore
+                candidates[numCandidates].cache = max(cacheReclaimable(stats, d) - plan->toDealloc[d], 0);
+                numCandidates += 1;
             }
         }
     }
 
-    if (candidates > 0) {
-        for (int d = 0; d < plan->numDomains; d++) {
-            if (canDeallocate(stats, d)) {
-                deallocQuota = deallocMem / candidates;
-                maxQuota = stats->domainStats[d].unused - unusedThreshold(stats, d);
-                deallocQuota = min(deallocQuota, maxQuota);
-                if (deallocQuota > MIN_CHANGE_FOR_DEALLOC) {
-                    printf("Domain %d eligible for deallocating %'.2fkb\n", d, deallocQuota);
-                    rt = AllocPlanAddDealloc(plan, d, deallocQuota);
-                    check(rt == 0, "failed to add deallocation quota to domain");
-                }
+    if (numCandidates > 0) {
+        // first reclaim disk caches, starting with the domains with the largest caches
+        qsort(candidates, numCandidates, sizeof(ReclaimCandidate), compareReclaimCandidates);
+        for (int c = 0; c < numCandidates && deallocMem > MIN_CHANGE_FOR_DEALLOC; c++) {
+            d = candidates[c].domain;
+            deallocQuota = limitReclaim(stats, d, min(deallocMem, candidates[c].cache));
+            if (deallocQuota > MIN_CHANGE_FOR_DEALLOC) {
+                logDebug("Domain %d eligible for deallocating %.2fkb from caches", d, deallocQuota);
+                rt = AllocPlanAddDealloc(plan, d, deallocQuota);
+                check(rt == 0, "failed to add deallocation quota to domain");
+                deallocMem -= deallocQuota;
+            }
+        }
+
+        // then evenly split the rest across the unused memory of the candidates
+        for (int c = 0; c < numCandidates && deallocMem > MIN_CHANGE_FOR_DEALLOC; c++) {
+            d = candidates[c].domain;
+            deallocQuota = deallocMem / numCandidates;
+            // keep enough unused memory to absorb the domain's recent usage bursts
+            burst = fabs(MemStatsUnusedDelta(stats, d));
+            maxQuota = stats->domainStats[d].unused - unusedThreshold(stats, d) - burst;
+            deallocQuota = min(deallocQuota, maxQuota);
+            deallocQuota = limitReclaim(stats, d, deallocQuota);
+            if (deallocQuota > MIN_CHANGE_FOR_DEALLOC) {
+                logDebug("Domain %d eligible for deallocating %.2fkb", d, deallocQuota);
+                rt = AllocPlanAddDealloc(plan, d, deallocQuota);
+                check(rt == 0, "failed to add deallocation quota to domain");
             }
         }
     }
     else {
-        printf("No additional domains eligible for deallocation\n");
+        logDebug("No additional domains eligible for deallocation");
     }
 
-    return 0;
+    rt = 0;
+    goto final;
+
 error:
-    return -1;
+    rt = -1;
+final:
+    free(candidates);
+    return rt;
+}
+
+#define isHostStalled(stats) ((stats)->hostStats.hasPressure &&\
+    (stats)->hostStats.full.avg10 >= FULL_PRESSURE_LIMIT)
+
+double hostReserve(MemStats *stats)
+{
+    double reserve = MIN_HOST_MEMORY;
+    if (stats->hostStats.hasPressure) {
+        reserve = reserve * (1 + stats->hostStats.some.avg10 / SOME_PRESSURE_SCALE);
+    }
+    reserve += stats->hostStats.emergencyReclaimed;
+    return reserve;
 }
 
 void readjustAllocsToFitHostMemory(AllocPlan *plan, MemStats *stats)
 {
     double remainingFree = 0;
+    double reserve = 0;
     double excess = 0;
     double excessOnDomain = 0;
     
-    // what would be left of free memory if host memory was used to allocate vms
-    remainingFree = (double) stats->hostStats.free - (double) AllocPlanDiff(plan);
-    excess = (double) MIN_HOST_MEMORY - remainingFree;
+    // what would be left of available memory (free + reclaimable host caches)
+    // if host memory was used to allocate vms
+    remainingFree = (double) stats->hostStats.available - (double) AllocPlanDiff(plan);
+    reserve = hostReserve(stats);
+    excess = reserve - remainingFree;
+    if (isHostStalled(stats)) {
+        // host is already thrashing, vms should not grow from host memory at all
+        excess = max(excess, AllocPlanDiff(plan));
+    }
     // how much the new allocations would exceed free memory
     excess = excess > 0 ? excess : 0;
     // how much memory each vm should give back to host to avoid using up free memory on host
     excessOnDomain = stats->numDomains > 0 ? ceil(excess / stats->numDomains) : 0;
 
-    printf("Alloc diff: %'.1fkb, curr free: %'.1fkb, remaining free: %'.1fkb, min free: %'dkb , excess: %'.1fkb, excess dom: %'.2fkb\n",
-        AllocPlanDiff(plan), stats->hostStats.free, remainingFree, MIN_HOST_MEMORY, excess, excessOnDomain);
+    logDebug("Alloc diff: %.1fkb, curr available: %.1fkb, remaining available: %.1fkb, reserve: %.1fkb , excess: %.1fkb, excess dom: %.2fkb",
+        AllocPlanDiff(plan), stats->hostStats.available, remainingFree, reserve, excess, excessOnDomain);
     if (excessOnDomain > 0) {
         for (int i = 0; i < plan->numDomains; i++) {
             plan->newSizes[i] = plan->newSizes[i] - (unsigned long) excessOnDomain;
-            printf("Free host memory exceeded by %'.1fkb, remove %'.1fkb from domain %d, new size %'lu\n",
+            logInfo("Free host memory exceeded by %.1fkb, remove %.1fkb from domain %d, new size %lu",
                 excess, excessOnDomain, i, plan->newSizes[i]);
         }
     }
 }
 
-int executeAllocationPlan(AllocPlan *plan, MemStats *stats, GuestList *guests)
+/**
+ * trims the growth of domains so that no NUMA cell drops below its share
+ * of the host reserve. The host check works on available memory, but a cell
+ * can run out of free memory while the others still have plenty, in which
+ * case the guest's memory would come from a remote cell or trigger an OOM on the local one
+ */
+int readjustAllocsToFitCellMemory(AllocPlan *plan, MemStats *stats)
+{
+    int rt = 0;
+    int numCells = stats->hostStats.numCells;
+    double cellReserve = 0;
+    double growth = 0;
+    double excess = 0;
+    double factor = 0;
+    double *cellFactors = NULL;
+    MemStatUnit domainGrowth = 0;
+
+    if (numCells <= 1) {
+        return 0;
+    }
+
+    cellFactors = calloc(numCells, sizeof(double));
+    checkMemAlloc(cellFactors);
+    cellReserve = hostReserve(stats) / numCells;
+
+    for (int c = 0; c < numCells; c++) {
+        growth = AllocPlanCellGrowth(plan, stats, c);
+        excess = cellReserve - (stats->hostStats.cells[c].free - growth);
+        excess = excess > 0 ? excess : 0;
+        // share of the planned growth the cell can accommodate
+        cellFactors[c] = growth > 0 ? max(1 - excess / growth, 0) : 1;
+        if (cellFactors[c] < 1) {
+            logInfo("Cell %d free memory %.1fkb exceeded by %.1fkb, scaling growth of its domains by %.2f",
+                c, stats->hostStats.cells[c].free, excess, cellFactors[c]);
+        }
+    }
+
+    for (int i = 0; i < plan->numDomains; i++) {
+        domainGrowth = (MemStatUnit) plan->newSizes[i] - stats->domainStats[i].actual;
+        if (domainGrowth <= 0) {
+            continue;
+        }
+        factor = 1;
+        for (int c = 0; c < numCells; c++) {
+            if (MemStatsIsDomainOnCell(stats, i, c)) {
+                factor = min(factor, cellFactors[c]);
+            }
+        }
+        if (factor < 1) {
+            plan->newSizes[i] = (unsigned long) (stats->domainStats[i].actual + floor(domainGrowth * factor));
+            logInfo("Domain %d growth limited by its cells, new size %lu", i, plan->newSizes[i]);
+        }
+    }
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    free(cellFactors);
+    return rt;
+}
+
+int executeAllocationPlan(AllocPlan *plan, MemStats *stats, GuestList *guests, BalloonCtl *ctl, Growth *growth)
 {
     int rt = 0;
     unsigned long newSize = 0;
+    MemStatUnit maxSize = 0;
     virDomainPtr domain;
     for (int i = 0; i < plan->numDomains; i++) {
         domain = GuestListDomainAt(guests, i);
-        newSize = min(plan->newSizes[i], stats->domainStats[i].max);
+        maxSize = stats->domainStats[i].max;
+        if (plan->newSizes[i] > maxSize) {
+            // try to grow the domain beyond its current max memory
+            maxSize = GrowthRaiseMax(growth, domain, i, plan->newSizes[i], stats);
+            check(maxSize > 0, "failed to raise domain max memory");
+        }
+        newSize = min(plan->newSizes[i], maxSize);
         if (!almostEquals(newSize, stats->domainStats[i].actual)) {
-            printf("Setting memory %'lukb for domain %d\n", newSize, i);
+            logInfo("Setting memory %lukb for domain %d", newSize, i);
             rt = virDomainSetMemory(domain, newSize);
+            MetricsCountRpc(METRICS_RPC_ACTUATE, rt != 0);
             check(rt == 0, "failed to set memory for domain");
+            BalloonCtlRecordAdjustment(ctl, i, (MemStatUnit) newSize - stats->domainStats[i].actual);
+            if (newSize < stats->domainStats[i].actual) {
+                MemStatsReclaimHistory(stats, i)->last = stats->domainStats[i].actual - newSize;
+            }
         }
     }
 
@@ -184,22 +447,71 @@ error:
     return -1;
 }
 
+/**
+ * adapts how often each domain's balloon driver collects stats: domains that are
+ * close to their thresholds, changing quickly or were just resized are sampled every
+ * second, the period of stable domains is doubled every few cycles up to the slowest period.
+ * Domains sampled every second are also hot for the coordinator's own sampling
+ */
+int adjustStatsPeriods(AllocPlan *plan, MemStats *stats, GuestList *guests)
+{
+    int rt = 0;
+    int isHot = 0;
+    MemStatUnit measurement = 0;
+    DomainSampling *sampling = NULL;
+
+    for (int d = 0; d < plan->numDomains; d++) {
+        sampling = MemStatsSampling(stats, d);
+        if (!sampling->sampled) {
+            continue;
+        }
+        measurement = MemStatsUnused(stats, d) + cacheReclaimable(stats, d);
+        isHot = isPaging(stats, d) ||
+            MemStatsIsStale(stats, d) ||
+            fabs(MemStatsUnusedDelta(stats, d)) >= FAST_SAMPLING_CHANGE ||
+            measurement < BALLOON_CTL_BAND_LOW + FAST_SAMPLING_MARGIN ||
+            measurement > BALLOON_CTL_BAND_HIGH - FAST_SAMPLING_MARGIN ||
+            !almostEquals(plan->newSizes[d], stats->domainStats[d].actual);
+
+        sampling->hot = isHot;
+        if (isHot) {
+            sampling->stableCycles = 0;
+            rt = MemStatsSetStatsPeriod(stats, guests, d, STATS_PERIOD_FAST);
+        }
+        else {
+            sampling->stableCycles += 1;
+            if (sampling->stableCycles % STABLE_CYCLES_TO_SLOW_DOWN == 0) {
+                rt = MemStatsSetStatsPeriod(stats, guests, d, min(2 * sampling->period, STATS_PERIOD_SLOW));
+            }
+        }
+        check(rt == 0, "failed to adjust stats period");
+    }
+
+    return 0;
+error:
+    return -1;
+}
 
-int reallocateMemory(MemStats *stats, GuestList *guests)
+int planMemory(MemStats *stats, AllocPlan *plan, BalloonCtl *ctl)
 {
     int rt = 0;
-    AllocPlan *plan = NULL;
     checkNull(stats);
-    checkNull(guests);
-    plan = AllocPlanCreate(guests->count);
     checkNull(plan);
+    checkNull(ctl);
+    rt = AllocPlanReset(plan);
+    check(rt == 0, "failed to reset allocation plan");
+
+    // learn from how domains handled the previous cycle's reclaims
+    updateReclaimHistory(stats);
+
+    updateBalloonControllers(ctl, stats);
 
     // get domains that need more memory
-    rt = allocateStarvingGuests(plan, stats);
+    rt = allocateStarvingGuests(plan, stats, ctl);
     check(rt == 0, "failed to allocate starving guests");
 
     // get candidates that are releasing memory
-    rt = deallocateWastefulGuests(plan, stats);
+    rt = deallocateWastefulGuests(plan, stats, ctl);
     check(rt == 0, "failed to deallocate wasteful guests");
 
     // get remaining memory from candidates not using up their memory
@@ -212,15 +524,42 @@ int reallocateMemory(MemStats *stats, GuestList *guests)
     // readjust sizes in order not to exceed free host memory
     readjustAllocsToFitHostMemory(plan, stats);
 
-    rt = executeAllocationPlan(plan, stats, guests);
+    // readjust sizes in order not to exhaust any single NUMA cell
+    rt = readjustAllocsToFitCellMemory(plan, stats);
+    check(rt == 0, "failed to fit allocations to cell memory");
+
+    return 0;
+error:
+    return -1;
+}
+
+int reallocateMemory(MemStats *stats, GuestList *guests, AllocPlan *plan, BalloonCtl *ctl, Growth *growth)
+{
+    int rt = 0;
+    MetricsTime start = MetricsNow();
+    checkNull(stats);
+    checkNull(guests);
+    checkNull(plan);
+    checkNull(ctl);
+    checkNull(growth);
+
+    rt = planMemory(stats, plan, ctl);
+    check(rt == 0, "failed to plan memory allocations");
+    MetricsRecordPhase(METRICS_PLAN, start);
+
+    start = MetricsNow();
+    GrowthCountCycle(growth);
+    rt = executeAllocationPlan(plan, stats, guests, ctl, growth);
     check(rt == 0, "failed to execute allocation plan");
 
-    rt = 0;
-    goto final;
+    rt = adjustStatsPeriods(plan, stats, guests);
+    check(rt == 0, "failed to adjust stats periods");
+    MetricsRecordPhase(METRICS_ACTUATE, start);
+
+    BalloonCtlPrintMetrics(ctl);
+    GrowthPrint(growth);
 
+    return 0;
 error:
-    rt = -1;
-final:
-    AllocPlanFree(plan);
-    return rt;
+    return -1;
 }
\ No newline at end of file
@@ -3,7 +3,25 @@
 
 #include "memstats.h"
 #include "guestlist.h"
+#include "balloonctl.h"
+#include "growth.h"
+#include "allocplan.h"
 
-int reallocateMemory(MemStats *stats, GuestList *guests);
+/**
+ * computes the allocation plan of one cycle without executing it. The controllers and the
+ * reclaim history of the domains are updated as in a real cycle
+ * @param plan filled with the new size of each domain
+ */
+int planMemory(MemStats *stats, AllocPlan *plan, BalloonCtl *ctl);
+/**
+ * computes how much memory should be left available on the host (in kB), the reserve grows
+ * with the memory pressure on the host and the memory recently reclaimed by the watchdog
+ */
+double hostReserve(MemStats *stats);
+/**
+ * runs one cycle of the memory coordination policy
+ * @param plan filled with the allocation plan of this cycle
+ */
+int reallocateMemory(MemStats *stats, GuestList *guests, AllocPlan *plan, BalloonCtl *ctl, Growth *growth);
 
 #endif
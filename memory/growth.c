@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "check.h"
+#include "util.h"
+#include "log.h"
+#include "metrics.h"
+#include "growth.h"
+
+Growth *GrowthCreate(int numDomains)
+{
+    Growth *growth = NULL;
+    growth = calloc(1, sizeof(Growth));
+    checkMemAlloc(growth);
+    growth->numDomains = numDomains;
+    growth->domains = calloc(numDomains, sizeof(DomainGrowth));
+    checkMemAlloc(growth->domains);
+
+    for (int d = 0; d < numDomains; d++) {
+        growth->domains[d].canSetMax = -1;
+        growth->domains[d].canHotplug = -1;
+        growth->domains[d].numGuestCells = -1;
+    }
+
+    return growth;
+error:
+    GrowthFree(growth);
+    return NULL;
+}
+
+void GrowthFree(Growth *growth)
+{
+    if (growth) {
+        if (growth->domains) {
+            free(growth->domains);
+        }
+        free(growth);
+    }
+}
+
+int GrowthSetCap(Growth *growth, int dom, MemStatUnit cap)
+{
+    checkNull(growth);
+    check(dom >= 0 && dom < growth->numDomains, "invalid domain for growth cap");
+    growth->domains[dom].cap = cap;
+    growth->enabled = 1;
+
+    return 0;
+error:
+    return -1;
+}
+
+void GrowthCountCycle(Growth *growth)
+{
+    DomainGrowth *domainGrowth = NULL;
+    if (!growth) {
+        return;
+    }
+    for (int d = 0; d < growth->numDomains; d++) {
+        domainGrowth = growth->domains + d;
+        domainGrowth->setMaxRetryIn -= domainGrowth->setMaxRetryIn > 0;
+        domainGrowth->hotplugRetryIn -= domainGrowth->hotplugRetryIn > 0;
+    }
+}
+
+/**
+ * @return whether the last libvirt error means the domain will never support the mechanism:
+ * the hypervisor does not implement it, or the domain's configuration does not allow it
+ * (no memory slot left for another DIMM, max memory above the domain's hotplug limit)
+ */
+int GrowthIsUnsupported(void)
+{
+    int code = virGetLastErrorCode();
+    return code == VIR_ERR_OPERATION_UNSUPPORTED || code == VIR_ERR_NO_SUPPORT || code == VIR_ERR_CONFIG_UNSUPPORTED;
+}
+
+/**
+ * records the outcome of trying a mechanism: it is not tried again if the domain does not support it,
+ * and only after GROWTH_RETRY_CYCLES cycles if it failed otherwise
+ */
+void GrowthRecordAttempt(int dom, int rt, int *supported, int *retryIn, const char *mechanism)
+{
+    if (rt == 0) {
+        *supported = 1;
+    }
+    else if (GrowthIsUnsupported()) {
+        logInfo("Domain %d does not support %s, no longer tried", dom, mechanism);
+        *supported = 0;
+    }
+    else {
+        logWarn("Domain %d: %s failed, trying it again in %d cycles", dom, mechanism, GROWTH_RETRY_CYCLES);
+        *retryIn = GROWTH_RETRY_CYCLES;
+    }
+}
+
+int GrowthSetMax(DomainGrowth *domainGrowth, virDomainPtr domain, int dom, MemStatUnit newMax)
+{
+    int rt = 0;
+    if (domainGrowth->canSetMax == 0 || domainGrowth->setMaxRetryIn > 0) {
+        return -1;
+    }
+    rt = virDomainSetMemoryFlags(domain, (unsigned long) newMax, VIR_DOMAIN_AFFECT_LIVE | VIR_DOMAIN_MEM_MAXIMUM);
+    MetricsCountRpc(METRICS_RPC_ACTUATE, rt != 0);
+    GrowthRecordAttempt(dom, rt, &domainGrowth->canSetMax, &domainGrowth->setMaxRetryIn, "raising max memory live");
+    return rt;
+}
+
+/**
+ * @return the number of NUMA cells in the guest's topology, 0 if it has none or its definition can't be read
+ */
+int GrowthGuestCells(virDomainPtr domain)
+{
+    char *xml = NULL;
+    const char *numa = NULL;
+    const char *end = NULL;
+    const char *cell = NULL;
+    int numCells = 0;
+
+    xml = virDomainGetXMLDesc(domain, 0);
+    MetricsCountRpc(METRICS_RPC_COLLECT, xml == NULL);
+    if (!xml) {
+        return 0;
+    }
+    numa = strstr(xml, "<numa>");
+    end = numa ? strstr(numa, "</numa>") : NULL;
+    for (cell = numa; end && (cell = strstr(cell, "<cell ")) && cell < end; cell++) {
+        numCells += 1;
+    }
+    free(xml);
+
+    return numCells;
+}
+
+int GrowthHotplug(DomainGrowth *domainGrowth, virDomainPtr domain, int dom, MemStatUnit size)
+{
+    int rt = 0;
+    char xml[MAX_DIMM_XML];
+    char node[32] = "";
+    if (domainGrowth->canHotplug == 0 || domainGrowth->hotplugRetryIn > 0) {
+        return -1;
+    }
+    if (domainGrowth->numGuestCells < 0) {
+        domainGrowth->numGuestCells = GrowthGuestCells(domain);
+    }
+    // the DIMMs go to each of the guest's cells in turn, guests with a single cell get them on it by default
+    if (domainGrowth->numGuestCells > 1) {
+        snprintf(node, sizeof(node), "<node>%d</node>", domainGrowth->numHotplugs % domainGrowth->numGuestCells);
+    }
+    snprintf(xml, MAX_DIMM_XML,
+        "<memory model='dimm'><target><size unit='KiB'>%lu</size>%s</target></memory>",
+        (unsigned long) size, node);
+    rt = virDomainAttachDeviceFlags(domain, xml, VIR_DOMAIN_AFFECT_LIVE);
+    MetricsCountRpc(METRICS_RPC_ACTUATE, rt != 0);
+    GrowthRecordAttempt(dom, rt, &domainGrowth->canHotplug, &domainGrowth->hotplugRetryIn, "dimm hotplug");
+    return rt;
+}
+
+MemStatUnit GrowthRaiseMax(Growth *growth, virDomainPtr domain, int dom, MemStatUnit size, MemStats *stats)
+{
+    DomainGrowth *domainGrowth = NULL;
+    MemStatUnit currentMax = 0;
+    MemStatUnit step = 0;
+    checkNull(growth);
+    checkNull(stats);
+    check(dom >= 0 && dom < growth->numDomains, "invalid domain to grow");
+
+    domainGrowth = growth->domains + dom;
+    currentMax = stats->domainStats[dom].max;
+    if (!growth->enabled || domainGrowth->cap <= 0 || size <= currentMax) {
+        return currentMax;
+    }
+
+    step = ceil((min(size, domainGrowth->cap) - currentMax) / GROWTH_STEP) * GROWTH_STEP;
+    step = min(step, domainGrowth->cap - currentMax);
+    if (step <= 0) {
+        if (!domainGrowth->reachedCap) {
+            logInfo("Domain %d reached its hard cap %.1fkb", dom, domainGrowth->cap);
+            domainGrowth->reachedCap = 1;
+        }
+        domainGrowth->lastMechanism = GROWTH_BALLOON;
+        return currentMax;
+    }
+
+    if (GrowthSetMax(domainGrowth, domain, dom, currentMax + step) == 0) {
+        domainGrowth->lastMechanism = GROWTH_SET_MAX;
+        domainGrowth->numSetMax += 1;
+    }
+    else if (GrowthHotplug(domainGrowth, domain, dom, step) == 0) {
+        domainGrowth->lastMechanism = GROWTH_HOTPLUG;
+        domainGrowth->numHotplugs += 1;
+    }
+    else {
+        domainGrowth->lastMechanism = GROWTH_BALLOON;
+        return currentMax;
+    }
+
+    domainGrowth->grown += step;
+    stats->domainStats[dom].max = currentMax + step;
+    logInfo("Domain %d max memory raised by %.1fkb to %.1fkb using %s",
+        dom, step, stats->domainStats[dom].max, GrowthMechanismName(domainGrowth->lastMechanism));
+
+    return stats->domainStats[dom].max;
+error:
+    return -1;
+}
+
+const char *GrowthMechanismName(GrowthMechanism mechanism)
+{
+    switch (mechanism) {
+        case GROWTH_BALLOON:
+            return "balloon";
+        case GROWTH_SET_MAX:
+            return "set max memory";
+        case GROWTH_HOTPLUG:
+            return "dimm hotplug";
+        default:
+            return "none";
+    }
+}
+
+void GrowthPrint(Growth *growth)
+{
+    DomainGrowth *domainGrowth = NULL;
+    if (!growth || !growth->enabled) {
+        return;
+    }
+    for (int d = 0; d < growth->numDomains; d++) {
+        domainGrowth = growth->domains + d;
+        if (domainGrowth->lastMechanism == GROWTH_NONE) {
+            continue;
+        }
+        logDebug("Domain %d growth: %.1fkb (cap %.1fkb), %d max raises, %d hotplugs, last: %s",
+            d, domainGrowth->grown, domainGrowth->cap, domainGrowth->numSetMax,
+            domainGrowth->numHotplugs, GrowthMechanismName(domainGrowth->lastMechanism));
+    }
+}
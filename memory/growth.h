@@ -0,0 +1,101 @@
+#ifndef growth_h
+#define growth_h
+
+#include <libvirt/libvirt.h>
+#include "memstats.h"
+
+// max memory is raised in steps of this size, DIMMs must be aligned
+#define GROWTH_STEP (256 * 1024)
+#define MAX_DIMM_XML 256
+// cycles after which a mechanism that failed for another reason than being unsupported is tried again
+#define GROWTH_RETRY_CYCLES 30
+
+typedef enum GrowthMechanism {
+    GROWTH_NONE = 0,
+    /**
+     * domain was kept at its current max memory, grew with balloon moves only
+     */
+    GROWTH_BALLOON,
+    /**
+     * max memory was raised live with virDomainSetMemoryFlags
+     */
+    GROWTH_SET_MAX,
+    /**
+     * a DIMM was hotplugged into the domain
+     */
+    GROWTH_HOTPLUG
+} GrowthMechanism;
+
+typedef struct DomainGrowth {
+    /**
+     * Hard cap on the domain's max memory (in kB)
+     */
+    MemStatUnit cap;
+    /**
+     * whether the domain supports raising its max memory live or
+     * DIMM hotplug, -1 until it's been tried
+     */
+    int canSetMax;
+    int canHotplug;
+    /**
+     * cycles left before raising the max memory live or hotplugging a DIMM
+     * is tried again after it failed, 0 when it can be tried
+     */
+    int setMaxRetryIn;
+    int hotplugRetryIn;
+    /**
+     * number of NUMA cells of the guest, the DIMMs are spread across them.
+     * -1 until it's been read from the domain's definition
+     */
+    int numGuestCells;
+    /**
+     * whether the domain's max memory reached its hard cap, so that it is only logged once
+     */
+    int reachedCap;
+    GrowthMechanism lastMechanism;
+    /**
+     * Total memory added to the domain's max memory (in kB)
+     */
+    MemStatUnit grown;
+    int numSetMax;
+    int numHotplugs;
+} DomainGrowth;
+
+typedef struct Growth {
+    int numDomains;
+    /**
+     * growth beyond the boot-time max memory is only done when enabled
+     */
+    int enabled;
+    DomainGrowth *domains;
+} Growth;
+
+/**
+ * creates the growth state of each domain, growth is disabled until
+ * a cap is set with GrowthSetCap()
+ * @return pointer to growth object. Created object should be freed using GrowthFree()
+ */
+Growth *GrowthCreate(int numDomains);
+void GrowthFree(Growth *growth);
+/**
+ * sets the hard cap on the domain's max memory (in kB) and enables growth
+ */
+int GrowthSetCap(Growth *growth, int dom, MemStatUnit cap);
+/**
+ * counts a cycle towards retrying the mechanisms that failed
+ */
+void GrowthCountCycle(Growth *growth);
+/**
+ * tries to raise the domain's max memory so that it can reach `size`, without
+ * exceeding the domain's hard cap. Domains without a cap do not grow. Raises max memory live if the domain supports it,
+ * hotplugs a DIMM otherwise and falls back to balloon moves within the current max.
+ * A mechanism is no longer tried once the domain does not support it, or has no memory slot left for a DIMM,
+ * and is tried again after GROWTH_RETRY_CYCLES cycles when it failed for another reason.
+ * Updates the domain's max in stats
+ * @return the domain's max memory after growing (in kB), -1 on error
+ */
+MemStatUnit GrowthRaiseMax(Growth *growth, virDomainPtr domain, int dom, MemStatUnit size, MemStats *stats);
+const char *GrowthMechanismName(GrowthMechanism mechanism);
+void GrowthPrint(Growth *growth);
+
+#endif
@@ -2,6 +2,7 @@
 #include <libvirt/libvirt.h>
 #include "check.h"
 #include "guestlist.h"
+#include "metrics.h"
 
 GuestList *GuestListGet(virConnectPtr conn)
 {
@@ -12,10 +13,12 @@ GuestList *GuestListGet(virConnectPtr conn)
     guestList->count = 0;
 
     numDomains = virConnectNumOfDomains(conn);
+    MetricsCountRpc(METRICS_RPC_LIST, numDomains < 0);
     guestList->ids = calloc(numDomains, sizeof(int));
     check(guestList->ids, "failed to allocated domain ids");
     
     numDomains = virConnectListDomains(conn, guestList->ids, numDomains);
+    MetricsCountRpc(METRICS_RPC_LIST, numDomains < 0);
     check(numDomains >= 0, "Failed to list domains");
     guestList->count = numDomains;
 
@@ -24,6 +27,7 @@ GuestList *GuestListGet(virConnectPtr conn)
 
     for (i = 0; i < numDomains; i++) {
         guestList->domains[i] = virDomainLookupByID(conn, guestList->ids[i]);
+        MetricsCountRpc(METRICS_RPC_LIST, guestList->domains[i] == NULL);
     }
 
     return guestList;
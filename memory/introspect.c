@@ -0,0 +1,328 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "check.h"
+#include "introspect.h"
+
+#define INTROSPECT_MIN_CAPACITY 4096
+
+static const char *sectionNames[] = {"stats", "plan", "metrics", "prometheus"};
+
+Introspect *IntrospectCreate(const char *name, const char *path)
+{
+    struct sockaddr_un addr;
+    Introspect *introspect = NULL;
+
+    checkNull(name);
+    checkNull(path);
+    check(strlen(path) < sizeof(addr.sun_path), "introspection socket path too long");
+
+    introspect = calloc(1, sizeof(Introspect));
+    checkMemAlloc(introspect);
+    introspect->fd = -1;
+    introspect->name = name;
+    introspect->back = -1;
+    atomic_store(&introspect->published, -1);
+    strcpy(introspect->path, path);
+
+    introspect->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    check(introspect->fd >= 0, "failed to create introspection socket");
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    check(bind(introspect->fd, (struct sockaddr *) &addr, sizeof(addr)) == 0, "failed to bind introspection socket");
+    check(listen(introspect->fd, 4) == 0, "failed to listen on introspection socket");
+
+    return introspect;
+error:
+    if (introspect) {
+        if (introspect->fd >= 0) {
+            close(introspect->fd);
+        }
+        free(introspect);
+    }
+    return NULL;
+}
+
+void IntrospectStop(Introspect *introspect)
+{
+    if (!introspect || !atomic_exchange(&introspect->running, 0)) {
+        return;
+    }
+    pthread_join(introspect->thread, NULL);
+}
+
+void IntrospectFree(Introspect *introspect)
+{
+    if (introspect) {
+        IntrospectStop(introspect);
+        close(introspect->fd);
+        unlink(introspect->path);
+        for (int s = 0; s < 2; s++) {
+            for (int i = 0; i < INTROSPECT_NUM_SECTIONS; i++) {
+                if (introspect->snapshots[s].sections[i].data) {
+                    free(introspect->snapshots[s].sections[i].data);
+                }
+            }
+        }
+        free(introspect);
+    }
+}
+
+int IntrospectBegin(Introspect *introspect, unsigned long cycle)
+{
+    IntrospectSnapshot *snapshot = NULL;
+    int back = atomic_load(&introspect->published) == 0 ? 1 : 0;
+
+    snapshot = introspect->snapshots + back;
+    if (atomic_load(&snapshot->readers) > 0) {
+        introspect->skipped += 1;
+        introspect->back = -1;
+        return -1;
+    }
+
+    snapshot->cycle = cycle;
+    for (int i = 0; i < INTROSPECT_NUM_SECTIONS; i++) {
+        snapshot->sections[i].length = 0;
+    }
+    introspect->back = back;
+    return 0;
+}
+
+int IntrospectReserve(IntrospectBuffer *buffer, size_t size)
+{
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : INTROSPECT_MIN_CAPACITY;
+    char *data = NULL;
+
+    if (buffer->length + size < buffer->capacity) {
+        return 0;
+    }
+    while (buffer->length + size >= capacity) {
+        capacity *= 2;
+    }
+    data = realloc(buffer->data, capacity);
+    checkMemAlloc(data);
+    buffer->data = data;
+    buffer->capacity = capacity;
+
+    return 0;
+error:
+    return -1;
+}
+
+int IntrospectPrintf(Introspect *introspect, IntrospectSection section, const char *format, ...)
+{
+    IntrospectBuffer *buffer = NULL;
+    va_list args;
+    int size = 0;
+
+    check(introspect->back >= 0, "no introspection snapshot being rendered");
+    buffer = introspect->snapshots[introspect->back].sections + section;
+
+    va_start(args, format);
+    size = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    check(IntrospectReserve(buffer, size + 1) == 0, "failed to grow introspection buffer");
+
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->length, size + 1, format, args);
+    va_end(args);
+    buffer->length += size;
+
+    return 0;
+error:
+    return -1;
+}
+
+void IntrospectPublish(Introspect *introspect)
+{
+    if (introspect->back < 0) {
+        return;
+    }
+    atomic_store(&introspect->published, introspect->back);
+    introspect->back = -1;
+}
+
+/**
+ * copies a section of the published snapshot, so that a slow client
+ * does not keep the snapshot from being reused
+ * @return 0 on success, -1 if nothing has been published yet
+ */
+int IntrospectRead(Introspect *introspect, IntrospectSection section, IntrospectBuffer *copy, unsigned long *cycle)
+{
+    IntrospectSnapshot *snapshot = NULL;
+    IntrospectBuffer *buffer = NULL;
+    int published = 0;
+
+    while (1) {
+        published = atomic_load(&introspect->published);
+        if (published < 0) {
+            return -1;
+        }
+        snapshot = introspect->snapshots + published;
+        atomic_fetch_add(&snapshot->readers, 1);
+        // the snapshot may have been reused before it was marked as being read
+        if (atomic_load(&introspect->published) == published) {
+            break;
+        }
+        atomic_fetch_sub(&snapshot->readers, 1);
+    }
+
+    buffer = snapshot->sections + section;
+    copy->length = 0;
+    if (IntrospectReserve(copy, buffer->length + 1) == 0) {
+        if (buffer->length > 0) {
+            memcpy(copy->data, buffer->data, buffer->length);
+        }
+        copy->length = buffer->length;
+    }
+    *cycle = snapshot->cycle;
+    atomic_fetch_sub(&snapshot->readers, 1);
+
+    return 0;
+}
+
+int IntrospectWriteAll(int fd, const char *data, size_t length)
+{
+    ssize_t written = 0;
+    while (length > 0) {
+        // a client that hung up must not raise SIGPIPE and terminate the daemon
+        written = send(fd, data, length, MSG_NOSIGNAL);
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/**
+ * answers a single request. Requests are section names followed by a new line,
+ * responses are a header line "ok <cycle> <length>" followed by <length> bytes,
+ * or "error <message>"
+ */
+int IntrospectRespond(Introspect *introspect, int client, const char *request, IntrospectBuffer *copy)
+{
+    char header[64];
+    unsigned long cycle = 0;
+    int section = -1;
+
+    for (int i = 0; i < INTROSPECT_NUM_SECTIONS; i++) {
+        if (strcmp(request, sectionNames[i]) == 0) {
+            section = i;
+        }
+    }
+    if (section < 0) {
+        snprintf(header, sizeof(header), "error unknown request\n");
+        return IntrospectWriteAll(client, header, strlen(header));
+    }
+    if (IntrospectRead(introspect, section, copy, &cycle) < 0) {
+        snprintf(header, sizeof(header), "error no snapshot yet\n");
+        return IntrospectWriteAll(client, header, strlen(header));
+    }
+
+    snprintf(header, sizeof(header), "ok %lu %zu\n", cycle, copy->length);
+    if (IntrospectWriteAll(client, header, strlen(header)) < 0) {
+        return -1;
+    }
+    return IntrospectWriteAll(client, copy->data, copy->length);
+}
+
+/**
+ * reads new line separated requests from a client until it disconnects, stays idle for
+ * INTROSPECT_IDLE_MS or the server stops, so that one client cannot lock the others out
+ */
+void IntrospectServe(Introspect *introspect, int client, IntrospectBuffer *copy)
+{
+    char request[INTROSPECT_MAX_REQUEST];
+    struct pollfd pfd;
+    struct timeval timeout;
+    size_t length = 0;
+    ssize_t rt = 0;
+    int idleMs = 0;
+    char c = 0;
+
+    timeout.tv_sec = INTROSPECT_SEND_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (INTROSPECT_SEND_TIMEOUT_MS % 1000) * 1000;
+    if (setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+        return;
+    }
+    pfd.fd = client;
+    pfd.events = POLLIN;
+    while (atomic_load(&introspect->running) && idleMs < INTROSPECT_IDLE_MS) {
+        rt = poll(&pfd, 1, INTROSPECT_POLL_MS);
+        if (rt == 0) {
+            idleMs += INTROSPECT_POLL_MS;
+            continue;
+        }
+        idleMs = 0;
+        if (rt < 0 || read(client, &c, 1) <= 0) {
+            return;
+        }
+        if (c == '\r') {
+            continue;
+        }
+        if (c != '\n') {
+            if (length + 1 >= INTROSPECT_MAX_REQUEST) {
+                return;
+            }
+            request[length++] = c;
+            continue;
+        }
+        request[length] = '\0';
+        length = 0;
+        if (IntrospectRespond(introspect, client, request, copy) < 0) {
+            return;
+        }
+    }
+}
+
+void *IntrospectRun(void *arg)
+{
+    Introspect *introspect = arg;
+    IntrospectBuffer copy;
+    struct pollfd pfd;
+    int client = 0;
+
+    memset(&copy, 0, sizeof(copy));
+    pfd.fd = introspect->fd;
+    pfd.events = POLLIN;
+    while (atomic_load(&introspect->running)) {
+        if (poll(&pfd, 1, INTROSPECT_POLL_MS) <= 0) {
+            continue;
+        }
+        client = accept(introspect->fd, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        IntrospectServe(introspect, client, &copy);
+        close(client);
+    }
+
+    if (copy.data) {
+        free(copy.data);
+    }
+    return NULL;
+}
+
+int IntrospectStart(Introspect *introspect)
+{
+    checkNull(introspect);
+    atomic_store(&introspect->running, 1);
+    check(pthread_create(&introspect->thread, NULL, IntrospectRun, introspect) == 0,
+        "failed to start introspection thread");
+
+    return 0;
+error:
+    if (introspect) {
+        atomic_store(&introspect->running, 0);
+    }
+    return -1;
+}
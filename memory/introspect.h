@@ -0,0 +1,85 @@
+#ifndef introspect_h
+#define introspect_h
+
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/un.h>
+
+#define INTROSPECT_MAX_REQUEST 64
+// how long the server waits for a request before checking whether it should stop
+#define INTROSPECT_POLL_MS 200
+// a client is served one at a time, it is disconnected when it sends no request for this long
+// or does not read a response within the send timeout
+#define INTROSPECT_IDLE_MS 2000
+#define INTROSPECT_SEND_TIMEOUT_MS 1000
+
+typedef enum IntrospectSection {
+    INTROSPECT_STATS = 0,
+    INTROSPECT_PLAN,
+    INTROSPECT_METRICS,
+    INTROSPECT_PROMETHEUS,
+    INTROSPECT_NUM_SECTIONS
+} IntrospectSection;
+
+typedef struct IntrospectBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+} IntrospectBuffer;
+
+typedef struct IntrospectSnapshot {
+    unsigned long cycle;
+    IntrospectBuffer sections[INTROSPECT_NUM_SECTIONS];
+    /**
+     * number of server reads in progress, the control loop does not
+     * overwrite a snapshot that is being read
+     */
+    atomic_int readers;
+} IntrospectSnapshot;
+
+/**
+ * serves the daemon's state over a Unix domain socket.
+ * The control loop renders its state into the back snapshot and publishes it at the end of
+ * the cycle, the server thread only reads the published snapshot. If the back snapshot is
+ * still being read when a cycle starts rendering, the cycle is not published instead of waiting
+ */
+typedef struct Introspect {
+    const char *name;
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    int fd;
+    pthread_t thread;
+    atomic_int running;
+    IntrospectSnapshot snapshots[2];
+    atomic_int published;
+    // snapshot being rendered, -1 if none
+    int back;
+    unsigned long skipped;
+} Introspect;
+
+/**
+ * creates the introspection server and binds its socket
+ * @param name name of the daemon, used as the prefix of the prometheus metrics
+ * @param path path of the socket, an existing socket file is replaced
+ * @return introspection server, should be freed with IntrospectFree()
+ */
+Introspect *IntrospectCreate(const char *name, const char *path);
+int IntrospectStart(Introspect *introspect);
+void IntrospectStop(Introspect *introspect);
+/**
+ * stops the server, removes the socket file and frees the snapshots
+ */
+void IntrospectFree(Introspect *introspect);
+/**
+ * starts rendering a new snapshot
+ * @return 0 if the back snapshot can be written, -1 if it is still being read
+ */
+int IntrospectBegin(Introspect *introspect, unsigned long cycle);
+int IntrospectPrintf(Introspect *introspect, IntrospectSection section, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+/**
+ * makes the rendered snapshot visible to the server
+ */
+void IntrospectPublish(Introspect *introspect);
+
+#endif
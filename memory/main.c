@@ -1,96 +1,202 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <locale.h>
 #include <unistd.h>
 #include <signal.h>
 #include <libvirt/libvirt.h>
-#include "guestlist.h"
 #include "memstats.h"
-#include "coordinator.h"
 #include "check.h"
-
-virConnectPtr conn = NULL;
-GuestList *guests = NULL;
-MemStats *stats = NULL;
-
+#include "log.h"
+#include "metrics.h"
+#include "worker.h"
+#include "statefile.h"
+#include "capacity.h"
+#include "util.h"
+#include "params.h"
+
+#define USAGE "usage: ./memory_coordinator [-c uri]... [-m meminfo_file] [-p pressure_file] [-G cap_mb] [-g domain=cap_mb] [-b rpc_budget] [-H housekeeping_cpu_mask] [-u cpu_budget] [-W guest_profile]... [-P params_profile] [-l log_level] [-j] [-s socket_path] [-S state_path] <interval>"
+// default number of libvirt calls used to sample stable domains each cycle
+#define DEFAULT_SAMPLE_BUDGET 64
+#define MAX_GROWTH_CAPS 64
+#define DEFAULT_URI "qemu:///system"
+#define DEFAULT_SOCKET_PATH "/tmp/memory_coordinator.sock"
+#define DEFAULT_STATE_PATH "/var/tmp/memory_coordinator.state"
+#define MAX_CONNECTIONS METRICS_MAX_SOURCES
+
+Worker *workers[MAX_CONNECTIONS];
+int numWorkers = 0;
 
 void cleanUp()
 {
-    if (conn) {
-        virConnectClose(conn);
-    }
-    if (guests) {
-        GuestListFree(guests);
-    }
-    if (stats) {
-        MemStatsFree(stats);
+    for (int i = 0; i < numWorkers; i++) {
+        WorkerJoin(workers[i]);
+        WorkerFree(workers[i]);
     }
+    numWorkers = 0;
+    // write out the queued log records
+    LogStop();
 }
 
 void sigintHandler(int sigNum)
 {
-    printf("Terminating due to keyboard interrupt...");
-    cleanUp();
-    exit(0);
+    WorkerStopAll();
+}
+
+/**
+ * what-if mode: plans how many guests of the profiles the host can take, from the stats of the last cycle
+ * saved in the state file and the memory available on the host now, without connecting to the hypervisor
+ */
+int planCapacity(Capacity *capacity, WorkerConfig *config, LogLevel logLevel)
+{
+    int rt = 0;
+    double age = 0;
+    MemStats *stats = NULL;
+
+    check(config->statePath[0] != '\0', "what-if mode reads the stats from the state file (-S)");
+    stats = StateFileLoadStats(config->statePath, &age);
+    check(stats, "failed to load the stats from the state file");
+    rt = MemStatsReadHostAvailable(&capacity->hostAvailable);
+    check(rt == 0, "failed to read the memory available on the host (-m)");
+    logInfo("planning with the stats of %d domains saved %.0fs ago", stats->numDomains, age);
+
+    // the simulated cycles would log every decision of the policy
+    LogSetLevel(min(logLevel, LOG_WARN));
+    rt = CapacityPlan(capacity, stats);
+    LogSetLevel(logLevel);
+    check(rt == 0, "failed to plan capacity");
+    CapacityPrint(capacity, stdout);
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    MemStatsFree(stats);
+    return rt;
 }
 
 int main(int argc, char *argv[])
 {
-    char *uri = "qemu:///system";
+    char *uris[MAX_CONNECTIONS];
+    int numUris = 0;
     int rt = 0;
-    int interval = 0;
+    int opt = 0;
+    char *growthCaps[MAX_GROWTH_CAPS];
+    unsigned long housekeepingCpus = 0;
+    int logLevel = LOG_INFO;
+    LogFormat logFormat = LOG_FORMAT_TEXT;
+    WorkerConfig config;
+    Capacity capacity;
+
+    config.interval = 0;
+    config.sampleBudget = DEFAULT_SAMPLE_BUDGET;
+    config.defaultGrowthCap = 0;
+    config.growthCaps = growthCaps;
+    config.numGrowthCaps = 0;
+    config.socketPath = DEFAULT_SOCKET_PATH;
+    config.statePath = DEFAULT_STATE_PATH;
+    config.cpuBudget = 0;
+    CapacityInit(&capacity, 0);
 
     signal(SIGINT, sigintHandler);
 
-    check(argc > 1, "interval arg required, usage: ./cpu_scheduler <interval>");
-    interval = atoi(argv[1]);
+    while ((opt = getopt(argc, argv, "c:m:p:G:g:b:H:u:W:P:l:js:S:")) != -1) {
+        switch (opt) {
+            case 'c':
+                check(numUris < MAX_CONNECTIONS, "too many connections");
+                uris[numUris++] = optarg;
+                break;
+            case 'm':
+                MemStatsSetHostFiles(optarg, NULL);
+                break;
+            case 'p':
+                MemStatsSetHostFiles(NULL, optarg);
+                break;
+            case 'G':
+                config.defaultGrowthCap = atof(optarg) * 1024;
+                break;
+            case 'g':
+                check(config.numGrowthCaps < MAX_GROWTH_CAPS, "too many domain growth caps");
+                growthCaps[config.numGrowthCaps++] = optarg;
+                break;
+            case 'b':
+                config.sampleBudget = atoi(optarg);
+                break;
+            case 'H':
+                housekeepingCpus = strtoul(optarg, NULL, 0);
+                break;
+            case 'u':
+                config.cpuBudget = atof(optarg);
+                break;
+            case 'W':
+                rt = CapacityAddProfile(&capacity, optarg);
+                check(rt == 0, "invalid guest profile, " USAGE);
+                break;
+            case 'P':
+                rt = ParamsLoad(ParamsGlobal(), optarg);
+                check(rt == 0, "invalid parameter profile");
+                break;
+            case 'l':
+                logLevel = LogParseLevel(optarg);
+                check(logLevel >= 0, "unknown log level, " USAGE);
+                break;
+            case 'j':
+                logFormat = LOG_FORMAT_JSON;
+                break;
+            case 's':
+                config.socketPath = optarg;
+                break;
+            case 'S':
+                config.statePath = optarg;
+                break;
+            default:
+                check(0, USAGE);
+        }
+    }
 
-    setlocale(LC_NUMERIC, "");
+    if (capacity.numProfiles > 0) {
+        // the plan is the only output on stdout
+        rt = LogStart(stderr, logLevel, logFormat);
+        check(rt == 0, "failed to start logging");
+        rt = planCapacity(&capacity, &config, logLevel) == 0 ? 0 : 1;
+        LogStop();
+        return rt;
+    }
 
-    conn = virConnectOpen(uri);
-    check(conn, "Failed to connect to hypervisor");
+    check(optind < argc, "interval arg required, " USAGE);
+    config.interval = atoi(argv[optind]);
+    if (numUris == 0) {
+        uris[numUris++] = DEFAULT_URI;
+    }
 
-    guests = GuestListGet(conn);
-    check(conn, "Failed to create guest list");
+    // pinned before any thread is started so that all of them inherit the affinity
+    rt = HousekeepingPinSelf(housekeepingCpus);
+    check(rt == 0, "failed to pin the coordinator to the housekeeping cpus");
 
-    for(int i = 0; i < guests->count; i++) {
-        rt = virDomainSetMemoryStatsPeriod(GuestListDomainAt(guests, i), 1, 0);
-        check(rt == 0, "failed to set memory stats period");
-    }
+    rt = LogStart(stdout, logLevel, logFormat);
+    check(rt == 0, "failed to start logging");
 
-    stats = MemStatsCreate(conn, guests);
-    check(stats, "Failed to create memory stats\n");
-
-    rt = MemStatsInit(stats, conn, guests);
-    check(rt == 0, "failed to init memory stats");
-    MemStatsPrint(stats, guests);
-
-    sleep(2);
-
-    rt = MemStatsUpdate(stats, conn, guests, 1);
-    check(rt == 0, "failed to update memory stats");
-    MemStatsPrint(stats, guests);
-
-
-    while (1) {
-        puts("sleeping...");
-        sleep(interval);
-        puts("coordinating...");
-        rt = MemStatsUpdate(stats, conn, guests, 1);
-        check(rt == 0, "error updating stats");
-        MemStatsPrint(stats, guests);
-        rt = reallocateMemory(stats, guests);
-        check(rt == 0, "error re-allocating memory");
-        // update stats to match the new allocations
-        rt = MemStatsUpdate(stats, conn, guests, 0);
-        check(rt == 0, "error updating stats");
-        puts("memory coordination cycle done\n");
+    // each connection is coordinated independently on its own thread
+    for (int i = 0; i < numUris; i++) {
+        workers[i] = WorkerCreate(i, uris[i], &config, numUris);
+        check(workers[i], "failed to create worker");
+        numWorkers += 1;
+        rt = WorkerStart(workers[i]);
+        check(rt == 0, "failed to start worker");
     }
 
     rt = 0;
+    for (int i = 0; i < numWorkers; i++) {
+        WorkerJoin(workers[i]);
+        if (workers[i]->failed) {
+            rt = 1;
+        }
+    }
+    logInfo("Terminating...");
     goto final;
 
 error:
+    WorkerStopAll();
     rt = 1;
 final:
     cleanUp();
@@ -1,31 +1,122 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "memstats.h"
 #include "check.h"
+#include "log.h"
+#include "metrics.h"
 
-int MemStatsUpdateHostStats(virConnectPtr conn, MemStats *stats)
+static const char *meminfoPath = DEFAULT_MEMINFO_PATH;
+static const char *pressurePath = DEFAULT_PRESSURE_PATH;
+
+void MemStatsSetHostFiles(const char *meminfo, const char *pressure)
+{
+    if (meminfo) {
+        meminfoPath = meminfo;
+    }
+    if (pressure) {
+        pressurePath = pressure;
+    }
+}
+
+int MemStatsReadHostAvailable(MemStatUnit *available)
+{
+    char line[256];
+    unsigned long long value = 0;
+    int rt = -1;
+    FILE *file = fopen(meminfoPath, "r");
+    if (!file) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "MemAvailable: %llu", &value) == 1) {
+            *available = (MemStatUnit) value;
+            rt = 0;
+            break;
+        }
+    }
+
+    fclose(file);
+    return rt;
+}
+
+/**
+ * reads memory pressure stall information, the file has the format:
+ * some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ * full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ * @return 0 if pressure stats were read, -1 if they're not available
+ */
+int MemStatsReadHostPressure(HostMemStats *hostStats)
+{
+    char line[256];
+    char kind[8];
+    PressureStats pressure;
+    int found = 0;
+    FILE *file = fopen(pressurePath, "r");
+    if (!file) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        pressure.total = 0;
+        if (sscanf(line, "%7s avg10=%lf avg60=%lf avg300=%lf total=%llu",
+            kind, &pressure.avg10, &pressure.avg60, &pressure.avg300, &pressure.total) < 4) {
+            continue;
+        }
+        if (strcmp(kind, "some") == 0) {
+            hostStats->some = pressure;
+            found += 1;
+        }
+        else if (strcmp(kind, "full") == 0) {
+            hostStats->full = pressure;
+            found += 1;
+        }
+    }
+
+    fclose(file);
+    return found > 0 ? 0 : -1;
+}
+
+int MemStatsUpdateHostStats(virConnectPtr conn, HostMemStats *hostStats)
 {
     int nparams = 0;
     int rt = 0;
+    int local = 0;
     int cellNum = VIR_NODE_MEMORY_STATS_ALL_CELLS;
     int fieldLength = VIR_NODE_MEMORY_STATS_FIELD_LENGTH;
     virNodeMemoryStatsPtr tempStats = NULL;
     rt = virNodeGetMemoryStats(conn, cellNum, NULL, &nparams, 0);
+    MetricsCountRpc(METRICS_RPC_COLLECT, rt != 0);
     check(rt == 0, "failed to get node memory stats params");
     tempStats = calloc(nparams, sizeof(virNodeMemoryStats));
     checkMemAlloc(tempStats);
     rt = virNodeGetMemoryStats(conn, cellNum, tempStats, &nparams, 0);
+    MetricsCountRpc(METRICS_RPC_COLLECT, rt != 0);
     check(rt == 0, "failed to get node memory stats");
 
     for (int i = 0; i < nparams; i++) {
         if (strncmp(tempStats[i].field, "total", fieldLength) == 0) {
-            stats->hostStats.total = (MemStatUnit) tempStats[i].value;
+            hostStats->total = (MemStatUnit) tempStats[i].value;
         }
         else if (strncmp(tempStats[i].field, "free", fieldLength) == 0) {
-            stats->hostStats.free = (MemStatUnit) tempStats[i].value;
+            hostStats->free = (MemStatUnit) tempStats[i].value;
         }
+        else if (strncmp(tempStats[i].field, "buffers", fieldLength) == 0) {
+            hostStats->buffers = (MemStatUnit) tempStats[i].value;
+        }
+        else if (strncmp(tempStats[i].field, "cached", fieldLength) == 0) {
+            hostStats->cached = (MemStatUnit) tempStats[i].value;
+        }
+    }
+
+    // the host files describe the local host, they are ignored for remote hypervisors
+    local = virConnectIsRemote(conn) == 0;
+    if (!local || MemStatsReadHostAvailable(&hostStats->available) != 0) {
+        hostStats->available = hostStats->free + hostStats->buffers + hostStats->cached;
     }
+    hostStats->hasPressure = local && MemStatsReadHostPressure(hostStats) == 0;
 
     rt = 0;
     goto final;
@@ -37,24 +128,289 @@ final:
     return rt;
 }
 
-int MemStatsUpdateDomainStats(virConnectPtr conn, GuestList *guests, MemStats *stats, int updateDeltas)
+/**
+ * updates a cumulative counter and its per-interval delta.
+ * Counters can go backwards when the guest reboots, in which
+ * case the delta is clamped to 0
+ */
+void MemStatsUpdateCounter(MemStatUnit *counter, MemStatUnit *delta, MemStatUnit value, int updateDeltas)
+{
+    if (updateDeltas) {
+        *delta = value >= *counter ? value - *counter : 0;
+    }
+    *counter = value;
+}
+
+int MemStatsUpdateCellStats(virConnectPtr conn, MemStats *stats)
+{
+    int rt = 0;
+    unsigned long long *cellsFree = NULL;
+    HostMemStats *hostStats = &stats->hostStats;
+
+    cellsFree = calloc(hostStats->numCells, sizeof(unsigned long long));
+    checkMemAlloc(cellsFree);
+    rt = virNodeGetCellsFreeMemory(conn, cellsFree, 0, hostStats->numCells);
+    MetricsCountRpc(METRICS_RPC_COLLECT, rt < 0);
+    check(rt == hostStats->numCells, "failed to get free memory of cells");
+
+    for (int c = 0; c < hostStats->numCells; c++) {
+        // cell free memory is reported in bytes
+        hostStats->cells[c].free = (MemStatUnit) cellsFree[c] / 1024;
+    }
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    free(cellsFree);
+    return rt;
+}
+
+int MemStatsInitCellStats(virConnectPtr conn, MemStats *stats)
+{
+    int nparams = 0;
+    int rt = 0;
+    virNodeInfo info;
+    virNodeMemoryStatsPtr tempStats = NULL;
+    HostMemStats *hostStats = &stats->hostStats;
+
+    rt = virNodeGetInfo(conn, &info);
+    MetricsCountRpc(METRICS_RPC_COLLECT, rt != 0);
+    check(rt == 0, "failed to get node info");
+    hostStats->numCells = info.nodes > 0 ? (int) info.nodes : 1;
+    hostStats->numCells = hostStats->numCells < MAX_CELLS ? hostStats->numCells : MAX_CELLS;
+    hostStats->cells = calloc(hostStats->numCells, sizeof(CellMemStats));
+    checkMemAlloc(hostStats->cells);
+
+    for (int c = 0; c < hostStats->numCells; c++) {
+        nparams = 0;
+        rt = virNodeGetMemoryStats(conn, c, NULL, &nparams, 0);
+        MetricsCountRpc(METRICS_RPC_COLLECT, rt != 0);
+        check(rt == 0, "failed to get cell memory stats params");
+        tempStats = calloc(nparams, sizeof(virNodeMemoryStats));
+        checkMemAlloc(tempStats);
+        rt = virNodeGetMemoryStats(conn, c, tempStats, &nparams, 0);
+        MetricsCountRpc(METRICS_RPC_COLLECT, rt != 0);
+        check(rt == 0, "failed to get cell memory stats");
+        for (int i = 0; i < nparams; i++) {
+            if (strncmp(tempStats[i].field, "total", VIR_NODE_MEMORY_STATS_FIELD_LENGTH) == 0) {
+                hostStats->cells[c].total = (MemStatUnit) tempStats[i].value;
+            }
+        }
+        free(tempStats);
+        tempStats = NULL;
+    }
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    free(tempStats);
+    return rt;
+}
+
+/**
+ * parses a NUMA nodeset string (e.g. "0-1,3") into a bit mask of cells
+ * @return the cells mask, 0 if the nodeset is empty or invalid
+ */
+unsigned long MemStatsParseNodeset(const char *nodeset)
+{
+    unsigned long mask = 0;
+    char *end = NULL;
+    long first = 0;
+    long last = 0;
+
+    while (nodeset && *nodeset) {
+        first = strtol(nodeset, &end, 10);
+        if (end == nodeset || first < 0) {
+            return 0;
+        }
+        last = first;
+        if (*end == '-') {
+            nodeset = end + 1;
+            last = strtol(nodeset, &end, 10);
+            if (end == nodeset || last < first) {
+                return 0;
+            }
+        }
+        for (long c = first; c <= last && c < MAX_CELLS; c++) {
+            mask |= 1UL << c;
+        }
+        nodeset = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            return 0;
+        }
+    }
+
+    return mask;
+}
+
+int MemStatsUpdateDomainCells(GuestList *guests, MemStats *stats)
+{
+    int nparams = 0;
+    int rt = 0;
+    const char *nodeset = NULL;
+    virTypedParameterPtr params = NULL;
+    virDomainPtr domain = NULL;
+    unsigned long allCells = 0;
+
+    for (int c = 0; c < stats->hostStats.numCells; c++) {
+        allCells |= 1UL << c;
+    }
+
+    for (int i = 0; i < stats->numDomains; i++) {
+        domain = GuestListDomainAt(guests, i);
+        stats->domainCells[i] = 0;
+        nparams = 0;
+        nodeset = NULL;
+
+        rt = virDomainGetNumaParameters(domain, NULL, &nparams, 0);
+        MetricsCountRpc(METRICS_RPC_COLLECT, rt != 0);
+        if (rt == 0 && nparams > 0) {
+            params = calloc(nparams, sizeof(virTypedParameter));
+            checkMemAlloc(params);
+            rt = virDomainGetNumaParameters(domain, params, &nparams, 0);
+            MetricsCountRpc(METRICS_RPC_COLLECT, rt != 0);
+            if (rt == 0 && virTypedParamsGetString(params, nparams, VIR_DOMAIN_NUMA_NODESET, &nodeset) == 1) {
+                stats->domainCells[i] = MemStatsParseNodeset(nodeset) & allCells;
+            }
+            virTypedParamsClear(params, nparams);
+            free(params);
+            params = NULL;
+        }
+
+        // domains without a memory nodeset can allocate from any cell
+        if (stats->domainCells[i] == 0) {
+            stats->domainCells[i] = allCells;
+        }
+    }
+
+    return 0;
+
+error:
+    free(params);
+    return -1;
+}
+
+int MemStatsSetStatsPeriod(MemStats *stats, GuestList *guests, int dom, int period)
+{
+    int rt = 0;
+    checkNull(stats);
+    checkNull(guests);
+    check(dom >= 0 && dom < stats->numDomains, "invalid domain for stats period");
+
+    if (stats->sampling[dom].period == period) {
+        return 0;
+    }
+    rt = virDomainSetMemoryStatsPeriod(GuestListDomainAt(guests, dom), period, 0);
+    MetricsCountRpc(METRICS_RPC_ACTUATE, rt != 0);
+    check(rt == 0, "failed to set memory stats period");
+    stats->sampling[dom].period = period;
+
+    return 0;
+error:
+    return -1;
+}
+
+int MemStatsDomainNumCells(MemStats *stats, int dom)
+{
+    int count = 0;
+    for (int c = 0; c < stats->hostStats.numCells; c++) {
+        count += MemStatsIsDomainOnCell(stats, dom, c);
+    }
+    return count;
+}
+
+/**
+ * scales the deltas of a domain that cover several cycles,
+ * so that they remain per-cycle deltas
+ */
+void MemStatsScaleDeltas(DomainMemStats *deltas, double cycles)
+{
+    deltas->actual /= cycles;
+    deltas->unused /= cycles;
+    deltas->usable /= cycles;
+    deltas->available /= cycles;
+    deltas->diskCaches /= cycles;
+    deltas->swapIn /= cycles;
+    deltas->swapOut /= cycles;
+    deltas->majorFault /= cycles;
+    deltas->minorFault /= cycles;
+}
+
+/**
+ * selects the domains to sample in this cycle: all hot domains, and the
+ * stable domains that fit in the sample budget, in round-robin order
+ */
+void MemStatsSelectSamples(MemStats *stats)
+{
+    int budget = stats->numDomains;
+    int selected = 0;
+    int d = 0;
+
+    if (stats->sampleBudget > 0) {
+        // always sample at least one stable domain so none of them is left behind
+        budget = stats->sampleBudget / RPCS_PER_SAMPLE;
+        budget = budget > 0 ? budget : 1;
+    }
+
+    for (d = 0; d < stats->numDomains; d++) {
+        stats->sampling[d].sampled = stats->sampling[d].hot;
+    }
+
+    for (int k = 0; k < stats->numDomains && selected < budget; k++) {
+        d = (stats->nextStable + k) % stats->numDomains;
+        if (!stats->sampling[d].hot) {
+            stats->sampling[d].sampled = 1;
+            selected += 1;
+            stats->nextStable = (d + 1) % stats->numDomains;
+        }
+    }
+}
+
+int MemStatsUpdateDomainStats(virConnectPtr conn, GuestList *guests, MemStats *stats, double timeInterval)
 {
+    int updateDeltas = timeInterval > 0;
     int numStats = 0;
+    MemStatUnit lastUpdate = 0;
     virDomainPtr domain = NULL;
     virDomainMemoryStatStruct tempStats[MAX_STATS];
     DomainMemStats *deltas;
     DomainMemStats *domainStats;
+    DomainSampling *sampling;
+    time_t now = time(NULL);
+
+    if (updateDeltas) {
+        MemStatsSelectSamples(stats);
+    }
 
     for (int i = 0; i < stats->numDomains; i++) {
-        domain = GuestListDomainAt(guests, i);
-        numStats = virDomainMemoryStats(domain, tempStats, MAX_STATS, 0);
+        sampling = stats->sampling + i;
         deltas = stats->domainDeltas + i;
         domainStats = stats->domainStats + i;
 
+        if (!sampling->sampled) {
+            // keep the last sample, without any change since
+            if (updateDeltas) {
+                memset(deltas, 0, sizeof(DomainMemStats));
+                sampling->cyclesSinceSample += 1;
+            }
+            continue;
+        }
+
+        domain = GuestListDomainAt(guests, i);
+        lastUpdate = domainStats->lastUpdate;
+        numStats = virDomainMemoryStats(domain, tempStats, MAX_STATS, 0);
+        MetricsCountRpc(METRICS_RPC_COLLECT, numStats < 0);
 
         check(numStats > 0, "Could not get domain memory stats");
 
         stats->domainStats[i].max = (MemStatUnit) virDomainGetMaxMemory(domain);
+        MetricsCountRpc(METRICS_RPC_COLLECT, stats->domainStats[i].max <= 0);
         check(stats->domainStats[i].max > 0, "failed to get domain max memory");
 
         for (int j = 0; j < numStats; j++) {
@@ -83,8 +439,52 @@ int MemStatsUpdateDomainStats(virConnectPtr conn, GuestList *guests, MemStats *s
                     }
                     domainStats->available = (MemStatUnit) tempStats[j].val;
                     break;
+                case VIR_DOMAIN_MEMORY_STAT_DISK_CACHES:
+                    if (updateDeltas) {
+                        deltas->diskCaches = (MemStatUnit) tempStats[j].val - domainStats->diskCaches;
+                    }
+                    domainStats->diskCaches = (MemStatUnit) tempStats[j].val;
+                    break;
+                case VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE:
+                    domainStats->lastUpdate = (MemStatUnit) tempStats[j].val;
+                    break;
+                case VIR_DOMAIN_MEMORY_STAT_SWAP_IN:
+                    MemStatsUpdateCounter(&domainStats->swapIn, &deltas->swapIn,
+                        (MemStatUnit) tempStats[j].val, updateDeltas);
+                    break;
+                case VIR_DOMAIN_MEMORY_STAT_SWAP_OUT:
+                    MemStatsUpdateCounter(&domainStats->swapOut, &deltas->swapOut,
+                        (MemStatUnit) tempStats[j].val, updateDeltas);
+                    break;
+                case VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT:
+                    MemStatsUpdateCounter(&domainStats->majorFault, &deltas->majorFault,
+                        (MemStatUnit) tempStats[j].val, updateDeltas);
+                    break;
+                case VIR_DOMAIN_MEMORY_STAT_MINOR_FAULT:
+                    MemStatsUpdateCounter(&domainStats->minorFault, &deltas->minorFault,
+                        (MemStatUnit) tempStats[j].val, updateDeltas);
+                    break;
             }
         }
+
+        if (updateDeltas) {
+            if (lastUpdate > 0 && domainStats->lastUpdate > 0) {
+                // the guest's stats only change when it refreshes them, the deltas cover the time between its
+                // refreshes rather than the cycles between samples, and are empty until it refreshes again
+                if (domainStats->lastUpdate > lastUpdate) {
+                    MemStatsScaleDeltas(deltas, (domainStats->lastUpdate - lastUpdate) / timeInterval);
+                } else {
+                    memset(deltas, 0, sizeof(DomainMemStats));
+                }
+            } else if (sampling->cyclesSinceSample > 0) {
+                MemStatsScaleDeltas(deltas, sampling->cyclesSinceSample + 1);
+            }
+            sampling->cyclesSinceSample = 0;
+        }
+
+        // the guest is expected to refresh its stats every period
+        sampling->age = domainStats->lastUpdate > 0 ? difftime(now, (time_t) domainStats->lastUpdate) : 0;
+        sampling->stale = sampling->age > 2 * sampling->period + STATS_STALE_GRACE;
     }
     return 0;
 
@@ -92,17 +492,29 @@ error:
     return -1;
 }
 
-MemStats *MemStatsCreate(virConnectPtr conn, GuestList *guests)
+MemStats *MemStatsCreateEmpty(int numDomains, int sampleBudget)
 {
     MemStats *stats = NULL;
     stats = calloc(1, sizeof(MemStats));
     checkMemAlloc(stats);
 
-    stats->numDomains = guests->count;
-    stats->domainStats = calloc(guests->count, sizeof(DomainMemStats));
+    stats->numDomains = numDomains;
+    stats->domainStats = calloc(numDomains, sizeof(DomainMemStats));
     checkMemAlloc(stats->domainStats);
-    stats->domainDeltas = calloc(guests->count, sizeof(DomainMemStats));
+    stats->domainDeltas = calloc(numDomains, sizeof(DomainMemStats));
     checkMemAlloc(stats->domainDeltas);
+    stats->reclaimHistory = calloc(numDomains, sizeof(DomainReclaimHistory));
+    checkMemAlloc(stats->reclaimHistory);
+    stats->domainCells = calloc(numDomains, sizeof(unsigned long));
+    checkMemAlloc(stats->domainCells);
+    stats->sampling = calloc(numDomains, sizeof(DomainSampling));
+    checkMemAlloc(stats->sampling);
+    stats->sampleBudget = sampleBudget;
+    // every domain is hot until the coordinator knows which ones are stable
+    for (int i = 0; i < numDomains; i++) {
+        stats->sampling[i].hot = 1;
+        stats->sampling[i].sampled = 1;
+    }
 
     return stats;
 error:
@@ -110,6 +522,11 @@ error:
     return NULL;
 }
 
+MemStats *MemStatsCreate(virConnectPtr conn, GuestList *guests, int sampleBudget)
+{
+    return MemStatsCreateEmpty(guests->count, sampleBudget);
+}
+
 void MemStatsFree(MemStats *stats)
 {
     if (stats) {
@@ -119,27 +536,57 @@ void MemStatsFree(MemStats *stats)
         if (stats->domainDeltas) {
             free(stats->domainDeltas);
         }
+        if (stats->reclaimHistory) {
+            free(stats->reclaimHistory);
+        }
+        if (stats->domainCells) {
+            free(stats->domainCells);
+        }
+        if (stats->sampling) {
+            free(stats->sampling);
+        }
+        if (stats->hostStats.cells) {
+            free(stats->hostStats.cells);
+        }
         free(stats);
     }
 }
 
 int MemStatsInit(MemStats *stats, virConnectPtr conn, GuestList *guests)
 {
+    int rt = 0;
+    checkNull(stats);
+
+    rt = MemStatsInitCellStats(conn, stats);
+    check(rt == 0, "failed to init cell stats");
+
+    rt = MemStatsUpdateDomainCells(guests, stats);
+    check(rt == 0, "failed to get domain cells");
+
     return MemStatsUpdate(stats, conn, guests, 0);
+
+error:
+    return -1;
 }
 
-int MemStatsUpdate(MemStats *stats, virConnectPtr conn, GuestList *guests, int updateDeltas)
+int MemStatsUpdate(MemStats *stats, virConnectPtr conn, GuestList *guests, double timeInterval)
 {
     int rt = 0;
     checkNull(stats);
     checkNull(conn);
     checkNull(guests);
 
-    rt = MemStatsUpdateHostStats(conn, stats);
+    rt = MemStatsUpdateHostStats(conn, &stats->hostStats);
     check(rt == 0, "failed to update host stats");
 
-    rt = MemStatsUpdateDomainStats(conn, guests, stats, updateDeltas);
+    rt = MemStatsUpdateCellStats(conn, stats);
+    check(rt == 0, "failed to update cell stats");
+
+    rt = MemStatsUpdateDomainStats(conn, guests, stats, timeInterval);
     check(rt == 0, "failed to update domain stats");
+    if (timeInterval > 0) {
+        stats->interval = timeInterval;
+    }
 
     return 0;
 
@@ -147,27 +594,117 @@ error:
     return -1;
 }
 
+MemStatUnit MemStatsReclaimable(MemStats *stats, int dom)
+{
+    DomainMemStats *domainStats = stats->domainStats + dom;
+    MemStatUnit reclaimable = 0;
+
+    // usable memory covers unused memory plus everything the guest
+    // can reclaim without swapping (caches, reclaimable slab)
+    reclaimable = domainStats->usable - domainStats->unused;
+    reclaimable = reclaimable > 0 ? reclaimable : 0;
+    // only count clean disk caches, if the guest reports them
+    if (domainStats->diskCaches > 0) {
+        reclaimable = reclaimable < domainStats->diskCaches ? reclaimable : domainStats->diskCaches;
+    }
+
+    return reclaimable;
+}
+
 void MemStatsPrint(MemStats *stats, GuestList *guests)
 {
+    DomainMemStats *domainStats = NULL;
+    DomainMemStats *deltas = NULL;
+    DomainSampling *sampling = NULL;
+
     if (!stats) {
-        printf("Null stats pointer\n");
+        logError("Null stats pointer");
+        return;
+    }
+    if (!LogIsEnabled(LOG_DEBUG)) {
         return;
     }
-    printf("Memory stats\n");
-    
-    printf("Host stats\n");
-    printf("-- Total: %'2.f\n", stats->hostStats.total);
-    printf("-- Free: %'2.f\n", stats->hostStats.free);
-    puts("");
+
+    logDebug("Host stats: total %.0f, free %.0f, buffers %.0f, cached %.0f, available %.0f",
+        stats->hostStats.total, stats->hostStats.free, stats->hostStats.buffers,
+        stats->hostStats.cached, stats->hostStats.available);
+    if (stats->hostStats.hasPressure) {
+        logDebug("Host pressure: some %.2f %.2f %.2f, full %.2f %.2f %.2f",
+            stats->hostStats.some.avg10, stats->hostStats.some.avg60, stats->hostStats.some.avg300,
+            stats->hostStats.full.avg10, stats->hostStats.full.avg60, stats->hostStats.full.avg300);
+    }
+    for (int c = 0; c < stats->hostStats.numCells; c++) {
+        logDebug("Cell %d stats: total %.0f, free %.0f", c,
+            stats->hostStats.cells[c].total, stats->hostStats.cells[c].free);
+    }
 
     for (int i = 0; i < stats->numDomains; i++) {
-        printf("Domain %d (%s) stats\n", i, virDomainGetName(GuestListDomainAt(guests, i)));
-        printf("-- Actual: %'.2f\n", stats->domainStats[i].actual);
-        printf("-- Unused: %'.2f\n", stats->domainStats[i].unused);
-        printf("-- Max: %'.2f\n", stats->domainStats[i].max);
-        printf("Domain %d deltas\n", i);
-        printf("-- Actual: %'.2f\n", stats->domainDeltas[i].actual);
-        printf("-- Unused: %'.2f\n", stats->domainDeltas[i].unused);
-        puts("");
+        domainStats = stats->domainStats + i;
+        deltas = stats->domainDeltas + i;
+        sampling = stats->sampling + i;
+        logDebug("Domain %d (%s) stats: actual %.2f, unused %.2f, max %.2f, usable %.2f, disk caches %.2f, "
+            "reclaimable %.2f, reclaim tolerated %.2f (rejected %d), cells 0x%lX",
+            i, virDomainGetName(GuestListDomainAt(guests, i)), domainStats->actual, domainStats->unused,
+            domainStats->max, domainStats->usable, domainStats->diskCaches, MemStatsReclaimable(stats, i),
+            stats->reclaimHistory[i].tolerated, stats->reclaimHistory[i].rejected, stats->domainCells[i]);
+        logDebug("Domain %d sampling: period %ds, age %.0fs%s, sampled %d cycles ago%s", i, sampling->period,
+            sampling->age, sampling->stale ? " (stale)" : "",
+            sampling->cyclesSinceSample, sampling->hot ? " (hot)" : "");
+        logDebug("Domain %d deltas: actual %.2f, unused %.2f, swap in %.2f, swap out %.2f, "
+            "major faults %.2f, minor faults %.2f", i, deltas->actual, deltas->unused,
+            deltas->swapIn, deltas->swapOut, deltas->majorFault, deltas->minorFault);
+    }
+}
+
+int MemStatsRender(MemStats *stats, Introspect *introspect)
+{
+    HostMemStats *host = NULL;
+    DomainMemStats *domainStats = NULL;
+    const char *name = NULL;
+    int rt = 0;
+    checkNull(stats);
+    checkNull(introspect);
+    host = &stats->hostStats;
+    name = introspect->name;
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_STATS,
+        "{\"host\":{\"total\":%.0f,\"free\":%.0f,\"available\":%.0f,\"some\":%.2f,\"full\":%.2f,"
+        "\"emergency_triggers\":%d},\"cells\":[",
+        host->total, host->free, host->available, host->some.avg10, host->full.avg10, host->emergencyTriggers);
+    for (int c = 0; c < host->numCells; c++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_STATS, "%s{\"total\":%.0f,\"free\":%.0f}",
+            c > 0 ? "," : "", host->cells[c].total, host->cells[c].free);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_STATS, "],\"domains\":[");
+    for (int d = 0; d < stats->numDomains; d++) {
+        domainStats = stats->domainStats + d;
+        rt |= IntrospectPrintf(introspect, INTROSPECT_STATS,
+            "%s{\"actual\":%.0f,\"unused\":%.0f,\"max\":%.0f,\"reclaimable\":%.0f,\"unused_delta\":%.0f,"
+            "\"swap_in_delta\":%.0f,\"major_fault_delta\":%.0f,\"period\":%d,\"stale\":%d,\"hot\":%d}",
+            d > 0 ? "," : "", domainStats->actual, domainStats->unused, domainStats->max,
+            MemStatsReclaimable(stats, d), stats->domainDeltas[d].unused, stats->domainDeltas[d].swapIn,
+            stats->domainDeltas[d].majorFault, stats->sampling[d].period, stats->sampling[d].stale,
+            stats->sampling[d].hot);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_STATS, "]}\n");
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS,
+        "# TYPE %s_host_free_kb gauge\n%s_host_free_kb %.0f\n"
+        "# TYPE %s_host_available_kb gauge\n%s_host_available_kb %.0f\n",
+        name, name, host->free, name, name, host->available);
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_domain_actual_kb gauge\n", name);
+    for (int d = 0; d < stats->numDomains; d++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "%s_domain_actual_kb{domain=\"%d\"} %.0f\n",
+            name, d, stats->domainStats[d].actual);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_domain_unused_kb gauge\n", name);
+    for (int d = 0; d < stats->numDomains; d++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "%s_domain_unused_kb{domain=\"%d\"} %.0f\n",
+            name, d, stats->domainStats[d].unused);
     }
+    check(rt == 0, "failed to render memory stats");
+
+    return 0;
+error:
+    return -1;
 }
@@ -3,8 +3,20 @@
 
 #include <libvirt/libvirt.h>
 #include "guestlist.h"
+#include "introspect.h"
 
 #define MAX_STATS 15
+// cells are tracked in an unsigned long bit mask
+#define MAX_CELLS (8 * (int) sizeof(unsigned long))
+// fastest and slowest stats period of the guests' balloon drivers (in seconds)
+#define STATS_PERIOD_FAST 1
+#define STATS_PERIOD_SLOW 30
+// stats are stale when they have not been updated for this long after the expected update
+#define STATS_STALE_GRACE 2
+// number of libvirt calls needed to sample a domain
+#define RPCS_PER_SAMPLE 2
+#define DEFAULT_MEMINFO_PATH "/proc/meminfo"
+#define DEFAULT_PRESSURE_PATH "/proc/pressure/memory"
 typedef double MemStatUnit;
 
 typedef struct DomainMemStats {
@@ -34,11 +46,143 @@ typedef struct DomainMemStats {
      * Maximum amount of physical memory allocated to the domain
      */
     MemStatUnit max;
+    /**
+     * The total amount of data read from swap space (in kB).
+     * Cumulative counter, its delta is the amount swapped in during the last interval.
+     */
+    MemStatUnit swapIn;
+    /**
+     * The total amount of memory written out to swap space (in kB).
+     * Cumulative counter, its delta is the amount swapped out during the last interval.
+     */
+    MemStatUnit swapOut;
+    /**
+     * Number of page faults that required disk IO to service.
+     * Cumulative counter, its delta is the number of major faults during the last interval.
+     */
+    MemStatUnit majorFault;
+    /**
+     * Number of page faults serviced without disk IO.
+     * Cumulative counter, its delta is the number of minor faults during the last interval.
+     */
+    MemStatUnit minorFault;
+    /**
+     * The amount of memory that can be quickly reclaimed without additional I/O (in kB).
+     * Typically these pages are used for caching files from disk.
+     */
+    MemStatUnit diskCaches;
+    /**
+     * Timestamp of the last update of the statistics by the guest (in seconds)
+     */
+    MemStatUnit lastUpdate;
 } DomainMemStats;
 
+typedef struct DomainSampling {
+    /**
+     * Current stats collection period of the domain's balloon driver (in seconds)
+     */
+    int period;
+    /**
+     * Number of consecutive cycles the domain has been stable
+     */
+    int stableCycles;
+    /**
+     * Age of the domain's stats when they were last read (in seconds)
+     */
+    double age;
+    /**
+     * Whether the domain's stats are older than expected from its period
+     */
+    int stale;
+    /**
+     * Hot domains are sampled every cycle, the others share the sample budget
+     */
+    int hot;
+    /**
+     * Whether the domain was sampled in the current cycle
+     */
+    int sampled;
+    /**
+     * Number of cycles since the domain was last sampled
+     */
+    int cyclesSinceSample;
+} DomainSampling;
+
+typedef struct DomainReclaimHistory {
+    /**
+     * Amount of memory reclaimed from the domain in the last cycle (in kB)
+     */
+    MemStatUnit last;
+    /**
+     * Total amount of memory reclaimed from the domain without it paging afterwards (in kB)
+     */
+    MemStatUnit tolerated;
+    /**
+     * Largest single reclaim the domain tolerated without paging (in kB)
+     */
+    MemStatUnit maxTolerated;
+    /**
+     * Number of reclaims after which the domain started paging
+     */
+    int rejected;
+} DomainReclaimHistory;
+
+typedef struct PressureStats {
+    /**
+     * Share of time (in %) stalled on memory over the last 10, 60 and 300 seconds
+     */
+    double avg10;
+    double avg60;
+    double avg300;
+    /**
+     * Cumulative time stalled on memory (in us), 0 if not reported
+     */
+    unsigned long long total;
+} PressureStats;
+
+typedef struct CellMemStats {
+    MemStatUnit total;
+    MemStatUnit free;
+} CellMemStats;
+
 typedef struct HostMemStats {
     MemStatUnit total;
     MemStatUnit free;
+    MemStatUnit buffers;
+    MemStatUnit cached;
+    /**
+     * Estimate of how much memory is available for new allocations without swapping,
+     * corresponds to 'MemAvailable' in /proc/meminfo, falls back to free + buffers + cached
+     */
+    MemStatUnit available;
+    /**
+     * Whether memory pressure stall information (PSI) is available on the host
+     */
+    int hasPressure;
+    /**
+     * Time during which at least one task was stalled on memory
+     */
+    PressureStats some;
+    /**
+     * Time during which all non-idle tasks were stalled on memory
+     */
+    PressureStats full;
+    /**
+     * Number of NUMA cells on the host
+     */
+    int numCells;
+    /**
+     * Total and free memory (in kB) of each NUMA cell
+     */
+    CellMemStats *cells;
+    /**
+     * Number of emergency reclaims done by the watchdog since the last cycle
+     */
+    int emergencyTriggers;
+    /**
+     * Memory recently reclaimed by the watchdog (in kB), decays by half every cycle
+     */
+    MemStatUnit emergencyReclaimed;
 } HostMemStats;
 
 typedef struct MemStats {
@@ -46,17 +190,98 @@ typedef struct MemStats {
     DomainMemStats *domainStats;
     HostMemStats hostStats;
     DomainMemStats *domainDeltas;
+    DomainReclaimHistory *reclaimHistory;
+    /**
+     * Bit mask of the NUMA cells each domain's memory is bound to
+     */
+    unsigned long *domainCells;
+    DomainSampling *sampling;
+    /**
+     * Maximum number of libvirt calls used to sample stable domains each cycle, 0 for no limit
+     */
+    int sampleBudget;
+    /**
+     * Next stable domain to sample, stable domains are sampled round-robin
+     */
+    int nextStable;
+    /**
+     * Length of the cycle the deltas cover (in seconds)
+     */
+    double interval;
 } MemStats;
 
 #define MemStatsUnused(stats, dom) ((stats)->domainStats[(dom)].unused)
 #define MemStatsUsable(stats, dom) ((stats)->domainStats[(dom)].usable)
 #define MemStatsActual(stats, dom) ((stats)->domainStats[(dom)].actual)
 #define MemStatsUnusedDelta(stats, dom) ((stats)->domainDeltas[(dom)].unused)
+#define MemStatsSwapInDelta(stats, dom) ((stats)->domainDeltas[(dom)].swapIn)
+#define MemStatsSwapOutDelta(stats, dom) ((stats)->domainDeltas[(dom)].swapOut)
+#define MemStatsMajorFaultDelta(stats, dom) ((stats)->domainDeltas[(dom)].majorFault)
+// per-second rates of the paging counters, so that their thresholds do not depend on the cycle interval.
+// Stats without an interval, e.g. the cycles of a capacity simulation, are taken per cycle
+#define MemStatsPerSecond(stats, delta) ((stats)->interval > 0 ? (delta) / (stats)->interval : (delta))
+#define MemStatsSwapInRate(stats, dom) MemStatsPerSecond(stats, MemStatsSwapInDelta(stats, dom))
+#define MemStatsMajorFaultRate(stats, dom) MemStatsPerSecond(stats, MemStatsMajorFaultDelta(stats, dom))
+#define MemStatsDiskCaches(stats, dom) ((stats)->domainStats[(dom)].diskCaches)
+#define MemStatsReclaimHistory(stats, dom) ((stats)->reclaimHistory + (dom))
+#define MemStatsSampling(stats, dom) ((stats)->sampling + (dom))
+#define MemStatsIsStale(stats, dom) ((stats)->sampling[(dom)].stale)
+#define MemStatsWasSampled(stats, dom) ((stats)->sampling[(dom)].sampled)
+#define MemStatsIsDomainOnCell(stats, dom, cell) (((stats)->domainCells[(dom)] >> (cell)) & 1UL)
 
-MemStats *MemStatsCreate(virConnectPtr conn, GuestList *guests);
+/**
+ * creates memory stats object, `sampleBudget` limits the number of libvirt calls
+ * used to sample stable domains each cycle (0 for no limit)
+ * @return pointer to stats object. Created object should be freed using MemStatsFree()
+ */
+MemStats *MemStatsCreate(virConnectPtr conn, GuestList *guests, int sampleBudget);
+/**
+ * creates memory stats for `numDomains` domains without reading them, e.g. for simulated domains
+ * @return pointer to stats object. Created object should be freed using MemStatsFree()
+ */
+MemStats *MemStatsCreateEmpty(int numDomains, int sampleBudget);
 void MemStatsFree(MemStats *stats);
 void MemStatsPrint(MemStats *print, GuestList *guests);
+/**
+ * renders the stats as JSON and as prometheus gauges in the introspection snapshot
+ */
+int MemStatsRender(MemStats *stats, Introspect *introspect);
+/**
+ * overrides the files host meminfo and memory pressure are read from,
+ * a NULL path keeps the current value. Useful to feed fake files in tests
+ */
+void MemStatsSetHostFiles(const char *meminfoPath, const char *pressurePath);
 int MemStatsInit(MemStats *stats, virConnectPtr conn, GuestList *guests);
-int MemStatsUpdate(MemStats *stats, virConnectPtr conn, GuestList *guests, int updateDeltas);
+/**
+ * updates host stats and the stats of the domains sampled in this cycle. With a positive `timeInterval`
+ * (in seconds), the deltas over that interval are computed and the hot domains and the next stable domains
+ * within the budget are selected for sampling, otherwise the domains selected by the previous update are refreshed
+ */
+int MemStatsUpdate(MemStats *stats, virConnectPtr conn, GuestList *guests, double timeInterval);
+/**
+ * reads MemAvailable (in kB) from the host's meminfo file
+ * @return 0 if the value was found, -1 otherwise
+ */
+int MemStatsReadHostAvailable(MemStatUnit *available);
+/**
+ * samples host-wide memory stats (total, free, buffers, cached, available and pressure)
+ * into `hostStats`, cell stats are left untouched
+ */
+int MemStatsUpdateHostStats(virConnectPtr conn, HostMemStats *hostStats);
+/**
+ * estimates how much memory the domain could give back without
+ * swapping, on top of its unused memory, i.e. clean disk caches.
+ * @return reclaimable memory in kB
+ */
+MemStatUnit MemStatsReclaimable(MemStats *stats, int dom);
+/**
+ * sets how often the domain's balloon driver collects memory stats,
+ * the guest is only called if the period changes
+ */
+int MemStatsSetStatsPeriod(MemStats *stats, GuestList *guests, int dom, int period);
+/**
+ * @return the number of NUMA cells the domain's memory is bound to
+ */
+int MemStatsDomainNumCells(MemStats *stats, int dom);
 
 #endif
\ No newline at end of file
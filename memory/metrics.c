@@ -0,0 +1,230 @@
+#include <stdatomic.h>
+#include "check.h"
+#include "log.h"
+#include "metrics.h"
+
+typedef struct MetricsHistogram {
+    atomic_ulong buckets[METRICS_NUM_BUCKETS];
+    // total latency in nanoseconds
+    atomic_ulong sum;
+    atomic_ulong count;
+} MetricsHistogram;
+
+/**
+ * metrics of one connection, only updated by the threads serving that connection
+ */
+typedef struct MetricsSource {
+    const char *name;
+    MetricsHistogram histograms[METRICS_NUM_PHASES];
+    atomic_ulong rpcs[METRICS_NUM_RPCS];
+    atomic_ulong rpcErrors[METRICS_NUM_RPCS];
+    atomic_ulong cycles;
+} MetricsSource;
+
+// upper bounds of the latency buckets in seconds
+static const double bucketBounds[METRICS_NUM_BUCKETS - 1] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05, 0.1, 0.25, 0.5, 1, 2.5, 5
+};
+static const char *phaseNames[] = {"collect", "plan", "actuate"};
+static const char *rpcNames[] = {"list", "collect", "actuate"};
+
+static MetricsSource sources[METRICS_MAX_SOURCES];
+static atomic_int numSources = 1;
+static _Thread_local MetricsSource *source = sources;
+
+int MetricsSetSource(int index, const char *name)
+{
+    int n = 0;
+    check(index >= 0 && index < METRICS_MAX_SOURCES, "metrics source out of bounds");
+    if (name) {
+        sources[index].name = name;
+    }
+    source = sources + index;
+    n = atomic_load(&numSources);
+    while (n <= index && !atomic_compare_exchange_weak(&numSources, &n, index + 1)) {
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+void MetricsCountRpc(MetricsRpc kind, int failed)
+{
+    atomic_fetch_add_explicit(source->rpcs + kind, 1, memory_order_relaxed);
+    if (failed) {
+        atomic_fetch_add_explicit(source->rpcErrors + kind, 1, memory_order_relaxed);
+    }
+}
+
+void MetricsCountCycle(void)
+{
+    atomic_fetch_add_explicit(&source->cycles, 1, memory_order_relaxed);
+}
+
+MetricsTime MetricsNow(void)
+{
+    MetricsTime now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now;
+}
+
+void MetricsRecordPhase(MetricsPhase phase, MetricsTime start)
+{
+    MetricsTime end = MetricsNow();
+    MetricsHistogram *histogram = source->histograms + phase;
+    long nanoseconds = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+    double latency = nanoseconds / 1e9;
+    int b = 0;
+
+    while (b < METRICS_NUM_BUCKETS - 1 && latency > bucketBounds[b]) {
+        b++;
+    }
+    // a histogram only has one writer, the atomics keep concurrent renders consistent
+    atomic_fetch_add_explicit(histogram->buckets + b, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, nanoseconds, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+}
+
+/**
+ * adds the metrics of a source to `total`
+ */
+void MetricsAdd(MetricsSource *total, MetricsSource *src)
+{
+    MetricsHistogram *histogram = NULL;
+    MetricsHistogram *srcHistogram = NULL;
+
+    for (int p = 0; p < METRICS_NUM_PHASES; p++) {
+        histogram = total->histograms + p;
+        srcHistogram = src->histograms + p;
+        for (int b = 0; b < METRICS_NUM_BUCKETS; b++) {
+            histogram->buckets[b] += atomic_load(srcHistogram->buckets + b);
+        }
+        histogram->sum += atomic_load(&srcHistogram->sum);
+        histogram->count += atomic_load(&srcHistogram->count);
+    }
+    for (int r = 0; r < METRICS_NUM_RPCS; r++) {
+        total->rpcs[r] += atomic_load(src->rpcs + r);
+        total->rpcErrors[r] += atomic_load(src->rpcErrors + r);
+    }
+    total->cycles += atomic_load(&src->cycles);
+}
+
+int MetricsRenderSourceJson(Introspect *introspect, MetricsSource *src)
+{
+    MetricsHistogram *histogram = NULL;
+    int rt = 0;
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "{\"cycles\":%lu,\"latency\":{", atomic_load(&src->cycles));
+    for (int p = 0; p < METRICS_NUM_PHASES; p++) {
+        histogram = src->histograms + p;
+        rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "%s\"%s\":{\"count\":%lu,\"sum\":%.6f,\"buckets\":[",
+            p > 0 ? "," : "", phaseNames[p], atomic_load(&histogram->count), atomic_load(&histogram->sum) / 1e9);
+        for (int b = 0; b < METRICS_NUM_BUCKETS; b++) {
+            rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "%s%lu", b > 0 ? "," : "",
+                atomic_load(histogram->buckets + b));
+        }
+        rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "]}");
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "},\"rpcs\":{");
+    for (int r = 0; r < METRICS_NUM_RPCS; r++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "%s\"%s\":{\"calls\":%lu,\"errors\":%lu}",
+            r > 0 ? "," : "", rpcNames[r], atomic_load(src->rpcs + r), atomic_load(src->rpcErrors + r));
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "}}");
+
+    return rt;
+}
+
+int MetricsRenderJson(Introspect *introspect)
+{
+    MetricsSource total = {0};
+    int n = atomic_load(&numSources);
+    int rt = 0;
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "{\"connections\":[");
+    for (int s = 0; s < n; s++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "%s{\"name\":\"%s\",\"metrics\":",
+            s > 0 ? "," : "", sources[s].name ? sources[s].name : "");
+        rt |= MetricsRenderSourceJson(introspect, sources + s);
+        rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "}");
+        MetricsAdd(&total, sources + s);
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, "],\"total\":");
+    rt |= MetricsRenderSourceJson(introspect, &total);
+    rt |= IntrospectPrintf(introspect, INTROSPECT_METRICS, ",\"log_dropped\":%lu,\"snapshots_skipped\":%lu}\n",
+        LogDropped(), introspect->skipped);
+
+    return rt == 0 ? 0 : -1;
+}
+
+int MetricsRenderPrometheus(Introspect *introspect)
+{
+    const char *name = introspect->name;
+    MetricsHistogram *histogram = NULL;
+    MetricsSource *src = NULL;
+    unsigned long cumulative = 0;
+    int n = atomic_load(&numSources);
+    int rt = 0;
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_cycles_total counter\n", name);
+    for (int s = 0; s < n; s++) {
+        rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "%s_cycles_total{connection=\"%d\"} %lu\n",
+            name, s, atomic_load(&sources[s].cycles));
+    }
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_phase_seconds histogram\n", name);
+    for (int s = 0; s < n; s++) {
+        src = sources + s;
+        for (int p = 0; p < METRICS_NUM_PHASES; p++) {
+            histogram = src->histograms + p;
+            cumulative = 0;
+            for (int b = 0; b < METRICS_NUM_BUCKETS - 1; b++) {
+                cumulative += atomic_load(histogram->buckets + b);
+                rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS,
+                    "%s_phase_seconds_bucket{connection=\"%d\",phase=\"%s\",le=\"%g\"} %lu\n",
+                    name, s, phaseNames[p], bucketBounds[b], cumulative);
+            }
+            cumulative += atomic_load(histogram->buckets + METRICS_NUM_BUCKETS - 1);
+            rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS,
+                "%s_phase_seconds_bucket{connection=\"%d\",phase=\"%s\",le=\"+Inf\"} %lu\n"
+                "%s_phase_seconds_sum{connection=\"%d\",phase=\"%s\"} %.6f\n"
+                "%s_phase_seconds_count{connection=\"%d\",phase=\"%s\"} %lu\n",
+                name, s, phaseNames[p], cumulative, name, s, phaseNames[p], atomic_load(&histogram->sum) / 1e9,
+                name, s, phaseNames[p], cumulative);
+        }
+    }
+
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_libvirt_calls_total counter\n", name);
+    for (int s = 0; s < n; s++) {
+        for (int r = 0; r < METRICS_NUM_RPCS; r++) {
+            rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS,
+                "%s_libvirt_calls_total{connection=\"%d\",kind=\"%s\"} %lu\n",
+                name, s, rpcNames[r], atomic_load(sources[s].rpcs + r));
+        }
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS, "# TYPE %s_libvirt_errors_total counter\n", name);
+    for (int s = 0; s < n; s++) {
+        for (int r = 0; r < METRICS_NUM_RPCS; r++) {
+            rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS,
+                "%s_libvirt_errors_total{connection=\"%d\",kind=\"%s\"} %lu\n",
+                name, s, rpcNames[r], atomic_load(sources[s].rpcErrors + r));
+        }
+    }
+    rt |= IntrospectPrintf(introspect, INTROSPECT_PROMETHEUS,
+        "# TYPE %s_log_dropped_total counter\n%s_log_dropped_total %lu\n", name, name, LogDropped());
+
+    return rt == 0 ? 0 : -1;
+}
+
+int MetricsRender(Introspect *introspect)
+{
+    checkNull(introspect);
+    check(MetricsRenderJson(introspect) == 0, "failed to render metrics");
+    check(MetricsRenderPrometheus(introspect) == 0, "failed to render prometheus metrics");
+
+    return 0;
+error:
+    return -1;
+}
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "check.h"
+#include "params.h"
+
+// name in profiles, member of Params and default value of each parameter
+#define PARAMS_FIELDS(X) \
+    X(min_change_for_dealloc, minChangeForDealloc, 1024) \
+    X(min_guest_memory, minGuestMemory, 100 * 1024) \
+    X(min_host_memory, minHostMemory, 200 * 1024) \
+    X(max_free_memory, maxFreeMemory, 300 * 1024) \
+    X(min_dealloc_amount, minDeallocAmount, 1024) \
+    X(max_wasteful_dealloc_amount, maxWastefulDeallocAmount, 100 * 1024) \
+    X(paging_swap_in_threshold, pagingSwapInThreshold, 200) \
+    X(paging_major_fault_threshold, pagingMajorFaultThreshold, 50) \
+    X(cache_reclaim_ratio, cacheReclaimRatio, 0.5) \
+    X(some_pressure_scale, somePressureScale, 10.0) \
+    X(full_pressure_limit, fullPressureLimit, 1.0) \
+    X(fast_sampling_change, fastSamplingChange, 10 * 1024) \
+    X(fast_sampling_margin, fastSamplingMargin, 50 * 1024) \
+    X(stable_cycles_to_slow_down, stableCyclesToSlowDown, 3) \
+    X(equality_precision, equalityPrecision, 100)
+
+#define PARAMS_FIELD(name, member, value) {#name, offsetof(Params, member), value},
+#define PARAMS_DEFAULT(name, member, value) .member = value,
+
+static const ParamsField fields[] = {PARAMS_FIELDS(PARAMS_FIELD)};
+
+#define NUM_FIELDS ((int) (sizeof(fields) / sizeof(fields[0])))
+
+static Params global = {PARAMS_FIELDS(PARAMS_DEFAULT)};
+static _Thread_local const Params *current = &global;
+
+const Params *ParamsCurrent(void)
+{
+    return current;
+}
+
+Params *ParamsGlobal(void)
+{
+    return &global;
+}
+
+void ParamsUse(const Params *params)
+{
+    current = params ? params : &global;
+}
+
+void ParamsInit(Params *params)
+{
+    for (int f = 0; f < NUM_FIELDS; f++) {
+        *ParamsValue(params, fields + f) = fields[f].defaultValue;
+    }
+}
+
+const ParamsField *ParamsFields(int *numFields)
+{
+    *numFields = NUM_FIELDS;
+    return fields;
+}
+
+int ParamsSet(Params *params, const char *name, double value)
+{
+    checkNull(params);
+    checkNull(name);
+    for (int f = 0; f < NUM_FIELDS; f++) {
+        if (strcmp(name, fields[f].name) == 0) {
+            check(value >= 0, "parameters cannot be negative");
+            *ParamsValue(params, fields + f) = value;
+            return 0;
+        }
+    }
+    check(0, "unknown parameter");
+error:
+    return -1;
+}
+
+int ParamsLoad(Params *params, const char *path)
+{
+    FILE *file = NULL;
+    char line[PARAMS_MAX_LINE];
+    char name[PARAMS_MAX_LINE];
+    double value = 0;
+    int lineNum = 0;
+
+    checkNull(params);
+    checkNull(path);
+    file = fopen(path, "r");
+    check(file, "failed to open parameter profile");
+
+    while (fgets(line, PARAMS_MAX_LINE, file)) {
+        lineNum += 1;
+        line[strcspn(line, "#\r\n")] = '\0';
+        if (strspn(line, " \t") == strlen(line)) {
+            continue;
+        }
+        if (sscanf(line, "%255s %lf", name, &value) != 2) {
+            fprintf(stderr, "%s:%d: ", path, lineNum);
+            check(0, "parameter should be <name> <value>");
+        }
+        // a profile can hold the parameters of both daemons
+        if (strncmp(name, PARAMS_PREFIX, strlen(PARAMS_PREFIX)) != 0) {
+            continue;
+        }
+        if (ParamsSet(params, name + strlen(PARAMS_PREFIX), value) != 0) {
+            fprintf(stderr, "%s:%d: ", path, lineNum);
+            check(0, "invalid parameter in profile");
+        }
+    }
+
+    fclose(file);
+    return 0;
+error:
+    if (file) {
+        fclose(file);
+    }
+    return -1;
+}
+
+void ParamsPrint(const Params *params, FILE *file)
+{
+    for (int f = 0; f < NUM_FIELDS; f++) {
+        fprintf(file, "%s%s %.10g\n", PARAMS_PREFIX, fields[f].name, *ParamsValue(params, fields + f));
+    }
+}
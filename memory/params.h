@@ -0,0 +1,92 @@
+#ifndef params_h
+#define params_h
+
+#include <stdio.h>
+
+// prefix of the coordinator's parameters in a profile, the parameters of the other daemon are skipped
+#define PARAMS_PREFIX "memory."
+#define PARAMS_MAX_LINE 256
+
+/**
+ * tunable thresholds of the coordination policy, sizes are in kB. A profile sets them at startup,
+ * the defaults are the values the policy was designed with
+ */
+typedef struct Params {
+    // minimum memory change in allocation plan to warrant de-allocation
+    double minChangeForDealloc;
+    // unused memory below which a guest is starving
+    double minGuestMemory;
+    // memory kept available on the host, before the pressure and emergency reclaims add to it
+    double minHostMemory;
+    // unused and reclaimable memory above which a guest is wasteful
+    double maxFreeMemory;
+    // minimum amount that can be deallocated
+    double minDeallocAmount;
+    // maximum amount to dealloc from wasteful guest
+    double maxWastefulDeallocAmount;
+    // amount swapped in per second above which a guest is considered to be paging
+    double pagingSwapInThreshold;
+    // number of major faults per second above which a guest is considered to be paging
+    double pagingMajorFaultThreshold;
+    // share of a guest's reclaimable disk caches the coordinator may take back
+    double cacheReclaimRatio;
+    // host "some" stall percentage at which the host memory reserve doubles
+    double somePressureScale;
+    // host "full" stall percentage above which guests may not grow from host memory
+    double fullPressureLimit;
+    // change in unused memory per cycle above which a domain's stats are sampled fast
+    double fastSamplingChange;
+    // distance from the band edges within which a domain's stats are sampled fast
+    double fastSamplingMargin;
+    // number of stable cycles after which a domain's stats period is doubled
+    double stableCyclesToSlowDown;
+    // memory sizes closer than this are considered equal
+    double equalityPrecision;
+} Params;
+
+/**
+ * describes a parameter: its name in profiles, where it is in Params and its default
+ */
+typedef struct ParamsField {
+    const char *name;
+    size_t offset;
+    double defaultValue;
+} ParamsField;
+
+#define ParamsValue(params, field) ((double *) ((char *) (params) + (field)->offset))
+
+/**
+ * @return the parameters in use on the calling thread, the process-wide ones unless ParamsUse() was called
+ */
+const Params *ParamsCurrent(void);
+/**
+ * @return the process-wide parameters, used by every thread that does not use its own
+ */
+Params *ParamsGlobal(void);
+/**
+ * makes the calling thread use `params`, or the process-wide parameters when NULL
+ */
+void ParamsUse(const Params *params);
+/**
+ * sets all the parameters to their defaults
+ */
+void ParamsInit(Params *params);
+/**
+ * @return the description of each parameter, and their number in `numFields`
+ */
+const ParamsField *ParamsFields(int *numFields);
+/**
+ * sets the parameter named `name`, without the prefix
+ */
+int ParamsSet(Params *params, const char *name, double value);
+/**
+ * loads a profile, one `<prefix><name> <value>` per line, `#` starts a comment.
+ * The parameters a profile does not set keep their value
+ */
+int ParamsLoad(Params *params, const char *path);
+/**
+ * writes the parameters as a profile
+ */
+void ParamsPrint(const Params *params, FILE *file);
+
+#endif
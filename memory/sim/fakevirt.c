@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libvirt/libvirt.h>
+#include "util.h"
+#include "fakevirt.h"
+
+struct _virConnect {
+    SimHost *host;
+};
+
+struct _virDomain {
+    SimHost *host;
+    int index;
+};
+
+// per thread, so that hosts can be simulated in parallel
+static _Thread_local SimHost *simHost = NULL;
+// wall clock time at which the simulated time started
+static _Thread_local time_t simStart = 0;
+// code of the last error, libvirt keeps it per thread too
+static _Thread_local int lastError = VIR_ERR_OK;
+
+time_t __real_time(time_t *t);
+
+void FakeVirtSetHost(SimHost *host)
+{
+    simHost = host;
+    simStart = host ? __real_time(NULL) - (time_t) host->time : 0;
+}
+
+/**
+ * the simulator is linked with time() wrapped, so that the coordinator sees
+ * the simulated time pass, e.g. between the guests' stats refreshes
+ */
+time_t __wrap_time(time_t *t)
+{
+    time_t now = simHost ? simStart + (time_t) simHost->time : __real_time(NULL);
+    if (t) {
+        *t = now;
+    }
+    return now;
+}
+
+#define guestOf(domain) ((domain)->host->guests + (domain)->index)
+
+virConnectPtr virConnectOpen(const char *name)
+{
+    virConnectPtr conn = NULL;
+    if (!simHost) {
+        return NULL;
+    }
+    conn = calloc(1, sizeof(struct _virConnect));
+    if (conn) {
+        conn->host = simHost;
+    }
+    return conn;
+}
+
+int virConnectClose(virConnectPtr conn)
+{
+    free(conn);
+    return 0;
+}
+
+/**
+ * the simulated host is reported as remote, so that the coordinator takes the host's memory
+ * from the node stats and not from the files of the machine running the simulation
+ */
+int virConnectIsRemote(virConnectPtr conn)
+{
+    return 1;
+}
+
+int virConnectNumOfDomains(virConnectPtr conn)
+{
+    return conn->host->numGuests;
+}
+
+int virConnectListDomains(virConnectPtr conn, int *ids, int maxids)
+{
+    int count = min(conn->host->numGuests, maxids);
+    for (int i = 0; i < count; i++) {
+        ids[i] = i + 1;
+    }
+    return count;
+}
+
+virDomainPtr virDomainLookupByID(virConnectPtr conn, int id)
+{
+    virDomainPtr domain = NULL;
+    if (id < 1 || id > conn->host->numGuests) {
+        return NULL;
+    }
+    domain = calloc(1, sizeof(struct _virDomain));
+    if (domain) {
+        domain->host = conn->host;
+        domain->index = id - 1;
+    }
+    return domain;
+}
+
+int virDomainFree(virDomainPtr domain)
+{
+    free(domain);
+    return 0;
+}
+
+const char *virDomainGetName(virDomainPtr domain)
+{
+    return guestOf(domain)->name;
+}
+
+unsigned int virDomainGetID(virDomainPtr domain)
+{
+    return domain->index + 1;
+}
+
+int virDomainGetUUIDString(virDomainPtr domain, char *buf)
+{
+    snprintf(buf, VIR_UUID_STRING_BUFLEN, "00000000-0000-0000-0000-%012d", domain->index + 1);
+    return 0;
+}
+
+/**
+ * the host has a single NUMA cell holding all its memory
+ */
+int virNodeGetInfo(virConnectPtr conn, virNodeInfoPtr info)
+{
+    memset(info, 0, sizeof(virNodeInfo));
+    info->memory = (unsigned long) conn->host->total;
+    info->nodes = 1;
+    return 0;
+}
+
+int virNodeGetMemoryStats(virConnectPtr conn, int cellNum, virNodeMemoryStatsPtr params, int *nparams,
+    unsigned int flags)
+{
+    const char *fields[] = {"total", "free", "buffers", "cached"};
+    unsigned long long values[] = {conn->host->total, max(SimHostFree(conn->host), 0), 0, 0};
+
+    if (!params) {
+        *nparams = 4;
+        return 0;
+    }
+    for (int i = 0; i < 4 && i < *nparams; i++) {
+        snprintf(params[i].field, VIR_NODE_MEMORY_STATS_FIELD_LENGTH, "%s", fields[i]);
+        params[i].value = values[i];
+    }
+    return 0;
+}
+
+int virNodeGetCellsFreeMemory(virConnectPtr conn, unsigned long long *freeMems, int startCell, int maxCells)
+{
+    if (startCell != 0 || maxCells < 1) {
+        return -1;
+    }
+    // reported in bytes
+    freeMems[0] = (unsigned long long) max(SimHostFree(conn->host), 0) * 1024;
+    return 1;
+}
+
+int virDomainGetNumaParameters(virDomainPtr domain, virTypedParameterPtr params, int *nparams, unsigned int flags)
+{
+    *nparams = 0;
+    return 0;
+}
+
+int virTypedParamsGetString(virTypedParameterPtr params, int nparams, const char *name, const char **value)
+{
+    return 0;
+}
+
+void virTypedParamsClear(virTypedParameterPtr params, int nparams)
+{
+}
+
+/**
+ * the balloon size is known to the hypervisor at all times, the other stats are the ones
+ * the balloon driver collected last
+ */
+int virDomainMemoryStats(virDomainPtr domain, virDomainMemoryStatPtr stats, unsigned int nr_stats,
+    unsigned int flags)
+{
+    SimGuest *guest = guestOf(domain);
+    DomainMemStats *reported = &guest->reported;
+    unsigned int count = 0;
+    struct {
+        int tag;
+        MemStatUnit value;
+    } values[] = {
+        {VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON, guest->actual},
+        {VIR_DOMAIN_MEMORY_STAT_UNUSED, reported->unused},
+        {VIR_DOMAIN_MEMORY_STAT_USABLE, reported->usable},
+        {VIR_DOMAIN_MEMORY_STAT_AVAILABLE, reported->available},
+        {VIR_DOMAIN_MEMORY_STAT_DISK_CACHES, reported->diskCaches},
+        {VIR_DOMAIN_MEMORY_STAT_SWAP_IN, reported->swapIn},
+        {VIR_DOMAIN_MEMORY_STAT_SWAP_OUT, reported->swapOut},
+        {VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT, reported->majorFault},
+        {VIR_DOMAIN_MEMORY_STAT_MINOR_FAULT, reported->minorFault},
+        // the time of the guest's last refresh on the simulated clock
+        {VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE, time(NULL) - (domain->host->time - guest->lastRefresh)}
+    };
+    // a driver that never collected stats only reports the balloon size
+    int numValues = guest->lastRefresh >= 0 ? sizeof(values) / sizeof(values[0]) : 1;
+
+    for (int i = 0; i < numValues && count < nr_stats; i++) {
+        stats[count].tag = values[i].tag;
+        stats[count].val = (unsigned long long) max(values[i].value, 0);
+        count += 1;
+    }
+    return count;
+}
+
+unsigned long virDomainGetMaxMemory(virDomainPtr domain)
+{
+    return (unsigned long) guestOf(domain)->max;
+}
+
+int virDomainSetMemory(virDomainPtr domain, unsigned long memory)
+{
+    SimGuest *guest = guestOf(domain);
+    if (memory > guest->max) {
+        return -1;
+    }
+    guest->target = memory;
+    domain->host->numAdjustments += 1;
+    return 0;
+}
+
+int virDomainSetMemoryStatsPeriod(virDomainPtr domain, int period, unsigned int flags)
+{
+    SimGuest *guest = guestOf(domain);
+    guest->period = period;
+    // the driver collects stats as soon as it is given a period
+    SimGuestRefresh(guest, domain->host->time, guest->lastRefresh < 0);
+    return 0;
+}
+
+int virGetLastErrorCode(void)
+{
+    return lastError;
+}
+
+void virResetLastError(void)
+{
+    lastError = VIR_ERR_OK;
+}
+
+/**
+ * the simulated guests cannot grow beyond their boot-time max memory
+ */
+int virDomainSetMemoryFlags(virDomainPtr domain, unsigned long memory, unsigned int flags)
+{
+    lastError = VIR_ERR_OPERATION_UNSUPPORTED;
+    return -1;
+}
+
+char *virDomainGetXMLDesc(virDomainPtr domain, unsigned int flags)
+{
+    return NULL;
+}
+
+int virDomainAttachDeviceFlags(virDomainPtr domain, const char *xml, unsigned int flags)
+{
+    lastError = VIR_ERR_OPERATION_UNSUPPORTED;
+    return -1;
+}
@@ -0,0 +1,12 @@
+#ifndef fakevirt_h
+#define fakevirt_h
+
+#include "simhost.h"
+
+/**
+ * libvirt entry points used by the coordinator, implemented over a simulated host and linked in place of
+ * libvirt. Every connection opened, whatever its URI, is to the host the calling thread set with FakeVirtSetHost()
+ */
+void FakeVirtSetHost(SimHost *host);
+
+#endif
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "check.h"
+#include "log.h"
+#include "simhost.h"
+#include "simulator.h"
+#include "params.h"
+
+#define USAGE "usage: ./memory_sim [-d duration] [-i interval] [-b rpc_budget] [-P params_profile] [-l log_level] [-j] <scenario>..."
+
+int main(int argc, char *argv[])
+{
+    int opt = 0;
+    int rt = 0;
+    double duration = 0;
+    int interval = 0;
+    int sampleBudget = 0;
+    int logLevel = LOG_WARN;
+    LogFormat logFormat = LOG_FORMAT_TEXT;
+    SimHost *host = NULL;
+
+    while ((opt = getopt(argc, argv, "d:i:b:P:l:j")) != -1) {
+        switch (opt) {
+            case 'd':
+                duration = atof(optarg);
+                break;
+            case 'i':
+                interval = atoi(optarg);
+                break;
+            case 'b':
+                sampleBudget = atoi(optarg);
+                break;
+            case 'P':
+                rt = ParamsLoad(ParamsGlobal(), optarg);
+                check(rt == 0, "invalid parameter profile");
+                break;
+            case 'l':
+                logLevel = LogParseLevel(optarg);
+                check(logLevel >= 0, "unknown log level, " USAGE);
+                break;
+            case 'j':
+                logFormat = LOG_FORMAT_JSON;
+                break;
+            default:
+                check(0, USAGE);
+        }
+    }
+    check(optind < argc, "scenario file required, " USAGE);
+
+    host = calloc(1, sizeof(SimHost));
+    checkMemAlloc(host);
+    // the report is the only output on stdout
+    rt = LogStart(stderr, logLevel, logFormat);
+    check(rt == 0, "failed to start logging");
+
+    // one report per scenario, so that scenarios can be compared side by side
+    printf("[");
+    for (int i = optind; i < argc; i++) {
+        rt = SimHostLoad(host, argv[i]);
+        check(rt == 0, "failed to load scenario");
+        host->duration = duration > 0 ? duration : host->duration;
+        host->interval = interval > 0 ? interval : host->interval;
+        rt = SimulatorRun(host, sampleBudget);
+        check(rt == 0, "simulation failed");
+        SimHostPrint(host, stdout);
+        SimHostRelease(host);
+        printf(i + 1 < argc ? ",\n" : "");
+    }
+    printf("]\n");
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = 1;
+final:
+    LogStop();
+    if (host) {
+        SimHostRelease(host);
+    }
+    free(host);
+    return rt;
+}
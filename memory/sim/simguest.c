@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "util.h"
+#include "simguest.h"
+
+static const char *patternNames[] = {"steady", "ramp", "cycle", "spike"};
+
+void SimGuestInit(SimGuest *guest, const char *name, MemStatUnit max, SimPattern pattern)
+{
+    memset(guest, 0, sizeof(SimGuest));
+    snprintf(guest->name, SIM_MAX_NAME, "%s", name);
+    guest->pattern = pattern;
+    guest->max = max;
+    guest->actual = max;
+    guest->target = max;
+    guest->cacheFillRate = SIM_DEFAULT_CACHE_FILL_RATE * 1024;
+    guest->inflateRate = SIM_DEFAULT_INFLATE_RATE * 1024;
+    guest->deflateRate = SIM_DEFAULT_DEFLATE_RATE * 1024;
+    guest->swapTouch = SIM_DEFAULT_SWAP_TOUCH;
+    // balloon drivers do not collect stats until they are given a period
+    guest->lastRefresh = -1;
+}
+
+int SimGuestSetParam(SimGuest *guest, const char *param)
+{
+    char key[16];
+    double value = 0;
+
+    checkNull(guest);
+    checkNull(param);
+    check(sscanf(param, "%15[^=]=%lf", key, &value) == 2 && value >= 0, "guest parameter should be <key>=<value>");
+
+    if (strcmp(key, "base") == 0) {
+        guest->base = value * 1024;
+        guest->used = guest->base;
+    }
+    else if (strcmp(key, "peak") == 0) {
+        guest->peak = value * 1024;
+    }
+    else if (strcmp(key, "alloc") == 0) {
+        guest->allocRate = value * 1024;
+    }
+    else if (strcmp(key, "free") == 0) {
+        guest->freeRate = value * 1024;
+    }
+    else if (strcmp(key, "start") == 0) {
+        guest->start = value;
+    }
+    else if (strcmp(key, "hold") == 0) {
+        guest->hold = value;
+    }
+    else if (strcmp(key, "cache") == 0) {
+        guest->cacheTarget = value * 1024;
+    }
+    else if (strcmp(key, "cachefill") == 0) {
+        guest->cacheFillRate = value * 1024;
+    }
+    else if (strcmp(key, "inflate") == 0) {
+        guest->inflateRate = value * 1024;
+    }
+    else if (strcmp(key, "deflate") == 0) {
+        guest->deflateRate = value * 1024;
+    }
+    else if (strcmp(key, "touch") == 0) {
+        guest->swapTouch = value;
+    }
+    else if (strcmp(key, "boot") == 0) {
+        guest->actual = min(value * 1024, guest->max);
+        guest->target = guest->actual;
+    }
+    else {
+        check(0, "unknown guest parameter");
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+void SimGuestSetTrace(SimGuest *guest, const MemStatUnit *trace, int length, double step, MemStatUnit actual)
+{
+    guest->pattern = SIM_PATTERN_TRACE;
+    guest->trace = trace;
+    guest->traceLength = length;
+    guest->traceStep = step;
+    guest->base = trace[0];
+    guest->used = trace[0];
+    guest->actual = min(actual, guest->max);
+    guest->target = guest->actual;
+    // the recorded memory used includes the guest's caches
+    guest->cacheTarget = 0;
+}
+
+int SimGuestParsePattern(const char *name)
+{
+    for (int p = SIM_PATTERN_STEADY; p <= SIM_PATTERN_SPIKE; p++) {
+        if (strcmp(name, patternNames[p]) == 0) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+/**
+ * moves the memory used by the guest's processes along its pattern. The freed memory
+ * leaves swap in proportion, the allocated memory is touched for the first time
+ */
+void SimGuestUpdateUsed(SimGuest *guest, double time, double dt)
+{
+    MemStatUnit used = guest->used;
+
+    if (time < guest->start) {
+        return;
+    }
+    switch (guest->pattern) {
+        case SIM_PATTERN_STEADY:
+            break;
+        case SIM_PATTERN_RAMP:
+            used = min(used + guest->allocRate * dt, guest->peak);
+            break;
+        case SIM_PATTERN_SPIKE:
+            if (!guest->freeing && used < guest->peak) {
+                used = guest->peak;
+                guest->heldSince = time;
+            }
+            else if (!guest->freeing) {
+                guest->freeing = time - guest->heldSince >= guest->hold;
+            }
+            else {
+                used = max(used - guest->freeRate * dt, guest->base);
+            }
+            break;
+        case SIM_PATTERN_CYCLE:
+            if (!guest->freeing && used < guest->peak) {
+                used = min(used + guest->allocRate * dt, guest->peak);
+                guest->heldSince = time;
+            }
+            else if (!guest->freeing) {
+                guest->freeing = time - guest->heldSince >= guest->hold;
+            }
+            else if (used > guest->base) {
+                used = max(used - guest->freeRate * dt, guest->base);
+                guest->heldSince = time;
+            }
+            else {
+                guest->freeing = time - guest->heldSince < guest->hold;
+            }
+            break;
+        case SIM_PATTERN_TRACE:
+            used = min(guest->trace[(long) (time / guest->traceStep) % guest->traceLength], guest->max);
+            break;
+    }
+
+    if (used < guest->used) {
+        guest->swapped -= guest->swapped * (guest->used - used) / guest->used;
+    }
+    else {
+        guest->minorFault += (used - guest->used) / SIM_PAGE_SIZE;
+    }
+    guest->used = used;
+}
+
+MemStatUnit SimGuestStep(SimGuest *guest, double time, double dt, MemStatUnit *hostFree)
+{
+    MemStatUnit reclaimed = 0;
+    MemStatUnit step = 0;
+    MemStatUnit swapped = 0;
+    MemStatUnit touched = 0;
+    MemStatUnit room = 0;
+
+    SimGuestUpdateUsed(guest, time, dt);
+
+    // the balloon moves towards its target at the driver's speed, growing only as far as the host has memory
+    if (guest->target < guest->actual) {
+        reclaimed = min(guest->actual - guest->target, guest->inflateRate * dt);
+        guest->actual -= reclaimed;
+        *hostFree += reclaimed;
+    }
+    else if (guest->target > guest->actual) {
+        step = min(min(guest->target - guest->actual, guest->deflateRate * dt), max(*hostFree, 0));
+        guest->actual += step;
+        *hostFree -= step;
+    }
+
+    // what the processes use beyond the balloon is swapped out, and swapped back in once there is room
+    swapped = max(guest->used - guest->actual, 0);
+    if (swapped > guest->swapped) {
+        guest->swapOut += swapped - guest->swapped;
+    }
+    else {
+        guest->swapIn += guest->swapped - swapped;
+        guest->majorFault += (guest->swapped - swapped) / SIM_PAGE_SIZE;
+    }
+    guest->swapped = swapped;
+    touched = guest->swapTouch * swapped * dt;
+    guest->swapIn += touched;
+    guest->swapOut += touched;
+    guest->majorFault += touched / SIM_PAGE_SIZE;
+
+    // caches are dropped before anything is swapped, and fill the free memory again slowly
+    room = max(guest->actual - guest->used, 0);
+    guest->cache = min(guest->cache, room);
+    guest->cache += min(min(room - guest->cache, guest->cacheFillRate * dt), max(guest->cacheTarget - guest->cache, 0));
+
+    SimGuestRefresh(guest, time + dt, 0);
+    return reclaimed;
+}
+
+MemStatUnit SimGuestUnused(SimGuest *guest)
+{
+    return max(guest->actual - (guest->used - guest->swapped) - guest->cache, 0);
+}
+
+void SimGuestRefresh(SimGuest *guest, double time, int force)
+{
+    DomainMemStats *reported = &guest->reported;
+
+    if (!force && (guest->period <= 0 || time - guest->lastRefresh < guest->period)) {
+        return;
+    }
+    reported->actual = guest->actual;
+    reported->unused = SimGuestUnused(guest);
+    reported->usable = reported->unused + guest->cache;
+    reported->available = guest->actual;
+    reported->max = guest->max;
+    reported->diskCaches = guest->cache;
+    reported->swapIn = guest->swapIn;
+    reported->swapOut = guest->swapOut;
+    reported->majorFault = guest->majorFault;
+    reported->minorFault = guest->minorFault;
+    guest->lastRefresh = time;
+}
@@ -0,0 +1,110 @@
+#ifndef simguest_h
+#define simguest_h
+
+#include "memstats.h"
+
+#define SIM_MAX_NAME 32
+// defaults of the guest parameters a scenario does not set (in MB/s, share of swapped memory per second)
+#define SIM_DEFAULT_INFLATE_RATE 64
+#define SIM_DEFAULT_DEFLATE_RATE 256
+#define SIM_DEFAULT_CACHE_FILL_RATE 4
+#define SIM_DEFAULT_SWAP_TOUCH 0.02
+// size of a guest page, the major faults are the pages read back from swap (in kB)
+#define SIM_PAGE_SIZE 4
+
+/**
+ * how the memory used by a guest's processes evolves over time
+ */
+typedef enum SimPattern {
+    // uses `base` all along
+    SIM_PATTERN_STEADY = 0,
+    // allocates from `base` to `peak` at the allocation rate from `start`, then keeps it
+    SIM_PATTERN_RAMP,
+    // allocates up to `peak`, holds it, frees back down to `base` at the free rate, holds it, and so on
+    SIM_PATTERN_CYCLE,
+    // allocates `peak` at once at `start`, holds it, then frees back down to `base` at the free rate
+    SIM_PATTERN_SPIKE,
+    // replays the memory used in a recorded trace, from its start again once it is over
+    SIM_PATTERN_TRACE
+} SimPattern;
+
+/**
+ * simulated guest: its workload, its balloon driver and its swap. Sizes are in kB, rates in kB/s
+ */
+typedef struct SimGuest {
+    char name[SIM_MAX_NAME];
+    SimPattern pattern;
+    MemStatUnit max;
+    MemStatUnit base;
+    MemStatUnit peak;
+    MemStatUnit allocRate;
+    MemStatUnit freeRate;
+    // time at which the pattern starts, and how long it holds `peak` and `base` (in seconds)
+    double start;
+    double hold;
+    // the guest fills its free memory with caches up to `cacheTarget`
+    MemStatUnit cacheTarget;
+    MemStatUnit cacheFillRate;
+    // speed at which the balloon driver takes memory from the guest, and gives it back
+    MemStatUnit inflateRate;
+    MemStatUnit deflateRate;
+    // share of the swapped memory the guest touches every second, each touch swaps a page in and another out
+    double swapTouch;
+    // memory used in each sample of a recorded trace, `traceStep` seconds apart, owned by the host
+    const MemStatUnit *trace;
+    int traceLength;
+    double traceStep;
+
+    // memory used by the processes, its part in swap, caches, and balloon size and target
+    MemStatUnit used;
+    MemStatUnit swapped;
+    MemStatUnit cache;
+    MemStatUnit actual;
+    MemStatUnit target;
+    // whether a cycle or spike is freeing memory, and since when its current level is held
+    int freeing;
+    double heldSince;
+    // cumulative counters of the guest's kernel
+    MemStatUnit swapIn;
+    MemStatUnit swapOut;
+    MemStatUnit majorFault;
+    MemStatUnit minorFault;
+    // stats as last collected by the balloon driver, every `period` seconds (never when 0)
+    int period;
+    double lastRefresh;
+    DomainMemStats reported;
+} SimGuest;
+
+/**
+ * sets the parameters of a guest to their defaults, booted with `max` and using none of it
+ */
+void SimGuestInit(SimGuest *guest, const char *name, MemStatUnit max, SimPattern pattern);
+/**
+ * sets a parameter of the guest given as `<key>=<value>`, sizes in MB and rates in MB/s
+ */
+int SimGuestSetParam(SimGuest *guest, const char *param);
+/**
+ * advances the guest by `dt` seconds
+ * @param hostFree memory the host can give to the guest's balloon (in kB), decreased by what it takes
+ * @return memory taken back from the guest by its balloon (in kB)
+ */
+MemStatUnit SimGuestStep(SimGuest *guest, double time, double dt, MemStatUnit *hostFree);
+/**
+ * unused memory of the guest, neither used by its processes nor by its caches (in kB)
+ */
+MemStatUnit SimGuestUnused(SimGuest *guest);
+/**
+ * collects the stats of the guest as its balloon driver would, when its period has elapsed
+ */
+void SimGuestRefresh(SimGuest *guest, double time, int force);
+/**
+ * makes the guest replay `length` samples of memory used (in kB) taken every `step` seconds, booted with
+ * the memory it had in the first sample
+ */
+void SimGuestSetTrace(SimGuest *guest, const MemStatUnit *trace, int length, double step, MemStatUnit actual);
+/**
+ * @return the pattern named `name` (steady, ramp, cycle or spike), -1 if unknown
+ */
+int SimGuestParsePattern(const char *name);
+
+#endif
@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "util.h"
+#include "simhost.h"
+
+/**
+ * parses a guest line, `guest <name> <max_mb> <pattern> [<key>=<value>]...`
+ */
+int SimHostParseGuest(SimHost *host, char *line)
+{
+    char name[SIM_MAX_NAME];
+    char patternName[16];
+    double max = 0;
+    int pattern = 0;
+    int offset = 0;
+    char *param = NULL;
+    SimGuest *guest = NULL;
+
+    check(host->numGuests < SIM_MAX_GUESTS, "too many guests in scenario");
+    check(sscanf(line, "guest %31s %lf %15s%n", name, &max, patternName, &offset) == 3 && max > 0,
+        "guest should be <name> <max_mb> <pattern> [<key>=<value>]...");
+    pattern = SimGuestParsePattern(patternName);
+    check(pattern >= 0, "unknown guest pattern");
+
+    guest = host->guests + host->numGuests;
+    SimGuestInit(guest, name, max * 1024, pattern);
+    for (param = strtok(line + offset, " \t"); param; param = strtok(NULL, " \t")) {
+        check(SimGuestSetParam(guest, param) == 0, "invalid guest parameter");
+    }
+    check(guest->used <= guest->max && guest->peak <= guest->max, "guest uses more than its max memory");
+    host->numGuests += 1;
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * appends a sample to the trace of guest `g`, doubling its capacity when full
+ */
+int SimHostAppendSample(SimHost *host, int g, int *capacity, MemStatUnit used)
+{
+    SimGuest *guest = host->guests + g;
+    MemStatUnit *trace = NULL;
+
+    if (guest->traceLength == capacity[g]) {
+        capacity[g] = capacity[g] > 0 ? capacity[g] * 2 : SIM_MIN_TRACE_CAPACITY;
+        trace = realloc(host->traces[g], capacity[g] * sizeof(MemStatUnit));
+        checkMemAlloc(trace);
+        host->traces[g] = trace;
+    }
+    host->traces[g][guest->traceLength++] = used;
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * parses a trace line, `trace <monitor_log> <max_mb> [seconds_per_sample]`, and adds a guest for each domain
+ * of the log. The monitor prints `<name>: <actual_mb> <unused_mb>` for each domain every sample, the memory
+ * used by the domain is what it had that was not unused
+ */
+int SimHostParseTrace(SimHost *host, const char *line, const char *scenario)
+{
+    char tracePath[SIM_MAX_LINE];
+    char logPath[2 * SIM_MAX_LINE];
+    char logLine[SIM_MAX_LINE];
+    char name[SIM_MAX_NAME];
+    double max = 0;
+    double step = SIM_DEFAULT_TRACE_STEP;
+    double actual = 0;
+    double unused = 0;
+    MemStatUnit booted[SIM_MAX_GUESTS];
+    int capacity[SIM_MAX_GUESTS] = {0};
+    int first = host->numGuests;
+    int g = 0;
+    const char *dirEnd = strrchr(scenario, '/');
+    FILE *file = NULL;
+
+    check(sscanf(line, "trace %511s %lf %lf", tracePath, &max, &step) >= 2 && max > 0 && step > 0,
+        "trace should be <monitor_log> <max_mb> [seconds_per_sample]");
+    // relative to the scenario's directory
+    if (tracePath[0] == '/' || !dirEnd) {
+        snprintf(logPath, sizeof(logPath), "%s", tracePath);
+    }
+    else {
+        snprintf(logPath, sizeof(logPath), "%.*s/%s", (int) (dirEnd - scenario), scenario, tracePath);
+    }
+    file = fopen(logPath, "r");
+    check(file, "failed to open trace");
+
+    while (fgets(logLine, SIM_MAX_LINE, file)) {
+        if (sscanf(logLine, "%31[^: \t]: %lf %lf", name, &actual, &unused) != 3) {
+            continue;
+        }
+        g = first;
+        while (g < host->numGuests && strcmp(host->guests[g].name, name) != 0) {
+            g++;
+        }
+        if (g == host->numGuests) {
+            check(host->numGuests < SIM_MAX_GUESTS, "too many guests in scenario");
+            SimGuestInit(host->guests + g, name, max * 1024, SIM_PATTERN_TRACE);
+            booted[g] = actual * 1024;
+            host->numGuests += 1;
+        }
+        check(SimHostAppendSample(host, g, capacity, (actual - unused) * 1024) == 0, "failed to read trace");
+    }
+    fclose(file);
+    file = NULL;
+
+    check(host->numGuests > first, "trace has no samples");
+    for (g = first; g < host->numGuests; g++) {
+        SimGuestSetTrace(host->guests + g, host->traces[g], host->guests[g].traceLength, step, booted[g]);
+    }
+
+    return 0;
+error:
+    if (file) {
+        fclose(file);
+    }
+    return -1;
+}
+
+int SimHostLoad(SimHost *host, const char *path)
+{
+    FILE *file = NULL;
+    char line[SIM_MAX_LINE];
+    double first = 0;
+    double second = 0;
+    int numValues = 0;
+
+    checkNull(host);
+    checkNull(path);
+    memset(host, 0, sizeof(SimHost));
+    host->scenario = path;
+    host->floor = SIM_DEFAULT_FLOOR * 1024;
+    host->duration = SIM_DEFAULT_DURATION;
+    host->interval = SIM_DEFAULT_INTERVAL;
+
+    file = fopen(path, "r");
+    check(file, "failed to open scenario");
+    while (fgets(line, SIM_MAX_LINE, file)) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        if (strspn(line, " \t") == strlen(line)) {
+            continue;
+        }
+        if (strncmp(line, "guest ", 6) == 0) {
+            check(SimHostParseGuest(host, line) == 0, "invalid guest in scenario");
+        }
+        else if (strncmp(line, "trace ", 6) == 0) {
+            check(SimHostParseTrace(host, line, path) == 0, "invalid trace in scenario");
+        }
+        else if ((numValues = sscanf(line, "host %lf %lf", &first, &second)) >= 1) {
+            host->total = first * 1024;
+            host->hostUsed = numValues == 2 ? second * 1024 : 0;
+        }
+        else if (sscanf(line, "floor %lf", &first) == 1) {
+            host->floor = first * 1024;
+        }
+        else if (sscanf(line, "duration %lf", &first) == 1) {
+            host->duration = first;
+        }
+        else if (sscanf(line, "interval %lf", &first) == 1) {
+            host->interval = (int) first;
+        }
+        else {
+            check(0, "unknown scenario setting");
+        }
+    }
+    fclose(file);
+    file = NULL;
+
+    check(host->total > 0, "scenario should set the host memory");
+    check(host->numGuests > 0, "scenario should have guests");
+    check(host->interval > 0 && host->duration > 0, "scenario duration and interval should be positive");
+    // the guests booted before the simulation, with the memory the host had
+    check(SimHostFree(host) >= 0, "guests boot with more memory than the host has");
+    host->minFree = SimHostFree(host);
+
+    return 0;
+error:
+    if (file) {
+        fclose(file);
+    }
+    if (host) {
+        SimHostRelease(host);
+    }
+    return -1;
+}
+
+void SimHostRelease(SimHost *host)
+{
+    for (int g = 0; g < SIM_MAX_GUESTS; g++) {
+        free(host->traces[g]);
+        host->traces[g] = NULL;
+    }
+}
+
+MemStatUnit SimHostFree(SimHost *host)
+{
+    MemStatUnit hostFree = host->total - host->hostUsed;
+    for (int g = 0; g < host->numGuests; g++) {
+        hostFree -= host->guests[g].actual;
+    }
+    return hostFree;
+}
+
+void SimHostAdvance(SimHost *host, int seconds)
+{
+    MemStatUnit hostFree = 0;
+    MemStatUnit swapIn = 0;
+    MemStatUnit actual = 0;
+    MemStatUnit reclaimed = 0;
+    int below = 0;
+
+    for (int s = 0; s < seconds; s++) {
+        hostFree = SimHostFree(host);
+        below = hostFree < host->floor;
+        for (int g = 0; g < host->numGuests; g++) {
+            swapIn = host->guests[g].swapIn;
+            actual = host->guests[g].actual;
+            reclaimed = SimGuestStep(host->guests + g, host->time, 1, &hostFree);
+            host->reclaimed += reclaimed;
+            host->given += host->guests[g].actual - actual + reclaimed;
+            host->swappedIn += host->guests[g].swapIn - swapIn;
+            host->swapSeconds += host->guests[g].swapped > 0;
+        }
+        host->time += 1;
+
+        hostFree = SimHostFree(host);
+        host->minFree = min(host->minFree, hostFree);
+        host->freeSum += hostFree;
+        if (hostFree < host->floor) {
+            host->floorViolations += !below;
+            host->floorSeconds += 1;
+        }
+    }
+}
+
+MemStatUnit SimHostMeanFree(SimHost *host)
+{
+    return host->time > 0 ? host->freeSum / host->time : SimHostFree(host);
+}
+
+void SimHostPrint(SimHost *host, FILE *file)
+{
+    fprintf(file, "{\"scenario\":\"%s\",\"duration_s\":%.0f,\"interval_s\":%d,\"guests\":%d,\"cycles\":%d,"
+        "\"adjustments\":%d,\"swap_guest_s\":%.0f,\"swapped_in_mb\":%.1f,\"reclaimed_mb\":%.1f,\"given_mb\":%.1f,"
+        "\"mean_free_mb\":%.1f,"
+        "\"host_floor\":{\"floor_mb\":%.1f,\"violations\":%d,\"seconds\":%.0f,\"min_free_mb\":%.1f},"
+        "\"elapsed_ms\":%.3f}",
+        host->scenario, host->duration, host->interval, host->numGuests, host->numCycles, host->numAdjustments,
+        host->swapSeconds, host->swappedIn / 1024, host->reclaimed / 1024, host->given / 1024,
+        SimHostMeanFree(host) / 1024, host->floor / 1024,
+        host->floorViolations, host->floorSeconds, host->minFree / 1024, host->elapsed * 1000);
+}
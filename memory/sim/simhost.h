@@ -0,0 +1,88 @@
+#ifndef simhost_h
+#define simhost_h
+
+#include <stdio.h>
+#include "simguest.h"
+
+#define SIM_MAX_GUESTS 64
+#define SIM_MAX_LINE 512
+// defaults of the scenario settings (in seconds and MB), the floor is the coordinator's host reserve
+#define SIM_DEFAULT_DURATION 3600
+#define SIM_DEFAULT_INTERVAL 5
+#define SIM_DEFAULT_FLOOR 200
+// seconds between the samples of a recorded trace, the memory monitor prints one every second
+#define SIM_DEFAULT_TRACE_STEP 1
+#define SIM_MIN_TRACE_CAPACITY 256
+
+/**
+ * simulated host: a pool of memory shared by the host's own processes and the guests' balloons,
+ * advanced one second at a time. Sizes are in kB
+ */
+typedef struct SimHost {
+    const char *scenario;
+    MemStatUnit total;
+    // memory used by the host's own processes
+    MemStatUnit hostUsed;
+    // free memory below which the host floor is violated
+    MemStatUnit floor;
+    // length of the scenario and interval of the coordination cycles (in seconds)
+    double duration;
+    int interval;
+    int numGuests;
+    SimGuest guests[SIM_MAX_GUESTS];
+    // samples of the recorded traces replayed by the guests, shared by the copies of the host
+    MemStatUnit *traces[SIM_MAX_GUESTS];
+    // simulated time (in seconds)
+    double time;
+
+    /**
+     * guest-seconds spent with memory in swap, memory swapped back in, and memory taken back
+     * from the guests by their balloons
+     */
+    double swapSeconds;
+    MemStatUnit swappedIn;
+    MemStatUnit reclaimed;
+    // memory given to the guests by their balloons, and the host free memory summed over every second
+    MemStatUnit given;
+    double freeSum;
+    // number of times the host free memory went below the floor, time spent below and lowest free memory
+    int floorViolations;
+    double floorSeconds;
+    MemStatUnit minFree;
+    // balloon changes requested by the coordinator
+    int numAdjustments;
+    // number of coordination cycles run and time taken by the simulation (in seconds)
+    int numCycles;
+    double elapsed;
+} SimHost;
+
+/**
+ * loads a scenario, one setting per line:
+ * `host <total_mb> [host_used_mb]`, `floor <mb>`, `duration <seconds>`, `interval <seconds>` and
+ * `guest <name> <max_mb> <pattern> [<key>=<value>]...` for each guest, and
+ * `trace <monitor_log> <max_mb> [seconds_per_sample]` for guests replaying a recording of the memory monitor,
+ * relative to the scenario. `#` starts a comment
+ */
+int SimHostLoad(SimHost *host, const char *path);
+/**
+ * frees the traces of a loaded host, its copies cannot be advanced anymore
+ */
+void SimHostRelease(SimHost *host);
+/**
+ * free memory of the host (in kB)
+ */
+MemStatUnit SimHostFree(SimHost *host);
+/**
+ * advances the host and its guests by `seconds`, one second at a time
+ */
+void SimHostAdvance(SimHost *host, int seconds);
+/**
+ * average free memory of the host over the simulation (in kB)
+ */
+MemStatUnit SimHostMeanFree(SimHost *host);
+/**
+ * writes the metrics of the simulation as a JSON object
+ */
+void SimHostPrint(SimHost *host, FILE *file);
+
+#endif
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <libvirt/libvirt.h>
+#include "check.h"
+#include "coordinator.h"
+#include "metrics.h"
+#include "fakevirt.h"
+#include "simulator.h"
+
+int SimulatorRun(SimHost *host, int sampleBudget)
+{
+    int rt = 0;
+    virConnectPtr conn = NULL;
+    GuestList *guests = NULL;
+    MemStats *stats = NULL;
+    BalloonCtl *ctl = NULL;
+    Growth *growth = NULL;
+    AllocPlan *plan = NULL;
+    MetricsTime start = MetricsNow();
+    MetricsTime end;
+
+    checkNull(host);
+    FakeVirtSetHost(host);
+    conn = virConnectOpen(SIMULATOR_URI);
+    check(conn, "failed to connect to the simulated host");
+
+    guests = GuestListGet(conn);
+    check(guests, "failed to create guest list");
+    stats = MemStatsCreate(conn, guests, sampleBudget);
+    check(stats, "failed to create memory stats");
+    for (int i = 0; i < guests->count; i++) {
+        rt = MemStatsSetStatsPeriod(stats, guests, i, STATS_PERIOD_FAST);
+        check(rt == 0, "failed to set memory stats period");
+    }
+    ctl = BalloonCtlCreate(guests->count);
+    check(ctl, "failed to create balloon controllers");
+    growth = GrowthCreate(guests->count);
+    check(growth, "failed to create growth state");
+    plan = AllocPlanCreate(guests->count);
+    check(plan, "failed to create allocation plan");
+
+    rt = MemStatsInit(stats, conn, guests);
+    check(rt == 0, "failed to init memory stats");
+    // the worker waits for the balloon drivers to collect a first sample
+    SimHostAdvance(host, 2);
+    rt = MemStatsUpdate(stats, conn, guests, 2);
+    check(rt == 0, "failed to update memory stats");
+
+    // same cycle as the worker's, the simulated time elapses instead of sleeping
+    while (host->time + host->interval <= host->duration) {
+        SimHostAdvance(host, host->interval);
+        rt = MemStatsUpdate(stats, conn, guests, host->interval);
+        check(rt == 0, "error updating stats");
+        MemStatsPrint(stats, guests);
+        rt = reallocateMemory(stats, guests, plan, ctl, growth);
+        check(rt == 0, "error re-allocating memory");
+        rt = MemStatsUpdate(stats, conn, guests, 0);
+        check(rt == 0, "error updating stats");
+        host->numCycles += 1;
+    }
+    SimHostAdvance(host, (int) (host->duration - host->time));
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    end = MetricsNow();
+    if (host) {
+        host->elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    AllocPlanFree(plan);
+    GrowthFree(growth);
+    BalloonCtlFree(ctl);
+    MemStatsFree(stats);
+    GuestListFree(guests);
+    if (conn) {
+        virConnectClose(conn);
+    }
+    return rt;
+}
@@ -0,0 +1,16 @@
+#ifndef simulator_h
+#define simulator_h
+
+#include "simhost.h"
+
+// uri of the simulated host, any uri connects to it
+#define SIMULATOR_URI "sim:///system"
+
+/**
+ * runs the memory coordinator's cycles against the simulated host until the end of its scenario,
+ * with the coordinator's own stats collection, policy and actuation, as a worker would
+ * @param sampleBudget number of libvirt calls used to sample stable domains each cycle, 0 to sample all of them
+ */
+int SimulatorRun(SimHost *host, int sampleBudget);
+
+#endif
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "check.h"
+#include "log.h"
+#include "simhost.h"
+#include "tuner.h"
+
+#define USAGE "usage: ./memory_tune [-d duration] [-i interval] [-b rpc_budget] [-n candidates] [-r rounds] [-t threads] [-s seed] [-w density,starvation,churn] [-o profile] [-l log_level] [-j] <scenario>..."
+
+int main(int argc, char *argv[])
+{
+    int opt = 0;
+    int rt = 0;
+    double duration = 0;
+    int interval = 0;
+    const char *profilePath = NULL;
+    int logLevel = LOG_WARN;
+    LogFormat logFormat = LOG_FORMAT_TEXT;
+    Tuner tuner;
+    SimHost *host = NULL;
+    FILE *profile = stdout;
+
+    TunerInit(&tuner);
+    while ((opt = getopt(argc, argv, "d:i:b:n:r:t:s:w:o:l:j")) != -1) {
+        switch (opt) {
+            case 'd':
+                duration = atof(optarg);
+                break;
+            case 'i':
+                interval = atoi(optarg);
+                break;
+            case 'b':
+                tuner.sampleBudget = atoi(optarg);
+                break;
+            case 'n':
+                tuner.numCandidates = atoi(optarg);
+                break;
+            case 'r':
+                tuner.numRounds = atoi(optarg);
+                break;
+            case 't':
+                tuner.numThreads = atoi(optarg);
+                break;
+            case 's':
+                tuner.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                rt = TunerParseWeights(&tuner.weights, optarg);
+                check(rt == 0, "invalid weights, " USAGE);
+                break;
+            case 'o':
+                profilePath = optarg;
+                break;
+            case 'l':
+                logLevel = LogParseLevel(optarg);
+                check(logLevel >= 0, "unknown log level, " USAGE);
+                break;
+            case 'j':
+                logFormat = LOG_FORMAT_JSON;
+                break;
+            default:
+                check(0, USAGE);
+        }
+    }
+    check(optind < argc, "scenario file required, " USAGE);
+    check(argc - optind <= TUNER_MAX_SCENARIOS, "too many scenarios");
+
+    for (int i = optind; i < argc; i++) {
+        host = calloc(1, sizeof(SimHost));
+        checkMemAlloc(host);
+        tuner.scenarios[tuner.numScenarios++] = host;
+        rt = SimHostLoad(host, argv[i]);
+        check(rt == 0, "failed to load scenario");
+        host->duration = duration > 0 ? duration : host->duration;
+        host->interval = interval > 0 ? interval : host->interval;
+    }
+
+    // the profile may be the only output on stdout
+    rt = LogStart(stderr, logLevel, logFormat);
+    check(rt == 0, "failed to start logging");
+    rt = TunerRun(&tuner);
+    check(rt == 0, "tuning failed");
+
+    if (profilePath) {
+        profile = fopen(profilePath, "w");
+        check(profile, "failed to open profile");
+    }
+    TunerPrint(&tuner, profile);
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = 1;
+final:
+    LogStop();
+    if (profile && profile != stdout) {
+        fclose(profile);
+    }
+    for (int s = 0; s < tuner.numScenarios; s++) {
+        SimHostRelease(tuner.scenarios[s]);
+        free(tuner.scenarios[s]);
+    }
+    return rt;
+}
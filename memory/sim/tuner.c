@@ -0,0 +1,359 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "check.h"
+#include "log.h"
+#include "metrics.h"
+#include "util.h"
+#include "simulator.h"
+#include "tuner.h"
+
+/**
+ * range a parameter is searched in, sizes in kB. The host pressure parameters are not searched,
+ * the simulated host has no pressure stall information
+ */
+typedef struct TunerRange {
+    const char *name;
+    double min;
+    double max;
+    int integer;
+} TunerRange;
+
+static const TunerRange ranges[] = {
+    {"min_change_for_dealloc", 256, 8 * 1024, 0},
+    {"min_guest_memory", 25 * 1024, 300 * 1024, 0},
+    {"min_host_memory", 100 * 1024, 600 * 1024, 0},
+    {"max_free_memory", 100 * 1024, 800 * 1024, 0},
+    {"min_dealloc_amount", 256, 8 * 1024, 0},
+    {"max_wasteful_dealloc_amount", 25 * 1024, 400 * 1024, 0},
+    {"paging_swap_in_threshold", 50, 1600, 0},
+    {"paging_major_fault_threshold", 12, 400, 0},
+    {"cache_reclaim_ratio", 0, 1, 0},
+    {"fast_sampling_change", 1024, 50 * 1024, 0},
+    {"fast_sampling_margin", 10 * 1024, 200 * 1024, 0},
+    {"stable_cycles_to_slow_down", 1, 10, 1},
+    {"equality_precision", 10, 1024, 0}
+};
+
+#define NUM_RANGES ((int) (sizeof(ranges) / sizeof(ranges[0])))
+
+/**
+ * pool of threads evaluating the candidates of a round, the main thread included.
+ * Each thread takes the next candidate not evaluated yet until there is none left
+ */
+typedef struct TunerPool {
+    Tuner *tuner;
+    TunerCandidate *candidates;
+    int numCandidates;
+    atomic_int next;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    // incremented to start a round, and number of threads still evaluating it
+    int round;
+    int busy;
+    int done;
+} TunerPool;
+
+void TunerInit(Tuner *tuner)
+{
+    long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(tuner, 0, sizeof(Tuner));
+    tuner->weights.density = TUNER_DEFAULT_DENSITY_WEIGHT;
+    tuner->weights.starvation = TUNER_DEFAULT_STARVATION_WEIGHT;
+    tuner->weights.churn = TUNER_DEFAULT_CHURN_WEIGHT;
+    tuner->numThreads = numCpus > 0 ? min(numCpus, TUNER_MAX_THREADS) : 1;
+    tuner->numRounds = TUNER_DEFAULT_ROUNDS;
+    tuner->numCandidates = TUNER_DEFAULT_CANDIDATES;
+    tuner->seed = TUNER_DEFAULT_SEED;
+}
+
+int TunerParseWeights(TunerWeights *weights, const char *text)
+{
+    checkNull(weights);
+    checkNull(text);
+    check(sscanf(text, "%lf,%lf,%lf", &weights->density, &weights->starvation, &weights->churn) == 3,
+        "weights should be <density>,<starvation>,<churn>");
+    check(weights->density >= 0 && weights->starvation >= 0 && weights->churn >= 0, "weights cannot be negative");
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * @return a number drawn uniformly in [0, 1), from a linear congruential generator so that a search can be
+ * repeated with the same seed
+ */
+double tunerRandom(unsigned long *state)
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return (*state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @return where the parameter searched in `range` is in `params`
+ */
+double *tunerValue(Params *params, const TunerRange *range)
+{
+    int numFields = 0;
+    const ParamsField *fields = ParamsFields(&numFields);
+
+    for (int f = 0; f < numFields; f++) {
+        if (strcmp(fields[f].name, range->name) == 0) {
+            return ParamsValue(params, fields + f);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * sets a searched parameter, within its range
+ */
+void tunerSet(Params *params, const TunerRange *range, double value)
+{
+    double *field = tunerValue(params, range);
+
+    value = max(min(value, range->max), range->min);
+    *field = range->integer ? floor(value + 0.5) : value;
+}
+
+/**
+ * keeps a wasteful guest far enough from starving that the coordinator does not take back what it gives
+ */
+void tunerConstrain(Params *params)
+{
+    params->maxFreeMemory = max(params->maxFreeMemory, 2 * params->minGuestMemory);
+}
+
+/**
+ * draws the candidates of a round: anywhere in the ranges for the first round, the defaults being the
+ * first candidate, and around the best candidate within `radius` of the ranges afterwards
+ */
+void tunerDraw(Tuner *tuner, TunerPool *pool, int round, unsigned long *state)
+{
+    double radius = round > 0 ? TUNER_INITIAL_RADIUS / (1 << (round - 1)) : 1;
+    TunerCandidate *candidate = NULL;
+    const TunerRange *range = NULL;
+
+    for (int c = 0; c < pool->numCandidates; c++) {
+        candidate = pool->candidates + c;
+        memset(candidate, 0, sizeof(TunerCandidate));
+        if (round == 0) {
+            ParamsInit(&candidate->params);
+            if (c == 0) {
+                continue;
+            }
+        }
+        else {
+            candidate->params = tuner->best.params;
+        }
+        for (int r = 0; r < NUM_RANGES; r++) {
+            range = ranges + r;
+            if (round == 0) {
+                tunerSet(&candidate->params, range, range->min + tunerRandom(state) * (range->max - range->min));
+            }
+            else {
+                tunerSet(&candidate->params, range, *tunerValue(&candidate->params, range) +
+                    (2 * tunerRandom(state) - 1) * radius * (range->max - range->min));
+            }
+        }
+        tunerConstrain(&candidate->params);
+    }
+}
+
+/**
+ * simulates every scenario with the candidate's parameters and scores the objectives it reaches
+ */
+void tunerEvaluate(Tuner *tuner, TunerCandidate *candidate)
+{
+    int rt = 0;
+    SimHost *host = NULL;
+    TunerScore *score = &candidate->score;
+
+    host = malloc(sizeof(SimHost));
+    checkMemAlloc(host);
+    // the coordinator's policy reads the parameters of the calling thread
+    ParamsUse(&candidate->params);
+
+    for (int s = 0; s < tuner->numScenarios; s++) {
+        // the copy shares the traces of the loaded scenario, they are only read
+        *host = *tuner->scenarios[s];
+        rt = SimulatorRun(host, tuner->sampleBudget);
+        check(rt == 0, "simulation of a candidate failed");
+        score->density += (double) SimHostMeanFree(host) / host->total;
+        score->starvation += (host->swapSeconds + host->floorSeconds * host->numGuests) /
+            (host->duration * host->numGuests);
+        score->churn += (double) (host->reclaimed + host->given) / host->total * 3600 / host->duration;
+    }
+    score->density /= tuner->numScenarios;
+    score->starvation /= tuner->numScenarios;
+    score->churn /= tuner->numScenarios;
+    score->score = tuner->weights.starvation * score->starvation + tuner->weights.churn * score->churn -
+        tuner->weights.density * score->density;
+
+    goto final;
+
+error:
+    candidate->failed = 1;
+final:
+    ParamsUse(NULL);
+    free(host);
+}
+
+void tunerEvaluateRound(TunerPool *pool)
+{
+    int c = 0;
+
+    while ((c = atomic_fetch_add(&pool->next, 1)) < pool->numCandidates) {
+        tunerEvaluate(pool->tuner, pool->candidates + c);
+    }
+}
+
+void *tunerWorker(void *arg)
+{
+    TunerPool *pool = arg;
+    int round = 0;
+
+    LogAttachThread("tuner");
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->done && pool->round == round) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->done) {
+            break;
+        }
+        round = pool->round;
+        pthread_mutex_unlock(&pool->lock);
+
+        tunerEvaluateRound(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->busy -= 1;
+        if (pool->busy == 0) {
+            pthread_cond_signal(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * evaluates the candidates of a round on every thread of the pool, `numWorkers` of them being started
+ */
+void tunerRunRound(TunerPool *pool, int numWorkers)
+{
+    pthread_mutex_lock(&pool->lock);
+    atomic_store(&pool->next, 0);
+    pool->busy = numWorkers;
+    pool->round += 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    tunerEvaluateRound(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int TunerRun(Tuner *tuner)
+{
+    int rt = 0;
+    TunerPool pool;
+    pthread_t threads[TUNER_MAX_THREADS];
+    int numWorkers = 0;
+    int found = 0;
+    unsigned long state = 0;
+    TunerCandidate *candidate = NULL;
+    MetricsTime start = MetricsNow();
+    MetricsTime end;
+
+    memset(&pool, 0, sizeof(TunerPool));
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    pthread_cond_init(&pool.idle, NULL);
+    checkNull(tuner);
+    check(tuner->numScenarios > 0, "no scenario to tune on");
+    check(tuner->numThreads > 0 && tuner->numThreads <= TUNER_MAX_THREADS, "invalid number of threads");
+    check(tuner->numCandidates > 0 && tuner->numRounds > 0, "invalid number of candidates or rounds");
+    state = tuner->seed;
+
+    pool.tuner = tuner;
+    pool.numCandidates = tuner->numCandidates;
+    pool.candidates = calloc(tuner->numCandidates, sizeof(TunerCandidate));
+    checkMemAlloc(pool.candidates);
+    // the main thread evaluates candidates as well
+    for (numWorkers = 0; numWorkers < tuner->numThreads - 1; numWorkers++) {
+        rt = pthread_create(threads + numWorkers, NULL, tunerWorker, &pool);
+        check(rt == 0, "failed to start tuner thread");
+    }
+
+    for (int round = 0; round < tuner->numRounds; round++) {
+        tunerDraw(tuner, &pool, round, &state);
+        tunerRunRound(&pool, numWorkers);
+        tuner->numEvaluated += pool.numCandidates;
+
+        if (round == 0) {
+            tuner->defaults = pool.candidates[0];
+            check(!tuner->defaults.failed, "failed to simulate the default parameters");
+        }
+        for (int c = 0; c < pool.numCandidates; c++) {
+            candidate = pool.candidates + c;
+            if (!candidate->failed && (!found || candidate->score.score < tuner->best.score.score)) {
+                tuner->best = *candidate;
+                found = 1;
+            }
+        }
+        logInfo("round %d: best score %.4f, density %.4f, starvation %.4f, churn %.4f", round,
+            tuner->best.score.score, tuner->best.score.density, tuner->best.score.starvation,
+            tuner->best.score.churn);
+    }
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    pthread_mutex_lock(&pool.lock);
+    pool.done = 1;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for (int t = 0; t < numWorkers; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_cond_destroy(&pool.idle);
+    pthread_cond_destroy(&pool.wake);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.candidates);
+    end = MetricsNow();
+    if (tuner) {
+        tuner->elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    return rt;
+}
+
+void TunerPrintScore(const char *name, TunerScore *score, FILE *file)
+{
+    fprintf(file, "# %-9s score %.4f, density %.4f, starvation %.4f, churn %.4f\n", name, score->score,
+        score->density, score->starvation, score->churn);
+}
+
+void TunerPrint(Tuner *tuner, FILE *file)
+{
+    fprintf(file, "# memory coordinator parameters tuned on %d scenarios, %d candidates in %.1fs\n",
+        tuner->numScenarios, tuner->numEvaluated, tuner->elapsed);
+    fprintf(file, "# weights: density %g, starvation %g, churn %g\n", tuner->weights.density,
+        tuner->weights.starvation, tuner->weights.churn);
+    TunerPrintScore("tuned:", &tuner->best.score, file);
+    TunerPrintScore("defaults:", &tuner->defaults.score, file);
+    ParamsPrint(&tuner->best.params, file);
+}
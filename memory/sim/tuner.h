@@ -0,0 +1,93 @@
+#ifndef tuner_h
+#define tuner_h
+
+#include <stdio.h>
+#include "params.h"
+#include "simhost.h"
+
+#define TUNER_MAX_SCENARIOS 32
+// every thread evaluating candidates has its own log queue, the main thread included
+#define TUNER_MAX_THREADS 32
+// defaults of the search: candidates evaluated each round, number of rounds and seed of the random draws
+#define TUNER_DEFAULT_CANDIDATES 32
+#define TUNER_DEFAULT_ROUNDS 4
+#define TUNER_DEFAULT_SEED 1
+// defaults of the weights of the objectives in the score
+#define TUNER_DEFAULT_DENSITY_WEIGHT 1.0
+#define TUNER_DEFAULT_STARVATION_WEIGHT 10.0
+#define TUNER_DEFAULT_CHURN_WEIGHT 0.1
+// share of a parameter's range the candidates are drawn in around the best one after the first round,
+// halved every round
+#define TUNER_INITIAL_RADIUS 0.25
+
+/**
+ * weights of the objectives in the score of a candidate
+ */
+typedef struct TunerWeights {
+    double density;
+    double starvation;
+    double churn;
+} TunerWeights;
+
+/**
+ * objectives reached by a candidate, averaged over the scenarios. The score is the weighted starvation and
+ * churn less the weighted density, lower is better
+ */
+typedef struct TunerScore {
+    // share of the host memory left free on average
+    double density;
+    // share of the guest-seconds spent swapping, the seconds spent below the host floor counting for every guest
+    double starvation;
+    // memory moved by the balloons per hour, relative to the host memory
+    double churn;
+    double score;
+} TunerScore;
+
+typedef struct TunerCandidate {
+    Params params;
+    TunerScore score;
+    // whether a simulation failed, the candidate is then never the best
+    int failed;
+} TunerCandidate;
+
+/**
+ * search of the coordinator's parameters on a set of scenarios: the defaults and random candidates are
+ * evaluated first, then each round draws candidates closer and closer around the best one so far.
+ * The candidates of a round are simulated in parallel
+ */
+typedef struct Tuner {
+    int numScenarios;
+    // loaded scenarios, each evaluation simulates a copy of them
+    SimHost *scenarios[TUNER_MAX_SCENARIOS];
+    int sampleBudget;
+    TunerWeights weights;
+    int numThreads;
+    int numRounds;
+    int numCandidates;
+    unsigned long seed;
+
+    TunerCandidate defaults;
+    TunerCandidate best;
+    // number of candidates evaluated and time taken by the search (in seconds)
+    int numEvaluated;
+    double elapsed;
+} Tuner;
+
+/**
+ * sets the search to its defaults, with one thread per online cpu, and no scenario
+ */
+void TunerInit(Tuner *tuner);
+/**
+ * parses the weights of the objectives, as `<density>,<starvation>,<churn>`
+ */
+int TunerParseWeights(TunerWeights *weights, const char *text);
+/**
+ * searches the parameters with the best score on the scenarios
+ */
+int TunerRun(Tuner *tuner);
+/**
+ * writes the best parameters as a profile, the objectives they reach and the defaults' in comments
+ */
+void TunerPrint(Tuner *tuner, FILE *file);
+
+#endif
@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "check.h"
+#include "log.h"
+#include "statefile.h"
+
+double StateFileNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * copies the snapshot currently in the file, if any
+ */
+int StateFileReadPrevious(StateFile *file)
+{
+    struct stat st;
+    void *data = NULL;
+
+    check(fstat(file->fd, &st) == 0, "failed to stat state file");
+    if ((size_t) st.st_size < sizeof(StateFileHeader)) {
+        return 0;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
+    check(data != MAP_FAILED, "failed to map state file");
+    file->previous = malloc(st.st_size);
+    if (file->previous) {
+        memcpy(file->previous, data, st.st_size);
+        file->previousSize = st.st_size;
+    }
+    munmap(data, st.st_size);
+    checkMemAlloc(file->previous);
+
+    return 0;
+error:
+    return -1;
+}
+
+StateFile *StateFileOpen(const char *path, int numDomains)
+{
+    StateFile *file = NULL;
+    void *data = NULL;
+
+    checkNull(path);
+    file = calloc(1, sizeof(StateFile));
+    checkMemAlloc(file);
+    file->fd = -1;
+    file->numDomains = numDomains;
+    file->size = sizeof(StateFileHeader) + numDomains * sizeof(StateFileRecord);
+
+    file->fd = open(path, O_RDWR | O_CREAT, 0600);
+    check(file->fd >= 0, "failed to open state file");
+    check(StateFileReadPrevious(file) == 0, "failed to read state file");
+    check(ftruncate(file->fd, file->size) == 0, "failed to resize state file");
+
+    data = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    check(data != MAP_FAILED, "failed to map state file");
+    file->header = data;
+    file->records = (StateFileRecord *) (file->header + 1);
+
+    return file;
+error:
+    StateFileClose(file);
+    return NULL;
+}
+
+void StateFileClose(StateFile *file)
+{
+    if (file) {
+        if (file->header) {
+            msync(file->header, file->size, MS_SYNC);
+            munmap(file->header, file->size);
+        }
+        if (file->fd >= 0) {
+            close(file->fd);
+        }
+        if (file->previous) {
+            free(file->previous);
+        }
+        free(file);
+    }
+}
+
+int StateFileSave(StateFile *file, MemStats *stats, AllocPlan *plan, BalloonCtl *ctl, GuestList *guests)
+{
+    StateFileHeader *header = NULL;
+    StateFileRecord *record = NULL;
+    virDomainPtr domain = NULL;
+
+    checkNull(file);
+    checkNull(stats);
+    checkNull(plan);
+    checkNull(ctl);
+    checkNull(guests);
+    header = file->header;
+
+    header->complete = 0;
+    memcpy(header->magic, STATE_FILE_MAGIC, sizeof(header->magic));
+    header->version = STATE_FILE_VERSION;
+    header->recordSize = sizeof(StateFileRecord);
+    header->numDomains = file->numDomains;
+
+    for (int d = 0; d < file->numDomains; d++) {
+        record = file->records + d;
+        domain = GuestListDomainAt(guests, d);
+        // the uuid and id of a running domain do not change, only look them up once per process
+        if (!file->saved || record->id != virDomainGetID(domain)) {
+            check(virDomainGetUUIDString(domain, record->uuid) == 0, "failed to get domain uuid");
+            record->id = virDomainGetID(domain);
+        }
+        record->stats = stats->domainStats[d];
+        record->reclaimHistory = stats->reclaimHistory[d];
+        record->sampling = stats->sampling[d];
+        record->ctl = ctl->states[d];
+        record->toAlloc = plan->toAlloc[d];
+        record->toDealloc = plan->toDealloc[d];
+        record->newSize = plan->newSizes[d];
+    }
+
+    header->time = StateFileNow();
+    header->complete = 1;
+    msync(header, file->size, MS_ASYNC);
+    file->saved = 1;
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * @return record of a domain in the previous snapshot, NULL if it is not there
+ */
+StateFileRecord *StateFileFindRecord(StateFile *file, const char *uuid, int id)
+{
+    StateFileHeader *header = file->previous;
+    StateFileRecord *records = (StateFileRecord *) (header + 1);
+
+    for (uint32_t i = 0; i < header->numDomains; i++) {
+        if (records[i].id == id && strncmp(records[i].uuid, uuid, VIR_UUID_STRING_BUFLEN) == 0) {
+            return records + i;
+        }
+    }
+    return NULL;
+}
+
+int StateFileRestore(StateFile *file, MemStats *stats, AllocPlan *plan, BalloonCtl *ctl, GuestList *guests,
+    int interval)
+{
+    StateFileHeader *header = NULL;
+    StateFileRecord *record = NULL;
+    virDomainPtr domain = NULL;
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    double elapsed = 0;
+    int cycles = 0;
+    int restored = 0;
+    int rt = 0;
+
+    checkNull(file);
+    checkNull(stats);
+    checkNull(plan);
+    checkNull(ctl);
+    checkNull(guests);
+
+    header = file->previous;
+    if (!header || memcmp(header->magic, STATE_FILE_MAGIC, sizeof(header->magic)) != 0) {
+        return 0;
+    }
+    if (header->version != STATE_FILE_VERSION || header->recordSize != sizeof(StateFileRecord) || !header->complete ||
+        file->previousSize < sizeof(StateFileHeader) + header->numDomains * sizeof(StateFileRecord)) {
+        logWarn("state file does not match this version, starting cold");
+        return 0;
+    }
+    elapsed = StateFileNow() - header->time;
+    if (elapsed <= 0 || elapsed > STATE_FILE_MAX_AGE) {
+        logWarn("state file is %.0fs old, starting cold", elapsed);
+        return 0;
+    }
+    // deltas since the snapshot are spread over the cycles it covers
+    cycles = interval > 0 ? (int) (elapsed / interval + 0.5) : 1;
+    cycles = cycles > 1 ? cycles : 1;
+
+    for (int d = 0; d < stats->numDomains; d++) {
+        domain = GuestListDomainAt(guests, d);
+        check(virDomainGetUUIDString(domain, uuid) == 0, "failed to get domain uuid");
+        record = StateFileFindRecord(file, uuid, virDomainGetID(domain));
+        if (!record) {
+            continue;
+        }
+        stats->domainStats[d] = record->stats;
+        stats->reclaimHistory[d] = record->reclaimHistory;
+        stats->sampling[d].cyclesSinceSample = cycles - 1;
+        // the guest last refreshed its stats on the period it had before the restart, they are
+        // only stale past that period, which it keeps until the coordinator speeds it up again
+        if (record->sampling.period > 0) {
+            rt = MemStatsSetStatsPeriod(stats, guests, d, record->sampling.period);
+            check(rt == 0, "failed to restore stats period");
+        }
+        stats->sampling[d].stableCycles = record->sampling.stableCycles;
+        stats->sampling[d].hot = record->sampling.hot;
+        ctl->states[d] = record->ctl;
+        plan->toAlloc[d] = record->toAlloc;
+        plan->toDealloc[d] = record->toDealloc;
+        plan->newSizes[d] = record->newSize;
+        restored += 1;
+    }
+    logInfo("restored the state of %d domains saved %.1fs ago", restored, elapsed);
+
+    return restored;
+error:
+    return -1;
+}
+
+MemStats *StateFileLoadStats(const char *path, double *age)
+{
+    int fd = -1;
+    struct stat st;
+    void *data = NULL;
+    StateFileHeader *header = NULL;
+    StateFileRecord *records = NULL;
+    MemStats *stats = NULL;
+
+    checkNull(path);
+    checkNull(age);
+
+    fd = open(path, O_RDONLY);
+    check(fd >= 0, "failed to open state file");
+    check(fstat(fd, &st) == 0, "failed to stat state file");
+    check((size_t) st.st_size >= sizeof(StateFileHeader), "state file holds no snapshot");
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    check(data != MAP_FAILED, "failed to map state file");
+    header = data;
+    records = (StateFileRecord *) (header + 1);
+
+    check(memcmp(header->magic, STATE_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == STATE_FILE_VERSION && header->recordSize == sizeof(StateFileRecord) && header->complete,
+        "state file does not hold a complete snapshot of this version");
+    check((size_t) st.st_size >= sizeof(StateFileHeader) + header->numDomains * sizeof(StateFileRecord),
+        "state file is truncated");
+
+    stats = MemStatsCreateEmpty(header->numDomains, 0);
+    check(stats, "failed to create stats");
+    for (uint32_t d = 0; d < header->numDomains; d++) {
+        stats->domainStats[d] = records[d].stats;
+        stats->reclaimHistory[d] = records[d].reclaimHistory;
+    }
+    *age = StateFileNow() - header->time;
+
+    munmap(data, st.st_size);
+    close(fd);
+    return stats;
+error:
+    if (data && data != MAP_FAILED) {
+        munmap(data, st.st_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    MemStatsFree(stats);
+    return NULL;
+}
@@ -0,0 +1,103 @@
+#ifndef statefile_h
+#define statefile_h
+
+#include <stdint.h>
+#include <libvirt/libvirt.h>
+#include "memstats.h"
+#include "allocplan.h"
+#include "balloonctl.h"
+#include "guestlist.h"
+
+#define STATE_FILE_MAGIC "MEMCSTAT"
+// must be incremented whenever the layout of the header or records changes
+#define STATE_FILE_VERSION 2
+// older snapshots do not describe the current memory usage of the domains
+#define STATE_FILE_MAX_AGE 300
+
+typedef struct StateFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t numDomains;
+    /**
+     * cleared while the records are written, so that a snapshot
+     * interrupted by a crash is not used
+     */
+    uint32_t complete;
+    /**
+     * wall clock time at which the snapshot was saved (in seconds)
+     */
+    double time;
+} StateFileHeader;
+
+typedef struct StateFileRecord {
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    /**
+     * id of the running domain, a domain that was restarted
+     * has a new id and its counters were reset
+     */
+    int id;
+    DomainMemStats stats;
+    DomainReclaimHistory reclaimHistory;
+    /**
+     * stats period the guest's balloon driver was left with, and how long the domain has been stable
+     */
+    DomainSampling sampling;
+    BalloonCtlState ctl;
+    MemStatUnit toAlloc;
+    MemStatUnit toDealloc;
+    unsigned long newSize;
+} StateFileRecord;
+
+/**
+ * coordinator state persisted in a memory mapped file, so that the coordinator
+ * can make a decision as soon as it restarts
+ */
+typedef struct StateFile {
+    int fd;
+    size_t size;
+    int numDomains;
+    /**
+     * whether this process saved the records yet, the uuids left by a previous one
+     * may belong to other domains that got the same ids, e.g. after the host rebooted
+     */
+    int saved;
+    StateFileHeader *header;
+    StateFileRecord *records;
+    /**
+     * copy of the snapshot found when the file was opened
+     */
+    void *previous;
+    size_t previousSize;
+} StateFile;
+
+/**
+ * opens (or creates) the state file and keeps a copy of the snapshot it holds
+ * @return state file, should be closed with StateFileClose()
+ */
+StateFile *StateFileOpen(const char *path, int numDomains);
+void StateFileClose(StateFile *file);
+/**
+ * saves the stats, controllers and plan of the last cycle, the stats should
+ * be updated after the plan was executed
+ */
+int StateFileSave(StateFile *file, MemStats *stats, AllocPlan *plan, BalloonCtl *ctl, GuestList *guests);
+/**
+ * restores the last sample, reclaim history, stats period, controllers and plan of the domains that have
+ * kept running since the snapshot was saved. The next stats update computes the deltas of
+ * these domains from the restored sample, scaled to the number of cycles the snapshot covers
+ * @param interval cycle interval (in seconds)
+ * @return number of domains restored, -1 on error
+ */
+int StateFileRestore(StateFile *file, MemStats *stats, AllocPlan *plan, BalloonCtl *ctl, GuestList *guests,
+    int interval);
+/**
+ * reads the snapshot of a state file without connecting to the hypervisor, e.g. the last cycle
+ * of a running coordinator or a snapshot recorded on another host. The file is not modified
+ * @param age set to the time since the snapshot was saved (in seconds)
+ * @return stats holding the last sample and reclaim history of the snapshot's domains, should be freed
+ * with MemStatsFree(), NULL if the file does not hold a complete snapshot of this version
+ */
+MemStats *StateFileLoadStats(const char *path, double *age);
+
+#endif
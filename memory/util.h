@@ -1,7 +1,10 @@
 #ifndef util_h
 #define util_h
 
-#define EQUALITY_PRECISION 100
+#include "params.h"
+
+// values closer than this are considered equal, set by the parameter profile
+#define EQUALITY_PRECISION (ParamsCurrent()->equalityPrecision)
 
 #define min(a, b) ((a) <= (b) ? (a) : (b))
 #define max(a, b) ((a) >= (b) ? (a) : (b))
@@ -0,0 +1,323 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "check.h"
+#include "util.h"
+#include "log.h"
+#include "metrics.h"
+#include "watchdog.h"
+
+typedef struct WatchdogCandidate {
+    int domain;
+    MemStatUnit actual;
+    MemStatUnit spare;
+} WatchdogCandidate;
+
+int WatchdogIsRunning(Watchdog *watchdog)
+{
+    int running = 0;
+    pthread_mutex_lock(&watchdog->lock);
+    running = watchdog->running;
+    pthread_mutex_unlock(&watchdog->lock);
+    return running;
+}
+
+/**
+ * @param stall share of the time since the previous sample (in %) the host spent fully stalled on memory
+ */
+int WatchdogIsTriggered(HostMemStats *hostStats, double stall)
+{
+    return hostStats->available < WATCHDOG_FREE_FLOOR || stall >= WATCHDOG_FULL_PRESSURE_LIMIT;
+}
+
+/**
+ * @return share of the time since the previous sample (in %) the host spent fully stalled on memory,
+ * 0 for the first sample or when the host does not report its stall total
+ */
+double WatchdogStallShare(HostMemStats *hostStats, unsigned long long lastStall, MetricsTime lastSample,
+    MetricsTime now)
+{
+    double elapsedUs = (now.tv_sec - lastSample.tv_sec) * 1e6 + (now.tv_nsec - lastSample.tv_nsec) / 1e3;
+
+    if (!hostStats->hasPressure || lastStall == 0 || hostStats->full.total < lastStall || elapsedUs <= 0) {
+        return 0;
+    }
+    return 100.0 * (hostStats->full.total - lastStall) / elapsedUs;
+}
+
+int compareWatchdogCandidates(const void *a, const void *b)
+{
+    MemStatUnit spareA = ((const WatchdogCandidate *) a)->spare;
+    MemStatUnit spareB = ((const WatchdogCandidate *) b)->spare;
+    // most over-provisioned guests first
+    return (spareA < spareB) - (spareA > spareB);
+}
+
+/**
+ * gets the guests which have unused memory above the watchdog's guest floor
+ * @return number of candidates found, -1 on error
+ */
+int WatchdogGetCandidates(Watchdog *watchdog, WatchdogCandidate *candidates)
+{
+    int numStats = 0;
+    int numCandidates = 0;
+    MemStatUnit unused = 0;
+    MemStatUnit actual = 0;
+    virDomainMemoryStatStruct tempStats[MAX_STATS];
+
+    for (int d = 0; d < watchdog->guests->count; d++) {
+        numStats = virDomainMemoryStats(GuestListDomainAt(watchdog->guests, d), tempStats, MAX_STATS, 0);
+        MetricsCountRpc(METRICS_RPC_COLLECT, numStats < 0);
+        if (numStats <= 0) {
+            continue;
+        }
+        unused = 0;
+        actual = 0;
+        for (int j = 0; j < numStats; j++) {
+            if (tempStats[j].tag == VIR_DOMAIN_MEMORY_STAT_UNUSED) {
+                unused = (MemStatUnit) tempStats[j].val;
+            }
+            else if (tempStats[j].tag == VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON) {
+                actual = (MemStatUnit) tempStats[j].val;
+            }
+        }
+        if (unused > WATCHDOG_GUEST_FLOOR && actual > 0) {
+            candidates[numCandidates].domain = d;
+            candidates[numCandidates].actual = actual;
+            candidates[numCandidates].spare = unused - WATCHDOG_GUEST_FLOOR;
+            numCandidates += 1;
+        }
+    }
+
+    return numCandidates;
+}
+
+void WatchdogRecordEvent(Watchdog *watchdog, WatchdogEvent *event, MemStatUnit *reclaimed, MemStatUnit *sizes)
+{
+    pthread_mutex_lock(&watchdog->lock);
+    if (watchdog->numEvents < WATCHDOG_MAX_EVENTS) {
+        watchdog->events[watchdog->numEvents] = *event;
+        watchdog->numEvents += 1;
+    }
+    else {
+        watchdog->numDropped += 1;
+    }
+    for (int d = 0; d < watchdog->guests->count; d++) {
+        watchdog->reclaimed[d] += reclaimed[d];
+        watchdog->sizes[d] = sizes[d] > 0 ? sizes[d] : watchdog->sizes[d];
+    }
+    pthread_mutex_unlock(&watchdog->lock);
+}
+
+/**
+ * reclaims memory from the most over-provisioned guests, bypassing
+ * the coordinator's allocation plan
+ */
+int WatchdogReclaim(Watchdog *watchdog, HostMemStats *hostStats, double stall)
+{
+    int rt = 0;
+    int numCandidates = 0;
+    int d = 0;
+    MemStatUnit needed = 0;
+    MemStatUnit toReclaim = 0;
+    MemStatUnit *reclaimed = NULL;
+    MemStatUnit *sizes = NULL;
+    WatchdogCandidate *candidates = NULL;
+    WatchdogEvent event;
+
+    memset(&event, 0, sizeof(WatchdogEvent));
+    event.hostAvailable = hostStats->available;
+    event.pressure = stall;
+
+    // bring host available memory back to twice the floor
+    needed = hostStats->available < WATCHDOG_FREE_FLOOR ?
+        2 * WATCHDOG_FREE_FLOOR - hostStats->available : WATCHDOG_PRESSURE_RECLAIM;
+
+    candidates = calloc(watchdog->guests->count, sizeof(WatchdogCandidate));
+    checkMemAlloc(candidates);
+    reclaimed = calloc(watchdog->guests->count, sizeof(MemStatUnit));
+    checkMemAlloc(reclaimed);
+    sizes = calloc(watchdog->guests->count, sizeof(MemStatUnit));
+    checkMemAlloc(sizes);
+
+    numCandidates = WatchdogGetCandidates(watchdog, candidates);
+    qsort(candidates, numCandidates, sizeof(WatchdogCandidate), compareWatchdogCandidates);
+
+    for (int c = 0; c < numCandidates && needed > 0; c++) {
+        d = candidates[c].domain;
+        toReclaim = min(candidates[c].spare, needed);
+        rt = virDomainSetMemory(GuestListDomainAt(watchdog->guests, d),
+            (unsigned long) (candidates[c].actual - toReclaim));
+        MetricsCountRpc(METRICS_RPC_ACTUATE, rt != 0);
+        if (rt != 0) {
+            logWarn("watchdog failed to reclaim memory from domain %d", d);
+            continue;
+        }
+        reclaimed[d] = toReclaim;
+        sizes[d] = candidates[c].actual - toReclaim;
+        needed -= toReclaim;
+        event.reclaimed += toReclaim;
+        event.numDomains += 1;
+    }
+
+    WatchdogRecordEvent(watchdog, &event, reclaimed, sizes);
+
+    rt = 0;
+    goto final;
+
+error:
+    rt = -1;
+final:
+    free(candidates);
+    free(reclaimed);
+    free(sizes);
+    return rt;
+}
+
+void *WatchdogRun(void *arg)
+{
+    Watchdog *watchdog = (Watchdog *) arg;
+    HostMemStats hostStats;
+    struct timespec interval;
+    MetricsTime lastSample;
+    MetricsTime now;
+    unsigned long long lastStall = 0;
+    double stall = 0;
+    int cooldown = 0;
+
+    MetricsSetSource(watchdog->metricsSource, NULL);
+    LogAttachThread("watchdog");
+    memset(&hostStats, 0, sizeof(HostMemStats));
+    interval.tv_sec = 0;
+    interval.tv_nsec = WATCHDOG_INTERVAL_MS * 1000000L;
+
+    while (WatchdogIsRunning(watchdog)) {
+        nanosleep(&interval, NULL);
+        if (cooldown > 0) {
+            cooldown -= WATCHDOG_INTERVAL_MS;
+            continue;
+        }
+        if (MemStatsUpdateHostStats(watchdog->conn, &hostStats) != 0) {
+            continue;
+        }
+        now = MetricsNow();
+        stall = WatchdogStallShare(&hostStats, lastStall, lastSample, now);
+        lastStall = hostStats.hasPressure ? hostStats.full.total : 0;
+        lastSample = now;
+        if (WatchdogIsTriggered(&hostStats, stall)) {
+            WatchdogReclaim(watchdog, &hostStats, stall);
+            cooldown = WATCHDOG_COOLDOWN_MS;
+        }
+    }
+
+    return NULL;
+}
+
+Watchdog *WatchdogCreate(virConnectPtr conn, GuestList *guests)
+{
+    Watchdog *watchdog = NULL;
+    checkNull(conn);
+    checkNull(guests);
+
+    watchdog = calloc(1, sizeof(Watchdog));
+    checkMemAlloc(watchdog);
+    watchdog->conn = conn;
+    watchdog->guests = guests;
+    watchdog->reclaimed = calloc(guests->count, sizeof(MemStatUnit));
+    checkMemAlloc(watchdog->reclaimed);
+    watchdog->sizes = calloc(guests->count, sizeof(MemStatUnit));
+    checkMemAlloc(watchdog->sizes);
+    check(pthread_mutex_init(&watchdog->lock, NULL) == 0, "failed to init watchdog lock");
+
+    return watchdog;
+error:
+    if (watchdog) {
+        free(watchdog->reclaimed);
+        free(watchdog->sizes);
+        free(watchdog);
+    }
+    return NULL;
+}
+
+int WatchdogStart(Watchdog *watchdog)
+{
+    checkNull(watchdog);
+    watchdog->running = 1;
+    check(pthread_create(&watchdog->thread, NULL, WatchdogRun, watchdog) == 0, "failed to start watchdog thread");
+
+    return 0;
+error:
+    if (watchdog) {
+        watchdog->running = 0;
+    }
+    return -1;
+}
+
+void WatchdogStop(Watchdog *watchdog)
+{
+    if (!watchdog || !WatchdogIsRunning(watchdog)) {
+        return;
+    }
+    pthread_mutex_lock(&watchdog->lock);
+    watchdog->running = 0;
+    pthread_mutex_unlock(&watchdog->lock);
+    pthread_join(watchdog->thread, NULL);
+}
+
+void WatchdogFree(Watchdog *watchdog)
+{
+    if (watchdog) {
+        WatchdogStop(watchdog);
+        pthread_mutex_destroy(&watchdog->lock);
+        if (watchdog->reclaimed) {
+            free(watchdog->reclaimed);
+        }
+        free(watchdog->sizes);
+        free(watchdog);
+    }
+}
+
+int WatchdogDrain(Watchdog *watchdog, MemStats *stats)
+{
+    int numEvents = 0;
+    MemStatUnit taken = 0;
+    WatchdogEvent *event = NULL;
+    checkNull(watchdog);
+    checkNull(stats);
+
+    pthread_mutex_lock(&watchdog->lock);
+    numEvents = watchdog->numEvents + watchdog->numDropped;
+    stats->hostStats.emergencyTriggers = numEvents;
+    stats->hostStats.emergencyReclaimed = stats->hostStats.emergencyReclaimed / 2;
+
+    for (int i = 0; i < watchdog->numEvents; i++) {
+        event = watchdog->events + i;
+        logInfo("Watchdog triggered with host available %.1fkb, stalled %.2f%%, reclaimed %.1fkb from %d domains",
+            event->hostAvailable, event->pressure, event->reclaimed, event->numDomains);
+        stats->hostStats.emergencyReclaimed += event->reclaimed;
+    }
+    if (watchdog->numDropped > 0) {
+        logWarn("Watchdog dropped %d events", watchdog->numDropped);
+    }
+
+    // emergency reclaims count towards what the domains tolerated, and the stats read before
+    // a reclaim still hold the balloon size from before it: the memory taken was unused
+    for (int d = 0; d < stats->numDomains && d < watchdog->guests->count; d++) {
+        MemStatsReclaimHistory(stats, d)->last += watchdog->reclaimed[d];
+        if (watchdog->sizes[d] > 0 && MemStatsActual(stats, d) > watchdog->sizes[d]) {
+            taken = MemStatsActual(stats, d) - watchdog->sizes[d];
+            MemStatsUnused(stats, d) = max(MemStatsUnused(stats, d) - taken, 0);
+            MemStatsActual(stats, d) = watchdog->sizes[d];
+        }
+        watchdog->reclaimed[d] = 0;
+        watchdog->sizes[d] = 0;
+    }
+
+    watchdog->numEvents = 0;
+    watchdog->numDropped = 0;
+    pthread_mutex_unlock(&watchdog->lock);
+
+    return numEvents;
+error:
+    return -1;
+}
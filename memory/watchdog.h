@@ -0,0 +1,99 @@
+#ifndef watchdog_h
+#define watchdog_h
+
+#include <pthread.h>
+#include <libvirt/libvirt.h>
+#include "guestlist.h"
+#include "memstats.h"
+
+// how often the watchdog samples host memory
+#define WATCHDOG_INTERVAL_MS 100
+// host available memory below which the watchdog reclaims memory from guests
+#define WATCHDOG_FREE_FLOOR (100 * 1024)
+// share of the time since the previous sample (in %) the host spent fully stalled on memory above which the
+// watchdog reclaims memory from guests. It is measured on the growth of the "full" stall total: the 10s average
+// stays high for seconds after a single stall and would trigger a reclaim after every cooldown
+#define WATCHDOG_FULL_PRESSURE_LIMIT 10.0
+// minimum time between two emergency reclaims, gives guests time to release memory
+#define WATCHDOG_COOLDOWN_MS 1000
+// unused memory the watchdog leaves to each guest
+#define WATCHDOG_GUEST_FLOOR (100 * 1024)
+// amount reclaimed when triggered by pressure while available memory is above the floor
+#define WATCHDOG_PRESSURE_RECLAIM (100 * 1024)
+#define WATCHDOG_MAX_EVENTS 64
+
+typedef struct WatchdogEvent {
+    /**
+     * Host available memory when the watchdog was triggered (in kB)
+     */
+    MemStatUnit hostAvailable;
+    /**
+     * Share of the time since the previous sample (in %) the host spent fully stalled on memory
+     */
+    double pressure;
+    /**
+     * Total memory reclaimed from guests (in kB)
+     */
+    MemStatUnit reclaimed;
+    /**
+     * Number of guests memory was reclaimed from
+     */
+    int numDomains;
+} WatchdogEvent;
+
+typedef struct Watchdog {
+    virConnectPtr conn;
+    GuestList *guests;
+    pthread_t thread;
+    /**
+     * metrics source of the watchdog's connection
+     */
+    int metricsSource;
+    /**
+     * protects all the fields below, which are shared with the main thread
+     */
+    pthread_mutex_t lock;
+    int running;
+    /**
+     * Events recorded since the last drain, events are dropped when full
+     */
+    WatchdogEvent events[WATCHDOG_MAX_EVENTS];
+    int numEvents;
+    int numDropped;
+    /**
+     * Memory reclaimed from each domain since the last drain (in kB)
+     */
+    MemStatUnit *reclaimed;
+    /**
+     * Balloon size the watchdog last set on each domain since the last drain, 0 if none (in kB)
+     */
+    MemStatUnit *sizes;
+} Watchdog;
+
+/**
+ * creates a watchdog that protects the host from running out of memory
+ * between two coordination cycles
+ * @return pointer to watchdog object. Created object should be freed using WatchdogFree()
+ */
+Watchdog *WatchdogCreate(virConnectPtr conn, GuestList *guests);
+/**
+ * starts the watchdog's sampling thread
+ */
+int WatchdogStart(Watchdog *watchdog);
+/**
+ * stops the sampling thread and waits for it to exit
+ */
+void WatchdogStop(Watchdog *watchdog);
+/**
+ * stops the watchdog if it's running and frees it
+ */
+void WatchdogFree(Watchdog *watchdog);
+/**
+ * moves the events recorded since the last call into the stats so
+ * that the coordination policy can take them into account. The domains reclaimed from
+ * get the balloon size the watchdog set, so that the plan does not give it back at once
+ * @return number of events drained
+ */
+int WatchdogDrain(Watchdog *watchdog, MemStats *stats);
+
+#endif
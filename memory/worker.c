@@ -0,0 +1,339 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include "check.h"
+#include "coordinator.h"
+#include "log.h"
+#include "metrics.h"
+#include "worker.h"
+
+static volatile sig_atomic_t stopping = 0;
+
+void WorkerStopAll(void)
+{
+    stopping = 1;
+}
+
+/**
+ * sleeps for `seconds`, waking up early if the workers are stopped
+ */
+void WorkerSleep(int seconds)
+{
+    for (int s = 0; s < seconds && !stopping; s++) {
+        sleep(1);
+    }
+}
+
+int WorkerSetPath(char *dst, const char *path, int index, int numWorkers)
+{
+    int length = 0;
+    if (numWorkers > 1 && path[0] != '\0') {
+        length = snprintf(dst, WORKER_MAX_PATH, "%s.%d", path, index);
+    }
+    else {
+        length = snprintf(dst, WORKER_MAX_PATH, "%s", path);
+    }
+    return length < WORKER_MAX_PATH ? 0 : -1;
+}
+
+Worker *WorkerCreate(int index, const char *uri, WorkerConfig *config, int numWorkers)
+{
+    Worker *worker = NULL;
+
+    checkNull(uri);
+    checkNull(config);
+    worker = calloc(1, sizeof(Worker));
+    checkMemAlloc(worker);
+    worker->index = index;
+    worker->uri = uri;
+    worker->config = *config;
+    check(WorkerSetPath(worker->socketPath, config->socketPath, index, numWorkers) == 0, "socket path too long");
+    check(WorkerSetPath(worker->statePath, config->statePath, index, numWorkers) == 0, "state path too long");
+
+    return worker;
+error:
+    WorkerFree(worker);
+    return NULL;
+}
+
+void WorkerFree(Worker *worker)
+{
+    if (worker) {
+        if (worker->introspect) {
+            IntrospectFree(worker->introspect);
+        }
+        if (worker->stateFile) {
+            StateFileClose(worker->stateFile);
+        }
+        if (worker->watchdog) {
+            WatchdogFree(worker->watchdog);
+        }
+        if (worker->conn) {
+            virConnectClose(worker->conn);
+        }
+        if (worker->guests) {
+            GuestListFree(worker->guests);
+        }
+        if (worker->stats) {
+            MemStatsFree(worker->stats);
+        }
+        if (worker->balloonCtl) {
+            BalloonCtlFree(worker->balloonCtl);
+        }
+        if (worker->growth) {
+            GrowthFree(worker->growth);
+        }
+        if (worker->plan) {
+            AllocPlanFree(worker->plan);
+        }
+        free(worker);
+    }
+}
+
+/**
+ * sets the growth hard caps of the domains, the default cap applies to all domains
+ * and the caps of specific domains override it
+ */
+int WorkerSetGrowthCaps(Worker *worker)
+{
+    WorkerConfig *config = &worker->config;
+    GuestList *guests = worker->guests;
+    int rt = 0;
+    char *separator = NULL;
+    const char *name = NULL;
+    int found = 0;
+
+    for (int d = 0; d < guests->count && config->defaultGrowthCap > 0; d++) {
+        rt = GrowthSetCap(worker->growth, d, config->defaultGrowthCap);
+        check(rt == 0, "failed to set default growth cap");
+    }
+
+    for (int i = 0; i < config->numGrowthCaps; i++) {
+        separator = strchr(config->growthCaps[i], '=');
+        check(separator, "domain growth cap should have the format <domain>=<cap_mb>");
+        found = 0;
+        for (int d = 0; d < guests->count; d++) {
+            name = virDomainGetName(GuestListDomainAt(guests, d));
+            if (name && strncmp(name, config->growthCaps[i], separator - config->growthCaps[i]) == 0 &&
+                strlen(name) == (size_t) (separator - config->growthCaps[i])) {
+                rt = GrowthSetCap(worker->growth, d, atof(separator + 1) * 1024);
+                check(rt == 0, "failed to set domain growth cap");
+                found = 1;
+            }
+        }
+        if (!found) {
+            logInfo("no active domain for growth cap %s", config->growthCaps[i]);
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * publishes the state of the coordinator to the introspection server,
+ * the cycle is skipped if the previous snapshot is still being read
+ */
+void WorkerPublishSnapshot(Worker *worker, unsigned long cycle)
+{
+    if (!worker->introspect || IntrospectBegin(worker->introspect, cycle) < 0) {
+        return;
+    }
+    MemStatsRender(worker->stats, worker->introspect);
+    AllocPlanRender(worker->plan, worker->introspect);
+    MetricsRender(worker->introspect);
+    IntrospectPublish(worker->introspect);
+}
+
+/**
+ * measures the daemon's own cpu usage over the last cycle and adapts the sample budget to its cpu budget
+ */
+void WorkerThrottle(Worker *worker)
+{
+    // without a sample budget every domain is sampled, which is the most the budget can be raised to
+    int maxBudget = worker->config.sampleBudget > 0 ?
+        worker->config.sampleBudget : RPCS_PER_SAMPLE * worker->stats->numDomains;
+    int sampleBudget = worker->stats->sampleBudget > 0 ? worker->stats->sampleBudget : maxBudget;
+
+    HousekeepingMeasure(&worker->housekeeping);
+    sampleBudget = HousekeepingThrottle(&worker->housekeeping, sampleBudget, RPCS_PER_SAMPLE, maxBudget);
+    worker->stats->sampleBudget = worker->housekeeping.throttled ? sampleBudget : worker->config.sampleBudget;
+}
+
+/**
+ * connects to the hypervisor and prepares the worker's stats, controllers, plan
+ * and state file
+ */
+int WorkerInit(Worker *worker)
+{
+    int rt = 0;
+    GuestList *guests = NULL;
+
+    worker->conn = virConnectOpen(worker->uri);
+    check(worker->conn, "Failed to connect to hypervisor");
+
+    worker->guests = GuestListGet(worker->conn);
+    check(worker->guests, "Failed to create guest list");
+    guests = worker->guests;
+
+    worker->stats = MemStatsCreate(worker->conn, guests, worker->config.sampleBudget);
+    check(worker->stats, "Failed to create memory stats");
+
+    // sample every guest quickly until the coordinator knows which ones are stable
+    for(int i = 0; i < guests->count; i++) {
+        rt = MemStatsSetStatsPeriod(worker->stats, guests, i, STATS_PERIOD_FAST);
+        check(rt == 0, "failed to set memory stats period");
+    }
+
+    worker->balloonCtl = BalloonCtlCreate(guests->count);
+    check(worker->balloonCtl, "failed to create balloon controllers");
+
+    worker->growth = GrowthCreate(guests->count);
+    check(worker->growth, "failed to create growth state");
+    rt = WorkerSetGrowthCaps(worker);
+    check(rt == 0, "failed to set growth caps");
+
+    worker->plan = AllocPlanCreate(guests->count);
+    check(worker->plan, "failed to create allocation plan");
+
+    if (worker->statePath[0] != '\0') {
+        worker->stateFile = StateFileOpen(worker->statePath, guests->count);
+        if (!worker->stateFile) {
+            logWarn("state will not be saved, could not open %s", worker->statePath);
+        }
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/**
+ * starts the introspection server and the watchdog, once the first stats are available
+ */
+int WorkerStartServices(Worker *worker)
+{
+    // the coordinator keeps running without introspection if the socket cannot be created
+    if (worker->socketPath[0] != '\0') {
+        worker->introspect = IntrospectCreate("memory_coordinator", worker->socketPath);
+        if (!worker->introspect || IntrospectStart(worker->introspect) < 0) {
+            logWarn("introspection disabled, could not serve %s", worker->socketPath);
+            IntrospectFree(worker->introspect);
+            worker->introspect = NULL;
+        }
+    }
+
+    worker->watchdog = WatchdogCreate(worker->conn, worker->guests);
+    check(worker->watchdog, "failed to create watchdog");
+    worker->watchdog->metricsSource = worker->index;
+    check(WatchdogStart(worker->watchdog) == 0, "failed to start watchdog");
+
+    return 0;
+error:
+    return -1;
+}
+
+void *WorkerRun(void *arg)
+{
+    Worker *worker = arg;
+    virConnectPtr conn = NULL;
+    GuestList *guests = NULL;
+    MemStats *stats = NULL;
+    unsigned long cycle = 0;
+    int restored = 0;
+    int warmStart = 0;
+    int rt = 0;
+    MetricsTime start;
+
+    MetricsSetSource(worker->index, worker->uri);
+    LogAttachThread(worker->uri);
+
+    rt = WorkerInit(worker);
+    check(rt == 0, "failed to initialize worker");
+    HousekeepingInit(&worker->housekeeping, worker->config.cpuBudget);
+    conn = worker->conn;
+    guests = worker->guests;
+    stats = worker->stats;
+
+    rt = MemStatsInit(stats, conn, guests);
+    check(rt == 0, "failed to init memory stats");
+    MemStatsPrint(stats, guests);
+
+    if (worker->stateFile) {
+        restored = StateFileRestore(worker->stateFile, stats, worker->plan, worker->balloonCtl, guests,
+            worker->config.interval);
+    }
+
+    // with the last sample of every domain restored, the first cycle
+    // can compute deltas and run right away
+    warmStart = restored > 0 && restored == guests->count;
+    if (!warmStart) {
+        sleep(2);
+
+        rt = MemStatsUpdate(stats, conn, guests, 2);
+        check(rt == 0, "failed to update memory stats");
+        MemStatsPrint(stats, guests);
+    }
+
+    rt = WorkerStartServices(worker);
+    check(rt == 0, "failed to start worker services");
+
+    while (!stopping) {
+        if (!warmStart) {
+            logDebug("sleeping...");
+            WorkerSleep(worker->config.interval);
+            if (stopping) {
+                break;
+            }
+        }
+        warmStart = 0;
+        logDebug("coordinating...");
+        start = MetricsNow();
+        rt = MemStatsUpdate(stats, conn, guests, worker->config.interval);
+        check(rt == 0, "error updating stats");
+        rt = WatchdogDrain(worker->watchdog, stats);
+        check(rt >= 0, "error draining watchdog events");
+        MetricsRecordPhase(METRICS_COLLECT, start);
+        MemStatsPrint(stats, guests);
+        rt = reallocateMemory(stats, guests, worker->plan, worker->balloonCtl, worker->growth);
+        check(rt == 0, "error re-allocating memory");
+        // update stats to match the new allocations
+        rt = MemStatsUpdate(stats, conn, guests, 0);
+        check(rt == 0, "error updating stats");
+        MetricsCountCycle();
+        if (worker->stateFile) {
+            StateFileSave(worker->stateFile, stats, worker->plan, worker->balloonCtl, guests);
+        }
+        WorkerPublishSnapshot(worker, ++cycle);
+        WorkerThrottle(worker);
+        logInfo("memory coordination cycle done, daemon cpu usage %.1f%%", 100 * worker->housekeeping.usage);
+    }
+
+    return NULL;
+error:
+    logError("memory coordination of %s stopped", worker->uri);
+    worker->failed = 1;
+    return NULL;
+}
+
+int WorkerStart(Worker *worker)
+{
+    checkNull(worker);
+    check(pthread_create(&worker->thread, NULL, WorkerRun, worker) == 0, "failed to start worker thread");
+    worker->started = 1;
+
+    return 0;
+error:
+    return -1;
+}
+
+void WorkerJoin(Worker *worker)
+{
+    if (worker && worker->started) {
+        pthread_join(worker->thread, NULL);
+        worker->started = 0;
+    }
+}
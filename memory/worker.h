@@ -0,0 +1,85 @@
+#ifndef worker_h
+#define worker_h
+
+#include <pthread.h>
+#include <libvirt/libvirt.h>
+#include "guestlist.h"
+#include "memstats.h"
+#include "allocplan.h"
+#include "balloonctl.h"
+#include "growth.h"
+#include "watchdog.h"
+#include "introspect.h"
+#include "statefile.h"
+#include "housekeeping.h"
+
+#define WORKER_MAX_PATH 256
+
+typedef struct WorkerConfig {
+    int interval;
+    int sampleBudget;
+    /**
+     * growth cap (in kB) of every domain, 0 to leave growth disabled
+     */
+    MemStatUnit defaultGrowthCap;
+    /**
+     * growth caps of specific domains, with the format "<domain name>=<cap in MB>"
+     */
+    char **growthCaps;
+    int numGrowthCaps;
+    /**
+     * share of one cpu the daemon may use before it reduces its sampling, 0 for no budget
+     */
+    double cpuBudget;
+    /**
+     * introspection socket and state file paths, empty to disable them. With several
+     * connections, the index of the connection is appended to each path
+     */
+    const char *socketPath;
+    const char *statePath;
+} WorkerConfig;
+
+/**
+ * coordinates the memory of the domains of one hypervisor connection on its own thread.
+ * Workers do not share any state, each one has its own connection, guest list, stats,
+ * controllers, plan and watchdog
+ */
+typedef struct Worker {
+    int index;
+    const char *uri;
+    WorkerConfig config;
+    char socketPath[WORKER_MAX_PATH];
+    char statePath[WORKER_MAX_PATH];
+    virConnectPtr conn;
+    GuestList *guests;
+    MemStats *stats;
+    Watchdog *watchdog;
+    BalloonCtl *balloonCtl;
+    Growth *growth;
+    AllocPlan *plan;
+    Introspect *introspect;
+    StateFile *stateFile;
+    Housekeeping housekeeping;
+    pthread_t thread;
+    int started;
+    // set when the worker stopped because of an error
+    int failed;
+} Worker;
+
+/**
+ * @param numWorkers total number of workers, paths are only suffixed with the index if there are several
+ * @return worker, should be freed with WorkerFree()
+ */
+Worker *WorkerCreate(int index, const char *uri, WorkerConfig *config, int numWorkers);
+int WorkerStart(Worker *worker);
+/**
+ * waits for the worker's thread to finish
+ */
+void WorkerJoin(Worker *worker);
+void WorkerFree(Worker *worker);
+/**
+ * asks every worker to stop after its current cycle, safe to call from a signal handler
+ */
+void WorkerStopAll(void);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "logparse.h"
+
+/**
+ * state of the sample being read from a log
+ */
+typedef struct LogParseState {
+    // usage and number of guests of each pCPU read in the current monitor sample
+    int numCpus;
+    double usages[SCORECARD_MAX_CPUS];
+    int numGuestsOn[SCORECARD_MAX_CPUS];
+    // whether the current daemon cycle found the pCPUs balanced, and the share of time guests queued in it
+    int balanced;
+    double queued;
+    double lastCycle;
+} LogParseState;
+
+void LogParseSetKind(Scorecard *scorecard, ScorecardKind kind)
+{
+    if (scorecard->kind == SCORECARD_UNKNOWN) {
+        scorecard->kind = kind;
+    }
+}
+
+/**
+ * parses the pins of a cpu monitor guest line, `vm1: ([(0, 1, 25560000000L, 0)], [(True, False, False, False)])`,
+ * one bit per pCPU of each vCPU in order
+ */
+void LogParseCpuGuest(Scorecard *scorecard, const char *name, const char *line)
+{
+    const char *pins = strstr(line, "], [(");
+    unsigned long long bits = 0;
+    int bit = 0;
+
+    if (!pins) {
+        return;
+    }
+    for (const char *c = pins; *c != '\0' && bit < 64; c++) {
+        if (strncmp(c, "True", 4) == 0) {
+            bits |= 1ULL << bit++;
+        }
+        else if (strncmp(c, "False", 5) == 0) {
+            bit++;
+        }
+    }
+    ScorecardAddPins(scorecard, ScorecardGuest(scorecard, name), bits);
+}
+
+/**
+ * parses a cpu monitor pCPU line, `0: 51.0 ['vm1', 'vm2']`, the monitor prints the usage in percent
+ */
+void LogParseCpuUsage(LogParseState *state, int cpu, double usage, const char *line)
+{
+    const char *guests = strchr(line, '[');
+    int quotes = 0;
+
+    if (cpu < 0 || cpu >= SCORECARD_MAX_CPUS || !guests) {
+        return;
+    }
+    for (const char *c = guests; *c != '\0' && *c != ']'; c++) {
+        quotes += *c == '\'' || *c == '"';
+    }
+    state->usages[cpu] = usage / 100;
+    state->numGuestsOn[cpu] = quotes / 2;
+    state->numCpus = cpu + 1 > state->numCpus ? cpu + 1 : state->numCpus;
+}
+
+/**
+ * closes the monitor sample being read, if any
+ */
+void LogParseEndSample(Scorecard *scorecard, LogParseState *state)
+{
+    if (state->numCpus > 0) {
+        ScorecardAddCpuSample(scorecard, scorecard->numSamples * scorecard->config.period,
+            state->usages, state->numGuestsOn, state->numCpus);
+    }
+    state->numCpus = 0;
+}
+
+/**
+ * parses the message of a daemon log record
+ */
+void LogParseDaemonMessage(Scorecard *scorecard, LogParseState *state, double time, const char *message)
+{
+    double value = 0;
+    unsigned long size = 0;
+    int index = 0;
+    char name[SCORECARD_MAX_NAME];
+
+    if (strstr(message, " new pin ") && !strstr(message, "emulator")) {
+        LogParseSetKind(scorecard, SCORECARD_CPU_DAEMON);
+        scorecard->numRepins += 1;
+    }
+    else if (strstr(message, "cpus already balanced")) {
+        state->balanced = 1;
+    }
+    else if (sscanf(message, "domains on cpu %d queue for %lf%%", &index, &value) == 2) {
+        state->queued += value / 100;
+    }
+    else if (strstr(message, "scheduling cycle done")) {
+        LogParseSetKind(scorecard, SCORECARD_CPU_DAEMON);
+        // guests queued for the share of the cycle reported at its start
+        scorecard->cpuStarvation += state->lastCycle > 0 ? state->queued * (time - state->lastCycle) : 0;
+        ScorecardAddCycle(scorecard, time, state->balanced);
+        state->lastCycle = time;
+        state->balanced = 0;
+        state->queued = 0;
+    }
+    else if (sscanf(message, "Setting memory %lukb for domain %d", &size, &index) == 2) {
+        LogParseSetKind(scorecard, SCORECARD_MEMORY_DAEMON);
+        snprintf(name, SCORECARD_MAX_NAME, "domain %d", index);
+        ScorecardAddGuestMemory(scorecard, ScorecardGuest(scorecard, name), size / 1024.0, -1);
+    }
+    else if (sscanf(message, "Watchdog triggered with host free %lfkb", &value) == 1) {
+        ScorecardAddWatchdog(scorecard, value / 1024);
+    }
+    else if (strstr(message, "memory coordination cycle done")) {
+        LogParseSetKind(scorecard, SCORECARD_MEMORY_DAEMON);
+        ScorecardAddCycle(scorecard, time, 1);
+    }
+}
+
+/**
+ * parses a daemon log line, either `<ts> <level> [<source>] <message>` or a JSON object with `ts` and `msg` fields
+ * @return whether the line is a daemon log record
+ */
+int LogParseDaemonLine(Scorecard *scorecard, LogParseState *state, char *line)
+{
+    double time = 0;
+    char level[16];
+    int offset = 0;
+    char *message = NULL;
+    char *end = NULL;
+
+    if (strncmp(line, "{\"ts\":", 6) == 0) {
+        time = strtod(line + 6, NULL);
+        message = strstr(line, "\"msg\":\"");
+        if (!message) {
+            return 0;
+        }
+        message += 7;
+        // escaped quotes only appear in messages quoting domain names, which the parsers do not need
+        end = strrchr(message, '"');
+        if (end) {
+            *end = '\0';
+        }
+    }
+    else if (sscanf(line, "%lf %15s %n", &time, level, &offset) == 2 && offset > 0 &&
+        (strcmp(level, "error") == 0 || strcmp(level, "warn") == 0 ||
+        strcmp(level, "info") == 0 || strcmp(level, "debug") == 0)) {
+        message = line + offset;
+        if (*message == '[' && (end = strstr(message, "] "))) {
+            message = end + 2;
+        }
+    }
+    else {
+        return 0;
+    }
+
+    LogParseDaemonMessage(scorecard, state, time, message);
+    return 1;
+}
+
+void LogParseLine(Scorecard *scorecard, LogParseState *state, char *line)
+{
+    char name[SCORECARD_MAX_NAME];
+    int cpu = 0;
+    double first = 0;
+    double second = 0;
+    int offset = 0;
+
+    if (LogParseDaemonLine(scorecard, state, line)) {
+        return;
+    }
+    if (strncmp(line, "-----", 5) == 0) {
+        LogParseEndSample(scorecard, state);
+    }
+    else if (sscanf(line, "%31[^: ]: ([(%n", name, &offset) == 1 && offset > 0) {
+        LogParseSetKind(scorecard, SCORECARD_CPU_MONITOR);
+        LogParseCpuGuest(scorecard, name, line);
+    }
+    else if (sscanf(line, "%d: %lf [", &cpu, &first) == 2 && strchr(line, '[')) {
+        LogParseCpuUsage(state, cpu, first, line);
+    }
+    else if (sscanf(line, "%31[^: ]: %lf %lf", name, &first, &second) == 3) {
+        LogParseSetKind(scorecard, SCORECARD_MEMORY_MONITOR);
+        ScorecardAddGuestMemory(scorecard, ScorecardGuest(scorecard, name), first, second);
+    }
+    else if (sscanf(line, "free : %lf KiB", &first) == 1) {
+        ScorecardAddHostMemory(scorecard, scorecard->numSamples * scorecard->config.period, first / 1024);
+    }
+}
+
+int LogParseFile(const char *path, Scorecard *scorecard)
+{
+    FILE *file = NULL;
+    char line[LOGPARSE_MAX_LINE];
+    LogParseState state;
+
+    checkNull(path);
+    checkNull(scorecard);
+    memset(&state, 0, sizeof(LogParseState));
+
+    file = fopen(path, "r");
+    check(file, "failed to open log");
+    while (fgets(line, LOGPARSE_MAX_LINE, file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        LogParseLine(scorecard, &state, line);
+    }
+    LogParseEndSample(scorecard, &state);
+    fclose(file);
+
+    return 0;
+error:
+    return -1;
+}
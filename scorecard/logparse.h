@@ -0,0 +1,15 @@
+#ifndef logparse_h
+#define logparse_h
+
+#include "scorecard.h"
+
+#define LOGPARSE_MAX_LINE 1024
+
+/**
+ * parses a monitor recording or a daemon log, in plain text or JSON lines, into the scorecard.
+ * The kind of log is guessed from the first line that one of the parsers recognises
+ * @return 0 on success, -1 if the file cannot be read
+ */
+int LogParseFile(const char *path, Scorecard *scorecard);
+
+#endif
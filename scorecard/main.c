@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "check.h"
+#include "scorecard.h"
+#include "logparse.h"
+
+#define USAGE "usage: ./scorecard [-p monitor_period] [-B balance_stddev] [-F host_floor_mb] [-g guest_floor_mb] <log>..."
+// the monitors print a sample every second
+#define DEFAULT_PERIOD 1.0
+// same closeness as the scheduler's balance check
+#define DEFAULT_BALANCE_STDDEV 0.1
+// the memory coordinator keeps 200MB free on the host and 100MB unused in each guest
+#define DEFAULT_HOST_FLOOR 200.0
+#define DEFAULT_GUEST_FLOOR 100.0
+
+int main(int argc, char *argv[])
+{
+    int opt = 0;
+    int rt = 0;
+    Scorecard scorecard;
+    ScorecardConfig config;
+
+    config.period = DEFAULT_PERIOD;
+    config.balanceStddev = DEFAULT_BALANCE_STDDEV;
+    config.hostFloor = DEFAULT_HOST_FLOOR;
+    config.guestFloor = DEFAULT_GUEST_FLOOR;
+
+    while ((opt = getopt(argc, argv, "p:B:F:g:")) != -1) {
+        switch (opt) {
+            case 'p':
+                config.period = atof(optarg);
+                break;
+            case 'B':
+                config.balanceStddev = atof(optarg);
+                break;
+            case 'F':
+                config.hostFloor = atof(optarg);
+                break;
+            case 'g':
+                config.guestFloor = atof(optarg);
+                break;
+            default:
+                check(0, USAGE);
+        }
+    }
+    check(optind < argc, "log file required, " USAGE);
+    check(config.period > 0, "monitor period should be positive");
+
+    // one scorecard per log, so that runs of different policies can be compared side by side
+    printf("[");
+    for (int i = optind; i < argc; i++) {
+        ScorecardInit(&scorecard, argv[i], &config);
+        rt = LogParseFile(argv[i], &scorecard);
+        check(rt == 0, "failed to parse log");
+        ScorecardPrint(&scorecard, stdout);
+        printf(i + 1 < argc ? ",\n" : "");
+    }
+    printf("]\n");
+
+    return 0;
+error:
+    return 1;
+}
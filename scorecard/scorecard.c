@@ -0,0 +1,189 @@
+#include <string.h>
+#include <math.h>
+#include "scorecard.h"
+
+void ScorecardInit(Scorecard *scorecard, const char *source, ScorecardConfig *config)
+{
+    memset(scorecard, 0, sizeof(Scorecard));
+    scorecard->source = source;
+    scorecard->config = *config;
+    scorecard->start = -1;
+    scorecard->balancedSince = -1;
+    scorecard->minHostFree = -1;
+}
+
+int ScorecardGuest(Scorecard *scorecard, const char *name)
+{
+    for (int g = 0; g < scorecard->numGuests; g++) {
+        if (strcmp(scorecard->guests[g], name) == 0) {
+            return g;
+        }
+    }
+    if (scorecard->numGuests >= SCORECARD_MAX_GUESTS) {
+        return -1;
+    }
+    strncpy(scorecard->guests[scorecard->numGuests], name, SCORECARD_MAX_NAME - 1);
+    scorecard->lastActual[scorecard->numGuests] = -1;
+    return scorecard->numGuests++;
+}
+
+/**
+ * records the time of a sample and whether the pCPUs were balanced in it
+ */
+void ScorecardAddSample(Scorecard *scorecard, double time, int balanced)
+{
+    if (scorecard->start < 0) {
+        scorecard->start = time;
+    }
+    scorecard->end = time;
+    scorecard->numSamples += 1;
+    if (!balanced) {
+        scorecard->balancedSince = -1;
+    }
+    else if (scorecard->balancedSince < 0) {
+        scorecard->balancedSince = time;
+    }
+}
+
+void ScorecardAddCpuSample(Scorecard *scorecard, double time, double *usages, int *numGuestsOn, int numCpus)
+{
+    double mean = 0;
+    double variance = 0;
+    double stddev = 0;
+    int spare = 0;
+
+    for (int c = 0; c < numCpus; c++) {
+        mean += usages[c] / numCpus;
+        spare |= usages[c] < SCORECARD_SPARE;
+    }
+    for (int c = 0; c < numCpus; c++) {
+        variance += (usages[c] - mean) * (usages[c] - mean) / numCpus;
+    }
+    stddev = sqrt(variance);
+    scorecard->stddevSum += stddev;
+    scorecard->stddevMax = fmax(scorecard->stddevMax, stddev);
+    scorecard->stddevLast = stddev;
+
+    // guests sharing a saturated pCPU starve when they could run elsewhere
+    for (int c = 0; c < numCpus && spare; c++) {
+        if (usages[c] >= SCORECARD_SATURATED && numGuestsOn[c] > 1) {
+            scorecard->cpuStarvation += numGuestsOn[c] * scorecard->config.period;
+        }
+    }
+
+    ScorecardAddSample(scorecard, time, stddev <= scorecard->config.balanceStddev);
+}
+
+void ScorecardAddPins(Scorecard *scorecard, int guest, unsigned long long pins)
+{
+    if (guest < 0) {
+        return;
+    }
+    if (scorecard->lastPins[guest] != 0 && scorecard->lastPins[guest] != pins) {
+        scorecard->numRepins += 1;
+    }
+    scorecard->lastPins[guest] = pins;
+}
+
+void ScorecardAddGuestMemory(Scorecard *scorecard, int guest, double actual, double unused)
+{
+    double change = 0;
+
+    if (guest < 0) {
+        return;
+    }
+    if (scorecard->lastActual[guest] >= 0 && actual != scorecard->lastActual[guest]) {
+        change = actual - scorecard->lastActual[guest];
+        if (change > 0) {
+            scorecard->deflated += change;
+        }
+        else {
+            scorecard->inflated += -change;
+        }
+        scorecard->numAdjustments += 1;
+    }
+    scorecard->lastActual[guest] = actual;
+    // daemon logs do not report the unused memory of the guests
+    if (unused >= 0 && unused < scorecard->config.guestFloor) {
+        scorecard->memoryStarvation += scorecard->config.period;
+    }
+}
+
+void ScorecardAddHostMemory(Scorecard *scorecard, double time, double free)
+{
+    int breached = free < scorecard->config.hostFloor;
+
+    if (scorecard->minHostFree < 0 || free < scorecard->minHostFree) {
+        scorecard->minHostFree = free;
+    }
+    if (breached) {
+        scorecard->floorBreachSeconds += scorecard->config.period;
+        scorecard->numFloorBreaches += !scorecard->lastBreached;
+    }
+    scorecard->lastBreached = breached;
+    ScorecardAddSample(scorecard, time, 1);
+}
+
+void ScorecardAddWatchdog(Scorecard *scorecard, double free)
+{
+    if (scorecard->minHostFree < 0 || free < scorecard->minHostFree) {
+        scorecard->minHostFree = free;
+    }
+    scorecard->numFloorBreaches += free < scorecard->config.hostFloor;
+}
+
+void ScorecardAddCycle(Scorecard *scorecard, double time, int balanced)
+{
+    ScorecardAddSample(scorecard, time, balanced);
+}
+
+/**
+ * writes a number, or null if it is not known
+ */
+void ScorecardPrintNumber(FILE *file, const char *key, double value, int known)
+{
+    if (known) {
+        fprintf(file, "\"%s\":%.4f", key, value);
+    }
+    else {
+        fprintf(file, "\"%s\":null", key);
+    }
+}
+
+void ScorecardPrint(Scorecard *scorecard, FILE *file)
+{
+    static const char *kindNames[] = {"unknown", "cpu_monitor", "memory_monitor", "cpu_daemon", "memory_daemon"};
+    int cpu = scorecard->kind == SCORECARD_CPU_MONITOR || scorecard->kind == SCORECARD_CPU_DAEMON;
+    int memory = scorecard->kind == SCORECARD_MEMORY_MONITOR || scorecard->kind == SCORECARD_MEMORY_DAEMON;
+    int stddevKnown = scorecard->kind == SCORECARD_CPU_MONITOR && scorecard->numSamples > 0;
+
+    fprintf(file, "{\"source\":\"%s\",\"kind\":\"%s\",\"samples\":%d,",
+        scorecard->source, kindNames[scorecard->kind], scorecard->numSamples);
+    ScorecardPrintNumber(file, "duration_s", scorecard->end - scorecard->start, scorecard->numSamples > 0);
+    if (cpu) {
+        fprintf(file, ",\"utilisation_stddev\":{");
+        ScorecardPrintNumber(file, "mean", scorecard->stddevSum / (scorecard->numSamples > 0 ? scorecard->numSamples : 1),
+            stddevKnown);
+        fprintf(file, ",");
+        ScorecardPrintNumber(file, "max", scorecard->stddevMax, stddevKnown);
+        fprintf(file, ",");
+        ScorecardPrintNumber(file, "last", scorecard->stddevLast, stddevKnown);
+        fprintf(file, "},");
+        ScorecardPrintNumber(file, "time_to_balance_s", scorecard->balancedSince - scorecard->start,
+            scorecard->numSamples > 0 && scorecard->balancedSince >= 0);
+        fprintf(file, ",\"repins\":%d,", scorecard->numRepins);
+        ScorecardPrintNumber(file, "starvation_guest_s", scorecard->cpuStarvation, 1);
+    }
+    if (memory) {
+        fprintf(file, ",\"balloon_traffic_mb\":{\"deflated\":%.4f,\"inflated\":%.4f,\"adjustments\":%d},",
+            scorecard->deflated, scorecard->inflated, scorecard->numAdjustments);
+        fprintf(file, "\"host_floor_breaches\":{\"count\":%d,", scorecard->numFloorBreaches);
+        ScorecardPrintNumber(file, "seconds", scorecard->floorBreachSeconds, scorecard->kind == SCORECARD_MEMORY_MONITOR);
+        fprintf(file, ",");
+        ScorecardPrintNumber(file, "min_free_mb", scorecard->minHostFree, scorecard->minHostFree >= 0);
+        fprintf(file, "},");
+        ScorecardPrintNumber(file, "starvation_guest_s", scorecard->memoryStarvation,
+            scorecard->kind == SCORECARD_MEMORY_MONITOR);
+    }
+    fprintf(file, "}");
+}
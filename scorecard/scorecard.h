@@ -0,0 +1,120 @@
+#ifndef scorecard_h
+#define scorecard_h
+
+#include <stdio.h>
+
+#define SCORECARD_MAX_CPUS 64
+#define SCORECARD_MAX_GUESTS 64
+#define SCORECARD_MAX_NAME 32
+// a pCPU at or above this usage is saturated, and below this one it has room to spare
+#define SCORECARD_SATURATED 0.95
+#define SCORECARD_SPARE 0.5
+
+/**
+ * what a log records, guessed from its lines
+ */
+typedef enum ScorecardKind {
+    SCORECARD_UNKNOWN = 0,
+    // monitor output of the vcpu scheduler tests: vCPU pins and usage of each pCPU
+    SCORECARD_CPU_MONITOR,
+    // monitor output of the memory coordinator tests: balloon size and unused memory of each guest, host memory
+    SCORECARD_MEMORY_MONITOR,
+    // log of the vcpu scheduler daemon
+    SCORECARD_CPU_DAEMON,
+    // log of the memory coordinator daemon
+    SCORECARD_MEMORY_DAEMON
+} ScorecardKind;
+
+typedef struct ScorecardConfig {
+    // time between two samples of a monitor log (in seconds)
+    double period;
+    // standard deviation of the pCPU usages at or below which the pCPUs are balanced
+    double balanceStddev;
+    // host free memory below which the host floor is breached (in MB)
+    double hostFloor;
+    // unused memory below which a guest is starved (in MB)
+    double guestFloor;
+} ScorecardConfig;
+
+/**
+ * quality metrics of a policy computed from one log
+ */
+typedef struct Scorecard {
+    const char *source;
+    ScorecardConfig config;
+    ScorecardKind kind;
+    int numSamples;
+    // time of the first and last samples (in seconds)
+    double start;
+    double end;
+    /**
+     * standard deviation of the pCPU usages of each sample: sum, maximum and last value
+     */
+    double stddevSum;
+    double stddevMax;
+    double stddevLast;
+    // time of the first sample after which the pCPUs stay balanced, -1 if they are unbalanced at the end
+    double balancedSince;
+    int numRepins;
+    /**
+     * guest-seconds spent on a saturated pCPU shared with other guests while another pCPU has room to spare
+     */
+    double cpuStarvation;
+    /**
+     * memory given to (deflated) and taken from (inflated) the guests by their balloons (in MB)
+     */
+    double deflated;
+    double inflated;
+    int numAdjustments;
+    // seconds and number of times the host free memory was below the floor, and its lowest value (in MB)
+    double floorBreachSeconds;
+    int numFloorBreaches;
+    double minHostFree;
+    // guest-seconds with the unused memory of a guest below the guest floor
+    double memoryStarvation;
+    /**
+     * guest names, and the last pins (one bit per pCPU, one word per vCPU) and balloon size of each guest
+     */
+    int numGuests;
+    char guests[SCORECARD_MAX_GUESTS][SCORECARD_MAX_NAME];
+    unsigned long long lastPins[SCORECARD_MAX_GUESTS];
+    double lastActual[SCORECARD_MAX_GUESTS];
+    int lastBreached;
+} Scorecard;
+
+void ScorecardInit(Scorecard *scorecard, const char *source, ScorecardConfig *config);
+/**
+ * @return index of the guest with the given name, added if it is new, -1 if there are too many guests
+ */
+int ScorecardGuest(Scorecard *scorecard, const char *name);
+/**
+ * records the usage of each pCPU at `time`
+ * @param numGuestsOn number of guests pinned to each pCPU
+ */
+void ScorecardAddCpuSample(Scorecard *scorecard, double time, double *usages, int *numGuestsOn, int numCpus);
+/**
+ * records the pins of a guest, a change from its last pins counts as a repin
+ */
+void ScorecardAddPins(Scorecard *scorecard, int guest, unsigned long long pins);
+/**
+ * records the balloon size and unused memory of a guest (in MB), a negative unused memory if unknown
+ */
+void ScorecardAddGuestMemory(Scorecard *scorecard, int guest, double actual, double unused);
+/**
+ * records the host free memory (in MB) at `time`, closing a sample of a memory log
+ */
+void ScorecardAddHostMemory(Scorecard *scorecard, double time, double free);
+/**
+ * records an emergency reclaim of the watchdog, triggered with the host free memory at `free` (in MB)
+ */
+void ScorecardAddWatchdog(Scorecard *scorecard, double free);
+/**
+ * records a sample of a daemon log, balanced or not
+ */
+void ScorecardAddCycle(Scorecard *scorecard, double time, int balanced);
+/**
+ * writes the scorecard as a JSON object, with the metrics relevant to its kind
+ */
+void ScorecardPrint(Scorecard *scorecard, FILE *file);
+
+#endif